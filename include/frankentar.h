@@ -51,6 +51,25 @@ extern "C" {
 #define FTAR_FTYPE_SPECIAL 3
 #define FTAR_FTYPE_DIR 4
 #define FTAR_FTYPE_FIFO 5
+#define FTAR_FTYPE_DICT 6 /** Shared compression dictionary (see compress.h) */
+#define FTAR_FTYPE_CHUNK 7 /** Content-defined chunk of other payloads (see chunk.h) */
+#define FTAR_FTYPE_WHITEOUT 8 /** Hides the entry with its name in archives mounted under this one (see overlay.h) */
+
+/** Payload codec macros */
+#define FTAR_CODEC_NONE 0 /** Stored as-is */
+#define FTAR_CODEC_LZ 1 /** Chunked frame of ftar_lz blocks (see compress.h) */
+#define FTAR_CODEC_LZ_DICT 2 /** FTAR_CODEC_LZ against the archive's dictionary */
+#define FTAR_CODEC_CHUNKED 3 /** Manifest of FTAR_FTYPE_CHUNK entries (see chunk.h) */
+#define FTAR_CODEC_DELTA 4 /** Binary delta against a base archive's entry (see delta.h) */
+#define FTAR_CODEC_AUTO 127 /** Writing only, pick per entry (never stored) */
+
+/** Entry flags */
+#define FTAR_ENT_DELETED (1) /** Deleted, skipped by readers until the archive is compacted */
+
+/**
+ * @brief The name given to dictionary entries
+ */
+#define FTAR_DICT_NAME ".ftar_dict"
 
 /** File mode macros */
 #define FTAR_MODE_EXEC (1) /** Executable */
@@ -77,7 +96,9 @@ extern "C" {
 struct ftar_ent {
 	char name[100]; /**< File name */
 	short mode; /**< File mode */
-	size_t size; /**< File size in bytes */
+	char codec; /**< Payload codec (lives in what used to be padding) */
+	char flags; /**< Entry flags (also in what used to be padding) */
+	size_t size; /**< File size in bytes (stored size when on disk) */
 	long mtime; /**< Last modification time */
 	long checksum; /**< Checksum of above values */
 	char type; /**< File type flag */
@@ -85,6 +106,34 @@ struct ftar_ent {
 	char *data; /**< The file itself (obviously not stored as a pointer) */
 };
 
+/**
+ * @brief The size of an entry header as it's stored in an archive (the
+ *  entry structure minus the data pointer)
+ */
+#define FTAR_ENT_HDR_SIZE (offsetof(struct ftar_ent, data))
+
+/**
+ * @brief The size of the archive header (magic followed by the entry count)
+ */
+#define FTAR_HDR_SIZE (FTAR_MAGIC_LEN + sizeof(size_t))
+
+/**
+ * @brief Where the payload alignment is kept in the archive header
+ *
+ * This is the magic's terminator, which holds the log2 of the alignment.
+ *  Archives from before alignment existed have 0 there, meaning none, and
+ *  readers that don't know about it reject aligned archives instead of
+ *  misreading them. When an archive is aligned, any entry with a payload has
+ *  zeros after its header up to the next multiple of the alignment (see
+ *  `ftar_payload_pad`).
+ */
+#define FTAR_ALIGN_OFF (FTAR_MAGIC_LEN - 1)
+
+/**
+ * @brief The largest payload alignment
+ */
+#define FTAR_ALIGN_MAX (1024 * 1024)
+
 /**
  * @brief A representation of a Frankentar archive.
  * 
@@ -92,7 +141,13 @@ struct ftar_ent {
 struct ftar {
 	char magic[FTAR_MAGIC_LEN]; /**< Magic signature */
 	size_t ent_count; /**< The number of entries found in the archive */
+	size_t align; /**< What payloads are aligned to when it's written, 0 or 1 for nothing */
 	struct ftar_ent **entries; /**< The entries in the archive */
+	size_t capacity; /**< How many entries fit in `entries`, which is `ent_count` if this is smaller */
+	struct ftar_ent *dict; /**< The dictionary entry, if there is one */
+	struct ftar_patch *patch; /**< Lazy loading state, from `ftar_load_patched` */
+	struct ftar_ent **names; /**< Name lookup table (see `ftar_name_slot`), or `NULL` to search the entries in order */
+	size_t mask; /**< The number of slots in `names` minus one */
 };
 
 #ifdef __cplusplus
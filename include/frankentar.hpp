@@ -0,0 +1,801 @@
+/**
+ * @file frankentar.hpp
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief C++ wrappers for Frankentar archives
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * These own the C structures and free them when they go out of scope, and
+ *  hand out names as `std::string_view` and payloads as
+ *  `std::span<const std::byte>` pointing straight at what the C functions
+ *  loaded or mapped. Nothing is allocated or copied on top of what the C
+ *  functions do themselves.
+ *
+ * `archive` loads a whole archive like `ftar_load`. `mapped_archive` maps it
+ *  and indexes it like `ftar_index_fd`, so payloads that are stored as they
+ *  are can be used right where they sit in the mapping:
+ *
+ * ```cpp
+ * frankentar::mapped_archive ar = frankentar::mapped_archive::open("a.ftar");
+ * for (frankentar::mapped_entry ent : ar) {
+ * 	if (ent.mapped())
+ * 		use(ent.name(), ent.bytes());
+ * 	else
+ * 		use(ent.name(), ar.read(ent).bytes());
+ * }
+ * ```
+ *
+ * Errors come back as `std::error_code`s and nothing throws. The classes are
+ *  in `frankentar` rather than `ftar`, which is taken by `struct ftar`.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_HPP
+#define FRANKENTAR_HPP 1
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frankentar.h"
+#include "frankentar/index.h"
+#include "frankentar/read.h"
+
+namespace frankentar
+{
+
+/**
+ * @brief A payload that was allocated for the caller, or the error getting
+ *  it failed with
+ */
+class payload {
+    public:
+	payload() noexcept = default;
+
+	/**
+	 * @brief Take ownership of a payload from the C functions
+	 *
+	 * @param data is the payload, which is freed with `free`, or `nullptr`
+	 * @param len is its length
+	 * @param err is 0 or the error the read failed with
+	 */
+	payload(char *data, std::size_t len, int err) noexcept
+		: m_data(data), m_len(data ? len : 0), m_err(err)
+	{
+	}
+
+	payload(payload &&other) noexcept
+		: m_data(std::exchange(other.m_data, nullptr)),
+		  m_len(std::exchange(other.m_len, 0)),
+		  m_err(std::exchange(other.m_err, 0))
+	{
+	}
+
+	payload &operator=(payload &&other) noexcept
+	{
+		if (this != &other) {
+			std::free(m_data);
+			m_data = std::exchange(other.m_data, nullptr);
+			m_len = std::exchange(other.m_len, 0);
+			m_err = std::exchange(other.m_err, 0);
+		}
+		return *this;
+	}
+
+	payload(const payload &) = delete;
+	payload &operator=(const payload &) = delete;
+
+	~payload()
+	{
+		std::free(m_data);
+	}
+
+	/**
+	 * @brief Check whether there's a payload
+	 */
+	explicit operator bool() const noexcept
+	{
+		return !m_err && m_data;
+	}
+
+	/**
+	 * @brief Get the error getting the payload failed with, if it did
+	 */
+	std::error_code error() const noexcept
+	{
+		return std::error_code(m_err, std::generic_category());
+	}
+
+	const std::byte *data() const noexcept
+	{
+		return reinterpret_cast<const std::byte *>(m_data);
+	}
+
+	std::size_t size() const noexcept
+	{
+		return m_len;
+	}
+
+	std::span<const std::byte> bytes() const noexcept
+	{
+		return { data(), m_len };
+	}
+
+	std::string_view view() const noexcept
+	{
+		return { m_data, m_len };
+	}
+
+	/**
+	 * @brief Give up ownership of the payload, which then has to be freed
+	 *  with `free`
+	 */
+	char *release() noexcept
+	{
+		m_len = 0;
+		return std::exchange(m_data, nullptr);
+	}
+
+    private:
+	char *m_data = nullptr;
+	std::size_t m_len = 0;
+	int m_err = 0;
+};
+
+/**
+ * @brief Get the part of a fixed size field before its terminator
+ */
+template <std::size_t N>
+constexpr std::string_view field_view(const char (&field)[N]) noexcept
+{
+	std::size_t len;
+
+	for (len = 0; len < N && field[len]; len++)
+		;
+	return { field, len };
+}
+
+/**
+ * @brief An entry of an `archive`, which is only valid as long as it is
+ */
+class entry {
+    public:
+	entry() noexcept = default;
+
+	explicit entry(const ftar_ent *ent) noexcept : m_ent(ent)
+	{
+	}
+
+	/**
+	 * @brief Check whether this is an entry (`find` gives empty ones)
+	 */
+	explicit operator bool() const noexcept
+	{
+		return m_ent;
+	}
+
+	std::string_view name() const noexcept
+	{
+		return field_view(m_ent->name);
+	}
+
+	std::string_view link() const noexcept
+	{
+		return field_view(m_ent->link);
+	}
+
+	int type() const noexcept
+	{
+		return m_ent->type;
+	}
+
+	short mode() const noexcept
+	{
+		return m_ent->mode;
+	}
+
+	long mtime() const noexcept
+	{
+		return m_ent->mtime;
+	}
+
+	/**
+	 * @brief Get the size of the payload, once it's been decompressed
+	 */
+	std::size_t size() const noexcept
+	{
+		return m_ent->size;
+	}
+
+	std::span<const std::byte> bytes() const noexcept
+	{
+		return { reinterpret_cast<const std::byte *>(m_ent->data),
+			 m_ent->size };
+	}
+
+	std::string_view view() const noexcept
+	{
+		return { m_ent->data, m_ent->size };
+	}
+
+	const ftar_ent *get() const noexcept
+	{
+		return m_ent;
+	}
+
+    private:
+	const ftar_ent *m_ent = nullptr;
+};
+
+/**
+ * @brief An archive loaded into memory with `ftar_load`
+ */
+class archive {
+    public:
+	class iterator {
+	    public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = entry;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = entry;
+
+		iterator() noexcept = default;
+
+		explicit iterator(ftar_ent *const *pos) noexcept : m_pos(pos)
+		{
+		}
+
+		entry operator*() const noexcept
+		{
+			return entry(*m_pos);
+		}
+
+		iterator &operator++() noexcept
+		{
+			m_pos++;
+			return *this;
+		}
+
+		iterator operator++(int) noexcept
+		{
+			return iterator(m_pos++);
+		}
+
+		bool operator==(const iterator &other) const noexcept = default;
+
+	    private:
+		ftar_ent *const *m_pos = nullptr;
+	};
+
+	archive() noexcept = default;
+
+	/**
+	 * @brief Take ownership of an archive from the C functions
+	 *
+	 * @param tar is the archive, which is freed with `ftar_free`
+	 * @param err is 0, or the error loading it failed with if `tar` is
+	 *  `nullptr`
+	 */
+	explicit archive(ftar *tar, int err = 0) noexcept
+		: m_tar(tar), m_err(tar ? 0 : (err ? err : EINVAL))
+	{
+	}
+
+	archive(archive &&other) noexcept
+		: m_tar(std::exchange(other.m_tar, nullptr)),
+		  m_err(std::exchange(other.m_err, 0))
+	{
+	}
+
+	archive &operator=(archive &&other) noexcept
+	{
+		if (this != &other) {
+			if (m_tar)
+				ftar_free(m_tar);
+			m_tar = std::exchange(other.m_tar, nullptr);
+			m_err = std::exchange(other.m_err, 0);
+		}
+		return *this;
+	}
+
+	archive(const archive &) = delete;
+	archive &operator=(const archive &) = delete;
+
+	~archive()
+	{
+		if (m_tar)
+			ftar_free(m_tar);
+	}
+
+	/**
+	 * @brief Load an archive that's in memory
+	 *
+	 * @param data is the archive, which can be freed afterwards
+	 */
+	static archive load(std::span<const std::byte> data) noexcept
+	{
+		ftar *tar;
+
+		tar = ftar_load(const_cast<std::byte *>(data.data()),
+				data.size());
+		return archive(tar, errno);
+	}
+
+	/**
+	 * @brief Load an archive from a file, by mapping it rather than
+	 *  reading it into a buffer first
+	 *
+	 * @param path is the path of the archive
+	 */
+	static archive open(const char *path) noexcept
+	{
+		struct stat st;
+		ftar *tar;
+		void *map;
+		int err;
+		int fd;
+
+		fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return archive(nullptr, errno);
+		if (fstat(fd, &st) < 0 || !st.st_size) {
+			err = st.st_size ? errno : EINVAL;
+			::close(fd);
+			return archive(nullptr, err);
+		}
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		err = errno;
+		::close(fd);
+		if (map == MAP_FAILED)
+			return archive(nullptr, err);
+
+		// Everything gets copied out, so the mapping can go right away
+		tar = ftar_load(map, st.st_size);
+		err = errno;
+		munmap(map, st.st_size);
+		return archive(tar, err);
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_tar;
+	}
+
+	/**
+	 * @brief Get the error loading the archive failed with, if it did
+	 */
+	std::error_code error() const noexcept
+	{
+		return std::error_code(m_err, std::generic_category());
+	}
+
+	/**
+	 * @brief Find an entry by name
+	 *
+	 * @return Returns the first entry called `name`, or an empty one
+	 *
+	 * This is `ftar_find_r`, so it's one lookup in the archive's table and
+	 *  any number of threads can do it at once.
+	 */
+	entry find(std::string_view name) const noexcept
+	{
+		char buf[sizeof(ftar_ent::name)];
+		const ftar_ent *ent;
+
+		if (!m_tar || name.size() >= sizeof(buf))
+			return entry();
+		std::memcpy(buf, name.data(), name.size());
+		buf[name.size()] = 0;
+		if (ftar_find_r(m_tar, buf, &ent) != FTAR_OK)
+			return entry();
+		return entry(ent);
+	}
+
+	std::size_t size() const noexcept
+	{
+		return m_tar ? m_tar->ent_count : 0;
+	}
+
+	iterator begin() const noexcept
+	{
+		return iterator(m_tar ? m_tar->entries : nullptr);
+	}
+
+	iterator end() const noexcept
+	{
+		return iterator(m_tar ? m_tar->entries + m_tar->ent_count :
+					nullptr);
+	}
+
+	ftar *get() const noexcept
+	{
+		return m_tar;
+	}
+
+	/**
+	 * @brief Give up ownership of the archive, which then has to be freed
+	 *  with `ftar_free`
+	 */
+	ftar *release() noexcept
+	{
+		return std::exchange(m_tar, nullptr);
+	}
+
+    private:
+	ftar *m_tar = nullptr;
+	int m_err = 0;
+};
+
+/**
+ * @brief An entry of a `mapped_archive`, which is only valid as long as it is
+ */
+class mapped_entry {
+    public:
+	mapped_entry() noexcept = default;
+
+	/**
+	 * @param ent is the entry in the index
+	 * @param target is the entry with its payload (see `ftar_index_read`),
+	 *  or `nullptr` if it's a link to nowhere
+	 * @param data is the payload in the mapping, if it's stored as it is
+	 */
+	mapped_entry(const ftar_index_ent *ent, const ftar_index_ent *target,
+		     const std::byte *data) noexcept
+		: m_ent(ent), m_target(target), m_data(data)
+	{
+	}
+
+	/**
+	 * @brief Check whether this is an entry (`find` gives empty ones)
+	 */
+	explicit operator bool() const noexcept
+	{
+		return m_ent;
+	}
+
+	std::string_view name() const noexcept
+	{
+		return field_view(m_ent->hdr.name);
+	}
+
+	std::string_view link() const noexcept
+	{
+		return field_view(m_ent->hdr.link);
+	}
+
+	int type() const noexcept
+	{
+		return m_ent->hdr.type;
+	}
+
+	short mode() const noexcept
+	{
+		return m_ent->hdr.mode;
+	}
+
+	long mtime() const noexcept
+	{
+		return m_ent->hdr.mtime;
+	}
+
+	int codec() const noexcept
+	{
+		return m_ent->hdr.codec;
+	}
+
+	/**
+	 * @brief Check whether the payload can be used where it is in the
+	 *  mapping, or has to be decoded with `mapped_archive::read`
+	 */
+	bool mapped() const noexcept
+	{
+		return m_data || (m_target && !m_target->hdr.size);
+	}
+
+	/**
+	 * @brief Get the payload in the mapping, which is empty unless it's
+	 *  `mapped`
+	 */
+	std::span<const std::byte> bytes() const noexcept
+	{
+		return { m_data, m_data ? m_target->hdr.size : 0 };
+	}
+
+	std::string_view view() const noexcept
+	{
+		return { reinterpret_cast<const char *>(m_data),
+			 m_data ? m_target->hdr.size : 0 };
+	}
+
+	const ftar_index_ent *get() const noexcept
+	{
+		return m_ent;
+	}
+
+    private:
+	const ftar_index_ent *m_ent = nullptr;
+	const ftar_index_ent *m_target = nullptr;
+	const std::byte *m_data = nullptr;
+};
+
+/**
+ * @brief An archive mapped into memory and indexed with `ftar_index_fd`
+ */
+class mapped_archive {
+    public:
+	class iterator {
+	    public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = mapped_entry;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = mapped_entry;
+
+		iterator() noexcept = default;
+
+		iterator(const mapped_archive *ar, const ftar_index_ent *pos,
+			 const ftar_index_ent *end) noexcept
+			: m_ar(ar), m_pos(pos), m_end(end)
+		{
+			skip();
+		}
+
+		mapped_entry operator*() const noexcept
+		{
+			return m_ar->make_entry(m_pos);
+		}
+
+		iterator &operator++() noexcept
+		{
+			m_pos++;
+			skip();
+			return *this;
+		}
+
+		iterator operator++(int) noexcept
+		{
+			iterator old = *this;
+
+			++*this;
+			return old;
+		}
+
+		bool operator==(const iterator &other) const noexcept
+		{
+			return m_pos == other.m_pos;
+		}
+
+	    private:
+		// Deleted entries are left out, like `ftar_load` does
+		void skip() noexcept
+		{
+			while (m_pos != m_end &&
+			       (m_pos->hdr.flags & FTAR_ENT_DELETED))
+				m_pos++;
+		}
+
+		const mapped_archive *m_ar = nullptr;
+		const ftar_index_ent *m_pos = nullptr;
+		const ftar_index_ent *m_end = nullptr;
+	};
+
+	mapped_archive() noexcept = default;
+
+	mapped_archive(mapped_archive &&other) noexcept
+		: m_fd(std::exchange(other.m_fd, -1)),
+		  m_idx(std::exchange(other.m_idx, nullptr)),
+		  m_map(std::exchange(other.m_map, nullptr)),
+		  m_len(std::exchange(other.m_len, 0)),
+		  m_err(std::exchange(other.m_err, 0))
+	{
+	}
+
+	mapped_archive &operator=(mapped_archive &&other) noexcept
+	{
+		if (this != &other) {
+			close();
+			m_fd = std::exchange(other.m_fd, -1);
+			m_idx = std::exchange(other.m_idx, nullptr);
+			m_map = std::exchange(other.m_map, nullptr);
+			m_len = std::exchange(other.m_len, 0);
+			m_err = std::exchange(other.m_err, 0);
+		}
+		return *this;
+	}
+
+	mapped_archive(const mapped_archive &) = delete;
+	mapped_archive &operator=(const mapped_archive &) = delete;
+
+	~mapped_archive()
+	{
+		close();
+	}
+
+	/**
+	 * @brief Map and index an archive
+	 *
+	 * @param path is the path of the archive
+	 */
+	static mapped_archive open(const char *path) noexcept
+	{
+		mapped_archive ar;
+		struct stat st;
+		void *map;
+
+		ar.m_fd = ::open(path, O_RDONLY);
+		if (ar.m_fd < 0 || fstat(ar.m_fd, &st) < 0)
+			return fail(std::move(ar), errno);
+		if (!st.st_size)
+			return fail(std::move(ar), EINVAL);
+		ar.m_idx = ftar_index_fd(ar.m_fd);
+		if (!ar.m_idx)
+			return fail(std::move(ar), errno);
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, ar.m_fd,
+			   0);
+		if (map == MAP_FAILED)
+			return fail(std::move(ar), errno);
+		ar.m_map = static_cast<const std::byte *>(map);
+		ar.m_len = st.st_size;
+
+		return ar;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_map;
+	}
+
+	/**
+	 * @brief Get the error opening the archive failed with, if it did
+	 */
+	std::error_code error() const noexcept
+	{
+		return std::error_code(m_err, std::generic_category());
+	}
+
+	/**
+	 * @brief Find an entry by name, with one lookup in the index's table
+	 *
+	 * @return Returns the entry, or an empty one
+	 */
+	mapped_entry find(std::string_view name) const noexcept
+	{
+		char buf[sizeof(ftar_ent::name)];
+		ftar_index_ent *ent;
+
+		if (!m_idx || name.size() >= sizeof(buf))
+			return mapped_entry();
+		std::memcpy(buf, name.data(), name.size());
+		buf[name.size()] = 0;
+		ent = ftar_index_find(m_idx, buf);
+		return ent ? make_entry(ent) : mapped_entry();
+	}
+
+	/**
+	 * @brief Decode an entry's payload, for ones that aren't `mapped`
+	 *
+	 * @param ent is the entry
+	 *
+	 * @return Returns the payload, or the error decoding it failed with
+	 *  (see `ftar_index_read`)
+	 */
+	payload read(const mapped_entry &ent) const noexcept
+	{
+		std::size_t len;
+		char *data;
+
+		if (!ent)
+			return payload(nullptr, 0, EINVAL);
+		data = ftar_index_read(m_fd, m_idx,
+				       const_cast<ftar_index_ent *>(ent.get()),
+				       &len);
+		return payload(data, len, data ? 0 : errno);
+	}
+
+	/**
+	 * @brief Get the number of entries, deleted ones included
+	 */
+	std::size_t size() const noexcept
+	{
+		return m_idx ? m_idx->ent_count : 0;
+	}
+
+	iterator begin() const noexcept
+	{
+		return m_idx ? iterator(this, m_idx->entries,
+					m_idx->entries + m_idx->ent_count) :
+			       iterator();
+	}
+
+	iterator end() const noexcept
+	{
+		return m_idx ? iterator(this, m_idx->entries + m_idx->ent_count,
+					m_idx->entries + m_idx->ent_count) :
+			       iterator();
+	}
+
+	/**
+	 * @brief Get the whole mapping
+	 */
+	std::span<const std::byte> bytes() const noexcept
+	{
+		return { m_map, m_len };
+	}
+
+	ftar_index *index() const noexcept
+	{
+		return m_idx;
+	}
+
+	int fd() const noexcept
+	{
+		return m_fd;
+	}
+
+    private:
+	static mapped_archive fail(mapped_archive ar, int err) noexcept
+	{
+		ar.close();
+		ar.m_err = err;
+		return ar;
+	}
+
+	mapped_entry make_entry(const ftar_index_ent *ent) const noexcept
+	{
+		const ftar_index_ent *target;
+
+		// Links with no payload share the one of an earlier entry
+		target = ent;
+		if (ent->hdr.type == FTAR_FTYPE_LINK && ent->hdr.link[0] &&
+		    !ent->hdr.size) {
+			target = ftar_index_find(m_idx, ent->hdr.link);
+			if (!target || target >= ent)
+				return mapped_entry(ent, nullptr, nullptr);
+		}
+		if (target->hdr.codec != FTAR_CODEC_NONE || !target->hdr.size ||
+		    target->data_off + target->hdr.size > m_len)
+			return mapped_entry(ent, target, nullptr);
+		return mapped_entry(ent, target, m_map + target->data_off);
+	}
+
+	void close() noexcept
+	{
+		if (m_map)
+			munmap(const_cast<std::byte *>(m_map), m_len);
+		ftar_index_free(m_idx);
+		if (m_fd >= 0)
+			::close(m_fd);
+		m_map = nullptr;
+		m_len = 0;
+		m_idx = nullptr;
+		m_fd = -1;
+	}
+
+	int m_fd = -1;
+	ftar_index *m_idx = nullptr;
+	const std::byte *m_map = nullptr;
+	std::size_t m_len = 0;
+	int m_err = 0;
+};
+
+} // namespace frankentar
+
+#endif /* !FRANKENTAR_HPP */
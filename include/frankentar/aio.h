@@ -0,0 +1,178 @@
+/**
+ * @file aio.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Reading many entries of an archive at once, asynchronously
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Reading entries one `pread` at a time only ever has one request in front of
+ *  the disk, which leaves fast drives mostly idle. These queue up reads of
+ *  any number of entries and keep `depth` of them in flight at once, on
+ *  io_uring if the kernel has it and on a pool of threads doing `pread` if it
+ *  doesn't. Each read's callback is called as soon as it's done, in whatever
+ *  order they finish in.
+ *
+ * Before they go out, the queued reads are sorted by where their payloads
+ *  are in the archive, and runs of payloads that are next to each other (or
+ *  only `gap` bytes apart) are read with one vectored read that scatters them
+ *  straight into their own buffers. Loading thousands of small entries then
+ *  takes a few big sequential reads rather than thousands of seeks.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_AIO_H
+#define FRANKENTAR_AIO_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "index.h"
+
+/**
+ * @brief The default number of reads in flight at once
+ */
+#define FTAR_AIO_DEPTH 64
+
+/**
+ * @brief The default number of threads doing reads when io_uring can't be
+ *  used
+ */
+#define FTAR_AIO_THREADS 16
+
+/**
+ * @brief The default largest gap between payloads that are read together
+ */
+#define FTAR_AIO_GAP (64 * 1024)
+
+/**
+ * @brief The default largest read that payloads are merged into
+ */
+#define FTAR_AIO_MAX_MERGE (4 * 1024 * 1024)
+
+/**
+ * @brief Options for reading entries, zero them for the defaults
+ */
+struct ftar_aio_opts {
+	unsigned depth; /**< Reads in flight at once, 0 for `FTAR_AIO_DEPTH` */
+	unsigned threads; /**< Threads to read with if io_uring can't be used, 0 for `FTAR_AIO_THREADS` */
+	bool no_uring; /**< Read with threads even if io_uring is there */
+	size_t gap; /**< Read payloads up to this many bytes apart together, 0 for `FTAR_AIO_GAP` */
+	size_t max_merge; /**< Don't merge payloads into reads bigger than this, 0 for `FTAR_AIO_MAX_MERGE` (1 to not merge at all) */
+};
+
+/**
+ * @brief Called when a read finishes
+ *
+ * @param ent is the entry that was read
+ * @param data is the payload (decompressed and put back together), which
+ *  belongs to the callback, or `NULL` if the read failed
+ * @param len is the length of the payload, or -1 if the read failed
+ * @param err is 0, or the error the read failed with (see `ftar_index_read`)
+ * @param user is the pointer given to `ftar_aio_read`
+ */
+typedef void (*ftar_aio_fn)(struct ftar_index_ent *ent, char *data,
+			    size_t len, int err, void *user);
+
+/**
+ * @brief An opaque queue of entry reads
+ */
+struct ftar_aio;
+
+/**
+ * @brief Set up to read entries from an archive
+ *
+ * @param fd is the archive, which is only read with positioned reads
+ * @param idx is the archive's index, which has to outlive the queue
+ * @param opts are the options to read with, or `NULL` for the defaults
+ *
+ * @return Returns `NULL` or the queue
+ *
+ * With io_uring, the archive is registered with the ring as a fixed file
+ *  where the kernel allows it, which saves looking it up on every read.
+ */
+extern struct ftar_aio *ftar_aio_create(int fd, struct ftar_index *idx,
+					const struct ftar_aio_opts *opts);
+
+/**
+ * @brief Queue a read of one entry
+ *
+ * @param aio is the queue
+ * @param ent is the entry to read, from the queue's index
+ * @param fn is called with the payload once it's been read
+ * @param user is passed to `fn`
+ *
+ * @return Returns 0 or -1 (error)
+ *
+ * Nothing is read until `ftar_aio_wait` or `ftar_aio_step` is called, so
+ *  that as many reads as possible go to the kernel together and can be
+ *  merged.
+ */
+extern int ftar_aio_read(struct ftar_aio *aio, struct ftar_index_ent *ent,
+			 ftar_aio_fn fn, void *user);
+
+/**
+ * @brief Do every queued read, calling their callbacks as they finish
+ *
+ * @param aio is the queue
+ *
+ * @return Returns 0, or -1 (error) if reads couldn't be submitted at all.
+ *  Reads that fail on their own are reported to their callbacks.
+ *
+ * The callbacks are called on this thread, and can queue more reads.
+ *  Decompressing and putting chunks back together happens here too.
+ */
+extern int ftar_aio_wait(struct ftar_aio *aio);
+
+/**
+ * @brief Do one round of reads: send out what's queued, wait for at least
+ *  one read in flight to finish, and call the callbacks of the ones that did
+ *
+ * @param aio is the queue
+ *
+ * @return Returns 1 if reads are still queued or in flight, 0 if there are
+ *  none left, or -1 (error) if reads couldn't be submitted at all
+ *
+ * This is `ftar_aio_wait` one round at a time, for callers that have more
+ *  reads coming in and don't want them held up until everything in flight
+ *  has finished. Reads queued between rounds go out with the next one, next
+ *  to the ones still in flight.
+ */
+extern int ftar_aio_step(struct ftar_aio *aio);
+
+/**
+ * @brief Check whether a queue is using io_uring
+ *
+ * @param aio is the queue
+ *
+ * @return Returns `true` for io_uring, `false` for threads
+ */
+extern bool ftar_aio_uring(const struct ftar_aio *aio);
+
+/**
+ * @brief Free a queue
+ *
+ * @param aio is the queue to free
+ *
+ * Reads that are still queued are dropped without calling their callbacks.
+ */
+extern void ftar_aio_free(struct ftar_aio *aio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_AIO_H */
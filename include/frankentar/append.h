@@ -0,0 +1,97 @@
+/**
+ * @file append.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Writing an archive from many threads at once
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Each thread that has an entry ready compresses it on its own, takes the
+ *  space it needs at the end of the file by moving the end along atomically,
+ *  and writes its header and payload there with `pwrite`. Nothing is shared
+ *  but the end of the file and the entry count, so there are no locks and
+ *  writers only wait on the disk. The entries end up in whatever order
+ *  their space was taken in.
+ *
+ * The archive header says there are no entries until `ftar_append_close`
+ *  fills in the real count, so a half written archive reads as empty rather
+ *  than broken.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_APPEND_H
+#define FRANKENTAR_APPEND_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+
+/**
+ * @brief An archive being written by many threads
+ */
+struct ftar_append;
+
+/**
+ * @brief Create an archive to write entries to from any thread
+ *
+ * @param path is where to create it, anything there is replaced
+ * @param align is what payloads are aligned to (a power of two, 0 or 1 for
+ *  nothing)
+ *
+ * @return Returns `NULL` or the writer
+ */
+extern struct ftar_append *ftar_append_open(const char *path, size_t align);
+
+/**
+ * @brief Write an entry, safe to call from any number of threads at once
+ *
+ * @param app is the writer
+ * @param ent is the entry, which is compressed if its `codec` asks for it
+ *  (`FTAR_CODEC_NONE`, `FTAR_CODEC_LZ` and `FTAR_CODEC_AUTO` work, anything
+ *  that needs other entries doesn't)
+ *
+ * @return Returns 0 or -1 (error)
+ *
+ * A named link has to come after the entry it points to, so only add one
+ *  once the call that added its target has returned. If writing fails after
+ *  the space was taken, the entry is left there marked as deleted.
+ */
+extern int ftar_append_entry(struct ftar_append *app,
+			     const struct ftar_ent *ent);
+
+/**
+ * @brief Get how many entries have been written so far
+ *
+ * @param app is the writer
+ *
+ * @return Returns the count
+ */
+extern size_t ftar_append_count(struct ftar_append *app);
+
+/**
+ * @brief Finish an archive, filling in its entry count, and free the writer
+ *
+ * @param app is the writer, which mustn't be in use by any other thread
+ *
+ * @return Returns 0 or -1 (error, which means the archive is no good)
+ */
+extern int ftar_append_close(struct ftar_append *app);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_APPEND_H */
@@ -0,0 +1,117 @@
+/**
+ * @file chunk.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Content-defined chunking for deduplicating payloads
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Payloads are cut wherever a rolling (gear) hash of the last 64 bytes hits
+ *  a pattern, so an edit only changes the chunks around it and the rest line
+ *  up with the old version's. Each distinct chunk is stored once per
+ *  archive as a `FTAR_FTYPE_CHUNK` entry named with the hex SHA-256 of its
+ *  contents, and a chunked entry (`FTAR_CODEC_CHUNKED`) stores a manifest:
+ *
+ *  u64 raw size | u32 chunk count | chunk hash | chunk hash | ...
+ *
+ * Chunks always come before the entries that use them. A delta pack is a
+ *  chunked archive that leaves out the chunks a base archive already has,
+ *  and can only be loaded along with that base (see `ftar_load_base`).
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_CHUNK_H
+#define FRANKENTAR_CHUNK_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "hash.h"
+
+/**
+ * @brief The smallest chunk that will be cut (unless the payload ends)
+ */
+#define FTAR_CDC_MIN (16 * 1024)
+
+/**
+ * @brief The size chunks are cut at on average
+ */
+#define FTAR_CDC_AVG (64 * 1024)
+
+/**
+ * @brief The largest chunk that will be cut
+ */
+#define FTAR_CDC_MAX (256 * 1024)
+
+/**
+ * @brief The size of a manifest's header (raw size and chunk count)
+ */
+#define FTAR_MANIFEST_HDR_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+
+/**
+ * @brief Find where the next chunk ends
+ *
+ * @param data is the start of the chunk
+ * @param len is the amount of data left, including anything past `FTAR_CDC_MAX`
+ *
+ * @return Returns the length of the chunk
+ */
+extern size_t ftar_cdc_cut(const void *data, size_t len);
+
+/**
+ * @brief Get the entry name of a chunk
+ *
+ * @param hash is the chunk's `FTAR_HASH_SIZE` byte hash
+ * @param name receives the name in hex, must hold `FTAR_HASH_SIZE * 2 + 1`
+ *  bytes
+ */
+extern void ftar_chunk_name(const uint8_t *hash, char *name);
+
+/**
+ * @brief Get the hash of a chunk from its entry name
+ *
+ * @param name is the chunk's name
+ * @param hash receives the `FTAR_HASH_SIZE` byte hash
+ *
+ * @return Returns 0 or -1 if `name` isn't a chunk name
+ */
+extern int ftar_chunk_hash(const char *name, uint8_t *hash);
+
+/**
+ * @brief Write a manifest header
+ *
+ * @param dst receives `FTAR_MANIFEST_HDR_SIZE` bytes
+ * @param raw_size is the size of the whole payload
+ * @param count is the number of chunk hashes that follow
+ */
+extern void ftar_manifest_hdr(void *dst, uint64_t raw_size, uint32_t count);
+
+/**
+ * @brief Build the manifest for a payload
+ *
+ * @param data is the payload
+ * @param len is the length of the payload
+ * @param len_ret returns the length of the manifest or -1 (error)
+ *
+ * @return Returns `NULL` or the manifest
+ */
+extern void *ftar_cdc_manifest(const void *data, size_t len, size_t *len_ret);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_CHUNK_H */
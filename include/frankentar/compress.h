@@ -0,0 +1,275 @@
+/**
+ * @file compress.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Compression functions for Frankentar payloads
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Compressed payloads (`FTAR_CODEC_LZ`) are stored as a frame:
+ *
+ *  u64 raw size | u32 chunk size | chunk | chunk | ...
+ *
+ * where every chunk but the last holds `chunk size` raw bytes and is stored
+ *  as a u32 length followed by that many bytes of ftar_lz data. If the top
+ *  bit of the length is set, the chunk is stored raw instead, so a chunk
+ *  never grows by more than its length prefix. Chunks are independent of
+ *  each other, which is what lets them be compressed in parallel.
+ *
+ * `FTAR_CODEC_LZ_DICT` payloads use the same frame, but every chunk is
+ *  compressed against the archive's dictionary entry (`FTAR_FTYPE_DICT`),
+ *  which is stored once, ahead of the entries that use it, and is itself
+ *  `FTAR_CODEC_LZ` when that makes it smaller.
+ *
+ * ftar_lz is a byte-oriented LZ77 in the spirit of LZ4: a token byte holds
+ *  the literal length and match length nibbles (with 255-continued extra
+ *  bytes), followed by the literals, then the match offset as a LEB128
+ *  varint. Offsets aren't limited to a window, so a block can reference
+ *  anywhere in an optional dictionary that logically precedes it.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_COMPRESS_H
+#define FRANKENTAR_COMPRESS_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+
+/**
+ * @brief The default amount of raw data in each chunk of a frame
+ */
+#define FTAR_CHUNK_SIZE (256 * 1024)
+
+/**
+ * @brief The size of the frame header (raw size and chunk size)
+ */
+#define FTAR_FRAME_HDR_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+
+/**
+ * @brief Set in a chunk's length prefix when the chunk is stored raw
+ */
+#define FTAR_CHUNK_STORED 0x80000000u
+
+/**
+ * @brief Get the largest size `len` bytes can compress to
+ *
+ * @param len is the length of the input
+ *
+ * @return Returns the worst case length of the ftar_lz output
+ */
+extern size_t ftar_lz_bound(size_t len);
+
+/**
+ * @brief Compress a block with ftar_lz
+ *
+ * @param src is the data to compress
+ * @param len is the length of `src`
+ * @param dst receives the compressed data
+ * @param cap is the size of `dst`
+ * @param dict is an optional dictionary that matches can refer back into
+ * @param dict_len is the length of `dict`
+ *
+ * @return Returns the compressed length, or 0 if it wouldn't fit in `cap`
+ */
+extern size_t ftar_lz_compress(const void *src, size_t len, void *dst,
+			       size_t cap, const void *dict, size_t dict_len);
+
+/**
+ * @brief Compress a block with ftar_lz against an old version of it
+ *
+ * @param src is the data to compress
+ * @param len is the length of `src`
+ * @param dst receives the compressed data
+ * @param cap is the size of `dst`
+ * @param dict is an optional dictionary that matches can refer back into
+ * @param dict_len is the length of `dict`
+ * @param rep is how far back matches are expected to be, or 0 if unknown
+ *
+ * @return Returns the compressed length, or 0 if it wouldn't fit in `cap`
+ *
+ * `dict` is (part of) the old version. The compressor always tries the
+ *  offset of the last match first, and `rep` gives it one to start with,
+ *  normally the distance back to the same position in the old version. Long
+ *  matches are looked for separately, so that repetitive data doesn't get
+ *  matched against the wrong copy of itself.
+ */
+extern size_t ftar_lz_compress_rep(const void *src, size_t len, void *dst,
+				   size_t cap, const void *dict,
+				   size_t dict_len, size_t rep);
+
+/**
+ * @brief Decompress an ftar_lz block
+ *
+ * @param src is the compressed block
+ * @param len is the length of `src`
+ * @param dst receives the decompressed data
+ * @param cap is the size of `dst`
+ * @param dict is the dictionary the block was compressed with, or `NULL`
+ * @param dict_len is the length of `dict`
+ *
+ * @return Returns the decompressed length or -1 if the block is corrupt
+ */
+extern size_t ftar_lz_decompress(const void *src, size_t len, void *dst,
+				 size_t cap, const void *dict, size_t dict_len);
+
+/**
+ * @brief Get the largest size a chunk of `len` bytes can be stored in
+ */
+#define ftar_chunk_bound(len) (sizeof(uint32_t) + (len))
+
+/**
+ * @brief Compress one chunk of a frame, including its length prefix
+ *
+ * @param src is the raw chunk
+ * @param len is the length of the chunk
+ * @param dst receives the chunk, must hold `ftar_chunk_bound(len)` bytes
+ * @param dict is an optional dictionary
+ * @param dict_len is the length of `dict`
+ *
+ * @return Returns the number of bytes written to `dst`
+ */
+extern size_t ftar_chunk_compress(const void *src, size_t len, void *dst,
+				  const void *dict, size_t dict_len);
+
+/**
+ * @brief A dictionary that's been hashed for compressing against, so blocks
+ *  compressed against the same one don't each hash it again
+ */
+struct ftar_lz_dict;
+
+/**
+ * @brief Hash a dictionary for compressing against
+ *
+ * @param dict is the dictionary, which is copied
+ * @param dict_len is the length of `dict`
+ *
+ * @return Returns `NULL` or the hashed dictionary, which is only read from
+ *  and can be used by any number of threads at once
+ *
+ * Blocks up to `dict_len` bytes long get a copy of the hashes. Bigger ones
+ *  need a bigger table, so the dictionary is hashed for those again.
+ */
+extern struct ftar_lz_dict *ftar_lz_dict_new(const void *dict, size_t dict_len);
+
+/**
+ * @brief Compress one chunk of a frame against a hashed dictionary
+ *
+ * @param src is the raw chunk
+ * @param len is the length of the chunk
+ * @param dst receives the chunk, must hold `ftar_chunk_bound(len)` bytes
+ * @param dict is the dictionary, from `ftar_lz_dict_new`
+ *
+ * @return Returns the number of bytes written to `dst`, which is the same
+ *  format as `ftar_chunk_compress` and decompresses the same way
+ */
+extern size_t ftar_chunk_compress_dict(const void *src, size_t len, void *dst,
+				       const struct ftar_lz_dict *dict);
+
+/**
+ * @brief Free a hashed dictionary
+ *
+ * @param dict is the dictionary to free
+ */
+extern void ftar_lz_dict_free(struct ftar_lz_dict *dict);
+
+/**
+ * @brief Write a frame header
+ *
+ * @param dst receives `FTAR_FRAME_HDR_SIZE` bytes
+ * @param raw_size is the size of the uncompressed payload
+ * @param chunk_size is the amount of raw data per chunk
+ */
+extern void ftar_frame_hdr(void *dst, uint64_t raw_size, uint32_t chunk_size);
+
+/**
+ * @brief Compress a whole payload into a frame
+ *
+ * @param src is the payload
+ * @param len is the length of the payload
+ * @param chunk_size is the amount of raw data per chunk (0 for the default)
+ * @param dict is an optional dictionary
+ * @param dict_len is the length of `dict`
+ * @param len_ret returns the length of the frame or -1 (error)
+ *
+ * @return Returns `NULL` or a buffer containing the frame
+ */
+extern void *ftar_compress(const void *src, size_t len, size_t chunk_size,
+			   const void *dict, size_t dict_len, size_t *len_ret);
+
+/**
+ * @brief Decompress a frame
+ *
+ * @param src is the frame
+ * @param len is the length of the frame
+ * @param dict is the dictionary the frame was compressed with, or `NULL`
+ * @param dict_len is the length of `dict`
+ * @param len_ret returns the length of the payload or -1 (error)
+ *
+ * @return Returns `NULL` or a buffer containing the payload
+ */
+extern void *ftar_decompress(const void *src, size_t len, const void *dict,
+			     size_t dict_len, size_t *len_ret);
+
+/**
+ * @brief How much of a payload `ftar_codec_choose` looks at
+ */
+#define FTAR_AUTO_SAMPLE_SIZE (64 * 1024)
+
+/**
+ * @brief Pick the codec to store a payload with
+ *
+ * @param sample is (the start of) the payload
+ * @param len is the length of `sample`, only the first
+ *  `FTAR_AUTO_SAMPLE_SIZE` bytes are looked at
+ *
+ * @return Returns `FTAR_CODEC_LZ` if the payload looks like it'll compress,
+ *  otherwise `FTAR_CODEC_NONE`
+ *
+ * Anything with close to 8 bits of entropy per byte (already compressed
+ *  media, mostly) is rejected straight away. Otherwise, a small trial
+ *  compression has to save at least a few percent.
+ */
+extern int ftar_codec_choose(const void *sample, size_t len);
+
+/**
+ * @brief The default size of a trained dictionary
+ */
+#define FTAR_DICT_SIZE (32 * 1024)
+
+/**
+ * @brief Train a dictionary for compressing small, similar payloads
+ *
+ * @param samples are the payloads to train from
+ * @param lens are the lengths of the samples
+ * @param count is the number of samples
+ * @param dict_cap is the largest the dictionary can be
+ * @param len_ret returns the length of the dictionary or -1 (error)
+ *
+ * @return Returns `NULL` or the dictionary
+ *
+ * The dictionary is built from the segments of the samples whose substrings
+ *  are shared by the most samples, with the most useful segments at the end
+ *  so that they get the shortest offsets.
+ */
+extern void *ftar_dict_train(const void *const *samples, const size_t *lens,
+			     size_t count, size_t dict_cap, size_t *len_ret);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_COMPRESS_H */
@@ -0,0 +1,143 @@
+/**
+ * @file delta.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Binary deltas between archives, for small patches
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * A patch is an archive holding every entry of the new version, where each
+ *  payload is either stored normally or as a delta (`FTAR_CODEC_DELTA`)
+ *  against the entry with the same name in the base:
+ *
+ *  u64 raw size | u32 chunk size | u64 base size | base SHA-256 | chunk | ...
+ *
+ * Every chunk but the last holds `chunk size` raw bytes. Its u32 length
+ *  prefix is either 0, meaning it's the same as the base at the same offset,
+ *  has `FTAR_CHUNK_STORED` set if it's stored raw, or is followed by that
+ *  many bytes of ftar_lz data compressed against the base from
+ *  `FTAR_DELTA_WINDOW` bytes before the chunk's offset to as far after its
+ *  end. Copies of base data become matches into that window, so a patch
+ *  mostly holds what actually changed, like bsdiff or VCDIFF.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_DELTA_H
+#define FRANKENTAR_DELTA_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "hash.h"
+
+/**
+ * @brief How far either side of a chunk's offset the base is searched
+ */
+#define FTAR_DELTA_WINDOW (1024 * 1024)
+
+/**
+ * @brief The size of a delta's header
+ */
+#define FTAR_DELTA_HDR_SIZE \
+	(sizeof(uint64_t) * 2 + sizeof(uint32_t) + FTAR_HASH_SIZE)
+
+/**
+ * @brief Encode a payload as a delta against an old version of it
+ *
+ * @param src is the new payload
+ * @param len is the length of the new payload
+ * @param base is the old payload
+ * @param base_len is the length of the old payload
+ * @param len_ret returns the length of the delta or -1 (error)
+ *
+ * @return Returns `NULL` or the delta
+ */
+extern void *ftar_delta_encode(const void *src, size_t len, const void *base,
+			       size_t base_len, size_t *len_ret);
+
+/**
+ * @brief Apply a delta to the payload it was made against
+ *
+ * @param delta is the delta
+ * @param len is the length of the delta
+ * @param base is the old payload, which has to match the one the delta was
+ *  made against (`EINVAL` otherwise)
+ * @param base_len is the length of the old payload
+ * @param len_ret returns the length of the new payload or -1 (error)
+ *
+ * @return Returns `NULL` or the new payload
+ */
+extern void *ftar_delta_decode(const void *delta, size_t len, const void *base,
+			       size_t base_len, size_t *len_ret);
+
+/**
+ * @brief Make a patch that turns one archive into another
+ *
+ * @param base is the old archive
+ * @param tar is the new archive
+ * @param len_ret returns the length of the patch or -1 (error)
+ *
+ * @return Returns `NULL` or a buffer containing the patch
+ *
+ * Each entry is stored as a delta against the base's entry with the same
+ *  name if that's smaller, otherwise as `FTAR_CODEC_AUTO` would store it.
+ *  Dictionaries and chunks are left out, since the payloads that used them
+ *  are stored without them.
+ */
+extern void *ftar_diff(struct ftar *base, struct ftar *tar, size_t *len_ret);
+
+/**
+ * @brief Load a patch on top of its base without applying it up front
+ *
+ * @param base is the archive the patch was made against, which has to stay
+ *  loaded until the result is freed
+ * @param patch is the patch in memory
+ * @param patch_len is the length of the patch
+ *
+ * @return Returns `NULL` or the patched archive
+ *
+ * The entries start out with no data (their sizes are the real ones), which
+ *  is only reconstructed when `ftar_patched_data` asks for it. Unchanged
+ *  entries share the base's data instead of copying it. None of this is
+ *  thread safe.
+ */
+extern struct ftar *ftar_load_patched(struct ftar *base, void *patch,
+				      size_t patch_len);
+
+/**
+ * @brief Get the data of an entry of a patched archive
+ *
+ * @param tar is the archive from `ftar_load_patched`
+ * @param ent is the entry
+ *
+ * @return Returns `NULL` or the entry's data, which is also put in
+ *  `ent->data`
+ */
+extern char *ftar_patched_data(struct ftar *tar, struct ftar_ent *ent);
+
+/**
+ * @brief Free the lazy loading state of a patched archive, along with its
+ *  entries and their data (used by `ftar_free`)
+ *
+ * @param tar is the archive from `ftar_load_patched`
+ */
+extern void ftar_patch_free(struct ftar *tar);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_DELTA_H */
@@ -0,0 +1,140 @@
+/**
+ * @file edit.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Functions for changing archives in place
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * These only touch the parts of the archive that change, so their cost
+ *  depends on the size of the change rather than of the archive. Deleting an
+ *  entry just sets `FTAR_ENT_DELETED` in its header, and the space it takes
+ *  up is only reclaimed by `ftar_compact`, whenever that's convenient.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_EDIT_H
+#define FRANKENTAR_EDIT_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "pack.h"
+
+/**
+ * @brief The default fraction of an archive that has to be dead before
+ *  `ftar_compact` rewrites it
+ */
+#define FTAR_COMPACT_THRESHOLD 0.25
+
+/**
+ * @brief The size of the reads and writes `ftar_compact` copies entries with
+ */
+#define FTAR_COMPACT_BUF_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief Appended to an archive's name to get the file `ftar_compact` writes
+ *  before replacing the archive with it
+ */
+#define FTAR_COMPACT_SUFFIX ".compact"
+
+/**
+ * @brief Add files to the end of an archive
+ *
+ * @param archive is the path of the archive
+ * @param paths are the files to add
+ * @param count is the number of files
+ * @param opts are the options to pack the files with (see `ftar_pack`), or
+ *  `NULL` for the defaults. With `cdc` set and no `base`, chunks already in
+ *  the archive are reused.
+ *
+ * @return Returns 0 or -1 (error)
+ *
+ * The new entries are written over the old trailer, and the entry count in
+ *  the archive header is only updated once they're all in place, so if this
+ *  is interrupted the archive still reads the same as before. Entries that
+ *  had the same names as the files are deleted after that.
+ */
+extern int ftar_add(const char *archive, const char *const *paths,
+		    size_t count, const struct ftar_pack_opts *opts);
+
+/** Flags for `ftar_update` */
+#define FTAR_UPDATE_CONTENTS (1) /** Compare contents too, not just the size, mtime and mode */
+#define FTAR_UPDATE_PRUNE (1 << 1) /** Delete entries for files that weren't given */
+
+/**
+ * @brief Bring an archive up to date with a set of files
+ *
+ * @param archive is the path of the archive
+ * @param paths are the files the archive should hold
+ * @param count is the number of files
+ * @param opts are the options to pack changed files with (see `ftar_add`),
+ *  or `NULL` for the defaults
+ * @param flags are any of the `FTAR_UPDATE_*` flags
+ *
+ * @return Returns 0 or -1 (error)
+ *
+ * A file is only read if it's new, or its type, mode, mtime or size doesn't
+ *  match its entry (or with `FTAR_UPDATE_CONTENTS`, its contents). Those are
+ *  passed to `ftar_add`, and everything else is left in place, so this
+ *  costs about as much as the files that changed.
+ */
+extern int ftar_update(const char *archive, const char *const *paths,
+		       size_t count, const struct ftar_pack_opts *opts,
+		       int flags);
+
+/**
+ * @brief Delete entries from an archive
+ *
+ * @param archive is the path of the archive
+ * @param names are the names of the entries to delete
+ * @param count is the number of names
+ *
+ * @return Returns 0 or -1 (error, `ENOENT` if an entry doesn't exist, or
+ *  `EINVAL` if it's a dictionary or a chunk, which only `ftar_compact` gets
+ *  rid of). Nothing is deleted if any of the names are bad.
+ *
+ * Only headers are written, so this takes the same time for any size of
+ *  entry. If other entries are links that share one's payload, the first of
+ *  them takes over that payload.
+ */
+extern int ftar_delete(const char *archive, const char *const *names,
+		       size_t count);
+
+/**
+ * @brief Rewrite an archive without its deleted entries, if enough of it is
+ *  dead
+ *
+ * @param archive is the path of the archive
+ * @param threshold is the fraction of the archive that has to be dead for it
+ *  to be rewritten (usually `FTAR_COMPACT_THRESHOLD`, 0 to always rewrite
+ *  it, even with nothing dead)
+ *
+ * @return Returns 1 (compacted), 0 (not enough dead space) or -1 (error)
+ *
+ * Chunks that no live entry uses any more count as dead too. The live
+ *  entries are copied in runs with large sequential reads and writes (or
+ *  `copy_file_range`, where there is one) into a new file next to the
+ *  archive (see `FTAR_COMPACT_SUFFIX`), which is then renamed over it, so
+ *  an interrupted compaction loses nothing.
+ */
+extern int ftar_compact(const char *archive, double threshold);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_EDIT_H */
@@ -0,0 +1,78 @@
+/**
+ * @file embed.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Generating C++ headers that embed the files of an archive
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * The header has each file's contents in a `constexpr` array and a perfect
+ *  hash table over their names, all in `frankentar::<namespace>`, so
+ *  `frankentar::embedded::find("shaders/x.spv")` is done by the compiler
+ *  when the name is a literal and takes two hashes and one comparison when
+ *  it isn't. See frankentar_embed.hpp for what it uses.
+ *
+ * The table is built by hash and displace: names are split into buckets by
+ *  their hash with a seed of 0, and each bucket, biggest first, gets the
+ *  first seed that sends all of its names to free slots. A lookup hashes
+ *  the name once to find its bucket and again with the bucket's seed to find
+ *  its slot.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_EMBED_H
+#define FRANKENTAR_EMBED_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+
+/**
+ * @brief The namespace (inside `frankentar`) embedded files go in by default
+ */
+#define FTAR_EMBED_NS "embedded"
+
+/**
+ * @brief Hash a name with a seed for the embedded file table
+ *
+ * @param name is the name
+ * @param len is its length
+ * @param seed is the seed
+ *
+ * @return Returns the hash, the same as `frankentar::embed_hash`
+ */
+extern uint64_t ftar_embed_hash(const char *name, size_t len, uint32_t seed);
+
+/**
+ * @brief Write a C++ header embedding the files in an archive
+ *
+ * @param out is where to write the header
+ * @param tar is the archive, only its regular files (and links to them) are
+ *  embedded
+ * @param ns is the namespace to put them in inside `frankentar`, or `NULL`
+ *  for `FTAR_EMBED_NS`
+ *
+ * @return Returns 0 or -1 (error), `EINVAL` if `ns` isn't an identifier
+ *
+ * Files that share a payload (see `ftar_pack_opts`) share an array too.
+ */
+extern int ftar_embed(FILE *out, struct ftar *tar, const char *ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_EMBED_H */
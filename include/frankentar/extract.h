@@ -0,0 +1,85 @@
+/**
+ * @file extract.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Functions for extracting archives onto disk
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_EXTRACT_H
+#define FRANKENTAR_EXTRACT_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "scan.h"
+
+/**
+ * @brief Extract the files in an archive into the current directory
+ *
+ * @param archive is the path of the archive
+ * @param names are the entries to extract, or `NULL` for all of them
+ * @param count is the number of names
+ * @param opts are the options to scan the archive with when extracting all of
+ *  it, or `NULL` for the defaults
+ *
+ * @return Returns 0 or -1 (error), `ENOENT` if one of the names isn't in the
+ *  archive, or `EINVAL` if an entry's name would put it outside the
+ *  current directory, or in a directory that's really a symlink
+ *
+ * To extract everything, the archive is read once from start to end with
+ *  `ftar_scan`, and payloads that aren't compressed are written out as
+ *  they're read, so memory use only depends on the size of the biggest
+ *  compressed entry. Entries made of chunks are put back together by reading
+ *  the chunks on their own (see `ftar_index_read`). Files with the same
+ *  contents (see `ftar_pack_opts`) are copied from the first one written,
+ *  and keep their own mode and mtime.
+ *
+ * Given names, only those entries are read, all at once with `ftar_aio`, and
+ *  each file is written as soon as its read finishes.
+ *
+ * Either way, the directories entries are in are made if they're missing.
+ */
+extern int ftar_extract(const char *archive, const char *const *names,
+			size_t count, const struct ftar_scan_opts *opts);
+
+/**
+ * @brief Extract a delta pack into the current directory
+ *
+ * @param archive is the path of the delta pack
+ * @param base is the path of the archive it was made against, or `NULL` for
+ *  the same as `ftar_extract`
+ * @param names are the entries to extract, or `NULL` for all of them
+ * @param count is the number of names
+ * @param opts are the options to scan the pack with when extracting all of
+ *  it, or `NULL` for the defaults
+ *
+ * @return Returns 0 or -1 (error), the same as `ftar_extract`, and `ENOENT`
+ *  if a chunk isn't in either archive
+ *
+ * Chunks that aren't in the pack are read from the base (see
+ *  `ftar_index_read_base`), which is only indexed, not read in full.
+ */
+extern int ftar_extract_base(const char *archive, const char *base,
+			     const char *const *names, size_t count,
+			     const struct ftar_scan_opts *opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_EXTRACT_H */
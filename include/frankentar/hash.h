@@ -0,0 +1,79 @@
+/**
+ * @file hash.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Content hashing for Frankentar payloads
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_HASH_H
+#define FRANKENTAR_HASH_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief The size of a content hash (SHA-256)
+ */
+#define FTAR_HASH_SIZE 32
+
+/**
+ * @brief The state of a SHA-256 hash in progress
+ */
+struct ftar_sha256 {
+	uint32_t state[8]; /**< The intermediate hash */
+	uint64_t len; /**< The number of bytes hashed so far */
+	uint8_t buf[64]; /**< Data waiting for a full block */
+};
+
+/**
+ * @brief Start a SHA-256 hash
+ *
+ * @param ctx is the hash state to initialize
+ */
+extern void ftar_sha256_init(struct ftar_sha256 *ctx);
+
+/**
+ * @brief Add data to a SHA-256 hash
+ *
+ * @param ctx is the hash state
+ * @param data is the data to add
+ * @param len is the length of `data`
+ */
+extern void ftar_sha256_update(struct ftar_sha256 *ctx, const void *data,
+			       size_t len);
+
+/**
+ * @brief Finish a SHA-256 hash
+ *
+ * @param ctx is the hash state
+ * @param out receives the `FTAR_HASH_SIZE` byte hash
+ */
+extern void ftar_sha256_final(struct ftar_sha256 *ctx, uint8_t *out);
+
+/**
+ * @brief Hash a buffer with SHA-256 in one go
+ *
+ * @param data is the data to hash
+ * @param len is the length of `data`
+ * @param out receives the `FTAR_HASH_SIZE` byte hash
+ */
+extern void ftar_sha256(const void *data, size_t len, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_HASH_H */
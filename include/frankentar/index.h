@@ -0,0 +1,188 @@
+/**
+ * @file index.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief An index of the entries in an archive file, without their payloads
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Building an index only reads the headers, so it costs one small read per
+ *  entry no matter how big the archive is. It's what lets archives be
+ *  changed in place and entries be read on their own.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_INDEX_H
+#define FRANKENTAR_INDEX_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+
+/**
+ * @brief An entry in an index
+ */
+struct ftar_index_ent {
+	struct ftar_ent hdr; /**< The header as stored (`size` is the stored size, there's no data) */
+	uint64_t off; /**< Offset of the header in the file */
+	uint64_t data_off; /**< Offset of the payload, after any padding */
+};
+
+/**
+ * @brief An index of an archive
+ */
+struct ftar_index {
+	size_t ent_count; /**< The number of entries */
+	size_t align; /**< What payloads are aligned to (1 for nothing) */
+	struct ftar_index_ent *entries; /**< The entries, in the order they're stored (deleted ones included) */
+	uint64_t end; /**< Offset of the end of the last entry, where the trailer starts */
+	uint64_t dead; /**< Bytes taken up by deleted entries */
+	struct ftar_ent **names; /**< Name lookup table (see `ftar_name_slot`) */
+	size_t mask; /**< The number of slots in `names` minus one */
+	uint64_t start; /**< Where the archive starts in the file */
+	size_t *dicts; /**< Where each dictionary is in `entries`, in order */
+	size_t dict_count; /**< The number of dictionaries */
+};
+
+/**
+ * @brief Index an archive
+ *
+ * @param fd is the archive, which is read with `pread` so its offset doesn't
+ *  change
+ *
+ * @return Returns `NULL` or the index
+ */
+extern struct ftar_index *ftar_index_fd(int fd);
+
+/**
+ * @brief Index an archive that's part of a bigger file
+ *
+ * @param fd is the file the archive is in
+ * @param start is where the archive starts in the file
+ * @param len is the length of the archive
+ *
+ * @return Returns `NULL` or the index
+ *
+ * Offsets in the index are into the file rather than the archive, so it can
+ *  be read from with `fd` like any other.
+ */
+extern struct ftar_index *ftar_index_fd_at(int fd, uint64_t start,
+					   uint64_t len);
+
+/**
+ * @brief Catch an index up with entries appended since it was made
+ *
+ * @param fd is the archive the index was made from
+ * @param old is the index, which is left alone
+ *
+ * @return Returns `NULL` or a new index, `ESTALE` if the archive was
+ *  replaced or rewritten rather than appended to (open it again)
+ *
+ * Appending (`ftar_add`, `ftar_append_close`) writes the new entries first
+ *  and then commits them by updating the count in the archive header, so
+ *  the count is the archive's generation. An index only ever sees the
+ *  entries of the generation it was made at, however much is appended
+ *  while it's being read from. This reads the count and only the headers
+ *  that are new since `old`, copying the rest from it, so readers can move
+ *  up to the newest generation when they like and drop `old` once they're
+ *  done with it.
+ *
+ * Adding an entry with the name of an old one marks the old one deleted, or
+ *  hands it over to a link that shared its payload, so the old headers with
+ *  the names of new entries and the links to them are read again too, and
+ *  the result is the same as indexing the archive from scratch. Entries
+ *  deleted with nothing added in their place (`ftar_delete`) don't change
+ *  the count, so they still look live here until the archive is indexed
+ *  from scratch.
+ */
+extern struct ftar_index *ftar_index_refresh(int fd,
+					     const struct ftar_index *old);
+
+/**
+ * @brief Find an entry in an index
+ *
+ * @param idx is the index to search
+ * @param name is the name of the entry
+ *
+ * @return Returns the first live entry called `name`, or `NULL` (with `errno`
+ *  set to `ENOENT`) if there isn't one
+ */
+extern struct ftar_index_ent *ftar_index_find(struct ftar_index *idx,
+					      const char *name);
+
+/**
+ * @brief Find the dictionary an entry was compressed against
+ *
+ * @param idx is the index
+ * @param ent is the entry
+ *
+ * @return Returns the last dictionary before `ent`, or `NULL` (with `errno`
+ *  set to `EINVAL`) if there isn't one
+ *
+ * Where the dictionaries are is noted while indexing, so this doesn't look
+ *  at any other entries.
+ */
+extern struct ftar_index_ent *ftar_index_dict(struct ftar_index *idx,
+					      struct ftar_index_ent *ent);
+
+/**
+ * @brief Read the payload of one entry
+ *
+ * @param fd is the archive the index was made from
+ * @param idx is the index
+ * @param ent is the entry
+ * @param len_ret returns the length of the payload or -1 (error)
+ *
+ * @return Returns `NULL` or the payload, decompressed and put back together
+ *  (`ENOENT` if it uses chunks from a base, `EINVAL` if it's a delta)
+ *
+ * Only the entry itself is read, along with its dictionary or chunks.
+ */
+extern char *ftar_index_read(int fd, struct ftar_index *idx,
+			     struct ftar_index_ent *ent, size_t *len_ret);
+
+/**
+ * @brief Read the payload of one entry of a delta pack
+ *
+ * @param fd is the delta pack the index was made from
+ * @param idx is the index
+ * @param base_fd is the archive the pack was made against
+ * @param base is its index, or `NULL` for the same as `ftar_index_read`
+ * @param ent is the entry
+ * @param len_ret returns the length of the payload or -1 (error)
+ *
+ * @return Returns `NULL` or the payload, `ENOENT` if a chunk isn't in either
+ *  archive
+ *
+ * Chunks that aren't in the pack are read from the base instead, like
+ *  `ftar_load_base` does.
+ */
+extern char *ftar_index_read_base(int fd, struct ftar_index *idx, int base_fd,
+				  struct ftar_index *base,
+				  struct ftar_index_ent *ent, size_t *len_ret);
+
+/**
+ * @brief Free an index
+ *
+ * @param idx is the index to free
+ */
+extern void ftar_index_free(struct ftar_index *idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_INDEX_H */
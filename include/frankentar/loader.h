@@ -0,0 +1,175 @@
+/**
+ * @file loader.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Loading entries in the background, most important first
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * A loader keeps a queue of requests for entries, ordered by priority and
+ *  then deadline, which a few threads work through. Payloads are read in
+ *  slices, and a thread that finds something more important waiting once
+ *  it's done with a slice puts what it was reading back in the queue and
+ *  picks that up instead. So a big prefetch can't hold up anything urgent
+ *  for longer than one slice takes to read.
+ *
+ * Each request gets a handle, which is both how to cancel it and how to wait
+ *  for it like a future. The handle belongs to the caller until it's given
+ *  to `ftar_load_free`.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_LOADER_H
+#define FRANKENTAR_LOADER_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+
+/**
+ * @brief The default number of threads a loader reads with
+ */
+#define FTAR_LOADER_THREADS 4
+
+/**
+ * @brief The default number of bytes of payloads a loader reads at once
+ */
+#define FTAR_LOADER_BUDGET (64 * 1024 * 1024)
+
+/**
+ * @brief The default amount read before checking for more important requests
+ */
+#define FTAR_LOADER_SLICE (1024 * 1024)
+
+/**
+ * @brief Options for a loader, zero them for the defaults
+ */
+struct ftar_loader_opts {
+	unsigned threads; /**< Threads to read with, 0 for `FTAR_LOADER_THREADS` */
+	size_t budget; /**< Bytes of payloads being read at once, 0 for `FTAR_LOADER_BUDGET` */
+	size_t slice; /**< Bytes read between checks for more important requests, 0 for `FTAR_LOADER_SLICE` */
+};
+
+/**
+ * @brief An opaque loader
+ */
+struct ftar_loader;
+
+/**
+ * @brief An opaque request
+ */
+struct ftar_load;
+
+/**
+ * @brief Called on one of the loader's threads when a request finishes
+ *
+ * @param load is the request
+ * @param data is the payload, which belongs to the callback, or `NULL`
+ * @param len is the length of the payload, or -1 (error)
+ * @param err is 0, `ECANCELED`, `ETIMEDOUT` if the deadline passed before it
+ *  was started, or another error from reading it
+ * @param user is the pointer given to `ftar_loader_request`
+ *
+ * Cancelled requests call this on the thread that cancelled them instead.
+ */
+typedef void (*ftar_load_fn)(struct ftar_load *load, char *data, size_t len,
+			     int err, void *user);
+
+/**
+ * @brief Start a loader
+ *
+ * @param archive is the path of the archive to load entries from
+ * @param opts are the options to load with, or `NULL` for the defaults
+ *
+ * @return Returns `NULL` or the loader
+ */
+extern struct ftar_loader *ftar_loader_open(const char *archive,
+					    const struct ftar_loader_opts *opts);
+
+/**
+ * @brief Get the time deadlines are measured against
+ *
+ * @return Returns a monotonic time in nanoseconds
+ */
+extern uint64_t ftar_loader_now(void);
+
+/**
+ * @brief Ask for an entry to be loaded
+ *
+ * @param loader is the loader
+ * @param name is the name of the entry
+ * @param priority is how important the request is, higher goes first
+ * @param deadline is the time (see `ftar_loader_now`) after which it isn't
+ *  worth starting, or 0 for none. Of requests with the same priority, the
+ *  ones with the earliest deadlines go first.
+ * @param fn is called when it's done, or `NULL` to get the payload from
+ *  `ftar_load_wait` instead
+ * @param user is passed to `fn`
+ *
+ * @return Returns `NULL` or the request's handle
+ */
+extern struct ftar_load *ftar_loader_request(struct ftar_loader *loader,
+					     const char *name, int priority,
+					     uint64_t deadline, ftar_load_fn fn,
+					     void *user);
+
+/**
+ * @brief Cancel a request that hasn't finished
+ *
+ * @param load is the request
+ *
+ * @return Returns 0 if it was cancelled, or -1 (`EBUSY` if a slice of it is
+ *  being read right now, `EALREADY` if it's done)
+ */
+extern int ftar_load_cancel(struct ftar_load *load);
+
+/**
+ * @brief Wait for a request to finish
+ *
+ * @param load is the request
+ * @param len_ret returns the length of the payload or -1 (error)
+ *
+ * @return Returns `NULL` (with `errno` set to what it failed with) or the
+ *  payload, which then belongs to the caller. Requests with a callback
+ *  always give `NULL` (with `errno` 0 if they succeeded).
+ */
+extern char *ftar_load_wait(struct ftar_load *load, size_t *len_ret);
+
+/**
+ * @brief Free a request, cancelling it if it hasn't been started
+ *
+ * @param load is the request to free
+ *
+ * A request that's being read is freed once it's done instead, which makes
+ *  it fine to call this from its own callback.
+ */
+extern void ftar_load_free(struct ftar_load *load);
+
+/**
+ * @brief Stop a loader
+ *
+ * @param loader is the loader to stop
+ *
+ * Every request's handle has to be freed first. Requests that were being
+ *  read when their handles were freed are finished before this returns.
+ */
+extern void ftar_loader_free(struct ftar_loader *loader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_LOADER_H */
@@ -0,0 +1,117 @@
+/**
+ * @file overlay.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Looking entries up in a stack of archives as if they were one
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * An overlay is a base archive with DLC and patches mounted on top of it.
+ *  Each archive has a priority, and where two have an entry with the same
+ *  name, the one with the higher priority wins, or the one mounted later if
+ *  they're the same. An entry of type `FTAR_FTYPE_WHITEOUT` wins the same
+ *  way but makes its name look like it isn't there at all, so a patch can
+ *  take files out of the archives under it.
+ *
+ * Every name ends up in one table that points straight at the winning
+ *  entry, so a lookup hashes the name once no matter how many archives are
+ *  mounted. Mounting an archive above everything else only adds its names
+ *  to the table; anything else builds it again.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_OVERLAY_H
+#define FRANKENTAR_OVERLAY_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "frankentar/util.h"
+
+/**
+ * @brief A stack of archives
+ */
+struct ftar_overlay;
+
+/**
+ * @brief Make an empty overlay
+ *
+ * @return Returns `NULL` or the overlay
+ */
+extern struct ftar_overlay *ftar_overlay_new(void);
+
+/**
+ * @brief Mount an archive
+ *
+ * @param overlay is the overlay
+ * @param tar is the archive, which has to stay around and not be changed
+ *  until it's unmounted
+ * @param priority is its priority, higher ones hide lower ones
+ *
+ * @return Returns 0 or -1 (error, the overlay is left as it was)
+ */
+extern int ftar_overlay_mount(struct ftar_overlay *overlay, struct ftar *tar,
+			      int priority);
+
+/**
+ * @brief Unmount an archive
+ *
+ * @param overlay is the overlay
+ * @param tar is the archive
+ *
+ * @return Returns 0 or -1 (error, `ENOENT` if it isn't mounted)
+ */
+extern int ftar_overlay_unmount(struct ftar_overlay *overlay,
+				struct ftar *tar);
+
+/**
+ * @brief Find the entry that wins for a name, safe to call from any number of
+ *  threads as long as nothing is being mounted or unmounted
+ *
+ * @param overlay is the overlay
+ * @param name is the name to look for
+ * @param ent_ret returns the entry
+ * @param tar_ret returns the archive it's in, if it isn't `NULL`
+ *
+ * @return Returns `FTAR_OK`, or `FTAR_E_NOENT` if no archive has it or the
+ *  winner is a whiteout
+ */
+extern enum ftar_result ftar_overlay_find(const struct ftar_overlay *overlay,
+					  const char *name,
+					  const struct ftar_ent **ent_ret,
+					  struct ftar **tar_ret);
+
+/**
+ * @brief Get the number of names that can be found
+ *
+ * @param overlay is the overlay
+ *
+ * @return Returns the count, which doesn't include whiteouts
+ */
+extern size_t ftar_overlay_count(const struct ftar_overlay *overlay);
+
+/**
+ * @brief Free an overlay, but not the archives in it
+ *
+ * @param overlay is the overlay to free
+ */
+extern void ftar_overlay_free(struct ftar_overlay *overlay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_OVERLAY_H */
@@ -0,0 +1,119 @@
+/**
+ * @file pack.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Functions for packing files on disk straight into an archive
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_PACK_H
+#define FRANKENTAR_PACK_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+
+/**
+ * @brief The default size of the largest entry compressed against a
+ *  dictionary
+ */
+#define FTAR_DICT_MAX_ENTRY (16 * 1024)
+
+/**
+ * @brief How many times the dictionary size to sample when training one
+ */
+#define FTAR_DICT_SAMPLE_FACTOR 100
+
+/**
+ * @brief Options for `ftar_pack`, zero them for the defaults
+ */
+struct ftar_pack_opts {
+	int codec; /**< Codec to store payloads with (`FTAR_CODEC_*`) */
+	unsigned threads; /**< Worker threads, 0 for one per CPU */
+	size_t chunk_size; /**< Raw bytes per chunk, 0 for `FTAR_CHUNK_SIZE` */
+	size_t max_inflight; /**< Bytes read but not yet written, 0 for 4 chunks per thread */
+	size_t dict_size; /**< Size of the dictionary to train for small entries, 0 for none */
+	size_t dict_max_entry; /**< Largest entry to use the dictionary for, 0 for `FTAR_DICT_MAX_ENTRY` */
+	bool dedup; /**< Store files with identical contents once */
+	bool cdc; /**< Split payloads into content-defined chunks and store each distinct one once (see chunk.h) */
+	const char *base; /**< With `cdc`, an archive whose chunks are left out, making a delta pack */
+	size_t align; /**< Start payloads on multiples of this (a power of two up to `FTAR_ALIGN_MAX`), 0 for no alignment */
+};
+
+/**
+ * @brief Fill out an entry's header from a file on disk
+ *
+ * @param ent is the entry to fill out (its data isn't touched)
+ * @param path is the file, which is also used as the entry's name
+ *
+ * @return Returns 0 or -1 (error)
+ */
+extern int ftar_ent_from_file(struct ftar_ent *ent, const char *path);
+
+/**
+ * @brief Write an archive containing the given files
+ *
+ * @param out is the file to write the archive to, which has to be seekable
+ *  if a codec or alignment is used
+ * @param paths are the files to add
+ * @param count is the number of files
+ * @param opts are the options to pack with, or `NULL` for the defaults
+ *
+ * @return Returns 0 or -1 (error)
+ *
+ * Files are split into chunks which are read (and compressed) by a thread
+ *  pool, while the calling thread writes them out in order. No more than
+ *  `max_inflight` bytes of chunks are held at once, so memory use doesn't
+ *  depend on the size of the files.
+ *
+ * With `cdc`, the files are chunked and hashed on the pool first, then the
+ *  chunks that haven't been seen yet (in this archive or `base`) are read
+ *  and compressed in batches of up to `max_inflight` bytes. The output has
+ *  to be seekable, and `dict_size` is ignored.
+ *
+ * With `align`, each payload is padded out to start on a multiple of it in
+ *  the file, so that it can be used straight from a mapping or read with
+ *  direct I/O (see `FTAR_ALIGN_OFF`).
+ */
+extern int ftar_pack(FILE *out, const char *const *paths, size_t count,
+		     const struct ftar_pack_opts *opts);
+
+/**
+ * @brief Write entries for the given files, without an archive header
+ *
+ * @param out is where the entries go, which has to be seekable
+ * @param paths are the files to add
+ * @param count is the number of files
+ * @param opts are the options to pack with, or `NULL` for the defaults
+ * @param written_ret returns the number of entries written, which can be
+ *  more than `count` (dictionaries and chunks are entries too)
+ *
+ * @return Returns 0 or -1 (error)
+ *
+ * This is `ftar_pack` for appending to an existing archive. The entries are
+ *  followed by the trailer, and it's up to the caller to update the entry
+ *  count in the archive header.
+ */
+extern int ftar_pack_entries(FILE *out, const char *const *paths, size_t count,
+			     const struct ftar_pack_opts *opts,
+			     size_t *written_ret);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_PACK_H */
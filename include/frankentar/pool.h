@@ -0,0 +1,82 @@
+/**
+ * @file pool.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief A simple thread pool used by the parallel parts of the library
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_POOL_H
+#define FRANKENTAR_POOL_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+
+/**
+ * @brief A task run by the pool
+ */
+typedef void (*ftar_task_fn)(void *arg);
+
+/**
+ * @brief An opaque thread pool
+ */
+struct ftar_pool;
+
+/**
+ * @brief Get the number of online CPUs
+ *
+ * @return Returns the number of CPUs, or 1 if it can't be determined
+ */
+extern unsigned ftar_cpu_count(void);
+
+/**
+ * @brief Start a thread pool
+ *
+ * @param threads is the number of workers, or 0 for one per CPU
+ *
+ * @return Returns `NULL` or the pool
+ */
+extern struct ftar_pool *ftar_pool_create(unsigned threads);
+
+/**
+ * @brief Queue a task, tasks start in the order they're submitted
+ *
+ * @param pool is the pool to run the task on
+ * @param fn is the function to run
+ * @param arg is passed to `fn`
+ *
+ * @return Returns 0 or -1 (error)
+ */
+extern int ftar_pool_submit(struct ftar_pool *pool, ftar_task_fn fn, void *arg);
+
+/**
+ * @brief Wait for every queued task to finish
+ *
+ * @param pool is the pool to wait on
+ */
+extern void ftar_pool_wait(struct ftar_pool *pool);
+
+/**
+ * @brief Finish the queued tasks, stop the workers and free the pool
+ *
+ * @param pool is the pool to free
+ */
+extern void ftar_pool_free(struct ftar_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_POOL_H */
@@ -37,9 +37,28 @@ extern "C" {
  * @param tar_len is the length of the memory containing the archive
  * 
  * @return Returns a pointer to a filled out `ftar` structure or `NULL`
+ *
+ * A `FTAR_FTYPE_LINK` entry with a link name and no payload is a duplicate
+ *  of the entry it names, and gets the same `data` pointer and size.
  */
 extern struct ftar *ftar_load(void *tar, size_t tar_len);
 
+/**
+ * @brief Load a Frankentar archive that may be a delta pack
+ *
+ * @param tar is a pointer to the start of an archive present in memory
+ * @param tar_len is the length of the memory containing the archive
+ * @param base is the archive the delta pack was made against, or `NULL`
+ *
+ * @return Returns a pointer to a filled out `ftar` structure or `NULL`
+ *
+ * Chunked entries whose chunks aren't in `tar` get them from `base`
+ *  instead (see chunk.h). Their data is copied, so `base` can be freed
+ *  afterwards. Fails with `ENOENT` if a chunk can't be found in either.
+ */
+extern struct ftar *ftar_load_base(void *tar, size_t tar_len,
+				   struct ftar *base);
+
 /**
  * @brief Find an entry with the given name in `tar`
  * 
@@ -52,6 +71,50 @@ extern struct ftar *ftar_load(void *tar, size_t tar_len);
  */
 extern struct ftar_ent *ftar_find(struct ftar *tar, long *index, const char *name, ...);
 
+/**
+ * @brief Find an entry by name, from any number of threads at once
+ *
+ * @param tar is the archive to search, which isn't changed
+ * @param name is the name of the entry
+ * @param ent_ret returns the first entry called `name`, or `NULL`
+ *
+ * @return Returns `FTAR_OK`, `FTAR_E_NOENT` or `FTAR_E_INVAL`
+ *
+ * Unlike `ftar_find`, this doesn't allocate, format `name` or touch `errno`,
+ *  and archives from `ftar_load` look names up in a hash table instead of
+ *  comparing against every entry.
+ */
+extern enum ftar_result ftar_find_r(const struct ftar *tar, const char *name,
+				    const struct ftar_ent **ent_ret);
+
+/**
+ * @brief Copy part of an entry's payload, from any number of threads at once
+ *
+ * @param ent is the entry
+ * @param off is where in the payload to start
+ * @param buf is where to copy it
+ * @param len is the size of `buf`
+ * @param len_ret returns how much was copied, which is less than `len` at
+ *  the end of the payload
+ *
+ * @return Returns `FTAR_OK`, `FTAR_E_RANGE` if `off` is past the end,
+ *  `FTAR_E_NODATA` for entries of patched archives that haven't been through
+ *  `ftar_patched_data` (which isn't thread safe), or `FTAR_E_INVAL`
+ */
+extern enum ftar_result ftar_read_r(const struct ftar_ent *ent, size_t off,
+				    void *buf, size_t len, size_t *len_ret);
+
+/**
+ * @brief Calculate an entry's checksum without storing it in the entry
+ *
+ * @param ent is the entry
+ * @param sum_ret returns the checksum
+ *
+ * @return Returns `FTAR_OK` or `FTAR_E_INVAL`
+ */
+extern enum ftar_result ftar_checksum_r(const struct ftar_ent *ent,
+					long *sum_ret);
+
 /**
  * @brief Gets the checksum for a given entry.
  * 
@@ -75,6 +138,9 @@ extern void ftar_print_ent(struct ftar_ent *ent);
  * @brief Free a Frankentar structure
  *
  * @param tar is the Frankentar structure to free
+ *
+ * This frees the entries and their data as well, except for the data of
+ *  named links, which belongs to the entry they point to.
  */
 extern void ftar_free(struct ftar *tar);
 
@@ -0,0 +1,114 @@
+/**
+ * @file scan.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Reading whole archives from start to end, without the page cache
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * A scan reads the archive in big blocks with `O_DIRECT`, into two aligned
+ *  buffers. While the entries in one buffer are handed out, the next block is
+ *  read into the other one on a worker thread, so the disk never waits on the
+ *  caller and the caller only waits on the disk. Nothing goes through the
+ *  page cache, so scanning an archive much bigger than memory doesn't push
+ *  everything else out of it.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_SCAN_H
+#define FRANKENTAR_SCAN_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+
+/**
+ * @brief The default size of each of a scan's two buffers
+ */
+#define FTAR_SCAN_BUF_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief What direct I/O buffers, offsets and lengths are aligned to
+ */
+#define FTAR_SCAN_ALIGN 4096
+
+/**
+ * @brief Options for a scan, zero them for the defaults
+ */
+struct ftar_scan_opts {
+	size_t buf_size; /**< Size of each buffer (rounded up to `FTAR_SCAN_ALIGN`), 0 for `FTAR_SCAN_BUF_SIZE` */
+	bool cached; /**< Read through the page cache instead of with `O_DIRECT` */
+};
+
+/**
+ * @brief Called by `ftar_scan` with each piece of an entry's payload
+ *
+ * @param hdr is the entry's header as stored (`size` is the stored size)
+ * @param data is the next piece of the stored payload, which is only valid
+ *  until this returns
+ * @param len is the length of the piece, 0 (with `data` `NULL`) for the one
+ *  call made for an entry with no payload
+ * @param off is where the piece starts in the payload, the last piece ends
+ *  at `hdr->size`
+ * @param user is the pointer given to `ftar_scan`
+ *
+ * @return Returns 0 to carry on, or -1 (error) to stop the scan
+ */
+typedef int (*ftar_scan_fn)(const struct ftar_ent *hdr, const void *data,
+			    size_t len, uint64_t off, void *user);
+
+/**
+ * @brief Read every live entry of an archive in order
+ *
+ * @param archive is the path of the archive
+ * @param opts are the options to scan with, or `NULL` for the defaults
+ * @param fn is called with the payload of each entry, in pieces
+ * @param user is passed to `fn`
+ *
+ * @return Returns 0 or -1 (error), `EINVAL` if the archive is malformed
+ *
+ * Deleted entries are skipped over. If the file system can't do direct I/O,
+ *  the archive is read through the page cache instead, and the pages are
+ *  dropped again once they've been copied out.
+ */
+extern int ftar_scan(const char *archive, const struct ftar_scan_opts *opts,
+		     ftar_scan_fn fn, void *user);
+
+/**
+ * @brief Check that every entry of an archive can be read back
+ *
+ * @param archive is the path of the archive
+ * @param opts are the options to scan with, or `NULL` for the defaults
+ * @param bad_ret if not `NULL`, returns the header of the first entry that
+ *  failed, if it was an entry's fault
+ *
+ * @return Returns 0 or -1 (error), `EINVAL` if the archive is corrupt
+ *
+ * The archive is scanned with `ftar_scan`. Every payload is decompressed,
+ *  every header's checksum is checked against the real size, and every link
+ *  and manifest has to point at entries before it. Chunks that aren't in the
+ *  archive are assumed to come from the base of a delta pack, and deltas are
+ *  only checked as far as their headers. Nothing covers the payloads
+ *  themselves, so damage to one is only found if it stops it decoding.
+ */
+extern int ftar_verify(const char *archive, const struct ftar_scan_opts *opts,
+		       struct ftar_ent *bad_ret);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_SCAN_H */
@@ -0,0 +1,137 @@
+/**
+ * @file self.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Archives appended to executables, and loading the running one's
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * `ftar_attach` (or `ftar attach`) puts an archive on the end of a file,
+ *  starting on a `FTAR_SELF_ALIGN` boundary (or the archive's alignment, if
+ *  that's bigger), followed by a trailer saying where it is:
+ *
+ * | Offset | Size | Contents                       |
+ * |--------|------|--------------------------------|
+ * | 0      | 8    | Offset of the archive          |
+ * | 8      | 8    | Length of the archive          |
+ * | 16     | 8    | `FTAR_SELF_MAGIC`              |
+ *
+ * Loaders ignore anything past the end of what they map, so the program
+ *  still runs, and `ftar_open_self` finds the archive again by reading the
+ *  trailer. Nothing is extracted or copied: the archive is mapped where it
+ *  is and indexed, and payloads that aren't compressed are used right out
+ *  of the mapping.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_SELF_H
+#define FRANKENTAR_SELF_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "frankentar/index.h"
+
+/**
+ * @brief The magic at the very end of a file with an archive attached
+ */
+#define FTAR_SELF_MAGIC "FTARSELF"
+
+/**
+ * @brief The length of `FTAR_SELF_MAGIC`, which has no terminator
+ */
+#define FTAR_SELF_MAGIC_LEN 8
+
+/**
+ * @brief The size of the trailer after an attached archive
+ */
+#define FTAR_SELF_TRAILER_SIZE (16 + FTAR_SELF_MAGIC_LEN)
+
+/**
+ * @brief What attached archives start on, enough for any page size so they
+ *  can be mapped without the rest of the file
+ */
+#define FTAR_SELF_ALIGN 65536
+
+/**
+ * @brief An archive attached to a file, mapped where it is
+ */
+struct ftar_self {
+	int fd; /**< The file, which `idx` can be read from with the index functions */
+	struct ftar_index *idx; /**< The index, with offsets into the file */
+	uint64_t off; /**< Where the archive starts in the file */
+	const char *data; /**< The archive */
+	size_t len; /**< The length of the archive */
+	void *map; /**< The mapping `data` is in */
+	size_t map_len; /**< The length of the mapping */
+};
+
+/**
+ * @brief Append an archive to a file, replacing any that's already there
+ *
+ * @param path is the file, usually an executable
+ * @param archive is the archive
+ * @param len is its length
+ *
+ * @return Returns 0 or -1 (error)
+ *
+ * The file's mode is left alone, so executables stay executable.
+ */
+extern int ftar_attach(const char *path, const void *archive, size_t len);
+
+/**
+ * @brief Open the archive attached to a file
+ *
+ * @param path is the file
+ *
+ * @return Returns `NULL` (`ENOENT` if nothing is attached) or the archive
+ */
+extern struct ftar_self *ftar_open_attached(const char *path);
+
+/**
+ * @brief Open the archive attached to the running program
+ *
+ * @return Returns `NULL` or the archive, `ENOSYS` where there's no
+ *  `/proc/self/exe`
+ */
+extern struct ftar_self *ftar_open_self(void);
+
+/**
+ * @brief Get an entry's payload where it is in the mapping
+ *
+ * @param self is the archive
+ * @param ent is the entry, from `ftar_index_find(self->idx, ...)`
+ * @param len_ret returns the length of the payload or -1 (error)
+ *
+ * @return Returns `NULL` or the payload, which lasts as long as `self`.
+ *  Compressed payloads can't be used in place (`EINVAL`), those have to be
+ *  read with `ftar_index_read(self->fd, self->idx, ent, ...)`.
+ */
+extern const char *ftar_self_view(struct ftar_self *self,
+				  struct ftar_index_ent *ent, size_t *len_ret);
+
+/**
+ * @brief Close an attached archive
+ *
+ * @param self is the archive to close
+ */
+extern void ftar_self_close(struct ftar_self *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_SELF_H */
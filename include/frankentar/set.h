@@ -0,0 +1,213 @@
+/**
+ * @file set.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Archive sets, which split entries across many archives with one
+ *  index for all of them
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * A set is a manifest and a number of ordinary archives, its shards, named
+ *  after it (see `FTAR_SET_SHARD_FMT`). The manifest is:
+ *
+ *  magic | u32 shard count | u32 placement | u64 entry count |
+ *  u64 shard size ... | record ...
+ *
+ * with a 24 byte record per entry, sorted by name hash:
+ *
+ *  u64 name hash (`ftar_name_hash`) | u64 header offset | u32 shard | u32 0
+ *
+ * Finding a name is a binary search of the records in memory and then one
+ *  read of the header in the shard, to make sure it's the right one, so
+ *  nothing but that shard is touched and no shard has to be indexed first.
+ *  Shards are written, verified and indexed in parallel, and each one can
+ *  be used on its own like any other archive.
+ *
+ * Since an entry has to be readable from its header alone, shards don't
+ *  use dictionaries or chunks. Duplicates are only found within a shard.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_SET_H
+#define FRANKENTAR_SET_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "frankentar/index.h"
+#include "frankentar/pack.h"
+#include "frankentar/scan.h"
+
+/**
+ * @brief The magic at the start of a manifest
+ */
+#define FTAR_SET_MAGIC "FTARSET1"
+
+/**
+ * @brief The length of the magic
+ */
+#define FTAR_SET_MAGIC_LEN 8
+
+/**
+ * @brief The size of the manifest before the shard sizes
+ */
+#define FTAR_SET_HDR_SIZE (FTAR_SET_MAGIC_LEN + 2 * sizeof(uint32_t) + sizeof(uint64_t))
+
+/**
+ * @brief The size of each record in the manifest
+ */
+#define FTAR_SET_REC_SIZE 24
+
+/**
+ * @brief The most shards a set can have
+ */
+#define FTAR_SET_MAX_SHARDS 4096
+
+/**
+ * @brief How shards are named, from the manifest's path and the shard's
+ *  number (`data.set` has `data.set.0.ftar`, `data.set.1.ftar` and so on)
+ */
+#define FTAR_SET_SHARD_FMT "%s.%u.ftar"
+
+/**
+ * @brief How entries are spread across shards
+ */
+enum ftar_set_placement {
+	FTAR_SET_BY_HASH, /**< By the hash of their names, which is stable as files come and go */
+	FTAR_SET_BY_SIZE /**< Biggest first into whichever shard is smallest, so they come out even */
+};
+
+/**
+ * @brief An open set
+ */
+struct ftar_set;
+
+/**
+ * @brief Write a set of archives containing the given files
+ *
+ * @param manifest is the path of the manifest, the shards go next to it
+ * @param paths are the files to add
+ * @param count is the number of files
+ * @param shards is the number of shards, from 1 to `FTAR_SET_MAX_SHARDS`
+ * @param placement is how files are spread across them
+ * @param opts are the options to pack each shard with, or `NULL` for the
+ *  defaults (`threads` is shared between the shards being packed at once)
+ *
+ * @return Returns 0 or -1 (error, `EINVAL` with `dict_size` or `cdc`)
+ *
+ * The shards are packed on a thread pool and then indexed, and the manifest
+ *  is written once they're all done, so a set is never left with a
+ *  manifest that doesn't match its shards.
+ */
+extern int ftar_set_create(const char *manifest, const char *const *paths,
+			   size_t count, unsigned shards,
+			   enum ftar_set_placement placement,
+			   const struct ftar_pack_opts *opts);
+
+/**
+ * @brief Check that a set's shards can all be read back and match its
+ *  manifest
+ *
+ * @param manifest is the path of the manifest
+ * @param opts are the options to scan with, or `NULL` for the defaults
+ * @param bad_ret if not `NULL`, returns the header of the first entry that
+ *  failed, if it was an entry's fault
+ *
+ * @return Returns 0 or -1 (error), `EINVAL` if something is corrupt
+ *
+ * Each shard is checked with `ftar_verify` on a thread pool, and each of
+ *  its entries has to have the record that says where it is.
+ */
+extern int ftar_set_verify(const char *manifest,
+			   const struct ftar_scan_opts *opts,
+			   struct ftar_ent *bad_ret);
+
+/**
+ * @brief Open a set
+ *
+ * @param manifest is the path of the manifest
+ *
+ * @return Returns `NULL` or the set, `ESTALE` if a shard isn't the size the
+ *  manifest says (it was changed on its own)
+ */
+extern struct ftar_set *ftar_set_open(const char *manifest);
+
+/**
+ * @brief Check whether a file is the manifest of a set
+ *
+ * @param path is the file
+ *
+ * @return Returns whether it starts with `FTAR_SET_MAGIC`
+ */
+extern bool ftar_set_is_manifest(const char *path);
+
+/**
+ * @brief Find an entry, safe to call from any number of threads
+ *
+ * @param set is the set
+ * @param name is the name of the entry
+ * @param ent_ret returns the entry, with offsets into its shard
+ * @param shard_ret returns the shard it's in
+ *
+ * @return Returns 0 or -1 (error, `ENOENT` if there's no such entry)
+ */
+extern int ftar_set_find(struct ftar_set *set, const char *name,
+			 struct ftar_index_ent *ent_ret, unsigned *shard_ret);
+
+/**
+ * @brief Read the payload of an entry, safe to call from any number of
+ *  threads
+ *
+ * @param set is the set
+ * @param shard is the shard the entry is in
+ * @param ent is the entry, from `ftar_set_find`
+ * @param len_ret returns the length of the payload or -1 (error)
+ *
+ * @return Returns `NULL` or the payload
+ */
+extern char *ftar_set_read(struct ftar_set *set, unsigned shard,
+			   const struct ftar_index_ent *ent, size_t *len_ret);
+
+/**
+ * @brief Get the number of entries in a set
+ *
+ * @param set is the set
+ *
+ * @return Returns the count
+ */
+extern size_t ftar_set_count(struct ftar_set *set);
+
+/**
+ * @brief Get the number of shards in a set
+ *
+ * @param set is the set
+ *
+ * @return Returns the count
+ */
+extern unsigned ftar_set_shards(struct ftar_set *set);
+
+/**
+ * @brief Close a set
+ *
+ * @param set is the set to close
+ */
+extern void ftar_set_close(struct ftar_set *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_SET_H */
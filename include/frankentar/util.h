@@ -24,11 +24,24 @@ extern "C" {
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 
+#include "frankentar.h"
 #include "stb_sprintf.h"
 
+/**
+ * @brief What the `_r` functions return instead of setting `errno`
+ */
+enum ftar_result {
+	FTAR_OK = 0,
+	FTAR_E_INVAL, /**< An argument was wrong */
+	FTAR_E_NOENT, /**< There's no entry with that name */
+	FTAR_E_RANGE, /**< The offset is past the end of the payload */
+	FTAR_E_NODATA, /**< The payload hasn't been loaded yet */
+};
+
 /**
  * @brief Get the base name of `path` (entirely stolen from Stack Overflow)
  */
@@ -101,6 +114,67 @@ ftar_err_exit(int code, const char *msg, ...);
  */
 extern bool ftar_get_y_or_n(const char *message, ...);
 
+/**
+ * @brief Describe a result
+ *
+ * @param res is the result
+ *
+ * @return Returns a message, which is a string literal
+ */
+extern const char *ftar_result_str(enum ftar_result res);
+
+/**
+ * @brief Hash an entry name (FNV-1a)
+ *
+ * @param name is the name to hash
+ *
+ * @return Returns the hash
+ */
+extern size_t ftar_name_hash(const char *name);
+
+/**
+ * @brief Look a name up in an open addressing table of entries
+ *
+ * @param table is the table, which has `mask + 1` slots (a power of two)
+ * @param mask is the number of slots minus one
+ * @param name is the name to look for
+ *
+ * @return Returns the slot holding the first entry called `name`, or the
+ *  empty slot it would go in
+ */
+extern struct ftar_ent **ftar_name_slot(struct ftar_ent **table, size_t mask,
+					const char *name);
+
+/**
+ * @brief Fill out an archive header
+ *
+ * @param dst receives `FTAR_HDR_SIZE` bytes
+ * @param count is the number of entries
+ * @param align is the payload alignment (a power of two, 0 or 1 for none)
+ */
+extern void ftar_archive_hdr(void *dst, size_t count, size_t align);
+
+/**
+ * @brief Check an archive header and get its payload alignment
+ *
+ * @param hdr is the first `FTAR_HDR_SIZE` bytes of the archive
+ * @param align_ret returns the alignment (1 if there isn't any)
+ *
+ * @return Returns 0 or -1 (`EINVAL` if it isn't an archive header)
+ */
+extern int ftar_archive_align(const void *hdr, size_t *align_ret);
+
+/**
+ * @brief Get the number of zeros between an entry's header and its payload
+ *
+ * @param hdr_off is the offset of the entry's header in the archive
+ * @param stored is the stored size of its payload
+ * @param align is the archive's alignment
+ *
+ * @return Returns the amount of padding, which is 0 if there's no payload
+ */
+extern size_t ftar_payload_pad(uint64_t hdr_off, size_t stored, size_t align);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,148 @@
+/**
+ * @file watch.h
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Noticing when an archive changes on disk, and what changed in it
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * A watch keeps an index of an archive and uses inotify on its directory to
+ *  find out when it's written to or replaced. Only headers are ever read,
+ *  never payloads, and when entries were just appended (`ftar add` and
+ *  `ftar update`) only the new headers are, along with the ones they
+ *  replace. Anything else (a repack, `ftar delete`, `ftar compact`) means
+ *  indexing the headers again. Either way the entries are compared with the
+ *  old ones by name, and the callback is told about each one that was
+ *  added, removed or changed (a different size, checksum, or anything else
+ *  in its header).
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_WATCH_H
+#define FRANKENTAR_WATCH_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frankentar.h"
+#include "frankentar/index.h"
+
+/**
+ * @brief What happened to an entry
+ */
+enum ftar_watch_change {
+	FTAR_WATCH_ADDED, /**< There was no entry with its name */
+	FTAR_WATCH_CHANGED, /**< Its header is different, or it was replaced in place */
+	FTAR_WATCH_REMOVED /**< There's no entry with its name any more */
+};
+
+/**
+ * @brief An archive being watched
+ */
+struct ftar_watch;
+
+/**
+ * @brief Called for each entry that changed
+ *
+ * @param watch is the watch, whose index and archive are already the new
+ *  ones, so `ent` can be read with `ftar_index_read`
+ * @param change is what happened
+ * @param old is the entry as it was, or `NULL` if it was added
+ * @param ent is the entry as it is, or `NULL` if it was removed
+ * @param user is the pointer given to `ftar_watch_open`
+ *
+ * Both entries only last until the callback returns.
+ */
+typedef void (*ftar_watch_fn)(struct ftar_watch *watch,
+			      enum ftar_watch_change change,
+			      const struct ftar_index_ent *old,
+			      const struct ftar_index_ent *ent, void *user);
+
+/**
+ * @brief Start watching an archive
+ *
+ * @param archive is the path of the archive
+ * @param fn is the callback for changed entries
+ * @param user is passed to it
+ *
+ * @return Returns `NULL` or the watch, `ENOSYS` without inotify
+ */
+extern struct ftar_watch *ftar_watch_open(const char *archive,
+					  ftar_watch_fn fn, void *user);
+
+/**
+ * @brief Get the file descriptor to wait on for changes, for `poll` and
+ *  friends
+ *
+ * @param watch is the watch
+ *
+ * @return Returns the descriptor, which becomes readable when there might
+ *  be something for `ftar_watch_poll`
+ */
+extern int ftar_watch_fd(struct ftar_watch *watch);
+
+/**
+ * @brief Wait for the archive to change and call the callback for what did
+ *
+ * @param watch is the watch
+ * @param timeout is how long to wait in milliseconds, 0 to only check or
+ *  -1 to wait forever
+ *
+ * @return Returns the number of entries that changed, or -1 (error). If the
+ *  archive can't be read (say it's only half written), the watch stays on
+ *  the old version and tries again next time it changes.
+ */
+extern int ftar_watch_poll(struct ftar_watch *watch, int timeout);
+
+/**
+ * @brief Check the archive for changes right away, without waiting for
+ *  inotify
+ *
+ * @param watch is the watch
+ *
+ * @return Returns the number of entries that changed, or -1 (error)
+ */
+extern int ftar_watch_reload(struct ftar_watch *watch);
+
+/**
+ * @brief Get the current index of the archive
+ *
+ * @param watch is the watch
+ *
+ * @return Returns the index, which lasts until the archive changes
+ */
+extern struct ftar_index *ftar_watch_index(struct ftar_watch *watch);
+
+/**
+ * @brief Get the current archive, to read from with the index
+ *
+ * @param watch is the watch
+ *
+ * @return Returns the file descriptor of the archive
+ */
+extern int ftar_watch_archive(struct ftar_watch *watch);
+
+/**
+ * @brief Stop watching an archive
+ *
+ * @param watch is the watch to free
+ */
+extern void ftar_watch_free(struct ftar_watch *watch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FRANKENTAR_WATCH_H */
@@ -35,6 +35,11 @@ extern "C" {
  * 
  * @return Returns either `NULL` or a buffer containing the information of the
  *  entry in a form suitable for writing to a file
+ *
+ * If the entry's `codec` isn't `FTAR_CODEC_NONE`, its data is compressed
+ *  with that codec and the header's size is that of the compressed data.
+ *  `FTAR_CODEC_AUTO` only compresses entries that look like they'll
+ *  benefit, and an entry that doesn't shrink is stored as-is either way.
  */
 extern void *ftar_ent_to_raw(struct ftar_ent *ent, size_t *len_ret);
 
@@ -44,10 +49,66 @@ extern void *ftar_ent_to_raw(struct ftar_ent *ent, size_t *len_ret);
  * @param tar is the structure to convert
  * @param len_ret returns the length of the buffer or -1 (error)
  * 
- * @return Returns `NULL` or the buffer
+ * @return Returns `NULL` or the buffer, `ENOENT` if a chunked entry uses
+ *  chunks that aren't earlier in `tar`, like a delta pack loaded with
+ *  `ftar_load_base` (whose base chunks aren't copied in)
  */
 extern void *ftar_to_raw(struct ftar *tar, size_t *len_ret);
 
+/**
+ * @brief Make an empty archive to add entries to
+ *
+ * @param align is what payloads are aligned to when it's written (a power of
+ *  two, 0 or 1 for nothing)
+ *
+ * @return Returns `NULL` or the archive, which is freed with `ftar_free`
+ */
+extern struct ftar *ftar_new(size_t align);
+
+/**
+ * @brief Add an entry to the end of an archive
+ *
+ * @param tar is the archive, from `ftar_new` or `ftar_load`
+ * @param ent is the entry, which the archive takes (along with its data)
+ *
+ * @return Returns 0 or -1 (error, `ENOENT` for a link to nothing)
+ *
+ * Named links are given the data of the entry they point to, like when an
+ *  archive is loaded. The entries grow by doubling and the name table is
+ *  kept up to date as they change, so adding is O(1) on average.
+ */
+extern int ftar_add_entry(struct ftar *tar, struct ftar_ent *ent);
+
+/**
+ * @brief Replace the first entry with the same name as another
+ *
+ * @param tar is the archive
+ * @param ent is the new entry, which the archive takes
+ *
+ * @return Returns 0 or -1 (error, `ENOENT` if there's nothing to replace)
+ *
+ * The new entry takes the old one's place, and links to it share the new
+ *  data. The old one is freed.
+ */
+extern int ftar_replace_entry(struct ftar *tar, struct ftar_ent *ent);
+
+/**
+ * @brief Remove the first entry with a name
+ *
+ * @param tar is the archive
+ * @param name is the name of the entry
+ *
+ * @return Returns 0 or -1 (error, `ENOENT` if there's no such entry)
+ *
+ * The entry is freed. Links to it are kept working: the first one takes
+ *  over its data and the others are pointed at that one. The rest of the
+ *  entries keep their order, so this moves the ones after it back.
+ *
+ * None of these can be used on patched archives, or while other threads
+ *  are reading the archive.
+ */
+extern int ftar_remove_entry(struct ftar *tar, const char *name);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,336 @@
+/**
+ * @file frankentar_async.hpp
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Reading entries from C++20 coroutines
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * `co_await ar.read(name)` suspends the coroutine until the entry has been
+ *  read and gives back its payload, without tying up a thread while it
+ *  waits. The reads are done by `ftar_aio` (io_uring, or a few threads if
+ *  the kernel doesn't have it), driven by one thread calling `run`, so any
+ *  number of loads can be waiting at once:
+ *
+ * ```cpp
+ * frankentar::task load_mesh(frankentar::async_archive &ar)
+ * {
+ * 	frankentar::payload mesh = co_await ar.read("meshes/tree.bin");
+ * 	if (!mesh)
+ * 		co_return; // mesh.error() says why
+ * 	upload(mesh.bytes());
+ * }
+ *
+ * frankentar::async_archive ar("assets.ftar");
+ * load_mesh(ar);
+ * ar.run();
+ * ```
+ *
+ * Any coroutine type works. `task` is the simplest one, which starts right
+ *  away and cleans up after itself when it's done, with nothing to wait on.
+ *
+ * Without an executor, coroutines are resumed on the thread in `run` as soon
+ *  as their reads finish. With one, they're handed to it instead, and `run`
+ *  keeps going until `stop` is called. Nothing here throws.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_ASYNC_HPP
+#define FRANKENTAR_ASYNC_HPP 1
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "frankentar.h"
+#include "frankentar.hpp"
+#include "frankentar/aio.h"
+#include "frankentar/index.h"
+
+namespace frankentar
+{
+
+/**
+ * @brief A coroutine that runs on its own, for starting loads and forgetting
+ *  about them
+ *
+ * It runs until its first `co_await` as soon as it's called, and frees
+ *  itself once it returns. There's no result, so anything it loads has to
+ *  be handed off by the coroutine itself.
+ */
+struct task {
+	struct promise_type {
+		task get_return_object() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void() noexcept
+		{
+		}
+
+		void unhandled_exception() noexcept
+		{
+			std::terminate();
+		}
+	};
+};
+
+/**
+ * @brief An archive whose entries are read by awaiting them
+ */
+class async_archive {
+    public:
+	/**
+	 * @brief Something that resumes coroutines, like a thread pool's
+	 *  `post`. It's called on the thread in `run`.
+	 */
+	using executor = std::function<void(std::coroutine_handle<>)>;
+
+	/**
+	 * @brief What `read` gives back to be awaited
+	 */
+	class read_op {
+	    public:
+		bool await_ready() const noexcept
+		{
+			return !m_ent;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			m_handle = handle;
+			m_ar->submit(this);
+		}
+
+		payload await_resume() noexcept
+		{
+			return std::move(m_result);
+		}
+
+	    private:
+		friend class async_archive;
+
+		read_op(async_archive *ar, ftar_index_ent *ent, int err) noexcept
+			: m_ar(ar), m_ent(ent), m_result(nullptr, 0, err)
+		{
+		}
+
+		async_archive *m_ar;
+		ftar_index_ent *m_ent;
+		std::coroutine_handle<> m_handle;
+		payload m_result;
+	};
+
+	/**
+	 * @brief Open an archive to read from
+	 *
+	 * @param path is the path of the archive
+	 * @param opts are the options for `ftar_aio_create`, or `nullptr` for
+	 *  the defaults
+	 * @param ex is what to resume coroutines with, or empty to resume them
+	 *  on the thread in `run`
+	 *
+	 * Check `error` to see whether it worked.
+	 */
+	explicit async_archive(const char *path,
+			       const ftar_aio_opts *opts = nullptr,
+			       executor ex = {})
+		: m_ex(std::move(ex))
+	{
+		m_fd = ::open(path, O_RDONLY);
+		if (m_fd < 0) {
+			m_err = errno;
+			return;
+		}
+		m_idx = ftar_index_fd(m_fd);
+		if (!m_idx) {
+			m_err = errno;
+			return;
+		}
+		m_aio = ftar_aio_create(m_fd, m_idx, opts);
+		if (!m_aio)
+			m_err = errno;
+	}
+
+	async_archive(const async_archive &) = delete;
+	async_archive &operator=(const async_archive &) = delete;
+
+	/**
+	 * @brief Close the archive, which mustn't have reads outstanding
+	 */
+	~async_archive()
+	{
+		ftar_aio_free(m_aio);
+		ftar_index_free(m_idx);
+		if (m_fd >= 0)
+			::close(m_fd);
+	}
+
+	/**
+	 * @brief Get the error opening the archive failed with, if it did
+	 */
+	std::error_code error() const noexcept
+	{
+		return std::error_code(m_err, std::generic_category());
+	}
+
+	/**
+	 * @brief Get the archive's index
+	 */
+	const ftar_index *index() const noexcept
+	{
+		return m_idx;
+	}
+
+	/**
+	 * @brief Read an entry, safe to call from any thread
+	 *
+	 * @param name is the name of the entry
+	 *
+	 * @return Returns something to `co_await` for the payload. Missing
+	 *  entries (`ENOENT`) and names that are too long (`ENAMETOOLONG`)
+	 *  fail right away, without suspending.
+	 */
+	read_op read(std::string_view name) noexcept
+	{
+		char buf[sizeof(ftar_ent::name)];
+		ftar_index_ent *ent;
+
+		if (m_err)
+			return read_op(this, nullptr, m_err);
+		if (name.size() >= sizeof(buf))
+			return read_op(this, nullptr, ENAMETOOLONG);
+		std::memcpy(buf, name.data(), name.size());
+		buf[name.size()] = 0;
+		ent = ftar_index_find(m_idx, buf);
+		if (!ent)
+			return read_op(this, nullptr, ENOENT);
+
+		return read_op(this, ent, 0);
+	}
+
+	/**
+	 * @brief Do reads and resume whoever's waiting on them
+	 *
+	 * Returns once nothing is waiting on a read, or with an executor, once
+	 *  `stop` is called, since coroutines it resumes can start more reads at
+	 *  any point. Only one thread should be in here at a time.
+	 */
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		std::vector<read_op *> ops;
+		bool busy;
+
+		m_stop = false;
+		busy = false;
+		while (!m_stop && (m_outstanding || m_ex)) {
+			if (m_submitted.empty() && !busy) {
+				m_cond.wait(lock);
+				continue;
+			}
+			ops.swap(m_submitted);
+			lock.unlock();
+
+			// New reads join the ones still in flight straight away
+			for (read_op *op : ops) {
+				if (ftar_aio_read(m_aio, op->m_ent, on_read,
+						  op) < 0)
+					finish(op, payload(nullptr, 0, errno));
+			}
+			ops.clear();
+
+			// One round, so reads started by the coroutines it
+			// resumes don't wait for the slowest of this batch.
+			// Reads that couldn't go out are still queued.
+			busy = ftar_aio_step(m_aio) != 0;
+
+			lock.lock();
+		}
+	}
+
+	/**
+	 * @brief Make `run` return, safe to call from any thread
+	 */
+	void stop()
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		m_stop = true;
+		m_cond.notify_all();
+	}
+
+    private:
+	void submit(read_op *op)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		m_submitted.push_back(op);
+		m_outstanding++;
+		m_cond.notify_all();
+	}
+
+	void finish(read_op *op, payload result)
+	{
+		op->m_result = std::move(result);
+		if (m_ex)
+			m_ex(op->m_handle);
+		else
+			op->m_handle.resume();
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_outstanding--;
+	}
+
+	static void on_read(ftar_index_ent *, char *data, std::size_t len,
+			    int err, void *user)
+	{
+		read_op *op = static_cast<read_op *>(user);
+
+		op->m_ar->finish(op, payload(data, len, err));
+	}
+
+	int m_fd = -1;
+	ftar_index *m_idx = nullptr;
+	ftar_aio *m_aio = nullptr;
+	int m_err = 0;
+	executor m_ex;
+
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	std::vector<read_op *> m_submitted;
+	std::size_t m_outstanding = 0;
+	bool m_stop = false;
+};
+
+} // namespace frankentar
+
+#endif /* !FRANKENTAR_ASYNC_HPP */
@@ -0,0 +1,97 @@
+/**
+ * @file frankentar_embed.hpp
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Finding files embedded in a program by `ftar embed`
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Headers made by `ftar embed` (see frankentar/embed.h) include this, and
+ *  give each namespace they fill a `find` that can be used in constant
+ *  expressions:
+ *
+ * ```cpp
+ * #include "shaders.hpp" // ftar embed shaders.hpp shaders/x.spv ...
+ *
+ * constexpr const frankentar::embedded_file *x =
+ * 	frankentar::embedded::find("shaders/x.spv");
+ * static_assert(x, "the shader is missing");
+ * upload(x->bytes());
+ * ```
+ *
+ * This only needs the standard library, so it can go in programs that don't
+ *  link the rest of Frankentar.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_EMBED_HPP
+#define FRANKENTAR_EMBED_HPP 1
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace frankentar
+{
+
+/**
+ * @brief A file embedded in the program
+ */
+struct embedded_file {
+	std::string_view name;
+	std::string_view data; /**< The contents, which are followed by a 0 */
+	long mtime;
+	short mode;
+
+	std::span<const std::byte> bytes() const noexcept
+	{
+		return { reinterpret_cast<const std::byte *>(data.data()),
+			 data.size() };
+	}
+};
+
+/**
+ * @brief Hash a name with a seed (FNV-1a, like `ftar_embed_hash`)
+ */
+constexpr std::uint64_t embed_hash(std::string_view name,
+				   std::uint32_t seed) noexcept
+{
+	std::uint64_t h;
+
+	h = 14695981039346656037ull ^ seed;
+	for (char c : name) {
+		h ^= static_cast<unsigned char>(c);
+		h *= 1099511628211ull;
+	}
+	return h ^ (h >> 29);
+}
+
+/**
+ * @brief Look a name up in an embedded file table
+ *
+ * @param files are the files, in the slots the table puts them in
+ * @param seeds are the seeds of each bucket
+ * @param name is the name to look for
+ *
+ * @return Returns the file or `nullptr`
+ */
+template <std::size_t N>
+constexpr const embedded_file *embed_find(const embedded_file (&files)[N],
+					  const std::uint32_t (&seeds)[N],
+					  std::string_view name) noexcept
+{
+	const embedded_file *file;
+
+	file = &files[embed_hash(name, seeds[embed_hash(name, 0) % N]) % N];
+	return file->name == name ? file : nullptr;
+}
+
+} // namespace frankentar
+
+#endif /* !FRANKENTAR_EMBED_HPP */
@@ -0,0 +1,177 @@
+/**
+ * @file frankentar_loader.hpp
+ * @author MobSlicer152 (brambleclaw1414@gmail.com)
+ * @brief Getting entries from a loader as `std::future`s
+ *
+ * @copyright Copyright (c) MobSlicer152 2021
+ * This software is provided 'as-is', without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * `loader` wraps `ftar_loader` so each request gives back a
+ *  `std::future<payload>`, which is ready once the loader's threads have
+ *  read the entry:
+ *
+ * ```cpp
+ * frankentar::loader ld("assets.ftar");
+ * std::future<frankentar::payload> music = ld.request("music/title.ogg");
+ * std::future<frankentar::payload> mesh = ld.request("meshes/tree.bin", 10);
+ * frankentar::payload data = mesh.get(); // Read first, it's more important
+ * ```
+ *
+ * The handles are freed as soon as the requests finish, so there's nothing
+ *  to clean up besides the futures. Nothing here throws.
+ */
+
+#pragma once
+
+#ifndef FRANKENTAR_LOADER_HPP
+#define FRANKENTAR_LOADER_HPP 1
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+
+#include "frankentar.h"
+#include "frankentar.hpp"
+#include "frankentar/loader.h"
+
+namespace frankentar
+{
+
+/**
+ * @brief A loader whose requests are waited on as futures
+ */
+class loader {
+    public:
+	/**
+	 * @brief Start loading from an archive
+	 *
+	 * @param path is the path of the archive
+	 * @param opts are the options for `ftar_loader_open`, or `nullptr`
+	 *  for the defaults
+	 *
+	 * Check `error` to see whether it worked.
+	 */
+	explicit loader(const char *path,
+			const ftar_loader_opts *opts = nullptr)
+	{
+		m_loader = ftar_loader_open(path, opts);
+		if (!m_loader)
+			m_err = errno;
+	}
+
+	loader(const loader &) = delete;
+	loader &operator=(const loader &) = delete;
+
+	/**
+	 * @brief Stop the loader, after the requests that are left finish
+	 */
+	~loader()
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+
+		m_cond.wait(lock, [this] { return !m_outstanding; });
+		lock.unlock();
+		ftar_loader_free(m_loader);
+	}
+
+	/**
+	 * @brief Get the error starting the loader failed with, if it did
+	 */
+	std::error_code error() const noexcept
+	{
+		return std::error_code(m_err, std::generic_category());
+	}
+
+	/**
+	 * @brief Ask for an entry, safe to call from any thread
+	 *
+	 * @param name is the name of the entry
+	 * @param priority is how important it is, higher goes first
+	 * @param deadline is the time (see `ftar_loader_now`) after which it
+	 *  isn't worth starting, or 0 for none
+	 *
+	 * @return Returns a future for the payload. Missing entries (`ENOENT`)
+	 *  and names that are too long (`ENAMETOOLONG`) are ready right away.
+	 */
+	std::future<payload> request(std::string_view name, int priority = 0,
+				     std::uint64_t deadline = 0)
+	{
+		char buf[sizeof(ftar_ent::name)];
+		std::future<payload> result;
+		pending *p;
+		int err;
+
+		p = new pending{ this, {} };
+		result = p->promise.get_future();
+		err = m_err;
+		if (!err && name.size() >= sizeof(buf))
+			err = ENAMETOOLONG;
+		if (err) {
+			p->promise.set_value(payload(nullptr, 0, err));
+			delete p;
+			return result;
+		}
+		std::memcpy(buf, name.data(), name.size());
+		buf[name.size()] = 0;
+
+		// Counted first, since it might finish before this returns
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_outstanding++;
+		}
+		if (!ftar_loader_request(m_loader, buf, priority, deadline,
+					 on_load, p)) {
+			p->promise.set_value(payload(nullptr, 0, errno));
+			delete p;
+			finish();
+		}
+
+		return result;
+	}
+
+    private:
+	struct pending {
+		loader *owner;
+		std::promise<payload> promise;
+	};
+
+	void finish()
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		m_outstanding--;
+		m_cond.notify_all();
+	}
+
+	static void on_load(struct ftar_load *load, char *data,
+			    std::size_t len, int err, void *user)
+	{
+		pending *p = static_cast<pending *>(user);
+		loader *owner = p->owner;
+
+		ftar_load_free(load);
+		p->promise.set_value(payload(data, len, err));
+		delete p;
+		owner->finish();
+	}
+
+	ftar_loader *m_loader = nullptr;
+	int m_err = 0;
+
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	std::size_t m_outstanding = 0;
+};
+
+} // namespace frankentar
+
+#endif /* !FRANKENTAR_LOADER_HPP */
@@ -0,0 +1,976 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "frankentar/aio.h"
+#include "frankentar/chunk.h"
+#include "frankentar/compress.h"
+#include "frankentar/pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pieces in one vectored read */
+#ifdef IOV_MAX
+#define AIO_IOV_MAX IOV_MAX
+#else
+#define AIO_IOV_MAX 1024
+#endif
+
+/* One read of a stored payload */
+struct aio_req {
+	struct ftar_aio *aio;
+	struct ftar_index_ent *ent; /* The entry being read */
+	struct ftar_index_ent *orig; /* What the callback gets, before links */
+	ftar_aio_fn fn;
+	void *user;
+	char *buf;
+	size_t done;
+	int err;
+
+	/* Chunks of a chunked entry point back at it */
+	struct aio_req *parent;
+	size_t index;
+
+	/* A chunked entry collects its chunks */
+	char **parts;
+	size_t *part_lens;
+	size_t part_count;
+	size_t pending;
+	uint64_t raw_size;
+
+	struct aio_req *next;
+};
+
+/* One read from the archive, covering the payloads of one or more requests */
+struct aio_op {
+	struct ftar_aio *aio;
+	struct iovec *iov;
+	struct aio_req **reqs; /* Who each piece of `iov` is for, `NULL` for gaps */
+	int count; /* The number of pieces */
+	uint64_t off;
+	size_t len;
+	size_t done;
+	int err;
+	struct aio_op *next;
+};
+
+#ifdef __linux__
+struct aio_uring {
+	int fd;
+	bool fixed; /* Whether the archive is registered */
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned unsubmitted; /* Queued on the ring but not taken by the kernel */
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+};
+#endif
+
+struct ftar_aio {
+	int fd;
+	struct ftar_index *idx;
+	unsigned depth;
+	unsigned inflight; /* Operations, not requests */
+	struct aio_req *head; /* Reads waiting to go out */
+	struct aio_req *tail;
+	bool sorted; /* Whether the queue is in offset order */
+	size_t gap;
+	size_t max_merge;
+	char *gap_buf; /* Where the bytes between merged payloads go */
+
+	/* The last dictionary used */
+	struct ftar_index_ent *dict_ent;
+	char *dict;
+	size_t dict_len;
+
+#ifdef __linux__
+	bool uring;
+	struct aio_uring ring;
+#endif
+
+	/* The fallback, finished reads are passed back through `done` */
+	struct ftar_pool *pool;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct aio_op *done;
+};
+
+static void aio_push(struct ftar_aio *aio, struct aio_req *req)
+{
+	req->next = NULL;
+	if (aio->tail)
+		aio->tail->next = req;
+	else
+		aio->head = req;
+	aio->tail = req;
+	aio->sorted = false;
+}
+
+static struct aio_req *aio_pop(struct ftar_aio *aio)
+{
+	struct aio_req *req;
+
+	req = aio->head;
+	aio->head = req->next;
+	if (!aio->head)
+		aio->tail = NULL;
+	return req;
+}
+
+static void aio_req_free(struct aio_req *req)
+{
+	size_t i;
+
+	if (req->parts) {
+		for (i = 0; i < req->part_count; i++)
+			free(req->parts[i]);
+	}
+	free(req->parts);
+	free(req->part_lens);
+	free(req->buf);
+	free(req);
+}
+
+/* Free a read without finishing it, along with its entry if it's a chunk */
+static void aio_drop(struct aio_req *req)
+{
+	struct aio_req *parent;
+
+	parent = req->parent;
+	aio_req_free(req);
+	if (parent && !--parent->pending)
+		aio_req_free(parent);
+}
+
+/* Set up a read of an entry's stored payload */
+static struct aio_req *aio_req_new(struct ftar_aio *aio,
+				   struct ftar_index_ent *ent)
+{
+	struct aio_req *req;
+
+	req = calloc(1, sizeof(struct aio_req));
+	if (!req)
+		return NULL;
+	req->aio = aio;
+	req->ent = ent;
+	req->orig = ent;
+	req->buf = malloc(ent->hdr.size ? ent->hdr.size : 1);
+	if (!req->buf) {
+		free(req);
+		return NULL;
+	}
+
+	return req;
+}
+
+/* Where the rest of a request's payload starts */
+static uint64_t aio_start(const struct aio_req *req)
+{
+	return req->ent->data_off + req->done;
+}
+
+static size_t aio_left(const struct aio_req *req)
+{
+	return req->ent->hdr.size - req->done;
+}
+
+static int aio_cmp(const void *a, const void *b)
+{
+	uint64_t x;
+	uint64_t y;
+
+	x = aio_start(*(struct aio_req *const *)a);
+	y = aio_start(*(struct aio_req *const *)b);
+	return x < y ? -1 : x > y;
+}
+
+/* Put the queue in the order the payloads are in the archive */
+static int aio_sort(struct ftar_aio *aio)
+{
+	struct aio_req **reqs;
+	struct aio_req *req;
+	size_t count;
+	size_t i;
+
+	if (aio->sorted || !aio->head)
+		return 0;
+
+	count = 0;
+	for (req = aio->head; req; req = req->next)
+		count++;
+	reqs = malloc(count * sizeof(struct aio_req *));
+	if (!reqs)
+		return -1;
+	for (i = 0, req = aio->head; req; req = req->next)
+		reqs[i++] = req;
+	qsort(reqs, count, sizeof(struct aio_req *), aio_cmp);
+	aio->head = NULL;
+	aio->tail = NULL;
+	for (i = 0; i < count; i++)
+		aio_push(aio, reqs[i]);
+	free(reqs);
+	aio->sorted = true;
+
+	return 0;
+}
+
+/*
+ * Take the next read off the queue, along with any after it whose payloads
+ *  are close enough to read in the same go
+ */
+static struct aio_op *aio_op_next(struct ftar_aio *aio)
+{
+	struct aio_req *last;
+	struct aio_req *req;
+	struct aio_op *op;
+	uint64_t start;
+	uint64_t end;
+	int count;
+	int i;
+
+	start = aio_start(aio->head);
+	end = start + aio_left(aio->head);
+	last = aio->head;
+	count = 1;
+	for (req = last->next; req && count + 2 <= AIO_IOV_MAX;
+	     req = req->next) {
+		if (aio_start(req) < end || aio_start(req) - end > aio->gap ||
+		    aio_start(req) + aio_left(req) - start > aio->max_merge)
+			break;
+		count += aio_start(req) > end ? 2 : 1;
+		end = aio_start(req) + aio_left(req);
+		last = req;
+	}
+
+	op = calloc(1, sizeof(struct aio_op));
+	if (!op)
+		return NULL;
+	op->iov = calloc(count, sizeof(struct iovec));
+	op->reqs = calloc(count, sizeof(struct aio_req *));
+	if (!op->iov || !op->reqs) {
+		free(op->iov);
+		free(op->reqs);
+		free(op);
+		return NULL;
+	}
+	op->aio = aio;
+	op->off = start;
+	op->len = end - start;
+
+	/* The reads are scattered straight into each request's buffer */
+	end = start;
+	i = 0;
+	do {
+		req = aio_pop(aio);
+		if (aio_start(req) > end) {
+			op->iov[i].iov_base = aio->gap_buf;
+			op->iov[i].iov_len = aio_start(req) - end;
+			i++;
+		}
+		op->iov[i].iov_base = req->buf + req->done;
+		op->iov[i].iov_len = aio_left(req);
+		op->reqs[i] = req;
+		i++;
+		end = aio_start(req) + aio_left(req);
+	} while (req != last);
+	op->count = i;
+
+	return op;
+}
+
+static void aio_op_free(struct aio_op *op)
+{
+	free(op->iov);
+	free(op->reqs);
+	free(op);
+}
+
+#ifdef __linux__
+static int uring_setup(struct aio_uring *ring, unsigned depth, int fd)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(struct aio_uring));
+	memset(&p, 0, sizeof(struct io_uring_params));
+	ring->fd = syscall(__NR_io_uring_setup, depth, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	/* Map the rings, which newer kernels put in one mapping */
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = 0;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		ring->sq_ptr = NULL;
+		return -1;
+	}
+	ring->cq_ptr = ring->sq_ptr;
+	if (ring->cq_len) {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd,
+				    IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			ring->cq_ptr = NULL;
+			return -1;
+		}
+	}
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		return -1;
+	}
+
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+	ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr +
+					     p.cq_off.cqes);
+
+	/* A fixed file saves a lookup per read, but isn't required */
+	ring->fixed = syscall(__NR_io_uring_register, ring->fd,
+			      IORING_REGISTER_FILES, &fd, 1) == 0;
+
+	return 0;
+}
+
+static void uring_free(struct aio_uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr)
+		munmap(ring->sq_ptr, ring->sq_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+}
+
+/* Put as many queued reads on the ring as there's room for */
+static int uring_queue(struct ftar_aio *aio)
+{
+	struct io_uring_sqe *sqe;
+	struct aio_op *op;
+	unsigned tail;
+	unsigned i;
+	int err;
+
+	err = 0;
+	tail = *aio->ring.sq_tail;
+	while (aio->head && aio->inflight < aio->depth) {
+		op = aio_op_next(aio);
+		if (!op) {
+			err = -1;
+			break;
+		}
+
+		i = tail & *aio->ring.sq_mask;
+		sqe = &aio->ring.sqes[i];
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = IORING_OP_READV;
+		if (aio->ring.fixed) {
+			sqe->fd = 0;
+			sqe->flags = IOSQE_FIXED_FILE;
+		} else {
+			sqe->fd = aio->fd;
+		}
+		sqe->addr = (uintptr_t)op->iov;
+		sqe->len = op->count;
+		sqe->off = op->off;
+		sqe->user_data = (uintptr_t)op;
+		aio->ring.sq_array[i] = i;
+		tail++;
+		aio->ring.unsubmitted++;
+		aio->inflight++;
+	}
+	__atomic_store_n(aio->ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+	return err;
+}
+
+/* Submit what's been queued and wait for at least one read to finish */
+static int uring_enter(struct ftar_aio *aio)
+{
+	int ret;
+
+	if (uring_queue(aio) < 0 && !aio->inflight)
+		return -1;
+	do {
+		ret = syscall(__NR_io_uring_enter, aio->ring.fd,
+			      aio->ring.unsubmitted, aio->inflight ? 1 : 0,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+	aio->ring.unsubmitted -= ret;
+
+	return 0;
+}
+
+/* Take the finished reads off the ring */
+static struct aio_op *uring_reap(struct ftar_aio *aio)
+{
+	struct io_uring_cqe *cqe;
+	struct aio_op *list;
+	struct aio_op *op;
+	unsigned head;
+	unsigned tail;
+
+	list = NULL;
+	head = *aio->ring.cq_head;
+	tail = __atomic_load_n(aio->ring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &aio->ring.cqes[head & *aio->ring.cq_mask];
+		op = (struct aio_op *)(uintptr_t)cqe->user_data;
+		if (cqe->res < 0)
+			op->err = -cqe->res;
+		else
+			op->done = cqe->res;
+		op->next = list;
+		list = op;
+		aio->inflight--;
+	}
+	__atomic_store_n(aio->ring.cq_head, head, __ATOMIC_RELEASE);
+
+	return list;
+}
+#endif
+
+/* Do a read on a pool thread, then hand it back */
+static void aio_pread_run(void *arg)
+{
+	struct ftar_aio *aio;
+	struct aio_op *op;
+	ssize_t n;
+
+	op = arg;
+	aio = op->aio;
+	do {
+		n = preadv(aio->fd, op->iov, op->count, op->off);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		op->err = errno;
+	else
+		op->done = n;
+
+	pthread_mutex_lock(&aio->lock);
+	op->next = aio->done;
+	aio->done = op;
+	pthread_cond_signal(&aio->cond);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+/* Hand queued reads to the pool and wait for at least one to finish */
+static struct aio_op *aio_pool_wait(struct ftar_aio *aio)
+{
+	struct aio_op *list;
+	struct aio_op *op;
+
+	while (aio->head && aio->inflight < aio->depth) {
+		op = aio_op_next(aio);
+		if (!op)
+			break;
+		if (ftar_pool_submit(aio->pool, aio_pread_run, op) < 0) {
+			op->err = errno;
+			op->next = NULL;
+			return op;
+		}
+		aio->inflight++;
+	}
+	if (!aio->inflight)
+		return NULL;
+
+	pthread_mutex_lock(&aio->lock);
+	while (!aio->done)
+		pthread_cond_wait(&aio->cond, &aio->lock);
+	list = aio->done;
+	aio->done = NULL;
+	pthread_mutex_unlock(&aio->lock);
+	for (op = list; op; op = op->next)
+		aio->inflight--;
+
+	return list;
+}
+
+/* Call a read's callback and get rid of it */
+static void aio_finish(struct aio_req *req, char *data, size_t len, int err)
+{
+	if (err) {
+		free(data);
+		data = NULL;
+		len = -1;
+	}
+	req->fn(req->orig, data, len, err, req->user);
+	aio_req_free(req);
+}
+
+/* Get the dictionary an entry was compressed against */
+static int aio_dict(struct ftar_aio *aio, struct ftar_index_ent *ent)
+{
+	struct ftar_index_ent *dict;
+
+	dict = ftar_index_dict(aio->idx, ent);
+	if (!dict)
+		return -1;
+	if (dict == aio->dict_ent)
+		return 0;
+
+	/* It's small and shared by lots of entries, so it's read right away */
+	free(aio->dict);
+	aio->dict_ent = NULL;
+	aio->dict = ftar_index_read(aio->fd, aio->idx, dict, &aio->dict_len);
+	if (!aio->dict)
+		return -1;
+	aio->dict_ent = dict;
+
+	return 0;
+}
+
+/* Put a chunked payload back together once all of its chunks are in */
+static void aio_assemble(struct aio_req *req)
+{
+	uint64_t off;
+	char *data;
+	size_t i;
+
+	if (req->err) {
+		aio_finish(req, NULL, 0, req->err);
+		return;
+	}
+
+	off = 0;
+	for (i = 0; i < req->part_count; i++)
+		off += req->part_lens[i];
+	if (off != req->raw_size) {
+		aio_finish(req, NULL, 0, EINVAL);
+		return;
+	}
+	data = malloc(req->raw_size ? req->raw_size : 1);
+	if (!data) {
+		aio_finish(req, NULL, 0, errno);
+		return;
+	}
+	off = 0;
+	for (i = 0; i < req->part_count; i++) {
+		memcpy(data + off, req->parts[i], req->part_lens[i]);
+		off += req->part_lens[i];
+	}
+	aio_finish(req, data, req->raw_size, 0);
+}
+
+/* Queue reads of the chunks in a manifest */
+static int aio_chunks(struct ftar_aio *aio, struct aio_req *req)
+{
+	char name[FTAR_HASH_SIZE * 2 + 1];
+	struct ftar_index_ent *chunk;
+	struct aio_req *part;
+	size_t len;
+	uint32_t count;
+	size_t i;
+
+	len = req->ent->hdr.size;
+	if (len < FTAR_MANIFEST_HDR_SIZE)
+		goto bad;
+	memcpy(&req->raw_size, req->buf, sizeof(uint64_t));
+	memcpy(&count, req->buf + sizeof(uint64_t), sizeof(uint32_t));
+	if ((len - FTAR_MANIFEST_HDR_SIZE) % FTAR_HASH_SIZE ||
+	    (len - FTAR_MANIFEST_HDR_SIZE) / FTAR_HASH_SIZE != count)
+		goto bad;
+
+	req->parts = calloc(count ? count : 1, sizeof(char *));
+	req->part_lens = calloc(count ? count : 1, sizeof(size_t));
+	if (!req->parts || !req->part_lens)
+		return -1;
+	req->part_count = count;
+
+	/* Check they're all here before reading any */
+	for (i = 0; i < count; i++) {
+		ftar_chunk_name((const uint8_t *)req->buf +
+					FTAR_MANIFEST_HDR_SIZE +
+					i * FTAR_HASH_SIZE,
+				name);
+		chunk = ftar_index_find(aio->idx, name);
+		if (!chunk || chunk->hdr.type != FTAR_FTYPE_CHUNK) {
+			errno = ENOENT;
+			return -1;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		ftar_chunk_name((const uint8_t *)req->buf +
+					FTAR_MANIFEST_HDR_SIZE +
+					i * FTAR_HASH_SIZE,
+				name);
+		part = aio_req_new(aio, ftar_index_find(aio->idx, name));
+		if (!part) {
+			/* The ones already queued still report back */
+			req->err = errno;
+			if (!req->pending)
+				return -1;
+			break;
+		}
+		part->parent = req;
+		part->index = i;
+		req->pending++;
+		aio_push(aio, part);
+	}
+	if (!count)
+		aio_assemble(req);
+
+	return 0;
+bad:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Decode a chunk, passing it to the entry it's part of */
+static void aio_chunk_done(struct aio_req *req)
+{
+	struct aio_req *parent;
+	size_t len;
+	char *data;
+
+	parent = req->parent;
+	data = NULL;
+	len = 0;
+	if (req->err) {
+		parent->err = req->err;
+	} else if (req->ent->hdr.codec == FTAR_CODEC_NONE) {
+		data = req->buf;
+		len = req->ent->hdr.size;
+		req->buf = NULL;
+	} else {
+		data = ftar_decompress(req->buf, req->ent->hdr.size, NULL, 0,
+				       &len);
+		if (!data)
+			parent->err = errno;
+	}
+	parent->parts[req->index] = data;
+	parent->part_lens[req->index] = data ? len : 0;
+	aio_req_free(req);
+
+	if (!--parent->pending)
+		aio_assemble(parent);
+}
+
+/* Deal with a finished read */
+static void aio_complete(struct ftar_aio *aio, struct aio_req *req)
+{
+	size_t len;
+	char *data;
+
+	/* Reads can come up short, the rest is read again */
+	if (!req->err && req->done < req->ent->hdr.size) {
+		aio_push(aio, req);
+		return;
+	}
+	if (req->parent) {
+		aio_chunk_done(req);
+		return;
+	}
+	if (req->err) {
+		aio_finish(req, NULL, 0, req->err);
+		return;
+	}
+
+	switch (req->ent->hdr.codec) {
+	case FTAR_CODEC_NONE:
+		data = req->buf;
+		req->buf = NULL;
+		aio_finish(req, data, req->ent->hdr.size, 0);
+		break;
+	case FTAR_CODEC_LZ:
+		data = ftar_decompress(req->buf, req->ent->hdr.size, NULL, 0,
+				       &len);
+		aio_finish(req, data, len, data ? 0 : errno);
+		break;
+	case FTAR_CODEC_LZ_DICT:
+		if (aio_dict(aio, req->ent) < 0) {
+			aio_finish(req, NULL, 0, errno);
+			break;
+		}
+		data = ftar_decompress(req->buf, req->ent->hdr.size, aio->dict,
+				       aio->dict_len, &len);
+		aio_finish(req, data, len, data ? 0 : errno);
+		break;
+	case FTAR_CODEC_CHUNKED:
+		if (aio_chunks(aio, req) < 0)
+			aio_finish(req, NULL, 0, errno);
+		break;
+	default:
+		aio_finish(req, NULL, 0, EINVAL);
+		break;
+	}
+}
+
+/* Hand out what an operation read to its requests */
+static void aio_op_done(struct ftar_aio *aio, struct aio_op *op)
+{
+	struct aio_req *req;
+	size_t left;
+	size_t n;
+	int i;
+
+	/* Nothing at all means the archive's been cut short */
+	if (!op->err && !op->done && op->len)
+		op->err = EINVAL;
+
+	left = op->done;
+	for (i = 0; i < op->count; i++) {
+		n = op->iov[i].iov_len < left ? op->iov[i].iov_len : left;
+		left -= n;
+		req = op->reqs[i];
+		if (!req)
+			continue;
+		req->done += n;
+		if (op->err && req->done < req->ent->hdr.size)
+			req->err = op->err;
+		aio_complete(aio, req);
+	}
+	aio_op_free(op);
+}
+
+/* Free an operation without finishing its requests */
+static void aio_op_drop(struct aio_op *op)
+{
+	int i;
+
+	for (i = 0; i < op->count; i++) {
+		if (op->reqs[i])
+			aio_drop(op->reqs[i]);
+	}
+	aio_op_free(op);
+}
+
+struct ftar_aio *ftar_aio_create(int fd, struct ftar_index *idx,
+				 const struct ftar_aio_opts *opts)
+{
+	struct ftar_aio *aio;
+	unsigned threads;
+
+	errno = 0;
+
+	if (fd < 0 || !idx) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	aio = calloc(1, sizeof(struct ftar_aio));
+	if (!aio)
+		return NULL;
+	aio->fd = fd;
+	aio->idx = idx;
+	aio->depth = opts && opts->depth ? opts->depth : FTAR_AIO_DEPTH;
+	aio->gap = opts && opts->gap ? opts->gap : FTAR_AIO_GAP;
+	aio->max_merge = opts && opts->max_merge ? opts->max_merge :
+						   FTAR_AIO_MAX_MERGE;
+	aio->gap_buf = malloc(aio->gap);
+	if (!aio->gap_buf) {
+		free(aio);
+		return NULL;
+	}
+	pthread_mutex_init(&aio->lock, NULL);
+	pthread_cond_init(&aio->cond, NULL);
+
+#ifdef __linux__
+	/* Anything that stops the ring being set up means using threads */
+	aio->ring.fd = -1;
+	if (!opts || !opts->no_uring) {
+		aio->uring = uring_setup(&aio->ring, aio->depth, fd) == 0;
+		if (!aio->uring) {
+			uring_free(&aio->ring);
+			aio->ring.fd = -1;
+		}
+	}
+	if (aio->uring) {
+		errno = 0;
+		return aio;
+	}
+#endif
+
+	threads = opts && opts->threads ? opts->threads : FTAR_AIO_THREADS;
+	aio->pool = ftar_pool_create(threads);
+	if (!aio->pool) {
+		ftar_aio_free(aio);
+		return NULL;
+	}
+
+	errno = 0;
+
+	return aio;
+}
+
+int ftar_aio_read(struct ftar_aio *aio, struct ftar_index_ent *ent,
+		  ftar_aio_fn fn, void *user)
+{
+	struct ftar_index_ent *target;
+	struct aio_req *req;
+
+	errno = 0;
+
+	if (!aio || !ent || !fn) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Links with no payload share the one of an earlier entry */
+	target = ent;
+	if (ent->hdr.type == FTAR_FTYPE_LINK && ent->hdr.link[0] &&
+	    !ent->hdr.size) {
+		target = ftar_index_find(aio->idx, ent->hdr.link);
+		if (!target || target >= ent) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	req = aio_req_new(aio, target);
+	if (!req)
+		return -1;
+	req->orig = ent;
+	req->fn = fn;
+	req->user = user;
+	aio_push(aio, req);
+
+	return 0;
+}
+
+int ftar_aio_step(struct ftar_aio *aio)
+{
+	struct aio_op *list;
+	struct aio_op *op;
+
+	errno = 0;
+
+	if (!aio) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!aio->head && !aio->inflight)
+		return 0;
+
+	if (aio_sort(aio) < 0 && !aio->inflight)
+		return -1;
+#ifdef __linux__
+	if (aio->uring) {
+		if (uring_enter(aio) < 0)
+			return -1;
+		list = uring_reap(aio);
+	} else {
+		list = aio_pool_wait(aio);
+	}
+#else
+	list = aio_pool_wait(aio);
+#endif
+	if (!list && !aio->inflight) /* Out of memory */
+		return -1;
+	while (list) {
+		op = list;
+		list = list->next;
+		aio_op_done(aio, op);
+	}
+
+	errno = 0;
+
+	return aio->head || aio->inflight;
+}
+
+int ftar_aio_wait(struct ftar_aio *aio)
+{
+	int ret;
+
+	while ((ret = ftar_aio_step(aio)) > 0)
+		;
+
+	return ret;
+}
+
+bool ftar_aio_uring(const struct ftar_aio *aio)
+{
+#ifdef __linux__
+	return aio && aio->uring;
+#else
+	(void)aio;
+	return false;
+#endif
+}
+
+void ftar_aio_free(struct ftar_aio *aio)
+{
+	struct aio_op *list;
+	struct aio_op *op;
+
+	if (!aio)
+		return;
+
+	/* Reads the kernel or the pool still has have to land first */
+#ifdef __linux__
+	if (aio->uring) {
+		while (aio->inflight) {
+			if (syscall(__NR_io_uring_enter, aio->ring.fd, 0, 1,
+				    IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+			    errno != EINTR)
+				break;
+			list = uring_reap(aio);
+			while (list) {
+				op = list;
+				list = list->next;
+				aio_op_drop(op);
+			}
+		}
+		uring_free(&aio->ring);
+	}
+#endif
+	if (aio->pool)
+		ftar_pool_free(aio->pool);
+	while (aio->done) {
+		op = aio->done;
+		aio->done = op->next;
+		aio_op_drop(op);
+	}
+	while (aio->head)
+		aio_drop(aio_pop(aio));
+
+	pthread_cond_destroy(&aio->cond);
+	pthread_mutex_destroy(&aio->lock);
+	free(aio->gap_buf);
+	free(aio->dict);
+	free(aio);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,200 @@
+#define _XOPEN_SOURCE 501
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "frankentar/append.h"
+#include "frankentar/util.h"
+#include "frankentar/write.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ftar_append {
+	int fd;
+	size_t align;
+	uint64_t tail; /* Where the next entry goes */
+	size_t count; /* Entries that have space, written or deleted */
+	int err; /* Set if an entry's space couldn't be filled in at all */
+};
+
+/* Write exactly `len` bytes */
+static int append_pwrite(int fd, const void *buf, size_t len, uint64_t off)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = pwrite(fd, (const char *)buf + done, len - done, off + done);
+		if (n < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Take the space for an entry at the end of the file */
+static uint64_t append_reserve(struct ftar_append *app, size_t stored,
+			       size_t *pad_ret)
+{
+	uint64_t off;
+	uint64_t end;
+
+	/* Without alignment every entry's size is known up front */
+	if (app->align <= 1) {
+		*pad_ret = 0;
+		return __atomic_fetch_add(&app->tail,
+					  FTAR_ENT_HDR_SIZE + stored,
+					  __ATOMIC_RELAXED);
+	}
+
+	/* With it, the padding depends on where the entry lands */
+	off = __atomic_load_n(&app->tail, __ATOMIC_RELAXED);
+	do {
+		*pad_ret = ftar_payload_pad(off, stored, app->align);
+		end = off + FTAR_ENT_HDR_SIZE + *pad_ret + stored;
+	} while (!__atomic_compare_exchange_n(&app->tail, &off, end, true,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	return off;
+}
+
+struct ftar_append *ftar_append_open(const char *path, size_t align)
+{
+	struct ftar_append *app;
+	char hdr[FTAR_HDR_SIZE];
+	int err;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!path || align > FTAR_ALIGN_MAX || (align & (align - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	app = calloc(1, sizeof(struct ftar_append));
+	if (!app)
+		return NULL;
+	app->align = align ? align : 1;
+	app->tail = FTAR_HDR_SIZE;
+	app->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (app->fd < 0) {
+		err = errno;
+		free(app);
+		errno = err;
+		return NULL;
+	}
+
+	/* No entries until it's closed */
+	ftar_archive_hdr(hdr, 0, app->align);
+	if (append_pwrite(app->fd, hdr, FTAR_HDR_SIZE, 0) < 0) {
+		err = errno;
+		close(app->fd);
+		free(app);
+		errno = err;
+		return NULL;
+	}
+
+	return app;
+}
+
+int ftar_append_entry(struct ftar_append *app, const struct ftar_ent *ent)
+{
+	struct ftar_ent hdr;
+	size_t stored;
+	uint64_t off;
+	size_t pad;
+	size_t len;
+	char *raw;
+	int err;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!app || !ent || !memchr(ent->name, 0, sizeof(ent->name)) ||
+	    ent->type == FTAR_FTYPE_DICT || ent->type == FTAR_FTYPE_CHUNK ||
+	    (ent->codec != FTAR_CODEC_NONE && ent->codec != FTAR_CODEC_LZ &&
+	     ent->codec != FTAR_CODEC_AUTO)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Compressing is the slow part, and it's done before taking space */
+	memcpy(&hdr, ent, sizeof(struct ftar_ent));
+	raw = ftar_ent_to_raw(&hdr, &len);
+	if (!raw)
+		return -1;
+	stored = len - FTAR_ENT_HDR_SIZE;
+
+	off = append_reserve(app, stored, &pad);
+	__atomic_fetch_add(&app->count, 1, __ATOMIC_RELAXED);
+
+	/* The padding is a hole, which reads back as zeros */
+	if (append_pwrite(app->fd, raw, FTAR_ENT_HDR_SIZE, off) < 0 ||
+	    append_pwrite(app->fd, raw + FTAR_ENT_HDR_SIZE, stored,
+			  off + FTAR_ENT_HDR_SIZE + pad) < 0) {
+		/* The space is taken now, so at least make it skippable */
+		err = errno;
+		memcpy(&hdr, raw, FTAR_ENT_HDR_SIZE);
+		hdr.flags |= FTAR_ENT_DELETED;
+		if (append_pwrite(app->fd, &hdr, FTAR_ENT_HDR_SIZE, off) < 0)
+			__atomic_store_n(&app->err, err, __ATOMIC_RELAXED);
+		free(raw);
+		errno = err;
+		return -1;
+	}
+	free(raw);
+
+	errno = 0;
+
+	return 0;
+}
+
+size_t ftar_append_count(struct ftar_append *app)
+{
+	return app ? __atomic_load_n(&app->count, __ATOMIC_RELAXED) : 0;
+}
+
+int ftar_append_close(struct ftar_append *app)
+{
+	static const char zero_block[FTAR_BLOCK_SIZE];
+	char hdr[FTAR_HDR_SIZE];
+	int err;
+
+	errno = 0;
+
+	if (!app) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Finish it off like any other archive, then publish the count */
+	err = app->err;
+	if (!err &&
+	    (append_pwrite(app->fd, zero_block, sizeof(zero_block),
+			   app->tail) < 0 ||
+	     append_pwrite(app->fd, zero_block, sizeof(zero_block),
+			   app->tail + sizeof(zero_block)) < 0))
+		err = errno;
+	ftar_archive_hdr(hdr, app->count, app->align);
+	if (!err && append_pwrite(app->fd, hdr, FTAR_HDR_SIZE, 0) < 0)
+		err = errno;
+	if (close(app->fd) < 0 && !err)
+		err = errno;
+	free(app);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,162 @@
+#include <pthread.h>
+
+#include "frankentar/chunk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cut points need more zero bits before the average size and fewer after
+ *  it, which keeps chunk sizes close to the average (FastCDC's normalised
+ *  chunking). The bits are taken from the top of the hash, since those
+ *  depend on the most bytes.
+ */
+#define CDC_BITS 16 /* log2(FTAR_CDC_AVG) */
+#define CDC_MASK(bits) (((1ull << (bits)) - 1) << (64 - (bits)))
+#define CDC_MASK_SMALL CDC_MASK(CDC_BITS + 2)
+#define CDC_MASK_LARGE CDC_MASK(CDC_BITS - 2)
+
+static uint64_t cdc_gear[256];
+static pthread_once_t cdc_gear_once = PTHREAD_ONCE_INIT;
+
+/* Fill the gear table with fixed pseudo-random values (splitmix64) */
+static void cdc_gear_init(void)
+{
+	uint64_t x;
+	uint64_t z;
+	size_t i;
+
+	x = 0x6672616e6b656e74ull; /* "frankent" */
+	for (i = 0; i < 256; i++) {
+		x += 0x9e3779b97f4a7c15ull;
+		z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		cdc_gear[i] = z ^ (z >> 31);
+	}
+}
+
+size_t ftar_cdc_cut(const void *data, size_t len)
+{
+	const uint8_t *p;
+	uint64_t h;
+	size_t normal;
+	size_t i;
+
+	pthread_once(&cdc_gear_once, cdc_gear_init);
+
+	if (len <= FTAR_CDC_MIN)
+		return len;
+	if (len > FTAR_CDC_MAX)
+		len = FTAR_CDC_MAX;
+	normal = len < FTAR_CDC_AVG ? len : FTAR_CDC_AVG;
+
+	/* Nothing before the minimum size can be a cut point, so skip it */
+	p = data;
+	h = 0;
+	for (i = FTAR_CDC_MIN; i < normal; i++) {
+		h = (h << 1) + cdc_gear[p[i]];
+		if (!(h & CDC_MASK_SMALL))
+			return i + 1;
+	}
+	for (; i < len; i++) {
+		h = (h << 1) + cdc_gear[p[i]];
+		if (!(h & CDC_MASK_LARGE))
+			return i + 1;
+	}
+
+	return len;
+}
+
+void ftar_chunk_name(const uint8_t *hash, char *name)
+{
+	static const char digits[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < FTAR_HASH_SIZE; i++) {
+		name[i * 2] = digits[hash[i] >> 4];
+		name[i * 2 + 1] = digits[hash[i] & 0xf];
+	}
+	name[FTAR_HASH_SIZE * 2] = 0;
+}
+
+/* Get the value of a lowercase hex digit, or -1 */
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+int ftar_chunk_hash(const char *name, uint8_t *hash)
+{
+	int hi;
+	int lo;
+	size_t i;
+
+	if (strlen(name) != FTAR_HASH_SIZE * 2)
+		return -1;
+	for (i = 0; i < FTAR_HASH_SIZE; i++) {
+		hi = hex_digit(name[i * 2]);
+		lo = hex_digit(name[i * 2 + 1]);
+		if (hi < 0 || lo < 0)
+			return -1;
+		hash[i] = (hi << 4) | lo;
+	}
+
+	return 0;
+}
+
+void ftar_manifest_hdr(void *dst, uint64_t raw_size, uint32_t count)
+{
+	memcpy(dst, &raw_size, sizeof(uint64_t));
+	memcpy((char *)dst + sizeof(uint64_t), &count, sizeof(uint32_t));
+}
+
+void *ftar_cdc_manifest(const void *data, size_t len, size_t *len_ret)
+{
+	const char *src;
+	char *buf;
+	size_t count;
+	size_t off;
+	size_t n;
+
+	errno = 0;
+
+	/* Check arguments */
+	if ((!data && len) || !len_ret) {
+		errno = EINVAL;
+		if (len_ret)
+			*len_ret = -1;
+		return NULL;
+	}
+
+	/* Every chunk but the last is at least the minimum size */
+	src = data;
+	buf = malloc(FTAR_MANIFEST_HDR_SIZE +
+		     (len / FTAR_CDC_MIN + 1) * FTAR_HASH_SIZE);
+	if (!buf) {
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Hash each chunk in order */
+	count = 0;
+	for (off = 0; off < len; off += n) {
+		n = ftar_cdc_cut(src + off, len - off);
+		ftar_sha256(src + off, n,
+			    (uint8_t *)buf + FTAR_MANIFEST_HDR_SIZE +
+				    count++ * FTAR_HASH_SIZE);
+	}
+	ftar_manifest_hdr(buf, len, count);
+
+	*len_ret = FTAR_MANIFEST_HDR_SIZE + count * FTAR_HASH_SIZE;
+	return buf;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,840 @@
+#include <math.h>
+
+#include "frankentar/compress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Shortest match worth encoding */
+#define FTAR_LZ_MIN_MATCH 4
+
+/* Length of the matches looked for separately against an old version */
+#define FTAR_LZ_LONG_MATCH 16
+
+/* Limits for the size of the match finder's hash table (in bits) */
+#define FTAR_LZ_MIN_HASH_BITS 12
+#define FTAR_LZ_MAX_HASH_BITS 20
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(uint32_t));
+	return v;
+}
+
+static uint32_t lz_hash(uint32_t v, int bits)
+{
+	return (v * 2654435761u) >> (32 - bits);
+}
+
+static uint8_t *lz_put_len(uint8_t *op, uint8_t *oend, size_t len)
+{
+	while (len >= 255) {
+		if (op >= oend)
+			return NULL;
+		*op++ = 255;
+		len -= 255;
+	}
+	if (op >= oend)
+		return NULL;
+	*op++ = (uint8_t)len;
+
+	return op;
+}
+
+static uint8_t *lz_put_varint(uint8_t *op, uint8_t *oend, size_t v)
+{
+	do {
+		if (op >= oend)
+			return NULL;
+		*op = v & 0x7f;
+		v >>= 7;
+		*op++ |= v ? 0x80 : 0;
+	} while (v);
+
+	return op;
+}
+
+/* Emit a sequence, a match length of 0 means this is the last one */
+static uint8_t *lz_emit(uint8_t *op, uint8_t *oend, const uint8_t *lit,
+			size_t lit_len, size_t off, size_t match_len)
+{
+	uint8_t *token;
+	size_t ml;
+
+	if (op >= oend)
+		return NULL;
+	token = op++;
+	*token = (lit_len >= 15 ? 15 : lit_len) << 4;
+	if (lit_len >= 15) {
+		op = lz_put_len(op, oend, lit_len - 15);
+		if (!op)
+			return NULL;
+	}
+
+	if ((size_t)(oend - op) < lit_len)
+		return NULL;
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	if (!match_len)
+		return op;
+
+	ml = match_len - FTAR_LZ_MIN_MATCH;
+	*token |= ml >= 15 ? 15 : ml;
+	op = lz_put_varint(op, oend, off);
+	if (op && ml >= 15)
+		op = lz_put_len(op, oend, ml - 15);
+
+	return op;
+}
+
+size_t ftar_lz_bound(size_t len)
+{
+	/* Everything as literals, plus the continuation bytes and a token */
+	return len + (len / 255) + 16;
+}
+
+/* Hash the `FTAR_LZ_LONG_MATCH` bytes at `p` */
+static uint32_t lz_hash_long(const uint8_t *p, int bits)
+{
+	uint64_t a;
+	uint64_t b;
+
+	memcpy(&a, p, sizeof(uint64_t));
+	memcpy(&b, p + sizeof(uint64_t), sizeof(uint64_t));
+	return ((a * 0x9e3779b97f4a7c15ull) ^ (b * 0xc2b2ae3d27d4eb4full)) >>
+	       (64 - bits);
+}
+
+/* Get the size of the match finder's hash table for `total` bytes */
+static int lz_hash_bits(size_t total)
+{
+	int bits;
+
+	bits = FTAR_LZ_MIN_HASH_BITS;
+	while (bits < FTAR_LZ_MAX_HASH_BITS && ((size_t)1 << (bits + 2)) < total)
+		bits++;
+
+	return bits;
+}
+
+struct ftar_lz_dict {
+	uint8_t *data;
+	size_t len;
+	int bits;
+	uint32_t *table; /* Every position in the dictionary, hashed */
+};
+
+struct ftar_lz_dict *ftar_lz_dict_new(const void *dict, size_t dict_len)
+{
+	struct ftar_lz_dict *lz_dict;
+	size_t i;
+
+	errno = 0;
+
+	if (!dict && dict_len) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* The table fits blocks up to the size of the dictionary itself */
+	lz_dict = calloc(1, sizeof(struct ftar_lz_dict));
+	if (!lz_dict)
+		return NULL;
+	lz_dict->len = dict_len;
+	lz_dict->bits = lz_hash_bits(dict_len * 2);
+	lz_dict->data = malloc(dict_len ? dict_len : 1);
+	lz_dict->table = calloc((size_t)1 << lz_dict->bits, sizeof(uint32_t));
+	if (!lz_dict->data || !lz_dict->table) {
+		ftar_lz_dict_free(lz_dict);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(lz_dict->data, dict, dict_len);
+
+	/* Positions are stored plus one, so zero means empty */
+	for (i = 0; i + FTAR_LZ_MIN_MATCH <= dict_len; i++)
+		lz_dict->table[lz_hash(lz_read32(lz_dict->data + i),
+				       lz_dict->bits)] = i + 1;
+
+	return lz_dict;
+}
+
+void ftar_lz_dict_free(struct ftar_lz_dict *dict)
+{
+	if (!dict)
+		return;
+
+	free(dict->data);
+	free(dict->table);
+	free(dict);
+}
+
+/*
+ * Compress a block. With `versioned`, the dictionary is an old version of
+ *  the block, which is also searched for matches of `FTAR_LZ_LONG_MATCH`
+ *  bytes. Those are much less likely than short ones to be found in the
+ *  wrong place in repetitive data, which would otherwise lose track of
+ *  where the old version lines up. With `lz_dict`, the dictionary is that
+ *  and its table is copied instead of hashed again, if it's big enough.
+ */
+static size_t lz_compress(const void *src, size_t len, void *dst, size_t cap,
+			  const void *dict, size_t dict_len, size_t rep,
+			  bool versioned, const struct ftar_lz_dict *lz_dict)
+{
+	const uint8_t *buf;
+	uint8_t *combined;
+	uint8_t *op;
+	uint8_t *oend;
+	uint32_t *table;
+	uint32_t *long_table;
+	uint32_t seq;
+	uint32_t h;
+	size_t total;
+	size_t ip;
+	size_t anchor;
+	size_t ref;
+	size_t long_ref;
+	size_t match_len;
+	size_t i;
+	int bits;
+
+	errno = 0;
+
+	if (lz_dict) {
+		dict = lz_dict->data;
+		dict_len = lz_dict->len;
+	}
+
+	/* Check arguments */
+	if ((!src && len) || !dst || (!dict && dict_len)) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	/*
+	 * Matches are allowed to start in the dictionary, so it's easiest to
+	 *  just put the two next to each other
+	 */
+	total = dict_len + len;
+	combined = NULL;
+	buf = src;
+	if (dict_len) {
+		combined = malloc(total);
+		if (!combined)
+			return 0;
+		memcpy(combined, dict, dict_len);
+		memcpy(combined + dict_len, src, len);
+		buf = combined;
+	}
+
+	/* Size the hash table to the input, within reason */
+	bits = lz_hash_bits(total);
+	if (lz_dict && bits <= lz_dict->bits) {
+		bits = lz_dict->bits;
+		table = malloc(((size_t)1 << bits) * sizeof(uint32_t));
+	} else {
+		lz_dict = NULL;
+		table = calloc((size_t)1 << bits, sizeof(uint32_t));
+	}
+	long_table = NULL;
+	if (versioned)
+		long_table = calloc((size_t)1 << bits, sizeof(uint32_t));
+	if (!table || (versioned && !long_table)) {
+		free(table);
+		free(long_table);
+		free(combined);
+		return 0;
+	}
+
+	/* Positions are stored plus one, so zero means empty */
+	if (lz_dict) {
+		memcpy(table, lz_dict->table,
+		       ((size_t)1 << bits) * sizeof(uint32_t));
+	} else {
+		for (i = 0; i + FTAR_LZ_MIN_MATCH <= dict_len; i++)
+			table[lz_hash(lz_read32(buf + i), bits)] = i + 1;
+	}
+	for (i = 0; long_table && i + FTAR_LZ_LONG_MATCH <= dict_len; i++)
+		long_table[lz_hash_long(buf + i, bits)] = i + 1;
+
+	op = dst;
+	oend = op + cap;
+	ip = dict_len;
+	anchor = ip;
+	while (len >= FTAR_LZ_MIN_MATCH && ip + FTAR_LZ_MIN_MATCH <= total) {
+		seq = lz_read32(buf + ip);
+		h = lz_hash(seq, bits);
+		ref = table[h];
+		table[h] = ip + 1;
+		long_ref = 0;
+		if (long_table && ip + FTAR_LZ_LONG_MATCH <= total) {
+			h = lz_hash_long(buf + ip, bits);
+			long_ref = long_table[h];
+			long_table[h] = ip + 1;
+		}
+
+		/*
+		 * Try the last match's offset first, since data that's been
+		 *  edited tends to line up with the original at the same one
+		 */
+		if (rep && rep <= ip && lz_read32(buf + ip - rep) == seq) {
+			ref = ip - rep;
+		} else if (long_ref && memcmp(buf + long_ref - 1, buf + ip,
+					      FTAR_LZ_LONG_MATCH) == 0) {
+			ref = long_ref - 1;
+		} else if (!ref || lz_read32(buf + ref - 1) != seq) {
+			/* Skip faster through data that isn't matching */
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		} else {
+			ref--;
+		}
+
+		/* Extend the match forwards, then backwards */
+		match_len = FTAR_LZ_MIN_MATCH;
+		while (ip + match_len < total &&
+		       buf[ref + match_len] == buf[ip + match_len])
+			match_len++;
+		while (ip > anchor && ref > 0 && buf[ip - 1] == buf[ref - 1]) {
+			ip--;
+			ref--;
+			match_len++;
+		}
+
+		op = lz_emit(op, oend, buf + anchor, ip - anchor, ip - ref,
+			     match_len);
+		if (!op)
+			goto fail;
+		rep = ip - ref;
+		ip += match_len;
+		anchor = ip;
+
+		/* Give the next search something recent to find */
+		if (ip + 2 <= total)
+			table[lz_hash(lz_read32(buf + ip - 2), bits)] = ip - 1;
+	}
+
+	/* Whatever's left goes out as literals */
+	op = lz_emit(op, oend, buf + anchor, total - anchor, 0, 0);
+	if (!op)
+		goto fail;
+
+	free(table);
+	free(long_table);
+	free(combined);
+
+	errno = 0;
+
+	return op - (uint8_t *)dst;
+fail:
+	free(table);
+	free(long_table);
+	free(combined);
+	errno = ENOSPC;
+	return 0;
+}
+
+size_t ftar_lz_compress(const void *src, size_t len, void *dst, size_t cap,
+			const void *dict, size_t dict_len)
+{
+	return lz_compress(src, len, dst, cap, dict, dict_len, 0, false, NULL);
+}
+
+size_t ftar_lz_compress_rep(const void *src, size_t len, void *dst, size_t cap,
+			    const void *dict, size_t dict_len, size_t rep)
+{
+	return lz_compress(src, len, dst, cap, dict, dict_len, rep, true, NULL);
+}
+
+size_t ftar_lz_decompress(const void *src, size_t len, void *dst, size_t cap,
+			  const void *dict, size_t dict_len)
+{
+	const uint8_t *ip;
+	const uint8_t *iend;
+	const uint8_t *d;
+	uint8_t *out;
+	size_t op;
+	size_t lit_len;
+	size_t match_len;
+	size_t off;
+	size_t n;
+	uint8_t b;
+	int shift;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!src || (!dst && cap) || (!dict && dict_len)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ip = src;
+	iend = ip + len;
+	d = dict;
+	out = dst;
+	op = 0;
+	while (ip < iend) {
+		b = *ip++;
+
+		/* Copy the literals */
+		lit_len = b >> 4;
+		match_len = b & 15;
+		if (lit_len == 15) {
+			do {
+				if (ip >= iend)
+					goto corrupt;
+				lit_len += *ip;
+			} while (*ip++ == 255);
+		}
+		if (lit_len > (size_t)(iend - ip) || lit_len > cap - op)
+			goto corrupt;
+		memcpy(out + op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+
+		/* The last sequence has no match */
+		if (ip == iend)
+			break;
+
+		/* Read the offset and the rest of the match length */
+		off = 0;
+		shift = 0;
+		do {
+			if (ip >= iend || shift > 63)
+				goto corrupt;
+			off |= (size_t)(*ip & 0x7f) << shift;
+			shift += 7;
+		} while (*ip++ & 0x80);
+		if (match_len == 15) {
+			do {
+				if (ip >= iend)
+					goto corrupt;
+				match_len += *ip;
+			} while (*ip++ == 255);
+		}
+		match_len += FTAR_LZ_MIN_MATCH;
+		if (!off || off > op + dict_len || match_len > cap - op)
+			goto corrupt;
+
+		/* The start of the match might be in the dictionary */
+		if (off > op) {
+			n = off - op;
+			if (n > match_len)
+				n = match_len;
+			memcpy(out + op, d + dict_len - (off - op), n);
+			op += n;
+			match_len -= n;
+		}
+
+		/* Matches can overlap themselves, which is how runs work */
+		if (off >= match_len) {
+			memcpy(out + op, out + op - off, match_len);
+			op += match_len;
+		} else {
+			while (match_len--) {
+				out[op] = out[op - off];
+				op++;
+			}
+		}
+	}
+
+	errno = 0;
+
+	return op;
+corrupt:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Compress a chunk against a dictionary or a prepared one */
+static size_t chunk_compress(const void *src, size_t len, void *dst,
+			     const void *dict, size_t dict_len,
+			     const struct ftar_lz_dict *lz_dict)
+{
+	uint32_t hdr;
+	size_t n;
+
+	/* Only keep the compressed version if it's actually smaller */
+	n = 0;
+	if (len > 1 && len < FTAR_CHUNK_STORED)
+		n = lz_compress(src, len, (char *)dst + sizeof(uint32_t),
+				len - 1, dict, dict_len, 0, false, lz_dict);
+	if (n) {
+		hdr = n;
+	} else {
+		memcpy((char *)dst + sizeof(uint32_t), src, len);
+		hdr = len | FTAR_CHUNK_STORED;
+		n = len;
+	}
+	memcpy(dst, &hdr, sizeof(uint32_t));
+
+	errno = 0;
+
+	return sizeof(uint32_t) + n;
+}
+
+size_t ftar_chunk_compress(const void *src, size_t len, void *dst,
+			   const void *dict, size_t dict_len)
+{
+	return chunk_compress(src, len, dst, dict, dict_len, NULL);
+}
+
+size_t ftar_chunk_compress_dict(const void *src, size_t len, void *dst,
+				const struct ftar_lz_dict *dict)
+{
+	return chunk_compress(src, len, dst, NULL, 0, dict);
+}
+
+void ftar_frame_hdr(void *dst, uint64_t raw_size, uint32_t chunk_size)
+{
+	memcpy(dst, &raw_size, sizeof(uint64_t));
+	memcpy((char *)dst + sizeof(uint64_t), &chunk_size, sizeof(uint32_t));
+}
+
+void *ftar_compress(const void *src, size_t len, size_t chunk_size,
+		    const void *dict, size_t dict_len, size_t *len_ret)
+{
+	char *buf;
+	char *addr;
+	size_t count;
+	size_t n;
+	size_t i;
+
+	errno = 0;
+
+	/* Check arguments */
+	if ((!src && len) || !len_ret || chunk_size >= FTAR_CHUNK_STORED) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!chunk_size)
+		chunk_size = FTAR_CHUNK_SIZE;
+
+	/* Every chunk being stored raw is the worst case */
+	count = (len + chunk_size - 1) / chunk_size;
+	buf = malloc(FTAR_FRAME_HDR_SIZE + count * sizeof(uint32_t) + len);
+	if (!buf) {
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Write the header, then the chunks */
+	ftar_frame_hdr(buf, len, chunk_size);
+	addr = buf + FTAR_FRAME_HDR_SIZE;
+	for (i = 0; i < count; i++) {
+		n = (i == count - 1) ? len - i * chunk_size : chunk_size;
+		addr += ftar_chunk_compress((const char *)src + i * chunk_size,
+					    n, addr, dict, dict_len);
+	}
+
+	errno = 0;
+
+	*len_ret = addr - buf;
+	return buf;
+}
+
+void *ftar_decompress(const void *src, size_t len, const void *dict,
+		      size_t dict_len, size_t *len_ret)
+{
+	const char *ip;
+	const char *iend;
+	char *buf;
+	uint64_t raw_size;
+	uint32_t chunk_size;
+	uint32_t hdr;
+	size_t out;
+	size_t want;
+	size_t n;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!src || !len_ret || len < FTAR_FRAME_HDR_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Read the frame header */
+	memcpy(&raw_size, src, sizeof(uint64_t));
+	memcpy(&chunk_size, (const char *)src + sizeof(uint64_t),
+	       sizeof(uint32_t));
+	if (!chunk_size && raw_size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Allocate the payload (always at least a byte, like calloc(0)) */
+	buf = malloc(raw_size ? raw_size : 1);
+	if (!buf) {
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Decode each chunk in turn */
+	ip = (const char *)src + FTAR_FRAME_HDR_SIZE;
+	iend = (const char *)src + len;
+	for (out = 0; out < raw_size; out += want) {
+		if (iend - ip < (ptrdiff_t)sizeof(uint32_t))
+			goto corrupt;
+		memcpy(&hdr, ip, sizeof(uint32_t));
+		ip += sizeof(uint32_t);
+
+		n = hdr & ~FTAR_CHUNK_STORED;
+		want = raw_size - out < chunk_size ? raw_size - out : chunk_size;
+		if (n > (size_t)(iend - ip))
+			goto corrupt;
+		if (hdr & FTAR_CHUNK_STORED) {
+			if (n != want)
+				goto corrupt;
+			memcpy(buf + out, ip, n);
+		} else if (ftar_lz_decompress(ip, n, buf + out, want, dict,
+					      dict_len) != want) {
+			goto corrupt;
+		}
+		ip += n;
+	}
+
+	errno = 0;
+
+	*len_ret = raw_size;
+	return buf;
+corrupt:
+	free(buf);
+	errno = EINVAL;
+	*len_ret = -1;
+	return NULL;
+}
+
+/* Payloads with more entropy than this (in bits per byte) aren't tried */
+#define FTAR_AUTO_MAX_ENTROPY 7.5
+
+/* How much of the sample the trial compression is run on */
+#define FTAR_AUTO_TRIAL_SIZE (16 * 1024)
+
+/* Percentage of the trial that compression has to save */
+#define FTAR_AUTO_MIN_SAVINGS 8
+
+/* Payloads smaller than this can't make up for the frame overhead */
+#define FTAR_AUTO_MIN_SIZE 64
+
+int ftar_codec_choose(const void *sample, size_t len)
+{
+	const uint8_t *p;
+	size_t counts[256];
+	double entropy;
+	double prob;
+	size_t trial;
+	void *buf;
+	size_t n;
+	size_t i;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!sample && len) {
+		errno = EINVAL;
+		return FTAR_CODEC_NONE;
+	}
+	if (len < FTAR_AUTO_MIN_SIZE)
+		return FTAR_CODEC_NONE;
+	if (len > FTAR_AUTO_SAMPLE_SIZE)
+		len = FTAR_AUTO_SAMPLE_SIZE;
+
+	/* Work out the byte entropy of the sample */
+	p = sample;
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < len; i++)
+		counts[p[i]]++;
+	entropy = 0;
+	for (i = 0; i < 256; i++) {
+		if (!counts[i])
+			continue;
+		prob = (double)counts[i] / len;
+		entropy -= prob * log2(prob);
+	}
+	if (entropy > FTAR_AUTO_MAX_ENTROPY)
+		return FTAR_CODEC_NONE;
+
+	/*
+	 * Low entropy doesn't always mean it'll compress well, so try it. The
+	 *  output buffer is only as big as the most it's allowed to take up.
+	 */
+	trial = len < FTAR_AUTO_TRIAL_SIZE ? len : FTAR_AUTO_TRIAL_SIZE;
+	buf = malloc(trial);
+	if (!buf)
+		return FTAR_CODEC_NONE;
+	n = ftar_lz_compress(sample, trial, buf,
+			     trial - (trial * FTAR_AUTO_MIN_SAVINGS / 100),
+			     NULL, 0);
+	free(buf);
+
+	errno = 0;
+
+	return n ? FTAR_CODEC_LZ : FTAR_CODEC_NONE;
+}
+
+/* Length of the substrings counted while training dictionaries */
+#define FTAR_DICT_KMER 8
+
+/* Length of the segments dictionaries are built out of */
+#define FTAR_DICT_SEGMENT 128
+
+/* Size of the k-mer frequency table (in bits) */
+#define FTAR_DICT_HASH_BITS 20
+
+static uint32_t dict_kmer_hash(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(uint64_t));
+	return (v * 0x9e3779b97f4a7c15ull) >> (64 - FTAR_DICT_HASH_BITS);
+}
+
+void *ftar_dict_train(const void *const *samples, const size_t *lens,
+		      size_t count, size_t dict_cap, size_t *len_ret)
+{
+	const uint8_t *s;
+	uint8_t *dict;
+	uint32_t *freq;
+	uint32_t *seen;
+	size_t epochs;
+	size_t epoch;
+	size_t fill;
+	size_t total;
+	size_t best_score;
+	size_t best_sample;
+	size_t best_off;
+	size_t best_len;
+	size_t score;
+	size_t seg;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!samples || !lens || !count || !dict_cap || !len_ret) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	dict = malloc(dict_cap);
+	if (!dict) {
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* If all the samples fit, there's no point in being picky */
+	total = 0;
+	for (i = 0; i < count; i++)
+		total += lens[i];
+	if (total <= dict_cap) {
+		fill = dict_cap;
+		for (i = 0; i < count; i++) {
+			fill -= lens[i];
+			memcpy(dict + fill, samples[i], lens[i]);
+		}
+		memmove(dict, dict + fill, total);
+		*len_ret = total;
+		return dict;
+	}
+
+	/*
+	 * Count how many samples each k-mer shows up in (not how many times,
+	 *  repeats within one entry get caught by compressing it anyway)
+	 */
+	freq = calloc((size_t)1 << FTAR_DICT_HASH_BITS, sizeof(uint32_t));
+	seen = calloc((size_t)1 << FTAR_DICT_HASH_BITS, sizeof(uint32_t));
+	if (!freq || !seen) {
+		free(freq);
+		free(seen);
+		free(dict);
+		*len_ret = -1;
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		s = samples[i];
+		for (j = 0; j + FTAR_DICT_KMER <= lens[i]; j++) {
+			k = dict_kmer_hash(s + j);
+			if (seen[k] != i + 1) {
+				seen[k] = i + 1;
+				freq[k]++;
+			}
+		}
+	}
+	free(seen);
+
+	/*
+	 * Split the samples into one epoch per segment the dictionary can
+	 *  hold, and take the best segment from each. The dictionary is filled
+	 *  from the back, since the segments picked first are the most common
+	 *  and should have the shortest offsets.
+	 */
+	epochs = dict_cap / FTAR_DICT_SEGMENT;
+	if (!epochs)
+		epochs = 1;
+	if (epochs > count)
+		epochs = count;
+	fill = dict_cap;
+	for (epoch = 0; epoch < epochs && fill; epoch++) {
+		best_score = 0;
+		best_sample = 0;
+		best_off = 0;
+		best_len = 0;
+		for (i = epoch; i < count; i += epochs) {
+			if (lens[i] < FTAR_DICT_KMER)
+				continue;
+			s = samples[i];
+			seg = lens[i] < FTAR_DICT_SEGMENT ? lens[i] :
+							    FTAR_DICT_SEGMENT;
+
+			/* Slide the segment along, keeping a running score */
+			score = 0;
+			for (k = 0; k + FTAR_DICT_KMER <= seg; k++)
+				score += freq[dict_kmer_hash(s + k)];
+			for (j = 0;; j++) {
+				if (score > best_score) {
+					best_score = score;
+					best_sample = i;
+					best_off = j;
+					best_len = seg;
+				}
+				if (j + seg >= lens[i])
+					break;
+				score -= freq[dict_kmer_hash(s + j)];
+				score += freq[dict_kmer_hash(
+					s + j + seg - FTAR_DICT_KMER + 1)];
+			}
+		}
+		if (!best_score)
+			continue;
+
+		/* Take the segment, and stop its k-mers from scoring again */
+		if (best_len > fill)
+			best_len = fill;
+		s = (const uint8_t *)samples[best_sample] + best_off;
+		fill -= best_len;
+		memcpy(dict + fill, s, best_len);
+		for (k = 0; k + FTAR_DICT_KMER <= best_len; k++)
+			freq[dict_kmer_hash(s + k)] = 0;
+	}
+	free(freq);
+
+	/* Move what was picked to the front */
+	memmove(dict, dict + fill, dict_cap - fill);
+
+	errno = 0;
+
+	*len_ret = dict_cap - fill;
+	return dict;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,640 @@
+#include "frankentar/compress.h"
+#include "frankentar/delta.h"
+#include "frankentar/util.h"
+#include "frankentar/write.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Where an entry of a patch is, and whether its data has to be freed */
+struct patch_ref {
+	const char *payload;
+	size_t len;
+	char codec; /* The codec it's stored with */
+	bool owned;
+};
+
+struct ftar_patch {
+	struct ftar *base;
+	char *buf; /* Copy of the patch */
+	struct ftar_ent *ents;
+	struct patch_ref *refs;
+	struct ftar_ent **names;
+	size_t mask;
+	struct ftar_ent **base_names;
+	size_t base_mask;
+};
+
+/* Get the part of the base a chunk is compressed against */
+static void delta_window(size_t base_len, size_t off, size_t n, size_t *start,
+			 size_t *end)
+{
+	*start = off > FTAR_DELTA_WINDOW ? off - FTAR_DELTA_WINDOW : 0;
+	*end = off + n + FTAR_DELTA_WINDOW;
+	if (*end > base_len)
+		*end = base_len;
+	if (*start > *end)
+		*start = *end;
+}
+
+void *ftar_delta_encode(const void *src, size_t len, const void *base,
+			size_t base_len, size_t *len_ret)
+{
+	const char *s;
+	const char *b;
+	char *buf;
+	char *addr;
+	uint64_t size;
+	uint32_t chunk_size;
+	uint32_t same;
+	uint32_t hdr;
+	size_t count;
+	size_t z;
+	size_t start;
+	size_t end;
+	size_t off;
+	size_t n;
+	size_t i;
+
+	errno = 0;
+
+	/* Check arguments */
+	if ((!src && len) || (!base && base_len) || !len_ret) {
+		errno = EINVAL;
+		if (len_ret)
+			*len_ret = -1;
+		return NULL;
+	}
+
+	/* Every chunk being stored raw is the worst case */
+	chunk_size = FTAR_CHUNK_SIZE;
+	count = (len + chunk_size - 1) / chunk_size;
+	buf = malloc(FTAR_DELTA_HDR_SIZE + count * sizeof(uint32_t) + len);
+	if (!buf) {
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Write the header, which identifies the base */
+	size = len;
+	memcpy(buf, &size, sizeof(uint64_t));
+	memcpy(buf + sizeof(uint64_t), &chunk_size, sizeof(uint32_t));
+	size = base_len;
+	memcpy(buf + sizeof(uint64_t) + sizeof(uint32_t), &size,
+	       sizeof(uint64_t));
+	ftar_sha256(base, base_len,
+		    (uint8_t *)buf + sizeof(uint64_t) * 2 + sizeof(uint32_t));
+
+	/* Then each chunk, compressed against the base around it */
+	s = src;
+	b = base;
+	same = 0;
+	addr = buf + FTAR_DELTA_HDR_SIZE;
+	for (i = 0; i < count; i++) {
+		off = i * chunk_size;
+		n = (i == count - 1) ? len - off : chunk_size;
+		if (off + n <= base_len && memcmp(s + off, b + off, n) == 0) {
+			memcpy(addr, &same, sizeof(uint32_t));
+			addr += sizeof(uint32_t);
+			continue;
+		}
+
+		/* The chunk's offset in the base is the best place to start */
+		delta_window(base_len, off, n, &start, &end);
+		z = 0;
+		if (n > 1)
+			z = ftar_lz_compress_rep(s + off, n,
+						 addr + sizeof(uint32_t), n - 1,
+						 b + start, end - start,
+						 end > off ? end - off : 0);
+		if (z) {
+			hdr = z;
+		} else {
+			memcpy(addr + sizeof(uint32_t), s + off, n);
+			hdr = n | FTAR_CHUNK_STORED;
+			z = n;
+		}
+		memcpy(addr, &hdr, sizeof(uint32_t));
+		addr += sizeof(uint32_t) + z;
+	}
+
+	errno = 0;
+
+	*len_ret = addr - buf;
+	return buf;
+}
+
+/* Check that a delta was made against `base`, and get its raw size */
+static int delta_check_base(const char *delta, size_t len, const void *base,
+			    size_t base_len, uint64_t *raw_size)
+{
+	uint8_t hash[FTAR_HASH_SIZE];
+	uint64_t size;
+
+	if (len < FTAR_DELTA_HDR_SIZE)
+		return -1;
+	memcpy(raw_size, delta, sizeof(uint64_t));
+	memcpy(&size, delta + sizeof(uint64_t) + sizeof(uint32_t),
+	       sizeof(uint64_t));
+	if (size != base_len)
+		return -1;
+	ftar_sha256(base, base_len, hash);
+	if (memcmp(hash, delta + sizeof(uint64_t) * 2 + sizeof(uint32_t),
+		   FTAR_HASH_SIZE) != 0)
+		return -1;
+
+	return 0;
+}
+
+void *ftar_delta_decode(const void *delta, size_t len, const void *base,
+			size_t base_len, size_t *len_ret)
+{
+	const char *ip;
+	const char *iend;
+	const char *b;
+	char *buf;
+	uint64_t raw_size;
+	uint32_t chunk_size;
+	uint32_t hdr;
+	size_t start;
+	size_t end;
+	size_t out;
+	size_t want;
+	size_t n;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!delta || (!base && base_len) || !len_ret) {
+		errno = EINVAL;
+		if (len_ret)
+			*len_ret = -1;
+		return NULL;
+	}
+
+	/* Make sure this is the base the delta is for */
+	if (delta_check_base(delta, len, base, base_len, &raw_size) < 0) {
+		errno = EINVAL;
+		*len_ret = -1;
+		return NULL;
+	}
+	memcpy(&chunk_size, (const char *)delta + sizeof(uint64_t),
+	       sizeof(uint32_t));
+	if (!chunk_size && raw_size) {
+		errno = EINVAL;
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Allocate the payload (always at least a byte, like calloc(0)) */
+	buf = malloc(raw_size ? raw_size : 1);
+	if (!buf) {
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Decode each chunk in turn */
+	b = base;
+	ip = (const char *)delta + FTAR_DELTA_HDR_SIZE;
+	iend = (const char *)delta + len;
+	for (out = 0; out < raw_size; out += want) {
+		if (iend - ip < (ptrdiff_t)sizeof(uint32_t))
+			goto corrupt;
+		memcpy(&hdr, ip, sizeof(uint32_t));
+		ip += sizeof(uint32_t);
+		want = raw_size - out < chunk_size ? raw_size - out : chunk_size;
+
+		/* Unchanged chunks come straight from the base */
+		if (!hdr) {
+			if (out + want > base_len)
+				goto corrupt;
+			memcpy(buf + out, b + out, want);
+			continue;
+		}
+
+		n = hdr & ~FTAR_CHUNK_STORED;
+		if (n > (size_t)(iend - ip))
+			goto corrupt;
+		if (hdr & FTAR_CHUNK_STORED) {
+			if (n != want)
+				goto corrupt;
+			memcpy(buf + out, ip, n);
+		} else {
+			delta_window(base_len, out, want, &start, &end);
+			if (ftar_lz_decompress(ip, n, buf + out, want, b + start,
+					       end - start) != want)
+				goto corrupt;
+		}
+		ip += n;
+	}
+
+	errno = 0;
+
+	*len_ret = raw_size;
+	return buf;
+corrupt:
+	free(buf);
+	errno = EINVAL;
+	*len_ret = -1;
+	return NULL;
+}
+
+/*
+ * Make a name table of the entries a patch can refer to, which leaves out
+ *  dictionaries and chunks
+ */
+static struct ftar_ent **patch_table(struct ftar *tar, size_t *mask_ret)
+{
+	struct ftar_ent **table;
+	struct ftar_ent **slot;
+	size_t mask;
+	size_t i;
+
+	for (mask = 1; mask < tar->ent_count * 2; mask <<= 1)
+		;
+	table = calloc(mask--, sizeof(struct ftar_ent *));
+	if (!table)
+		return NULL;
+	for (i = 0; i < tar->ent_count; i++) {
+		if (tar->entries[i]->type == FTAR_FTYPE_DICT ||
+		    tar->entries[i]->type == FTAR_FTYPE_CHUNK)
+			continue;
+		slot = ftar_name_slot(table, mask, tar->entries[i]->name);
+		if (!*slot)
+			*slot = tar->entries[i];
+	}
+
+	*mask_ret = mask;
+	return table;
+}
+
+/* Store an entry as a delta against `old` or as itself, whichever's smaller */
+static char *diff_ent(struct ftar_ent *ent, struct ftar_ent *old,
+		      size_t *len_ret)
+{
+	struct ftar_ent hdr;
+	char *delta;
+	char *full;
+	char *buf;
+	size_t delta_len;
+	size_t full_len;
+	char codec;
+
+	memcpy(&hdr, ent, sizeof(struct ftar_ent));
+	hdr.codec = FTAR_CODEC_AUTO;
+	if ((ent->type == FTAR_FTYPE_LINK && ent->link[0]) || !old ||
+	    !ent->size)
+		return ftar_ent_to_raw(&hdr, len_ret);
+
+	delta = ftar_delta_encode(ent->data, ent->size, old->data, old->size,
+				  &delta_len);
+	if (!delta) {
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Don't bother compressing it if the delta is already small */
+	if (delta_len * 4 > ent->size) {
+		full = ftar_ent_to_raw(&hdr, &full_len);
+		if (!full || full_len <= FTAR_ENT_HDR_SIZE + delta_len) {
+			free(delta);
+			*len_ret = full_len;
+			return full;
+		}
+		free(full);
+	}
+
+	buf = malloc(FTAR_ENT_HDR_SIZE + delta_len);
+	if (!buf) {
+		free(delta);
+		*len_ret = -1;
+		return NULL;
+	}
+	codec = FTAR_CODEC_DELTA;
+	memcpy(buf, ent, FTAR_ENT_HDR_SIZE);
+	memcpy(buf + offsetof(struct ftar_ent, codec), &codec, sizeof(char));
+	memcpy(buf + offsetof(struct ftar_ent, size), &delta_len,
+	       sizeof(size_t));
+	memcpy(buf + FTAR_ENT_HDR_SIZE, delta, delta_len);
+	free(delta);
+
+	*len_ret = FTAR_ENT_HDR_SIZE + delta_len;
+	return buf;
+}
+
+void *ftar_diff(struct ftar *base, struct ftar *tar, size_t *len_ret)
+{
+	struct ftar_ent **names;
+	struct ftar_ent *ent;
+	char **raw;
+	size_t *raw_len;
+	size_t mask;
+	size_t count;
+	size_t len;
+	char *buf;
+	char *addr;
+	size_t i;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!base || !tar || !len_ret) {
+		errno = EINVAL;
+		if (len_ret)
+			*len_ret = -1;
+		return NULL;
+	}
+
+	names = patch_table(base, &mask);
+	raw = calloc(tar->ent_count ? tar->ent_count : 1, sizeof(char *));
+	raw_len = calloc(tar->ent_count ? tar->ent_count : 1, sizeof(size_t));
+	if (!names || !raw || !raw_len) {
+		free(names);
+		free(raw);
+		free(raw_len);
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Store each entry, apart from the ones that only existed for others */
+	len = FTAR_HDR_SIZE + (FTAR_BLOCK_SIZE * 2);
+	count = 0;
+	for (i = 0; i < tar->ent_count; i++) {
+		ent = tar->entries[i];
+		if (ent->type == FTAR_FTYPE_DICT ||
+		    ent->type == FTAR_FTYPE_CHUNK)
+			continue;
+
+		raw[count] = diff_ent(ent, *ftar_name_slot(names, mask, ent->name),
+				      &raw_len[count]);
+		if (!raw[count])
+			break;
+		len += raw_len[count++];
+	}
+	free(names);
+
+	/* Allocate the buffer */
+	buf = i == tar->ent_count ? calloc(len, 1) : NULL;
+	if (!buf) {
+		while (count--)
+			free(raw[count]);
+		free(raw);
+		free(raw_len);
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Copy in the signature and the entries */
+	strncpy(buf, FTAR_MAGIC, FTAR_MAGIC_LEN);
+	addr = buf + FTAR_MAGIC_LEN;
+	memcpy(addr, &count, sizeof(size_t));
+	addr += sizeof(size_t);
+	for (i = 0; i < count; i++) {
+		memcpy(addr, raw[i], raw_len[i]);
+		addr += raw_len[i];
+		free(raw[i]);
+	}
+	free(raw);
+	free(raw_len);
+
+	errno = 0;
+
+	/* The last two blocks are already zeroed */
+	*len_ret = len;
+	return buf;
+}
+
+struct ftar *ftar_load_patched(struct ftar *base, void *patch,
+			       size_t patch_len)
+{
+	struct ftar_patch *state;
+	struct ftar *tar;
+	struct ftar_ent *ent;
+	struct ftar_ent **slot;
+	uint64_t raw_size;
+	size_t stored;
+	size_t count;
+	char *addr;
+	char *end;
+	size_t i;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!base || !patch || patch_len < FTAR_HDR_SIZE ||
+	    memcmp(patch, FTAR_MAGIC, FTAR_MAGIC_LEN) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	memcpy(&count, (char *)patch + FTAR_MAGIC_LEN, sizeof(size_t));
+	if (count > (patch_len - FTAR_HDR_SIZE) / FTAR_ENT_HDR_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Allocate everything */
+	tar = calloc(1, sizeof(struct ftar));
+	state = calloc(1, sizeof(struct ftar_patch));
+	if (!tar || !state) {
+		free(tar);
+		free(state);
+		return NULL;
+	}
+	tar->patch = state;
+	state->base = base;
+	state->buf = malloc(patch_len);
+	tar->entries = calloc(count ? count : 1, sizeof(struct ftar_ent *));
+	state->ents = calloc(count ? count : 1, sizeof(struct ftar_ent));
+	state->refs = calloc(count ? count : 1, sizeof(struct patch_ref));
+	for (state->mask = 1; state->mask < count * 2; state->mask <<= 1)
+		;
+	state->names = calloc(state->mask--, sizeof(struct ftar_ent *));
+	state->base_names = patch_table(base, &state->base_mask);
+	if (!state->buf || !tar->entries || !state->ents || !state->refs ||
+	    !state->names || !state->base_names)
+		goto fail;
+	memcpy(state->buf, patch, patch_len);
+	memcpy(tar->magic, state->buf, FTAR_MAGIC_LEN);
+	tar->ent_count = count;
+	tar->align = base->align; /* Patches aren't aligned, but the result is */
+
+	/* Only read the headers, the payloads are decoded when they're needed */
+	addr = state->buf + FTAR_HDR_SIZE;
+	end = state->buf + patch_len;
+	for (i = 0; i < count; i++) {
+		if (addr + FTAR_ENT_HDR_SIZE > end)
+			goto corrupt;
+		ent = &state->ents[i];
+		memcpy(ent->name, addr, FTAR_ENT_HDR_SIZE);
+		stored = ent->size;
+		if (stored > (size_t)(end - addr) - FTAR_ENT_HDR_SIZE)
+			goto corrupt;
+		state->refs[i].payload = addr + FTAR_ENT_HDR_SIZE;
+		state->refs[i].len = stored;
+		state->refs[i].codec = ent->codec;
+
+		/* Get the real size, which is all that's needed for now */
+		if (ent->type == FTAR_FTYPE_LINK && ent->link[0] && !stored) {
+			slot = ftar_name_slot(state->names, state->mask,
+					      ent->link);
+			if (!*slot)
+				goto corrupt;
+			ent->size = (*slot)->size;
+		} else if (ent->codec == FTAR_CODEC_LZ ||
+			   ent->codec == FTAR_CODEC_DELTA) {
+			/* Frames and deltas both start with the raw size */
+			if (stored < sizeof(uint64_t))
+				goto corrupt;
+			memcpy(&raw_size, state->refs[i].payload,
+			       sizeof(uint64_t));
+			ent->size = raw_size;
+		} else if (ent->codec != FTAR_CODEC_NONE) {
+			goto corrupt;
+		}
+
+		/* A delta means nothing outside of this patch */
+		if (ent->codec == FTAR_CODEC_DELTA)
+			ent->codec = FTAR_CODEC_AUTO;
+		tar->entries[i] = ent;
+
+		slot = ftar_name_slot(state->names, state->mask, ent->name);
+		if (!*slot)
+			*slot = ent;
+		addr += FTAR_ENT_HDR_SIZE + stored;
+	}
+	tar->names = state->names;
+	tar->mask = state->mask;
+
+	return tar;
+corrupt:
+	errno = EINVAL;
+fail:
+	i = errno;
+	tar->ent_count = 0;
+	ftar_patch_free(tar);
+	free(tar->entries);
+	free(tar);
+	errno = i;
+	return NULL;
+}
+
+char *ftar_patched_data(struct ftar *tar, struct ftar_ent *ent)
+{
+	struct ftar_patch *state;
+	struct patch_ref *ref;
+	struct ftar_ent *target;
+	struct ftar_ent *old;
+	const char *ip;
+	uint64_t raw_size;
+	uint32_t hdr;
+	size_t len;
+	size_t i;
+	bool same;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!tar || !tar->patch || !ent || ent < tar->patch->ents ||
+	    ent >= tar->patch->ents + tar->ent_count) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (ent->data)
+		return ent->data;
+	state = tar->patch;
+	ref = &state->refs[ent - state->ents];
+
+	/* Links share their target's data */
+	if (ent->type == FTAR_FTYPE_LINK && ent->link[0] && !ref->len) {
+		target = *ftar_name_slot(state->names, state->mask, ent->link);
+		if (!target || target == ent) {
+			errno = EINVAL;
+			return NULL;
+		}
+		ent->data = ftar_patched_data(tar, target);
+		return ent->data;
+	}
+
+	switch (ref->codec) {
+	case FTAR_CODEC_NONE:
+		ent->data = malloc(ref->len ? ref->len : 1);
+		if (!ent->data)
+			return NULL;
+		memcpy(ent->data, ref->payload, ref->len);
+		break;
+	case FTAR_CODEC_LZ:
+		ent->data = ftar_decompress(ref->payload, ref->len, NULL, 0,
+					    &len);
+		if (!ent->data)
+			return NULL;
+		break;
+	case FTAR_CODEC_DELTA:
+		old = *ftar_name_slot(state->base_names, state->base_mask,
+				      ent->name);
+		if (!old || !old->data) {
+			errno = ENOENT;
+			return NULL;
+		}
+
+		/* If nothing changed, the base's data can just be shared */
+		same = ref->len >= FTAR_DELTA_HDR_SIZE;
+		ip = ref->payload + FTAR_DELTA_HDR_SIZE;
+		for (i = FTAR_DELTA_HDR_SIZE; same && i < ref->len;
+		     i += sizeof(uint32_t)) {
+			memcpy(&hdr, ip, sizeof(uint32_t));
+			ip += sizeof(uint32_t);
+			same = !hdr;
+		}
+		if (same && ent->size == old->size &&
+		    delta_check_base(ref->payload, ref->len, old->data,
+				     old->size, &raw_size) == 0) {
+			ent->data = old->data;
+			return ent->data;
+		}
+
+		ent->data = ftar_delta_decode(ref->payload, ref->len,
+					      old->data, old->size, &len);
+		if (!ent->data)
+			return NULL;
+		break;
+	default:
+		errno = EINVAL;
+		return NULL;
+	}
+	ref->owned = true;
+
+	errno = 0;
+
+	return ent->data;
+}
+
+void ftar_patch_free(struct ftar *tar)
+{
+	struct ftar_patch *state;
+	size_t i;
+
+	if (!tar || !tar->patch)
+		return;
+	state = tar->patch;
+
+	/* Entries are all in one block, so ftar_free can't free them */
+	for (i = 0; i < tar->ent_count; i++) {
+		if (state->refs[i].owned)
+			free(state->ents[i].data);
+	}
+	tar->ent_count = 0;
+
+	free(state->base_names);
+	free(state->names);
+	tar->names = NULL;
+	free(state->refs);
+	free(state->ents);
+	free(state->buf);
+	free(state);
+	tar->patch = NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,720 @@
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "frankentar/chunk.h"
+#include "frankentar/edit.h"
+#include "frankentar/index.h"
+#include "frankentar/pack.h"
+#include "frankentar/read.h"
+#include "frankentar/util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Write exactly `len` bytes at `off` */
+static int edit_pwrite(int fd, const void *buf, size_t len, uint64_t off)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = pwrite(fd, (const char *)buf + done, len - done, off + done);
+		if (n < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Read exactly `len` bytes at `off` */
+static int edit_pread(int fd, void *buf, size_t len, uint64_t off)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = pread(fd, (char *)buf + done, len - done, off + done);
+		if (n < 0)
+			return -1;
+		if (!n) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Whether an entry is a link made by deduplication, which shares a payload */
+static bool edit_is_dedup_link(const struct ftar_ent *hdr)
+{
+	return hdr->type == FTAR_FTYPE_LINK && hdr->link[0] && !hdr->size;
+}
+
+/*
+ * Delete an entry by setting its flag. Links that share its payload would be
+ *  left without one, so the first of them takes the payload over instead:
+ *  the entry's header is rewritten as that link's, the other links are
+ *  pointed at it, and it's the link that gets deleted. Each step leaves the
+ *  archive readable.
+ */
+static int edit_kill(int fd, struct ftar_index *idx,
+		     struct ftar_index_ent *victim)
+{
+	struct ftar_index_ent *heir;
+	struct ftar_ent **slot;
+	struct ftar_ent hdr;
+	size_t i;
+
+	heir = NULL;
+	for (i = victim - idx->entries + 1; i < idx->ent_count; i++) {
+		if (idx->entries[i].hdr.flags & FTAR_ENT_DELETED ||
+		    !edit_is_dedup_link(&idx->entries[i].hdr) ||
+		    strcmp(idx->entries[i].hdr.link, victim->hdr.name) != 0)
+			continue;
+
+		/* The rest of the links go to the heir */
+		if (heir) {
+			memset(idx->entries[i].hdr.link, 0,
+			       sizeof(idx->entries[i].hdr.link));
+			strcpy(idx->entries[i].hdr.link, heir->hdr.name);
+			if (edit_pwrite(fd, idx->entries[i].hdr.link,
+					sizeof(idx->entries[i].hdr.link),
+					idx->entries[i].off +
+						offsetof(struct ftar_ent,
+							 link)) < 0)
+				return -1;
+		} else {
+			heir = &idx->entries[i];
+		}
+	}
+
+	if (heir) {
+		/* The payload keeps its type and codec, but takes the name */
+		memcpy(&hdr, &victim->hdr, FTAR_ENT_HDR_SIZE);
+		memcpy(hdr.name, heir->hdr.name, sizeof(hdr.name));
+		hdr.mode = heir->hdr.mode;
+		hdr.mtime = heir->hdr.mtime;
+
+		/* The checksum is calculated from the raw size */
+		if (hdr.codec != FTAR_CODEC_NONE &&
+		    edit_pread(fd, &hdr.size, sizeof(uint64_t),
+			       victim->data_off) < 0)
+			return -1;
+		hdr.checksum = 0;
+		ftar_checksum(&hdr);
+		hdr.size = victim->hdr.size;
+		if (edit_pwrite(fd, &hdr, FTAR_ENT_HDR_SIZE, victim->off) < 0)
+			return -1;
+
+		/* Lookups of the heir's name find the payload now */
+		memcpy(&victim->hdr, &hdr, FTAR_ENT_HDR_SIZE);
+		slot = ftar_name_slot(idx->names, idx->mask, hdr.name);
+		*slot = &victim->hdr;
+		victim = heir;
+	}
+
+	victim->hdr.flags |= FTAR_ENT_DELETED;
+	if (edit_pwrite(fd, &victim->hdr.flags, sizeof(char),
+			victim->off + offsetof(struct ftar_ent, flags)) < 0)
+		return -1;
+	idx->dead += victim->data_off + victim->hdr.size - victim->off;
+
+	return 0;
+}
+
+int ftar_add(const char *archive, const char *const *paths, size_t count,
+	     const struct ftar_pack_opts *opts)
+{
+	static const struct ftar_pack_opts default_opts;
+	struct ftar_pack_opts add_opts;
+	struct ftar_index_ent *old;
+	struct ftar_index *idx;
+	size_t written;
+	size_t i;
+	FILE *out;
+	int fd;
+	int err;
+
+	errno = 0;
+
+	if (!archive || (!paths && count)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Chunks can be shared with the ones already in the archive */
+	add_opts = opts ? *opts : default_opts;
+	if (add_opts.cdc && !add_opts.base)
+		add_opts.base = archive;
+
+	/* Only the headers are needed to find the end of the last entry */
+	fd = open(archive, O_RDWR);
+	if (fd < 0)
+		return -1;
+	idx = ftar_index_fd(fd);
+	if (!idx) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	/* The new entries have to be laid out like the old ones */
+	add_opts.align = idx->align;
+
+	/* Write the new entries and a new trailer over the old one */
+	err = 0;
+	out = NULL;
+	written = 0;
+	if (!err) {
+		out = fdopen(dup(fd), "r+b");
+		if (!out)
+			err = errno;
+	}
+	if (!err && fseek(out, idx->end, SEEK_SET) < 0)
+		err = errno;
+	if (!err &&
+	    ftar_pack_entries(out, paths, count, &add_opts, &written) < 0)
+		err = errno;
+	if (!err && (ftruncate(fileno(out), ftell(out)) < 0 || fsync(fd) < 0))
+		err = errno;
+
+	/* Then make them part of the archive */
+	written += idx->ent_count;
+	if (!err && (pwrite(fd, &written, sizeof(size_t), FTAR_MAGIC_LEN) !=
+			     sizeof(size_t) ||
+		     fsync(fd) < 0))
+		err = errno ? errno : EIO;
+
+	/*
+	 * Entries with the same names get replaced, but only now that the new
+	 *  versions are there, so there's never a point where neither is
+	 */
+	for (i = 0; i < count && !err; i++) {
+		old = ftar_index_find(idx, paths[i]);
+		if (old && edit_kill(fd, idx, old) < 0)
+			err = errno;
+	}
+	if (!err && fsync(fd) < 0)
+		err = errno;
+
+	if (out && fclose(out) != 0 && !err)
+		err = errno;
+	ftar_index_free(idx);
+	close(fd);
+
+	errno = err;
+	return err ? -1 : 0;
+}
+
+int ftar_delete(const char *archive, const char *const *names, size_t count)
+{
+	struct ftar_index_ent **victims;
+	struct ftar_index *idx;
+	size_t i;
+	int fd;
+	int err;
+
+	errno = 0;
+
+	if (!archive || (!names && count)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = open(archive, O_RDWR);
+	if (fd < 0)
+		return -1;
+	idx = ftar_index_fd(fd);
+	if (!idx) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	/* Find everything first, so nothing is deleted if a name is wrong */
+	err = 0;
+	victims = calloc(count ? count : 1, sizeof(struct ftar_index_ent *));
+	if (!victims)
+		err = errno;
+	for (i = 0; i < count && !err; i++) {
+		victims[i] = ftar_index_find(idx, names[i]);
+		if (!victims[i])
+			err = errno;
+		else if (victims[i]->hdr.type == FTAR_FTYPE_DICT ||
+			 victims[i]->hdr.type == FTAR_FTYPE_CHUNK)
+			err = EINVAL; /* Compaction takes care of these */
+	}
+
+	/*
+	 * Look them up again as they go, since deleting one entry can move
+	 *  another's payload, and the same name can be given twice
+	 */
+	for (i = 0; i < count && !err; i++) {
+		victims[i] = ftar_index_find(idx, names[i]);
+		if (victims[i] && edit_kill(fd, idx, victims[i]) < 0)
+			err = errno;
+	}
+	if (!err && fsync(fd) < 0)
+		err = errno;
+
+	free(victims);
+	ftar_index_free(idx);
+	close(fd);
+
+	errno = err;
+	return err ? -1 : 0;
+}
+
+/* Get the raw size of an entry's payload */
+static int edit_raw_size(int fd, struct ftar_index *idx,
+			 struct ftar_index_ent *ent, uint64_t *size)
+{
+	/* Dedup links go to an earlier entry, which isn't a link */
+	if (edit_is_dedup_link(&ent->hdr)) {
+		ent = ftar_index_find(idx, ent->hdr.link);
+		if (!ent) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	/* Every codec's payload starts with the raw size */
+	if (ent->hdr.codec == FTAR_CODEC_NONE) {
+		*size = ent->hdr.size;
+		return 0;
+	}
+	return edit_pread(fd, size, sizeof(uint64_t),
+			  ent->data_off);
+}
+
+/* Compare a file with an entry's payload, returning 1 if they differ */
+static int edit_differs(int fd, struct ftar_index *idx,
+			struct ftar_index_ent *ent, const char *path)
+{
+	char buf[BUFSIZ];
+	char *data;
+	size_t len;
+	size_t off;
+	size_t n;
+	FILE *f;
+	int ret;
+
+	data = ftar_index_read(fd, idx, ent, &len);
+	if (!data)
+		return -1;
+	f = fopen(path, "rb");
+	if (!f) {
+		free(data);
+		return -1;
+	}
+
+	ret = 0;
+	for (off = 0; !ret && (n = fread(buf, 1, sizeof(buf), f)) > 0;
+	     off += n) {
+		if (n > len - off || memcmp(buf, data + off, n) != 0)
+			ret = 1;
+	}
+	if (!ret && ferror(f))
+		ret = -1;
+	else if (!ret && off != len)
+		ret = 1;
+	fclose(f);
+	free(data);
+
+	return ret;
+}
+
+/* Check whether a file is different from the entry with its name */
+static int edit_changed(int fd, struct ftar_index *idx,
+			struct ftar_index_ent *ent, const char *path,
+			int flags)
+{
+	struct ftar_ent cur;
+	uint64_t size;
+	char type;
+
+	if (ftar_ent_from_file(&cur, path) < 0)
+		return -1;
+
+	/* The same things rsync looks at, plus the mode and type */
+	type = edit_is_dedup_link(&ent->hdr) ? FTAR_FTYPE_REG : ent->hdr.type;
+	if (cur.type != type || cur.mode != ent->hdr.mode ||
+	    cur.mtime != ent->hdr.mtime)
+		return 1;
+	if (cur.type != FTAR_FTYPE_REG)
+		return strcmp(cur.link, ent->hdr.link) != 0;
+	if (edit_raw_size(fd, idx, ent, &size) < 0)
+		return -1;
+	if (size != cur.size)
+		return 1;
+
+	/* Content that changed without touching the size or mtime */
+	if (flags & FTAR_UPDATE_CONTENTS)
+		return edit_differs(fd, idx, ent, path);
+
+	return 0;
+}
+
+int ftar_update(const char *archive, const char *const *paths, size_t count,
+		const struct ftar_pack_opts *opts, int flags)
+{
+	struct ftar_index_ent *ent;
+	struct ftar_index *idx;
+	const char **changed;
+	const char **pruned;
+	size_t changed_count;
+	size_t pruned_count;
+	bool *seen;
+	size_t i;
+	int fd;
+	int ret;
+	int err;
+
+	errno = 0;
+
+	if (!archive || (!paths && count)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = open(archive, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	idx = ftar_index_fd(fd);
+	if (!idx) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	err = 0;
+	changed = calloc(count ? count : 1, sizeof(char *));
+	pruned = calloc(idx->ent_count ? idx->ent_count : 1, sizeof(char *));
+	seen = calloc(idx->ent_count ? idx->ent_count : 1, sizeof(bool));
+	if (!changed || !pruned || !seen)
+		err = errno;
+
+	/* Only files that are new or changed get read */
+	changed_count = 0;
+	for (i = 0; i < count && !err; i++) {
+		ent = ftar_index_find(idx, paths[i]);
+		if (ent) {
+			seen[ent - idx->entries] = true;
+			ret = edit_changed(fd, idx, ent, paths[i], flags);
+		} else {
+			ret = 1;
+		}
+		if (ret < 0)
+			err = errno;
+		else if (ret)
+			changed[changed_count++] = paths[i];
+	}
+
+	/* Anything that wasn't given is gone from the source */
+	pruned_count = 0;
+	for (i = 0; i < idx->ent_count && !err && flags & FTAR_UPDATE_PRUNE;
+	     i++) {
+		if (!seen[i] &&
+		    !(idx->entries[i].hdr.flags & FTAR_ENT_DELETED) &&
+		    idx->entries[i].hdr.type != FTAR_FTYPE_DICT &&
+		    idx->entries[i].hdr.type != FTAR_FTYPE_CHUNK &&
+		    ftar_index_find(idx, idx->entries[i].hdr.name) ==
+			    &idx->entries[i])
+			pruned[pruned_count++] = idx->entries[i].hdr.name;
+	}
+
+	/* Unchanged entries stay where they are */
+	if (!err && changed_count &&
+	    ftar_add(archive, changed, changed_count, opts) < 0)
+		err = errno;
+	if (!err && pruned_count &&
+	    ftar_delete(archive, pruned, pruned_count) < 0)
+		err = errno;
+
+	free(seen);
+	free(pruned);
+	free(changed);
+	ftar_index_free(idx);
+	close(fd);
+
+	errno = err;
+	return err ? -1 : 0;
+}
+
+/* Mark the chunks used by a live manifest */
+static int compact_mark_chunks(int fd, struct ftar_index *idx,
+			       struct ftar_index_ent *ent, bool *keep)
+{
+	struct ftar_index_ent *chunk;
+	char name[FTAR_HASH_SIZE * 2 + 1];
+	uint8_t *manifest;
+	uint32_t count;
+	size_t i;
+
+	if (ent->hdr.size < FTAR_MANIFEST_HDR_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	manifest = malloc(ent->hdr.size);
+	if (!manifest)
+		return -1;
+	if (edit_pread(fd, manifest, ent->hdr.size, ent->data_off) < 0) {
+		free(manifest);
+		return -1;
+	}
+	memcpy(&count, manifest + sizeof(uint64_t), sizeof(uint32_t));
+	if (count > (ent->hdr.size - FTAR_MANIFEST_HDR_SIZE) / FTAR_HASH_SIZE) {
+		free(manifest);
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Chunks that come from a base aren't in the index at all */
+	for (i = 0; i < count; i++) {
+		ftar_chunk_name(manifest + FTAR_MANIFEST_HDR_SIZE +
+					i * FTAR_HASH_SIZE,
+				name);
+		chunk = ftar_index_find(idx, name);
+		if (chunk)
+			keep[chunk - idx->entries] = true;
+	}
+	free(manifest);
+
+	errno = 0;
+	return 0;
+}
+
+/* Write exactly `len` bytes to the end of a file */
+static int compact_write(int out, const void *buf, size_t len)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = write(out, (const char *)buf + done, len - done);
+		if (n < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Copy `len` bytes from one file to the end of another, in the kernel if it
+ *  can (which can share the blocks instead of copying them on some
+ *  filesystems)
+ */
+static int compact_copy(int in, int out, uint64_t off, uint64_t len,
+			char *buf)
+{
+	size_t n;
+#ifdef __linux__
+	ssize_t w;
+	loff_t in_off;
+
+	in_off = off;
+	while (len) {
+		w = copy_file_range(in, &in_off, out, NULL, len, 0);
+		if (w < 0 && (errno == ENOSYS || errno == EXDEV ||
+			      errno == EINVAL || errno == EOPNOTSUPP))
+			break; /* Do it the normal way */
+		if (w < 0)
+			return -1;
+		if (!w) {
+			errno = EINVAL;
+			return -1;
+		}
+		len -= w;
+	}
+	off = in_off;
+#endif
+
+	while (len) {
+		n = len < FTAR_COMPACT_BUF_SIZE ? len : FTAR_COMPACT_BUF_SIZE;
+		if (edit_pread(in, buf, n, off) < 0 ||
+		    compact_write(out, buf, n) < 0)
+			return -1;
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int ftar_compact(const char *archive, double threshold)
+{
+	static const char zero_block[FTAR_BLOCK_SIZE];
+	struct ftar_index_ent *ent;
+	struct ftar_index *idx;
+	char hdr[FTAR_HDR_SIZE];
+	struct stat st;
+	uint64_t out_pos;
+	uint64_t run_start;
+	uint64_t run_len;
+	uint64_t dead;
+	size_t old_pad;
+	size_t kept;
+	size_t pad;
+	size_t i;
+	char *tmp;
+	char *buf;
+	bool *keep;
+	int out;
+	int fd;
+	int err;
+
+	errno = 0;
+
+	if (!archive) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = open(archive, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	idx = ftar_index_fd(fd);
+	if (!idx || fstat(fd, &st) < 0) {
+		err = errno;
+		ftar_index_free(idx);
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	/*
+	 * Deleted entries are dead, and so are chunks nothing live uses any
+	 *  more. Dictionaries are kept, since finding their users would mean
+	 *  reading every payload.
+	 */
+	err = 0;
+	keep = calloc(idx->ent_count ? idx->ent_count : 1, sizeof(bool));
+	if (!keep)
+		err = errno;
+	for (i = 0; i < idx->ent_count && !err; i++) {
+		if (idx->entries[i].hdr.flags & FTAR_ENT_DELETED)
+			continue;
+		if (idx->entries[i].hdr.type != FTAR_FTYPE_CHUNK)
+			keep[i] = true;
+		if (idx->entries[i].hdr.codec == FTAR_CODEC_CHUNKED &&
+		    compact_mark_chunks(fd, idx, &idx->entries[i], keep) < 0)
+			err = errno;
+	}
+	dead = 0;
+	kept = 0;
+	for (i = 0; i < idx->ent_count && !err; i++) {
+		if (keep[i])
+			kept++;
+		else
+			dead += idx->entries[i].data_off +
+				idx->entries[i].hdr.size - idx->entries[i].off;
+	}
+
+	/* Leave the archive alone until enough of it is dead (0 always goes) */
+	if (err || (threshold > 0 &&
+		    (!dead || (double)dead < threshold * idx->end))) {
+		free(keep);
+		ftar_index_free(idx);
+		close(fd);
+		errno = err;
+		return err ? -1 : 0;
+	}
+
+	/* The live entries go to a new file, which then replaces the old one */
+	out = -1;
+	buf = NULL;
+	tmp = malloc(strlen(archive) + sizeof(FTAR_COMPACT_SUFFIX));
+	if (!tmp)
+		err = errno;
+	if (!err) {
+		strcpy(tmp, archive);
+		strcat(tmp, FTAR_COMPACT_SUFFIX);
+		out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC,
+			   st.st_mode & 07777);
+		if (out < 0)
+			err = errno;
+	}
+	if (!err) {
+		buf = malloc(FTAR_COMPACT_BUF_SIZE);
+		if (!buf)
+			err = errno;
+	}
+	ftar_archive_hdr(hdr, kept, idx->align);
+	if (!err && compact_write(out, hdr, FTAR_HDR_SIZE) < 0)
+		err = errno;
+
+	/*
+	 * Runs of live entries are contiguous, so each is one big copy, as long
+	 *  as moving them doesn't change their padding
+	 */
+	out_pos = FTAR_HDR_SIZE;
+	run_start = 0;
+	run_len = 0;
+	for (i = 0; i < idx->ent_count && !err; i++) {
+		if (!keep[i])
+			continue;
+		ent = &idx->entries[i];
+		pad = ftar_payload_pad(out_pos, ent->hdr.size, idx->align);
+		old_pad = ent->data_off - ent->off - FTAR_ENT_HDR_SIZE;
+		out_pos += FTAR_ENT_HDR_SIZE + pad + ent->hdr.size;
+		if (run_len &&
+		    (ent->off != run_start + run_len || pad != old_pad)) {
+			if (compact_copy(fd, out, run_start, run_len, buf) < 0)
+				err = errno;
+			run_len = 0;
+		}
+		if (pad == old_pad) {
+			if (!run_len)
+				run_start = ent->off;
+			run_len += ent->data_off + ent->hdr.size - ent->off;
+			continue;
+		}
+
+		/* Otherwise the payload starts a new run after new padding */
+		memset(buf, 0, pad);
+		if (!err && (compact_copy(fd, out, ent->off, FTAR_ENT_HDR_SIZE,
+					  buf + pad) < 0 ||
+			     compact_write(out, buf, pad) < 0))
+			err = errno;
+		run_start = ent->data_off;
+		run_len = ent->hdr.size;
+	}
+	if (!err && run_len &&
+	    compact_copy(fd, out, run_start, run_len, buf) < 0)
+		err = errno;
+
+	/* Finish it off the same way as any other archive */
+	if (!err && (compact_write(out, zero_block, sizeof(zero_block)) < 0 ||
+		     compact_write(out, zero_block, sizeof(zero_block)) < 0 ||
+		     fsync(out) < 0))
+		err = errno;
+	if (out >= 0 && close(out) < 0 && !err)
+		err = errno;
+	if (!err && rename(tmp, archive) < 0)
+		err = errno;
+	if (err && out >= 0)
+		remove(tmp);
+
+	free(tmp);
+	free(buf);
+	free(keep);
+	ftar_index_free(idx);
+	close(fd);
+
+	errno = err;
+	return err ? -1 : 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
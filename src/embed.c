@@ -0,0 +1,309 @@
+#define _XOPEN_SOURCE 700
+
+#include <ctype.h>
+
+#include "frankentar/embed.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Give up on a bucket after this many seeds (it never gets close) */
+#define EMBED_MAX_SEED (1u << 24)
+
+/* Bytes of a file per line of the header */
+#define EMBED_LINE 64
+
+struct embed_file {
+	struct ftar_ent *ent;
+	size_t name_len;
+	size_t array; /* The array its contents are in */
+	size_t slot;
+};
+
+struct embed_bucket {
+	size_t start; /* Where its files start in the bucket order */
+	size_t count;
+	uint32_t seed;
+};
+
+uint64_t ftar_embed_hash(const char *name, size_t len, uint32_t seed)
+{
+	uint64_t h;
+	size_t i;
+
+	h = 14695981039346656037ull ^ seed;
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 1099511628211ull;
+	}
+
+	return h ^ (h >> 29);
+}
+
+/* Biggest buckets first, they're the hardest to place */
+static int embed_bucket_cmp(const void *a, const void *b)
+{
+	const struct embed_bucket *x = *(const struct embed_bucket *const *)a;
+	const struct embed_bucket *y = *(const struct embed_bucket *const *)b;
+
+	return (x->count < y->count) - (x->count > y->count);
+}
+
+/* Write bytes as the inside of a string literal */
+static void embed_literal(FILE *out, const char *data, size_t len)
+{
+	unsigned char c;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		c = data[i];
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c >= ' ' && c <= '~' && c != '?')
+			fputc(c, out);
+		else /* Octal escapes always stop after three digits */
+			fprintf(out, "\\%03o", c);
+	}
+}
+
+/* Find a seed for every bucket that puts each file in a slot of its own */
+static int embed_place(struct embed_file *files, size_t count,
+		       struct embed_bucket *buckets, size_t *order)
+{
+	struct embed_bucket **sorted;
+	struct embed_bucket *b;
+	struct embed_file *f;
+	bool *taken;
+	uint32_t seed;
+	size_t slot;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	sorted = calloc(count, sizeof(struct embed_bucket *));
+	taken = calloc(count, sizeof(bool));
+	if (!sorted || !taken) {
+		free(sorted);
+		free(taken);
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+		sorted[i] = &buckets[i];
+	qsort(sorted, count, sizeof(struct embed_bucket *), embed_bucket_cmp);
+
+	for (i = 0; i < count && sorted[i]->count; i++) {
+		b = sorted[i];
+		for (seed = 1; seed < EMBED_MAX_SEED; seed++) {
+			/* Take slots, handing them back if one's taken */
+			for (j = 0; j < b->count; j++) {
+				f = &files[order[b->start + j]];
+				slot = ftar_embed_hash(f->ent->name, f->name_len,
+						       seed) %
+				       count;
+				if (taken[slot])
+					break;
+				taken[slot] = true;
+				f->slot = slot;
+			}
+			if (j == b->count)
+				break;
+			for (k = 0; k < j; k++)
+				taken[files[order[b->start + k]].slot] = false;
+		}
+		if (seed == EMBED_MAX_SEED) {
+			free(sorted);
+			free(taken);
+			errno = ERANGE;
+			return -1;
+		}
+		b->seed = seed;
+	}
+
+	free(sorted);
+	free(taken);
+	return 0;
+}
+
+static bool embed_ns_ok(const char *ns)
+{
+	size_t i;
+
+	if (!isalpha((unsigned char)ns[0]) && ns[0] != '_')
+		return false;
+	for (i = 1; ns[i]; i++) {
+		if (!isalnum((unsigned char)ns[i]) && ns[i] != '_')
+			return false;
+	}
+
+	return true;
+}
+
+int ftar_embed(FILE *out, struct ftar *tar, const char *ns)
+{
+	struct embed_bucket *buckets;
+	struct embed_file *files;
+	struct embed_file *f;
+	struct ftar_ent *ent;
+	size_t *by_slot;
+	size_t *order;
+	size_t arrays;
+	size_t count;
+	size_t off;
+	size_t i;
+	size_t j;
+	int err;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!ns)
+		ns = FTAR_EMBED_NS;
+	if (!out || !tar || !embed_ns_ok(ns)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	files = calloc(tar->ent_count ? tar->ent_count : 1,
+		       sizeof(struct embed_file));
+	if (!files)
+		return -1;
+	buckets = NULL;
+	order = NULL;
+	by_slot = NULL;
+
+	/* Only the first file with a name can be found, like with `ftar_find` */
+	count = 0;
+	arrays = 0;
+	for (i = 0; i < tar->ent_count; i++) {
+		ent = tar->entries[i];
+		if (ent->type != FTAR_FTYPE_REG && ent->type != FTAR_FTYPE_LINK)
+			continue;
+		f = &files[count];
+		f->ent = ent;
+		f->name_len = strnlen(ent->name, sizeof(ent->name));
+		for (j = 0; j < count; j++) {
+			if (files[j].name_len == f->name_len &&
+			    memcmp(files[j].ent->name, ent->name,
+				   f->name_len) == 0)
+				break;
+		}
+		if (j < count)
+			continue;
+
+		/* Links with no payload of their own share their target's */
+		f->array = arrays;
+		for (j = 0; j < count && ent->data; j++) {
+			if (files[j].ent->data == ent->data) {
+				f->array = files[j].array;
+				break;
+			}
+		}
+		if (f->array == arrays)
+			arrays++;
+		count++;
+	}
+
+	fprintf(out, "/* Generated by ftar embed, don't edit */\n\n"
+		     "#pragma once\n\n"
+		     "#include \"frankentar_embed.hpp\"\n\n"
+		     "namespace frankentar::%s\n{\n\n",
+		ns);
+	if (!count) {
+		fprintf(out,
+			"constexpr const embedded_file *find(std::string_view)"
+			" noexcept\n{\n\treturn nullptr;\n}\n");
+		goto done;
+	}
+
+	/* Sort the files into buckets */
+	buckets = calloc(count, sizeof(struct embed_bucket));
+	order = calloc(count, sizeof(size_t));
+	by_slot = calloc(count, sizeof(size_t));
+	if (!buckets || !order || !by_slot)
+		goto fail;
+	for (i = 0; i < count; i++) {
+		f = &files[i];
+		buckets[ftar_embed_hash(f->ent->name, f->name_len, 0) % count]
+			.count++;
+	}
+	for (i = 1; i < count; i++)
+		buckets[i].start = buckets[i - 1].start + buckets[i - 1].count;
+
+	/* Until they're placed, seeds count the files put in each bucket */
+	for (i = 0; i < count; i++) {
+		f = &files[i];
+		j = ftar_embed_hash(f->ent->name, f->name_len, 0) % count;
+		order[buckets[j].start + buckets[j].seed++] = i;
+	}
+	for (i = 0; i < count; i++)
+		buckets[i].seed = 0;
+	if (embed_place(files, count, buckets, order) < 0)
+		goto fail;
+	for (i = 0; i < count; i++)
+		by_slot[files[i].slot] = i;
+
+	/* The contents, each once */
+	for (i = 0, j = 0; i < count; i++) {
+		f = &files[i];
+		if (f->array != j)
+			continue;
+		fprintf(out, "inline constexpr char file_%zu[] =", j++);
+		if (!f->ent->size)
+			fprintf(out, " \"\"");
+		for (off = 0; off < f->ent->size; off += EMBED_LINE) {
+			fprintf(out, "\n\t\"");
+			embed_literal(out, f->ent->data + off,
+				      f->ent->size - off < EMBED_LINE ?
+					      f->ent->size - off :
+					      EMBED_LINE);
+			fputc('"', out);
+		}
+		fprintf(out, ";\n\n");
+	}
+
+	/* The table, in slot order */
+	fprintf(out, "inline constexpr embedded_file files[] = {\n");
+	for (i = 0; i < count; i++) {
+		f = &files[by_slot[i]];
+		fprintf(out, "\t{ \"");
+		embed_literal(out, f->ent->name, f->name_len);
+		fprintf(out, "\", { file_%zu, %zu }, %ld, %d },\n", f->array,
+			f->ent->size, f->ent->mtime, f->ent->mode);
+	}
+	fprintf(out, "};\n\ninline constexpr std::uint32_t seeds[] = {");
+	for (i = 0; i < count; i++)
+		fprintf(out, "%s%s%u", i ? "," : "", i % 8 ? " " : "\n\t",
+			buckets[i].seed);
+	fprintf(out,
+		"\n};\n\n"
+		"constexpr const embedded_file *find(std::string_view name)"
+		" noexcept\n{\n\treturn embed_find(files, seeds, name);\n}\n");
+done:
+	fprintf(out, "\n} // namespace frankentar::%s\n", ns);
+
+	free(by_slot);
+	free(order);
+	free(buckets);
+	free(files);
+	if (ferror(out)) {
+		errno = EIO;
+		return -1;
+	}
+
+	errno = 0;
+
+	return 0;
+fail:
+	err = errno;
+	free(by_slot);
+	free(order);
+	free(buckets);
+	free(files);
+	errno = err;
+	return -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,516 @@
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "frankentar/aio.h"
+#include "frankentar/compress.h"
+#include "frankentar/extract.h"
+#include "frankentar/index.h"
+#include "frankentar/scan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct extract {
+	const char *archive;
+	int err; /* The first error from a read done with `ftar_aio` */
+	int fd; /* The file being written */
+	char *buf; /* The stored payload so far, if it's needed whole */
+	size_t cap;
+	char *dict;
+	size_t dict_len;
+	int ar_fd; /* For reading chunks and links out of order */
+	struct ftar_index *idx;
+	int base_fd; /* What a delta pack's missing chunks come from */
+	struct ftar_index *base;
+};
+
+/* Names can't be absolute or go up a directory */
+static bool extract_name_ok(const char *name)
+{
+	const char *p;
+
+	if (!name[0] || name[0] == '/')
+		return false;
+	for (p = name; p; p = strchr(p, '/')) {
+		if (*p == '/')
+			p++;
+		if (p[0] == '.' && p[1] == '.' && (!p[2] || p[2] == '/'))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Make the directories a name is in, or with `make` false just check them.
+ *  Each one has to really be a directory, since a symlink made by an earlier
+ *  entry could point anywhere.
+ */
+static int extract_parents(const char *name, bool make)
+{
+	char path[sizeof(((struct ftar_ent *)0)->name)];
+	struct stat st;
+	char *p;
+
+	if (!extract_name_ok(name)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	strcpy(path, name);
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = 0;
+		if (make && mkdir(path, 0755) < 0 && errno != EEXIST)
+			return -1;
+		if (lstat(path, &st) < 0)
+			return -1;
+		if (!S_ISDIR(st.st_mode)) {
+			errno = EINVAL;
+			return -1;
+		}
+		*p = '/';
+	}
+
+	errno = 0;
+
+	return 0;
+}
+
+/* Make the directories a name is in, and get rid of whatever's there now */
+static int extract_prepare(const char *name)
+{
+	if (extract_parents(name, true) < 0)
+		return -1;
+
+	/* Don't write through a link to something else */
+	if (unlink(name) < 0 && errno != ENOENT && errno != EISDIR &&
+	    errno != EPERM)
+		return -1;
+
+	errno = 0;
+
+	return 0;
+}
+
+static int extract_write(int fd, const void *data, size_t len)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = write(fd, (const char *)data + done, len - done);
+		if (n < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int extract_open(struct extract *x, const struct ftar_ent *hdr)
+{
+	if (extract_prepare(hdr->name) < 0)
+		return -1;
+	x->fd = open(hdr->name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	return x->fd < 0 ? -1 : 0;
+}
+
+/* Give a file its mode and mtime, then close it */
+static int extract_close(struct extract *x, const struct ftar_ent *hdr)
+{
+	struct timespec times[2];
+	int err;
+
+	times[0].tv_sec = hdr->mtime;
+	times[0].tv_nsec = 0;
+	times[1] = times[0];
+	err = fchmod(x->fd, hdr->mode & 07777) < 0 ||
+	      futimens(x->fd, times) < 0;
+	if (close(x->fd) < 0)
+		err = 1;
+	x->fd = -1;
+
+	return err ? -1 : 0;
+}
+
+static int extract_file(struct extract *x, const struct ftar_ent *hdr,
+			const void *data, size_t len)
+{
+	if (extract_open(x, hdr) < 0 || extract_write(x->fd, data, len) < 0)
+		return -1;
+	return extract_close(x, hdr);
+}
+
+/* Read an entry through the index, for the ones that need other entries */
+static int extract_indexed(struct extract *x, const struct ftar_ent *hdr)
+{
+	struct ftar_index_ent *ent;
+	size_t len;
+	char *data;
+	int err;
+
+	if (!x->idx) {
+		x->ar_fd = open(x->archive, O_RDONLY);
+		if (x->ar_fd < 0)
+			return -1;
+		x->idx = ftar_index_fd(x->ar_fd);
+		if (!x->idx)
+			return -1;
+	}
+
+	ent = ftar_index_find(x->idx, hdr->name);
+	if (!ent)
+		return -1;
+	data = ftar_index_read_base(x->ar_fd, x->idx, x->base_fd, x->base, ent,
+				    &len);
+	if (!data)
+		return -1;
+	err = extract_file(x, hdr, data, len);
+	free(data);
+
+	return err;
+}
+
+/* Copy the rest of one file to another, in the kernel if it can */
+static int extract_copy(int in, int out)
+{
+	char buf[16384];
+	ssize_t n;
+
+#ifdef __linux__
+	for (;;) {
+		n = copy_file_range(in, NULL, out, NULL, SSIZE_MAX, 0);
+		if (!n)
+			return 0;
+		if (n < 0 && (errno == ENOSYS || errno == EXDEV ||
+			      errno == EINVAL || errno == EOPNOTSUPP))
+			break; /* Do it the normal way */
+		if (n < 0)
+			return -1;
+	}
+#endif
+
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (extract_write(out, buf, n) < 0)
+			return -1;
+	}
+
+	return n < 0 ? -1 : 0;
+}
+
+/*
+ * Copy the earlier file with the same contents. Only the contents are the
+ *  same, so it isn't a hard link: the copy gets its own mode and mtime, and
+ *  writing to one doesn't change the other.
+ */
+static int extract_link(struct extract *x, const struct ftar_ent *hdr)
+{
+	struct stat st;
+	int err;
+	int in;
+
+	if (!extract_name_ok(hdr->link))
+		return extract_indexed(x, hdr);
+
+	if (extract_parents(hdr->link, false) < 0)
+		return -1;
+	in = open(hdr->link, O_RDONLY | O_NOFOLLOW);
+	if (in < 0)
+		return -1;
+
+	err = 0;
+	if (fstat(in, &st) < 0) {
+		err = errno;
+	} else if (!S_ISREG(st.st_mode)) {
+		err = EINVAL;
+	} else if (extract_open(x, hdr) < 0) {
+		err = errno;
+	} else if (extract_copy(in, x->fd) < 0) {
+		err = errno;
+		close(x->fd);
+		x->fd = -1;
+	}
+	close(in);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return extract_close(x, hdr);
+}
+
+/* Handle an entry with nothing left to read */
+static int extract_ent(struct extract *x, const struct ftar_ent *hdr)
+{
+	const void *dict;
+	struct stat st;
+	size_t dict_len;
+	size_t len;
+	char *data;
+	int err;
+
+	switch (hdr->type) {
+	case FTAR_FTYPE_DIR:
+		if (extract_parents(hdr->name, true) < 0)
+			return -1;
+		if (mkdir(hdr->name, 0700) < 0 && errno != EEXIST)
+			return -1;
+		if (lstat(hdr->name, &st) < 0)
+			return -1;
+		if (!S_ISDIR(st.st_mode)) {
+			errno = EINVAL;
+			return -1;
+		}
+		return chmod(hdr->name, hdr->mode & 07777);
+	case FTAR_FTYPE_SYMLINK:
+		if (extract_prepare(hdr->name) < 0)
+			return -1;
+		return symlink(hdr->link, hdr->name);
+	case FTAR_FTYPE_FIFO:
+		if (extract_prepare(hdr->name) < 0)
+			return -1;
+		return mkfifo(hdr->name, hdr->mode & 07777);
+	case FTAR_FTYPE_SPECIAL:
+	case FTAR_FTYPE_WHITEOUT:
+		/* There's nothing stored to make one from */
+		return 0;
+	case FTAR_FTYPE_LINK:
+		if (hdr->link[0] && !hdr->size)
+			return extract_link(x, hdr);
+		break;
+	default:
+		break;
+	}
+
+	switch (hdr->codec) {
+	case FTAR_CODEC_NONE:
+		/* Already written */
+		return extract_close(x, hdr);
+	case FTAR_CODEC_LZ:
+	case FTAR_CODEC_LZ_DICT:
+		dict = NULL;
+		dict_len = 0;
+		if (hdr->codec == FTAR_CODEC_LZ_DICT) {
+			if (!x->dict) {
+				errno = EINVAL;
+				return -1;
+			}
+			dict = x->dict;
+			dict_len = x->dict_len;
+		}
+		data = ftar_decompress(x->buf, hdr->size, dict, dict_len, &len);
+		if (!data)
+			return -1;
+		err = extract_file(x, hdr, data, len);
+		free(data);
+		return err;
+	case FTAR_CODEC_CHUNKED:
+		return extract_indexed(x, hdr);
+	default:
+		/* Deltas are only in patches */
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+/* Keep a dictionary for the entries after it */
+static int extract_dict(struct extract *x, const struct ftar_ent *hdr)
+{
+	free(x->dict);
+	x->dict = NULL;
+	if (hdr->codec == FTAR_CODEC_NONE) {
+		x->dict = malloc(hdr->size ? hdr->size : 1);
+		if (!x->dict)
+			return -1;
+		memcpy(x->dict, x->buf, hdr->size);
+		x->dict_len = hdr->size;
+		return 0;
+	}
+
+	x->dict = ftar_decompress(x->buf, hdr->size, NULL, 0, &x->dict_len);
+	return x->dict ? 0 : -1;
+}
+
+static int extract_piece(const struct ftar_ent *hdr, const void *data,
+			 size_t len, uint64_t off, void *user)
+{
+	struct extract *x;
+	bool stream;
+	char *buf;
+
+	x = user;
+	if (hdr->type == FTAR_FTYPE_CHUNK)
+		return 0;
+
+	/* Raw files are written as they come in, anything else is kept */
+	stream = hdr->codec == FTAR_CODEC_NONE &&
+		 (hdr->type == FTAR_FTYPE_REG ||
+		  (hdr->type == FTAR_FTYPE_LINK && !hdr->link[0]));
+	if (stream) {
+		if (!off && extract_open(x, hdr) < 0)
+			return -1;
+		if (extract_write(x->fd, data, len) < 0)
+			return -1;
+	} else if (hdr->codec != FTAR_CODEC_CHUNKED) {
+		if (hdr->size > x->cap) {
+			buf = realloc(x->buf, hdr->size);
+			if (!buf)
+				return -1;
+			x->buf = buf;
+			x->cap = hdr->size;
+		}
+		if (len)
+			memcpy(x->buf + off, data, len);
+	}
+
+	if (off + len < hdr->size)
+		return 0;
+	if (hdr->type == FTAR_FTYPE_DICT)
+		return extract_dict(x, hdr);
+	return extract_ent(x, hdr);
+}
+
+static void extract_done(struct ftar_index_ent *ent, char *data, size_t len,
+			 int err, void *user)
+{
+	struct extract *x;
+
+	x = user;
+	if (!err && extract_file(x, &ent->hdr, data, len) < 0)
+		err = errno;
+	if (err && !x->err)
+		x->err = err;
+	free(data);
+}
+
+/* Check whether an entry needs chunks from the base, which aio can't read */
+static bool extract_from_base(struct extract *x, struct ftar_index_ent *ent)
+{
+	if (!x->base)
+		return false;
+
+	if (ent->hdr.type == FTAR_FTYPE_LINK && ent->hdr.link[0] &&
+	    !ent->hdr.size)
+		ent = ftar_index_find(x->idx, ent->hdr.link);
+
+	return ent && ent->hdr.codec == FTAR_CODEC_CHUNKED;
+}
+
+/* Read just the entries asked for, all at once */
+static int extract_some(struct extract *x, const char *const *names,
+			size_t count)
+{
+	struct ftar_index_ent *ent;
+	struct ftar_aio *aio;
+	size_t i;
+
+	x->ar_fd = open(x->archive, O_RDONLY);
+	if (x->ar_fd < 0)
+		return -1;
+	x->idx = ftar_index_fd(x->ar_fd);
+	if (!x->idx)
+		return -1;
+
+	/* Check the names first, so nothing's written if one's wrong */
+	for (i = 0; i < count; i++) {
+		ent = ftar_index_find(x->idx, names[i]);
+		if (!ent || ent->hdr.type == FTAR_FTYPE_DICT ||
+		    ent->hdr.type == FTAR_FTYPE_CHUNK) {
+			errno = ENOENT;
+			return -1;
+		}
+		if (!extract_name_ok(names[i])) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	aio = ftar_aio_create(x->ar_fd, x->idx, NULL);
+	if (!aio)
+		return -1;
+	for (i = 0; i < count; i++) {
+		ent = ftar_index_find(x->idx, names[i]);
+		if (extract_from_base(x, ent)) {
+			if (extract_indexed(x, &ent->hdr) < 0)
+				break;
+		} else if (ent->hdr.type == FTAR_FTYPE_REG ||
+			   ent->hdr.type == FTAR_FTYPE_LINK) {
+			if (ftar_aio_read(aio, ent, extract_done, x) < 0)
+				break;
+		} else if (extract_ent(x, &ent->hdr) < 0) {
+			break;
+		}
+	}
+	if (i < count || ftar_aio_wait(aio) < 0) {
+		x->err = errno;
+		ftar_aio_free(aio);
+		return -1;
+	}
+	ftar_aio_free(aio);
+
+	errno = x->err;
+	return x->err ? -1 : 0;
+}
+
+int ftar_extract(const char *archive, const char *const *names, size_t count,
+		 const struct ftar_scan_opts *opts)
+{
+	return ftar_extract_base(archive, NULL, names, count, opts);
+}
+
+int ftar_extract_base(const char *archive, const char *base,
+		      const char *const *names, size_t count,
+		      const struct ftar_scan_opts *opts)
+{
+	struct extract x;
+	int err;
+
+	errno = 0;
+
+	if (!archive || (count && !names)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&x, 0, sizeof(struct extract));
+	x.archive = archive;
+	x.fd = -1;
+	x.ar_fd = -1;
+	x.base_fd = -1;
+	err = 0;
+	if (base) {
+		x.base_fd = open(base, O_RDONLY);
+		if (x.base_fd >= 0)
+			x.base = ftar_index_fd(x.base_fd);
+		if (!x.base)
+			err = errno;
+	}
+	if (!err && count)
+		err = extract_some(&x, names, count) < 0 ? errno : 0;
+	else if (!err)
+		err = ftar_scan(archive, opts, extract_piece, &x) < 0 ? errno :
+									0;
+
+	if (x.fd >= 0)
+		close(x.fd);
+	if (x.ar_fd >= 0)
+		close(x.ar_fd);
+	if (x.base_fd >= 0)
+		close(x.base_fd);
+	ftar_index_free(x.idx);
+	ftar_index_free(x.base);
+	free(x.buf);
+	free(x.dict);
+
+	errno = err;
+	return err ? -1 : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,595 @@
+#define _XOPEN_SOURCE 501
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "frankentar/chunk.h"
+#include "frankentar/compress.h"
+#include "frankentar/index.h"
+#include "frankentar/util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Read exactly `len` bytes, failing with EINVAL if the file is too short */
+static int index_pread(int fd, void *buf, size_t len, uint64_t off)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = pread(fd, (char *)buf + done, len - done, off + done);
+		if (n < 0)
+			return -1;
+		if (!n) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Read the headers of entries `from` on, the first of which is at `off` */
+static int index_scan(int fd, struct ftar_index *idx, size_t from,
+		      uint64_t off, uint64_t limit)
+{
+	struct ftar_index_ent *ent;
+	struct ftar_ent **slot;
+	size_t *dicts;
+	size_t i;
+
+	/* Read each header, skipping over the payloads */
+	for (i = from; i < idx->ent_count; i++) {
+		ent = &idx->entries[i];
+		if (index_pread(fd, &ent->hdr, FTAR_ENT_HDR_SIZE, off) < 0)
+			return -1;
+		ent->hdr.name[sizeof(ent->hdr.name) - 1] = 0;
+		ent->hdr.data = NULL;
+		ent->off = off;
+		ent->data_off = off + FTAR_ENT_HDR_SIZE +
+				ftar_payload_pad(off - idx->start,
+						 ent->hdr.size, idx->align);
+		off = ent->data_off + ent->hdr.size;
+		if (off > limit) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		/* Entries use the last dictionary before them */
+		if (ent->hdr.type == FTAR_FTYPE_DICT) {
+			dicts = realloc(idx->dicts, (idx->dict_count + 1) *
+							    sizeof(size_t));
+			if (!dicts)
+				return -1;
+			idx->dicts = dicts;
+			idx->dicts[idx->dict_count++] = i;
+		}
+
+		/* Deleted entries only count towards the dead space */
+		if (ent->hdr.flags & FTAR_ENT_DELETED) {
+			idx->dead += off - ent->off;
+			continue;
+		}
+		slot = ftar_name_slot(idx->names, idx->mask, ent->hdr.name);
+		if (!*slot)
+			*slot = &ent->hdr;
+	}
+	idx->end = off;
+
+	return 0;
+}
+
+struct ftar_index *ftar_index_fd(int fd)
+{
+	struct stat st;
+
+	errno = 0;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	return ftar_index_fd_at(fd, 0, st.st_size);
+}
+
+struct ftar_index *ftar_index_fd_at(int fd, uint64_t start, uint64_t len)
+{
+	struct ftar_index *idx;
+	char hdr[FTAR_HDR_SIZE];
+	int err;
+
+	errno = 0;
+
+	/* Check the archive header */
+	if (index_pread(fd, hdr, FTAR_HDR_SIZE, start) < 0)
+		return NULL;
+	idx = calloc(1, sizeof(struct ftar_index));
+	if (!idx)
+		return NULL;
+	idx->start = start;
+	if (ftar_archive_align(hdr, &idx->align) < 0) {
+		free(idx);
+		return NULL;
+	}
+	memcpy(&idx->ent_count, hdr + FTAR_MAGIC_LEN, sizeof(size_t));
+	if (idx->ent_count > len / FTAR_ENT_HDR_SIZE) { /* Can't be right */
+		free(idx);
+		errno = EINVAL;
+		return NULL;
+	}
+	idx->entries = calloc(idx->ent_count ? idx->ent_count : 1,
+			      sizeof(struct ftar_index_ent));
+	for (idx->mask = 1; idx->mask < idx->ent_count * 2; idx->mask <<= 1)
+		;
+	idx->names = calloc(idx->mask--, sizeof(struct ftar_ent *));
+	if (!idx->entries || !idx->names)
+		goto fail;
+
+	if (index_scan(fd, idx, 0, start + FTAR_HDR_SIZE, start + len) < 0)
+		goto fail;
+
+	errno = 0;
+
+	return idx;
+fail:
+	err = errno;
+	ftar_index_free(idx);
+	errno = err;
+	return NULL;
+}
+
+/* Fill an index's name table in again after entries were deleted */
+static void index_names(struct ftar_index *idx)
+{
+	struct ftar_ent **slot;
+	size_t i;
+
+	memset(idx->names, 0, (idx->mask + 1) * sizeof(struct ftar_ent *));
+	for (i = 0; i < idx->ent_count; i++) {
+		if (idx->entries[i].hdr.flags & FTAR_ENT_DELETED)
+			continue;
+		slot = ftar_name_slot(idx->names, idx->mask,
+				      idx->entries[i].hdr.name);
+		if (!*slot)
+			*slot = &idx->entries[i].hdr;
+	}
+}
+
+/* Read an old header again, noting whether it changed */
+static int index_reread(int fd, struct ftar_index *idx,
+			struct ftar_index_ent *ent, bool *changed)
+{
+	struct ftar_ent hdr;
+
+	if (index_pread(fd, &hdr, FTAR_ENT_HDR_SIZE, ent->off) < 0)
+		return -1;
+	hdr.name[sizeof(hdr.name) - 1] = 0;
+	hdr.data = NULL;
+	if (memcmp(&hdr, &ent->hdr, FTAR_ENT_HDR_SIZE) == 0)
+		return 0;
+
+	if (hdr.flags & FTAR_ENT_DELETED &&
+	    !(ent->hdr.flags & FTAR_ENT_DELETED))
+		idx->dead += ent->data_off + ent->hdr.size - ent->off;
+	memcpy(&ent->hdr, &hdr, FTAR_ENT_HDR_SIZE);
+	*changed = true;
+
+	return 0;
+}
+
+/*
+ * Appending replaces entries by marking the old ones deleted in place, or
+ *  if dedup links point at one, by renaming it to the first link and
+ *  deleting that link instead (see `edit_kill`). Only entries with the names
+ *  of new ones (from `from` on) and the links to them can have been touched,
+ *  so those are the only old headers read again.
+ */
+static int index_recheck(int fd, struct ftar_index *idx, size_t from)
+{
+	char name[sizeof(((struct ftar_ent *)0)->name)];
+	struct ftar_index_ent *old;
+	struct ftar_ent *hdr;
+	bool replaced;
+	bool changed;
+	size_t i;
+	size_t j;
+
+	do {
+		changed = false;
+		for (i = from; i < idx->ent_count; i++) {
+			if (idx->entries[i].hdr.flags & FTAR_ENT_DELETED)
+				continue;
+			old = ftar_index_find(idx, idx->entries[i].hdr.name);
+			if (!old || old - idx->entries >= (ptrdiff_t)from)
+				continue;
+			memcpy(name, old->hdr.name, sizeof(name));
+			replaced = false;
+			if (index_reread(fd, idx, old, &replaced) < 0)
+				return -1;
+			if (!replaced)
+				continue;
+			changed = true;
+
+			/* Links to it are either deleted or pointed elsewhere */
+			for (j = old - idx->entries + 1; j < from; j++) {
+				hdr = &idx->entries[j].hdr;
+				if (hdr->flags & FTAR_ENT_DELETED ||
+				    hdr->type != FTAR_FTYPE_LINK || hdr->size ||
+				    strcmp(hdr->link, name) != 0)
+					continue;
+				if (index_reread(fd, idx, &idx->entries[j],
+						 &changed) < 0)
+					return -1;
+			}
+		}
+
+		/* An older entry with the same name might show through now */
+		if (changed)
+			index_names(idx);
+	} while (changed);
+
+	return 0;
+}
+
+struct ftar_index *ftar_index_refresh(int fd, const struct ftar_index *old)
+{
+	struct ftar_index_ent *ent;
+	struct ftar_index_ent last;
+	struct ftar_index *idx;
+	struct ftar_ent **slot;
+	char hdr[FTAR_HDR_SIZE];
+	struct stat st;
+	size_t count;
+	size_t align;
+	size_t i;
+	int err;
+
+	errno = 0;
+
+	if (!old) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* The count in the header is what commits appended entries */
+	if (fstat(fd, &st) < 0 ||
+	    index_pread(fd, hdr, FTAR_HDR_SIZE, old->start) < 0 ||
+	    ftar_archive_align(hdr, &align) < 0)
+		return NULL;
+	memcpy(&count, hdr + FTAR_MAGIC_LEN, sizeof(size_t));
+	if (count > (uint64_t)st.st_size / FTAR_ENT_HDR_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/*
+	 * Appending never touches what's there, besides marking entries as
+	 *  deleted, so if the last entry isn't where it was, this isn't the
+	 *  same archive any more
+	 */
+	if (count < old->ent_count || align != old->align) {
+		errno = ESTALE;
+		return NULL;
+	}
+	if (old->ent_count) {
+		last = old->entries[old->ent_count - 1];
+		if (index_pread(fd, &last.hdr, FTAR_ENT_HDR_SIZE, last.off) < 0)
+			return NULL;
+		last.hdr.name[sizeof(last.hdr.name) - 1] = 0;
+		last.hdr.flags = old->entries[old->ent_count - 1].hdr.flags;
+		if (memcmp(&last.hdr, &old->entries[old->ent_count - 1].hdr,
+			   FTAR_ENT_HDR_SIZE) != 0) {
+			errno = ESTALE;
+			return NULL;
+		}
+	}
+
+	/* The old entries are copied, and only the new headers are read */
+	idx = calloc(1, sizeof(struct ftar_index));
+	if (!idx)
+		return NULL;
+	*idx = *old;
+	idx->ent_count = count;
+	idx->entries = calloc(count ? count : 1, sizeof(struct ftar_index_ent));
+	for (idx->mask = 1; idx->mask < count * 2; idx->mask <<= 1)
+		;
+	idx->names = calloc(idx->mask--, sizeof(struct ftar_ent *));
+	idx->dicts = malloc((old->dict_count ? old->dict_count : 1) *
+			    sizeof(size_t));
+	if (!idx->entries || !idx->names || !idx->dicts)
+		goto fail;
+	memcpy(idx->entries, old->entries,
+	       old->ent_count * sizeof(struct ftar_index_ent));
+	memcpy(idx->dicts, old->dicts, old->dict_count * sizeof(size_t));
+
+	/* Move the old table over if it's the same size, or fill a new one */
+	if (idx->mask == old->mask) {
+		for (i = 0; i <= old->mask; i++) {
+			if (!old->names[i])
+				continue;
+			ent = (struct ftar_index_ent *)old->names[i];
+			idx->names[i] = &idx->entries[ent - old->entries].hdr;
+		}
+	} else {
+		for (i = 0; i < old->ent_count; i++) {
+			if (idx->entries[i].hdr.flags & FTAR_ENT_DELETED)
+				continue;
+			slot = ftar_name_slot(idx->names, idx->mask,
+					      idx->entries[i].hdr.name);
+			if (!*slot)
+				*slot = &idx->entries[i].hdr;
+		}
+	}
+
+	if (index_scan(fd, idx, old->ent_count, old->end, st.st_size) < 0 ||
+	    index_recheck(fd, idx, old->ent_count) < 0)
+		goto fail;
+
+	errno = 0;
+
+	return idx;
+fail:
+	err = errno;
+	ftar_index_free(idx);
+	errno = err;
+	return NULL;
+}
+
+struct ftar_index_ent *ftar_index_find(struct ftar_index *idx,
+				       const char *name)
+{
+	struct ftar_ent *ent;
+
+	errno = 0;
+
+	if (!idx || !name) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* The header is the first member, so this gets the whole entry */
+	ent = *ftar_name_slot(idx->names, idx->mask, name);
+	if (!ent || ent->flags & FTAR_ENT_DELETED) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	return (struct ftar_index_ent *)ent;
+}
+
+struct ftar_index_ent *ftar_index_dict(struct ftar_index *idx,
+				       struct ftar_index_ent *ent)
+{
+	size_t pos;
+	size_t mid;
+	size_t lo;
+	size_t hi;
+
+	errno = 0;
+
+	if (!idx || !ent) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Find the first dictionary after the entry, the one before is it */
+	pos = ent - idx->entries;
+	lo = 0;
+	hi = idx->dict_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->dicts[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return &idx->entries[idx->dicts[lo - 1]];
+}
+
+/* Read an entry's stored payload and decompress it if need be */
+static char *index_decode(int fd, struct ftar_index_ent *ent, const void *dict,
+			  size_t dict_len, size_t *len_ret)
+{
+	char *stored;
+	char *data;
+	int err;
+
+	stored = malloc(ent->hdr.size ? ent->hdr.size : 1);
+	if (!stored) {
+		*len_ret = -1;
+		return NULL;
+	}
+	if (index_pread(fd, stored, ent->hdr.size, ent->data_off) < 0) {
+		err = errno;
+		free(stored);
+		errno = err;
+		*len_ret = -1;
+		return NULL;
+	}
+	if (ent->hdr.codec == FTAR_CODEC_NONE ||
+	    ent->hdr.codec == FTAR_CODEC_CHUNKED) { /* Manifests aren't compressed */
+		*len_ret = ent->hdr.size;
+		return stored;
+	}
+
+	data = ftar_decompress(stored, ent->hdr.size, dict, dict_len, len_ret);
+	err = errno;
+	free(stored);
+	errno = err;
+	return data;
+}
+
+/*
+ * Put a chunked payload back together, like `ftar_load_base` does, with
+ *  chunks this archive doesn't have coming from `base` if there is one
+ */
+static char *index_chunked(int fd, struct ftar_index *idx, int base_fd,
+			   struct ftar_index *base, struct ftar_index_ent *ent,
+			   size_t *len_ret)
+{
+	char name[FTAR_HASH_SIZE * 2 + 1];
+	struct ftar_index_ent *chunk;
+	uint64_t raw_size;
+	uint32_t count;
+	char *manifest;
+	int chunk_fd;
+	char *data;
+	char *buf;
+	size_t len;
+	size_t off;
+	size_t i;
+	int err;
+
+	manifest = index_decode(fd, ent, NULL, 0, &len);
+	if (!manifest) {
+		*len_ret = -1;
+		return NULL;
+	}
+	buf = NULL;
+	err = EINVAL;
+	if (len < FTAR_MANIFEST_HDR_SIZE)
+		goto fail;
+	memcpy(&raw_size, manifest, sizeof(uint64_t));
+	memcpy(&count, manifest + sizeof(uint64_t), sizeof(uint32_t));
+	if ((len - FTAR_MANIFEST_HDR_SIZE) % FTAR_HASH_SIZE ||
+	    (len - FTAR_MANIFEST_HDR_SIZE) / FTAR_HASH_SIZE != count)
+		goto fail;
+	buf = malloc(raw_size ? raw_size : 1);
+	if (!buf) {
+		err = errno;
+		goto fail;
+	}
+
+	/* Chunks come from this archive first, then the base */
+	off = 0;
+	for (i = 0; i < count; i++) {
+		ftar_chunk_name((const uint8_t *)manifest +
+					FTAR_MANIFEST_HDR_SIZE +
+					i * FTAR_HASH_SIZE,
+				name);
+		chunk_fd = fd;
+		chunk = ftar_index_find(idx, name);
+		if ((!chunk || chunk->hdr.type != FTAR_FTYPE_CHUNK) && base) {
+			chunk_fd = base_fd;
+			chunk = ftar_index_find(base, name);
+		}
+		if (!chunk || chunk->hdr.type != FTAR_FTYPE_CHUNK) {
+			err = ENOENT;
+			goto fail;
+		}
+		data = index_decode(chunk_fd, chunk, NULL, 0, &len);
+		if (!data) {
+			err = errno;
+			goto fail;
+		}
+		if (len > raw_size - off) {
+			free(data);
+			err = EINVAL;
+			goto fail;
+		}
+		memcpy(buf + off, data, len);
+		free(data);
+		off += len;
+	}
+	if (off != raw_size)
+		goto fail;
+	free(manifest);
+
+	*len_ret = raw_size;
+	return buf;
+fail:
+	free(buf);
+	free(manifest);
+	errno = err;
+	*len_ret = -1;
+	return NULL;
+}
+
+char *ftar_index_read(int fd, struct ftar_index *idx,
+		      struct ftar_index_ent *ent, size_t *len_ret)
+{
+	return ftar_index_read_base(fd, idx, -1, NULL, ent, len_ret);
+}
+
+char *ftar_index_read_base(int fd, struct ftar_index *idx, int base_fd,
+			   struct ftar_index *base, struct ftar_index_ent *ent,
+			   size_t *len_ret)
+{
+	struct ftar_index_ent *target;
+	struct ftar_index_ent *dict;
+	size_t dict_len;
+	char *dict_data;
+	char *data;
+	int err;
+
+	errno = 0;
+
+	if (!idx || !ent || !len_ret) {
+		errno = EINVAL;
+		if (len_ret)
+			*len_ret = -1;
+		return NULL;
+	}
+
+	/* Links with no payload share the one of an earlier entry */
+	if (ent->hdr.type == FTAR_FTYPE_LINK && ent->hdr.link[0] &&
+	    !ent->hdr.size) {
+		target = ftar_index_find(idx, ent->hdr.link);
+		if (!target || target >= ent) {
+			errno = EINVAL;
+			*len_ret = -1;
+			return NULL;
+		}
+		ent = target;
+	}
+
+	switch (ent->hdr.codec) {
+	case FTAR_CODEC_NONE:
+	case FTAR_CODEC_LZ:
+		return index_decode(fd, ent, NULL, 0, len_ret);
+	case FTAR_CODEC_LZ_DICT:
+		dict = ftar_index_dict(idx, ent);
+		if (!dict) {
+			*len_ret = -1;
+			return NULL;
+		}
+		dict_data = index_decode(fd, dict, NULL, 0, &dict_len);
+		if (!dict_data) {
+			*len_ret = -1;
+			return NULL;
+		}
+		data = index_decode(fd, ent, dict_data, dict_len, len_ret);
+		err = errno;
+		free(dict_data);
+		errno = err;
+		return data;
+	case FTAR_CODEC_CHUNKED:
+		return index_chunked(fd, idx, base_fd, base, ent, len_ret);
+	default:
+		errno = EINVAL;
+		*len_ret = -1;
+		return NULL;
+	}
+}
+
+void ftar_index_free(struct ftar_index *idx)
+{
+	if (!idx)
+		return;
+
+	free(idx->names);
+	free(idx->entries);
+	free(idx->dicts);
+	free(idx);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,647 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frankentar/compress.h"
+#include "frankentar/index.h"
+#include "frankentar/loader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	LOAD_QUEUED, /* In the heap, not started */
+	LOAD_PARKED, /* In the heap, partly read and holding budget */
+	LOAD_RUNNING, /* Being read, or its callback is running */
+	LOAD_DONE
+};
+
+struct ftar_load {
+	struct ftar_loader *loader;
+	struct ftar_index_ent *ent; /* What was asked for */
+	struct ftar_index_ent *target; /* Where the payload is, after links */
+	int priority;
+	uint64_t deadline;
+	uint64_t seq; /* Keeps requests that tie in the order they came in */
+	ftar_load_fn fn;
+	void *user;
+	int state;
+	bool detached; /* Freed by the loader once it's done */
+	size_t pos; /* Where it is in the heap */
+
+	/* The stored payload, once it's been started */
+	char *buf;
+	size_t done;
+	bool held; /* Whether it counts against the budget */
+	struct ftar_load *prev;
+	struct ftar_load *next;
+
+	/* The result, for `ftar_load_wait` */
+	char *data;
+	size_t len;
+	int err;
+};
+
+struct loader_dict {
+	struct ftar_index_ent *ent;
+	char *data;
+	size_t len;
+};
+
+struct ftar_loader {
+	int fd;
+	struct ftar_index *idx;
+	size_t budget;
+	size_t slice;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* Signalled when something's queued or budget frees up */
+	pthread_cond_t done; /* Signalled when a request finishes */
+	struct ftar_load **heap; /* Queued and parked requests, best first */
+	size_t count;
+	size_t cap; /* Never less than `live`, so parking can't fail */
+	size_t live; /* Requests that haven't finished */
+	uint64_t seq;
+	size_t in_flight; /* Bytes held by started requests */
+	struct ftar_load *holders;
+	bool stop;
+	unsigned thread_count;
+	pthread_t *threads;
+
+	/* Every dictionary used so far, there's rarely more than one */
+	pthread_mutex_t dict_lock;
+	struct loader_dict *dicts;
+	size_t dict_count;
+};
+
+/* Whether `a` should be read before `b` */
+static bool loader_before(const struct ftar_load *a, const struct ftar_load *b)
+{
+	if (a->priority != b->priority)
+		return a->priority > b->priority;
+	if (a->deadline != b->deadline)
+		return a->deadline && (!b->deadline || a->deadline < b->deadline);
+	return a->seq < b->seq;
+}
+
+static void loader_swap(struct ftar_loader *loader, size_t i, size_t j)
+{
+	struct ftar_load *tmp;
+
+	tmp = loader->heap[i];
+	loader->heap[i] = loader->heap[j];
+	loader->heap[j] = tmp;
+	loader->heap[i]->pos = i;
+	loader->heap[j]->pos = j;
+}
+
+static void loader_up(struct ftar_loader *loader, size_t i)
+{
+	while (i && loader_before(loader->heap[i], loader->heap[(i - 1) / 2])) {
+		loader_swap(loader, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void loader_down(struct ftar_loader *loader, size_t i)
+{
+	size_t best;
+
+	while (true) {
+		best = i;
+		if (i * 2 + 1 < loader->count &&
+		    loader_before(loader->heap[i * 2 + 1], loader->heap[best]))
+			best = i * 2 + 1;
+		if (i * 2 + 2 < loader->count &&
+		    loader_before(loader->heap[i * 2 + 2], loader->heap[best]))
+			best = i * 2 + 2;
+		if (best == i)
+			break;
+		loader_swap(loader, i, best);
+		i = best;
+	}
+}
+
+static void loader_push(struct ftar_loader *loader, struct ftar_load *load)
+{
+	load->pos = loader->count++;
+	loader->heap[load->pos] = load;
+	loader_up(loader, load->pos);
+}
+
+static void loader_remove(struct ftar_loader *loader, struct ftar_load *load)
+{
+	size_t i;
+
+	i = load->pos;
+	loader->count--;
+	if (i == loader->count)
+		return;
+	loader_swap(loader, i, loader->count);
+	loader_up(loader, i);
+	loader_down(loader, i);
+}
+
+/* Whether a request can be started without going over the budget */
+static bool loader_fits(struct ftar_loader *loader, struct ftar_load *load)
+{
+	struct ftar_load *held;
+
+	if (load->held || !loader->in_flight ||
+	    loader->in_flight + load->target->hdr.size <= loader->budget)
+		return true;
+
+	/* Only something at least as important can keep it waiting */
+	for (held = loader->holders; held; held = held->next) {
+		if (held->priority >= load->priority)
+			return false;
+	}
+
+	return true;
+}
+
+static void loader_hold(struct ftar_loader *loader, struct ftar_load *load)
+{
+	load->held = true;
+	loader->in_flight += load->target->hdr.size;
+	load->prev = NULL;
+	load->next = loader->holders;
+	if (loader->holders)
+		loader->holders->prev = load;
+	loader->holders = load;
+}
+
+static void loader_release(struct ftar_loader *loader, struct ftar_load *load)
+{
+	if (!load->held)
+		return;
+
+	load->held = false;
+	loader->in_flight -= load->target->hdr.size;
+	if (load->prev)
+		load->prev->next = load->next;
+	else
+		loader->holders = load->next;
+	if (load->next)
+		load->next->prev = load->prev;
+	pthread_cond_broadcast(&loader->work);
+}
+
+/*
+ * Hand a request its result, called and returning with the lock held. The
+ * request may be gone afterwards.
+ */
+static void loader_finish(struct ftar_loader *loader, struct ftar_load *load,
+			  char *data, size_t len, int err)
+{
+	loader_release(loader, load);
+	free(load->buf);
+	load->buf = NULL;
+
+	/* Nothing else touches it while the callback runs */
+	load->state = LOAD_RUNNING;
+	load->err = err;
+	load->len = data ? len : (size_t)-1;
+	if (load->fn) {
+		pthread_mutex_unlock(&loader->lock);
+		load->fn(load, data, load->len, err, load->user);
+		pthread_mutex_lock(&loader->lock);
+	} else {
+		load->data = data;
+	}
+
+	loader->live--;
+	if (load->detached) {
+		free(load->data);
+		free(load);
+		return;
+	}
+	load->state = LOAD_DONE;
+	pthread_cond_broadcast(&loader->done);
+}
+
+/* Get the dictionary an entry was compressed with, which stays put */
+static char *loader_dict(struct ftar_loader *loader, struct ftar_index_ent *ent,
+			 size_t *len_ret)
+{
+	struct ftar_index_ent *dict;
+	struct loader_dict *dicts;
+	char *data;
+	size_t i;
+
+	dict = ftar_index_dict(loader->idx, ent);
+	if (!dict)
+		return NULL;
+
+	pthread_mutex_lock(&loader->dict_lock);
+	for (i = 0; i < loader->dict_count; i++) {
+		if (loader->dicts[i].ent == dict) {
+			data = loader->dicts[i].data;
+			*len_ret = loader->dicts[i].len;
+			goto out;
+		}
+	}
+
+	/* They're small, so whoever needs one first reads it right away */
+	data = NULL;
+	dicts = realloc(loader->dicts,
+			(loader->dict_count + 1) * sizeof(struct loader_dict));
+	if (!dicts)
+		goto out;
+	loader->dicts = dicts;
+	data = ftar_index_read(loader->fd, loader->idx, dict, len_ret);
+	if (data) {
+		dicts[loader->dict_count].ent = dict;
+		dicts[loader->dict_count].data = data;
+		dicts[loader->dict_count].len = *len_ret;
+		loader->dict_count++;
+	}
+out:
+	pthread_mutex_unlock(&loader->dict_lock);
+	return data;
+}
+
+/* Read a request a slice at a time, called unlocked and returning locked */
+static void loader_run(struct ftar_loader *loader, struct ftar_load *load)
+{
+	struct ftar_index_ent *target;
+	struct ftar_load *top;
+	size_t dict_len;
+	char *dict;
+	size_t want;
+	char *data;
+	size_t len;
+	ssize_t n;
+	int err;
+
+	target = load->target;
+	data = NULL;
+	len = -1;
+
+	/* Chunks are all over the archive, so there's nothing to slice up */
+	if (target->hdr.codec == FTAR_CODEC_CHUNKED) {
+		data = ftar_index_read(loader->fd, loader->idx, target, &len);
+		err = data ? 0 : errno;
+		goto out;
+	}
+
+	if (!load->buf) {
+		load->buf = malloc(target->hdr.size ? target->hdr.size : 1);
+		if (!load->buf) {
+			err = errno;
+			goto out;
+		}
+	}
+	while (load->done < target->hdr.size) {
+		want = target->hdr.size - load->done;
+		if (want > loader->slice)
+			want = loader->slice;
+		n = pread(loader->fd, load->buf + load->done, want,
+			  target->data_off + load->done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			err = n ? errno : EINVAL;
+			goto out;
+		}
+		load->done += n;
+		if (load->done == target->hdr.size)
+			break;
+
+		/* Make way for anything more important that can start */
+		pthread_mutex_lock(&loader->lock);
+		top = loader->count ? loader->heap[0] : NULL;
+		if (top && top->priority > load->priority &&
+		    loader_fits(loader, top)) {
+			load->state = LOAD_PARKED;
+			loader_push(loader, load);
+			pthread_cond_signal(&loader->work);
+			return;
+		}
+		pthread_mutex_unlock(&loader->lock);
+	}
+
+	err = 0;
+	switch (target->hdr.codec) {
+	case FTAR_CODEC_NONE:
+		data = load->buf;
+		len = target->hdr.size;
+		load->buf = NULL;
+		break;
+	case FTAR_CODEC_LZ:
+		data = ftar_decompress(load->buf, target->hdr.size, NULL, 0,
+				       &len);
+		break;
+	case FTAR_CODEC_LZ_DICT:
+		dict = loader_dict(loader, target, &dict_len);
+		if (dict)
+			data = ftar_decompress(load->buf, target->hdr.size,
+					       dict, dict_len, &len);
+		break;
+	default:
+		errno = EINVAL;
+		break;
+	}
+	if (!data)
+		err = errno;
+out:
+	pthread_mutex_lock(&loader->lock);
+	loader_finish(loader, load, data, len, err);
+}
+
+static void *loader_worker(void *arg)
+{
+	struct ftar_loader *loader;
+	struct ftar_load *load;
+
+	loader = arg;
+	pthread_mutex_lock(&loader->lock);
+	while (true) {
+		load = loader->count ? loader->heap[0] : NULL;
+		if (!load && loader->stop)
+			break;
+		if (!load) {
+			pthread_cond_wait(&loader->work, &loader->lock);
+			continue;
+		}
+
+		/* Requests past their deadline aren't worth starting */
+		if (load->state == LOAD_QUEUED && load->deadline &&
+		    ftar_loader_now() >= load->deadline) {
+			loader_remove(loader, load);
+			loader_finish(loader, load, NULL, 0, ETIMEDOUT);
+			continue;
+		}
+		if (!loader_fits(loader, load)) {
+			pthread_cond_wait(&loader->work, &loader->lock);
+			continue;
+		}
+
+		loader_remove(loader, load);
+		if (!load->held)
+			loader_hold(loader, load);
+		load->state = LOAD_RUNNING;
+		pthread_mutex_unlock(&loader->lock);
+		loader_run(loader, load);
+	}
+	pthread_mutex_unlock(&loader->lock);
+
+	return NULL;
+}
+
+struct ftar_loader *ftar_loader_open(const char *archive,
+				     const struct ftar_loader_opts *opts)
+{
+	struct ftar_loader *loader;
+	unsigned threads;
+	unsigned i;
+	int err;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!archive) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	threads = opts && opts->threads ? opts->threads : FTAR_LOADER_THREADS;
+	loader = calloc(1, sizeof(struct ftar_loader));
+	if (!loader)
+		return NULL;
+	loader->budget = opts && opts->budget ? opts->budget :
+						FTAR_LOADER_BUDGET;
+	loader->slice = opts && opts->slice ? opts->slice : FTAR_LOADER_SLICE;
+	pthread_mutex_init(&loader->lock, NULL);
+	pthread_cond_init(&loader->work, NULL);
+	pthread_cond_init(&loader->done, NULL);
+	pthread_mutex_init(&loader->dict_lock, NULL);
+
+	/* Index the archive */
+	loader->fd = open(archive, O_RDONLY);
+	if (loader->fd < 0)
+		goto fail;
+	loader->idx = ftar_index_fd(loader->fd);
+	if (!loader->idx)
+		goto fail;
+
+	/* Start the threads */
+	loader->threads = calloc(threads, sizeof(pthread_t));
+	if (!loader->threads)
+		goto fail;
+	for (i = 0; i < threads; i++) {
+		errno = pthread_create(&loader->threads[i], NULL, loader_worker,
+				       loader);
+		if (errno)
+			goto fail;
+		loader->thread_count++;
+	}
+
+	errno = 0;
+
+	return loader;
+fail:
+	err = errno;
+	ftar_loader_free(loader);
+	errno = err;
+	return NULL;
+}
+
+uint64_t ftar_loader_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct ftar_load *ftar_loader_request(struct ftar_loader *loader,
+				      const char *name, int priority,
+				      uint64_t deadline, ftar_load_fn fn,
+				      void *user)
+{
+	struct ftar_index_ent *target;
+	struct ftar_index_ent *ent;
+	struct ftar_load **heap;
+	struct ftar_load *load;
+	size_t cap;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!loader || !name) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ent = ftar_index_find(loader->idx, name);
+	if (!ent)
+		return NULL;
+
+	/* Links with no payload share the one of an earlier entry */
+	target = ent;
+	if (ent->hdr.type == FTAR_FTYPE_LINK && ent->hdr.link[0] &&
+	    !ent->hdr.size) {
+		target = ftar_index_find(loader->idx, ent->hdr.link);
+		if (!target || target >= ent) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+
+	load = calloc(1, sizeof(struct ftar_load));
+	if (!load)
+		return NULL;
+	load->loader = loader;
+	load->ent = ent;
+	load->target = target;
+	load->priority = priority;
+	load->deadline = deadline;
+	load->fn = fn;
+	load->user = user;
+	load->len = -1;
+
+	pthread_mutex_lock(&loader->lock);
+	if (loader->live == loader->cap) {
+		cap = loader->cap ? loader->cap * 2 : 64;
+		heap = realloc(loader->heap, cap * sizeof(struct ftar_load *));
+		if (!heap) {
+			pthread_mutex_unlock(&loader->lock);
+			free(load);
+			return NULL;
+		}
+		loader->heap = heap;
+		loader->cap = cap;
+	}
+	load->seq = loader->seq++;
+	load->state = LOAD_QUEUED;
+	loader_push(loader, load);
+	loader->live++;
+	pthread_cond_signal(&loader->work);
+	pthread_mutex_unlock(&loader->lock);
+
+	return load;
+}
+
+int ftar_load_cancel(struct ftar_load *load)
+{
+	struct ftar_loader *loader;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!load) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	loader = load->loader;
+	pthread_mutex_lock(&loader->lock);
+	if (load->state != LOAD_QUEUED && load->state != LOAD_PARKED) {
+		errno = load->state == LOAD_DONE ? EALREADY : EBUSY;
+		pthread_mutex_unlock(&loader->lock);
+		return -1;
+	}
+	loader_remove(loader, load);
+	loader_finish(loader, load, NULL, 0, ECANCELED);
+	pthread_mutex_unlock(&loader->lock);
+
+	errno = 0;
+
+	return 0;
+}
+
+char *ftar_load_wait(struct ftar_load *load, size_t *len_ret)
+{
+	struct ftar_loader *loader;
+	char *data;
+	int err;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!load || !len_ret) {
+		errno = EINVAL;
+		if (len_ret)
+			*len_ret = -1;
+		return NULL;
+	}
+
+	loader = load->loader;
+	pthread_mutex_lock(&loader->lock);
+	while (load->state != LOAD_DONE)
+		pthread_cond_wait(&loader->done, &loader->lock);
+	data = load->data;
+	load->data = NULL;
+	*len_ret = data ? load->len : (size_t)-1;
+	err = load->err;
+	pthread_mutex_unlock(&loader->lock);
+
+	errno = err;
+	return data;
+}
+
+void ftar_load_free(struct ftar_load *load)
+{
+	struct ftar_loader *loader;
+
+	if (!load)
+		return;
+
+	loader = load->loader;
+	pthread_mutex_lock(&loader->lock);
+	if (load->state == LOAD_QUEUED || load->state == LOAD_PARKED) {
+		loader_remove(loader, load);
+		loader_finish(loader, load, NULL, 0, ECANCELED);
+	}
+
+	/* Whoever's reading it frees it when they're done */
+	if (load->state == LOAD_RUNNING) {
+		load->detached = true;
+		pthread_mutex_unlock(&loader->lock);
+		return;
+	}
+	pthread_mutex_unlock(&loader->lock);
+
+	free(load->data);
+	free(load);
+}
+
+void ftar_loader_free(struct ftar_loader *loader)
+{
+	unsigned i;
+
+	if (!loader)
+		return;
+
+	/* Let the threads finish what they've started and exit */
+	pthread_mutex_lock(&loader->lock);
+	loader->stop = true;
+	pthread_cond_broadcast(&loader->work);
+	pthread_mutex_unlock(&loader->lock);
+	for (i = 0; i < loader->thread_count; i++)
+		pthread_join(loader->threads[i], NULL);
+
+	for (i = 0; i < loader->dict_count; i++)
+		free(loader->dicts[i].data);
+	free(loader->dicts);
+	free(loader->heap);
+	free(loader->threads);
+	ftar_index_free(loader->idx);
+	if (loader->fd >= 0)
+		close(loader->fd);
+	pthread_mutex_destroy(&loader->dict_lock);
+	pthread_cond_destroy(&loader->done);
+	pthread_cond_destroy(&loader->work);
+	pthread_mutex_destroy(&loader->lock);
+	free(loader);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -11,7 +11,16 @@
 #include <unistd.h>
 
 #include "frankentar.h"
+#include "frankentar/compress.h"
+#include "frankentar/delta.h"
+#include "frankentar/edit.h"
+#include "frankentar/embed.h"
+#include "frankentar/extract.h"
+#include "frankentar/pack.h"
 #include "frankentar/read.h"
+#include "frankentar/scan.h"
+#include "frankentar/self.h"
+#include "frankentar/set.h"
 #include "frankentar/util.h"
 #include "frankentar/write.h"
 
@@ -22,6 +31,13 @@
 #define FTAR_OP_ADD_STR "add"
 #define FTAR_OP_DEL_STR "delete"
 #define FTAR_OP_EXTR_STR "extract"
+#define FTAR_OP_DIFF_STR "diff"
+#define FTAR_OP_PATCH_STR "patch"
+#define FTAR_OP_COMPACT_STR "compact"
+#define FTAR_OP_UPDATE_STR "update"
+#define FTAR_OP_VERIFY_STR "verify"
+#define FTAR_OP_EMBED_STR "embed"
+#define FTAR_OP_ATTACH_STR "attach"
 #define FTAR_OP_HELP_STR "help"
 
 #define FTAR_OP_READ 0
@@ -32,46 +48,318 @@
 #define FTAR_OP_DEL 5
 #define FTAR_OP_EXTR 6
 #define FTAR_OP_HELP 7
+#define FTAR_OP_DIFF 8
+#define FTAR_OP_PATCH 9
+#define FTAR_OP_COMPACT 10
+#define FTAR_OP_UPDATE 11
+#define FTAR_OP_VERIFY 12
+#define FTAR_OP_EMBED 13
+#define FTAR_OP_ATTACH 14
 
-#ifdef _MSC_VER
-#define S_IFMT _S_IFMT
-#define S_IFSOCK _S_IFCHR
-#define S_IFLNK _S_IFLNK
-#define S_IFREG _S_IFREG
-#define S_IFBLK _S_IFCHR
-#define S_IFDIR _S_IFDIR
-#define S_IFCHR _S_IFCHR
-#define S_IFIFO _S_IFIFO
-#else
-#define S_IFMT __S_IFMT
-#define S_IFSOCK __S_IFSOCK
-#define S_IFLNK __S_IFLNK
-#define S_IFREG __S_IFREG
-#define S_IFBLK __S_IFBLK
-#define S_IFDIR __S_IFDIR
-#define S_IFCHR __S_IFCHR
-#define S_IFIFO __S_IFIFO
-#endif
+/* Read a whole file, exiting on failure */
+static void *read_file(const char *path, size_t *len_ret)
+{
+	void *buf;
+	size_t len;
+	FILE *f;
+
+	/* Try to open the file */
+	f = fopen(path, "rb");
+	if (!f)
+		ftar_err_exit(errno,
+			      "Error: failed to open archive \"%s\": %s\n",
+			      path, strerror(errno));
+
+	/* Determine its length */
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (!len)
+		ftar_err_exit(EINVAL, "Error: empty file\n");
+
+	/* Allocate a buffer */
+	buf = calloc(len, sizeof(char));
+	if (!buf)
+		ftar_err_exit(errno, "Error: failed to allocate buffer: %s\n",
+			      strerror(errno));
+
+	/* Read the file */
+	if (fread(buf, sizeof(char), len, f) != len)
+		ftar_err_exit(errno ? errno : EIO,
+			      "Error: failed to read file: %s\n",
+			      strerror(errno ? errno : EIO));
+	fclose(f);
+
+	*len_ret = len;
+	return buf;
+}
+
+/* Write a whole file, exiting on failure */
+static void write_file(const char *path, const void *buf, size_t len)
+{
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (!f)
+		ftar_err_exit(errno, "Error: failed to create file: %s\n",
+			      strerror(errno));
+	if (fwrite(buf, len, 1, f) != 1 || fclose(f) != 0)
+		ftar_err_exit(errno ? errno : EIO,
+			      "Error: failed to write file: %s\n",
+			      strerror(errno ? errno : EIO));
+}
+
+/* Check whether a file starts with an archive header */
+static bool is_archive(const char *path)
+{
+	char hdr[FTAR_HDR_SIZE];
+	size_t align;
+	bool ret;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return false;
+	ret = fread(hdr, 1, FTAR_HDR_SIZE, f) == FTAR_HDR_SIZE &&
+	      ftar_archive_align(hdr, &align) == 0;
+	fclose(f);
+
+	return ret;
+}
+
+/* Pack files into an archive in memory, exiting on failure */
+static void *pack_raw(const char *const *paths, size_t count, size_t *len_ret)
+{
+	struct ftar_pack_opts opts;
+	void *buf;
+	size_t len;
+	FILE *f;
+
+	f = tmpfile();
+	if (!f)
+		ftar_err_exit(errno, "Error: failed to create file: %s\n",
+			      strerror(errno));
+	memset(&opts, 0, sizeof(struct ftar_pack_opts));
+	if (ftar_pack(f, paths, count, &opts) < 0)
+		ftar_err_exit(errno, "Error: failed to pack files: %s\n",
+			      strerror(errno));
+
+	/* Read it back */
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = calloc(len, sizeof(char));
+	if (!buf)
+		ftar_err_exit(errno, "Error: failed to allocate buffer: %s\n",
+			      strerror(errno));
+	if (fread(buf, sizeof(char), len, f) != len)
+		ftar_err_exit(errno ? errno : EIO,
+			      "Error: failed to read file: %s\n",
+			      strerror(errno ? errno : EIO));
+	fclose(f);
+
+	*len_ret = len;
+	return buf;
+}
+
+/* Pack files and parse the result, exiting on failure */
+static struct ftar *pack_files(const char *const *paths, size_t count)
+{
+	struct ftar *tar;
+	void *buf;
+	size_t len;
+
+	buf = pack_raw(paths, count, &len);
+	tar = ftar_load(buf, len);
+	if (!tar)
+		ftar_err_exit(errno, "Error: failed to parse archive: %s\n",
+			      strerror(errno));
+	free(buf);
+
+	return tar;
+}
+
+/* Read and parse an archive, exiting on failure */
+static struct ftar *load_archive(const char *archive, struct ftar *base)
+{
+	struct ftar *tar;
+	void *ar_cont;
+	size_t len;
+
+	ar_cont = read_file(archive, &len);
+
+	/* Now parse the archive */
+	tar = ftar_load_base(ar_cont, len, base);
+	if (!tar)
+		ftar_err_exit(errno, "Error: failed to parse archive: %s\n",
+			      strerror(errno));
+
+	/* Free the buffer */
+	free(ar_cont);
+
+	return tar;
+}
+
+/*
+ * Parse the options for packing files, exiting on failure. This returns the
+ *  index of the first argument after them.
+ */
+static size_t parse_pack_opts(int argc, char *argv[],
+			      struct ftar_pack_opts *opts, int *update_flags,
+			      unsigned *shards,
+			      enum ftar_set_placement *placement,
+			      const char *mode)
+{
+	size_t i;
+
+	memset(opts, 0, sizeof(struct ftar_pack_opts));
+	if (update_flags)
+		*update_flags = 0;
+	if (shards) {
+		*shards = 0;
+		*placement = FTAR_SET_BY_HASH;
+	}
+	for (i = 2; i < (size_t)argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "--") == 0) {
+			i++;
+			break;
+		} else if (strcmp(argv[i], "--compress") == 0) {
+			opts->codec = FTAR_CODEC_LZ;
+
+			/* The codec to use can optionally be given */
+			if (i + 1 < (size_t)argc &&
+			    strcmp(argv[i + 1], "auto") == 0) {
+				opts->codec = FTAR_CODEC_AUTO;
+				i++;
+			} else if (i + 1 < (size_t)argc &&
+				   strcmp(argv[i + 1], "lz") == 0) {
+				i++;
+			}
+		} else if (strcmp(argv[i], "--dedup") == 0) {
+			opts->dedup = true;
+		} else if (strcmp(argv[i], "--cdc") == 0) {
+			opts->cdc = true;
+		} else if (strcmp(argv[i], "--base") == 0 &&
+			   i + 1 < (size_t)argc) {
+			opts->cdc = true;
+			opts->base = argv[++i];
+		} else if (update_flags &&
+			   strcmp(argv[i], "--contents") == 0) {
+			*update_flags |= FTAR_UPDATE_CONTENTS;
+		} else if (update_flags && strcmp(argv[i], "--prune") == 0) {
+			*update_flags |= FTAR_UPDATE_PRUNE;
+		} else if (shards && strcmp(argv[i], "--shards") == 0 &&
+			   i + 1 < (size_t)argc) {
+			*shards = strtoul(argv[++i], NULL, 10);
+			if (!*shards || *shards > FTAR_SET_MAX_SHARDS)
+				ftar_err_exit(EINVAL,
+					      "Error: invalid shard count"
+					      " \"%s\", it has to be from 1"
+					      " to %d\n",
+					      argv[i], FTAR_SET_MAX_SHARDS);
+		} else if (shards && strcmp(argv[i], "--by-size") == 0) {
+			*placement = FTAR_SET_BY_SIZE;
+		} else if (strcmp(argv[i], "--align") == 0 &&
+			   i + 1 < (size_t)argc) {
+			opts->align = strtoul(argv[++i], NULL, 10);
+			if (!opts->align || opts->align > FTAR_ALIGN_MAX ||
+			    (opts->align & (opts->align - 1)))
+				ftar_err_exit(EINVAL,
+					      "Error: invalid alignment"
+					      " \"%s\", it has to be a power"
+					      " of two up to %d\n",
+					      argv[i], FTAR_ALIGN_MAX);
+		} else if (strcmp(argv[i], "--dict") == 0) {
+			opts->codec = FTAR_CODEC_LZ;
+			opts->dict_size = FTAR_DICT_SIZE;
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < (size_t)argc) {
+			opts->threads = strtoul(argv[++i], NULL, 10);
+			if (!opts->threads)
+				ftar_err_exit(EINVAL,
+					      "Error: invalid thread"
+					      " count \"%s\"\n",
+					      argv[i]);
+		} else {
+			ftar_err_exit(EINVAL,
+				      "Error: invalid option \"%s\","
+				      " see \"%s %s %s\"\n",
+				      argv[i],
+				      FTAR_GET_BASENAME(argv[0]),
+				      mode,
+				      FTAR_OP_HELP_STR);
+		}
+	}
+
+	return i;
+}
+
+/*
+ * Parse the options for scanning an archive, exiting on failure. This returns
+ *  the index of the first argument after them. `--base` is only taken if
+ *  `base` isn't `NULL`.
+ */
+static size_t parse_scan_opts(int argc, char *argv[],
+			      struct ftar_scan_opts *opts, const char **base,
+			      const char *mode)
+{
+	size_t i;
+
+	memset(opts, 0, sizeof(struct ftar_scan_opts));
+	if (base)
+		*base = NULL;
+	for (i = 2; i < (size_t)argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "--") == 0) {
+			i++;
+			break;
+		} else if (base && strcmp(argv[i], "--base") == 0 &&
+			   i + 1 < (size_t)argc) {
+			*base = argv[++i];
+		} else if (strcmp(argv[i], "--cached") == 0) {
+			opts->cached = true;
+		} else if (strcmp(argv[i], "--buffer") == 0 &&
+			   i + 1 < (size_t)argc) {
+			opts->buf_size = strtoul(argv[++i], NULL, 10);
+			if (!opts->buf_size)
+				ftar_err_exit(EINVAL,
+					      "Error: invalid buffer size"
+					      " \"%s\"\n",
+					      argv[i]);
+		} else {
+			ftar_err_exit(EINVAL,
+				      "Error: invalid option \"%s\","
+				      " see \"%s %s %s\"\n",
+				      argv[i],
+				      FTAR_GET_BASENAME(argv[0]),
+				      mode,
+				      FTAR_OP_HELP_STR);
+		}
+	}
+
+	return i;
+}
 
 int main(int argc, char *argv[])
 {
 	/* General variables that are used all over */
 	char op;
 	char *archive;
-	void *ar_cont;
+	void *buf;
 	char *path;
 	struct ftar *tar;
+	struct ftar *base;
+	const char *base_path;
 	struct ftar_ent *ent;
+	struct ftar_pack_opts opts;
+	struct ftar_scan_opts scan_opts;
+	struct ftar_ent bad;
+	enum ftar_set_placement placement;
+	unsigned shards;
+	double threshold;
+	int flags;
 	FILE *ar;
-	FILE *fp;
 	size_t len;
 	size_t i;
 	int err;
-#ifdef _MSC_VER
-	struct _stat64 st;
-#else
-	struct stat st;
-#endif
 
 	/* Check if we got too few args */
 	if (argc < 2)
@@ -95,6 +383,20 @@ int main(int argc, char *argv[])
 		op = FTAR_OP_DEL;
 	else if (strcmp(argv[1], FTAR_OP_EXTR_STR) == 0)
 		op = FTAR_OP_EXTR;
+	else if (strcmp(argv[1], FTAR_OP_DIFF_STR) == 0)
+		op = FTAR_OP_DIFF;
+	else if (strcmp(argv[1], FTAR_OP_PATCH_STR) == 0)
+		op = FTAR_OP_PATCH;
+	else if (strcmp(argv[1], FTAR_OP_COMPACT_STR) == 0)
+		op = FTAR_OP_COMPACT;
+	else if (strcmp(argv[1], FTAR_OP_UPDATE_STR) == 0)
+		op = FTAR_OP_UPDATE;
+	else if (strcmp(argv[1], FTAR_OP_VERIFY_STR) == 0)
+		op = FTAR_OP_VERIFY;
+	else if (strcmp(argv[1], FTAR_OP_EMBED_STR) == 0)
+		op = FTAR_OP_EMBED;
+	else if (strcmp(argv[1], FTAR_OP_ATTACH_STR) == 0)
+		op = FTAR_OP_ATTACH;
 	else if (strcmp(argv[1], FTAR_OP_HELP_STR) == 0 ||
 		 strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)
 		op = FTAR_OP_HELP;
@@ -118,8 +420,10 @@ int main(int argc, char *argv[])
 
 		/* Check if help was requested */
 		if (strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
-			printf("Frankentar %s mode usage: %s %s <archive> "
-			       "<file to read>\n",
+			printf("Frankentar %s mode usage: %s %s [--base "
+			       "<base archive>] <archive> <file to read>\n"
+			       "  --base - the archive a delta pack was made"
+			       " against\n",
 			       FTAR_OP_READ_STR, FTAR_GET_BASENAME(argv[0]),
 			       FTAR_OP_READ_STR);
 			return 0;
@@ -134,46 +438,26 @@ int main(int argc, char *argv[])
 				      FTAR_OP_READ_STR, FTAR_OP_HELP_STR);
 
 		/* Parse our arguments */
-		archive = argv[2];
-		path = argv[3];
-
-		/* Try to open the file */
-		ar = fopen(archive, "rb");
-		if (!ar)
-			ftar_err_exit(
-				errno,
-				"Error: failed to open archive \"%s\": %s\n",
-				archive, strerror(errno));
-
-		/* Determine its length */
-		fseek(ar, 0, SEEK_END);
-		len = ftell(ar);
-		fseek(ar, 0, SEEK_SET);
-		if (!len)
-			ftar_err_exit(EINVAL, "Error: empty file\n");
-
-		/* Allocate a buffer */
-		ar_cont = calloc(len, sizeof(char));
-		if (!ar_cont)
-			ftar_err_exit(errno,
-				      "Error: failed to allocate buffer: %s\n",
-				      strerror(errno));
-
-		/* Read the archive */
-		fread(ar_cont, sizeof(char), len, ar);
-		if (!ar_cont)
-			ftar_err_exit(errno, "Error: failed to read file: %s\n",
-				      strerror(errno));
-
-		/* Now parse the archive */
-		tar = ftar_load(ar_cont, len);
-		if (!tar)
-			ftar_err_exit(errno,
-				      "Error: failed to parse archive: %s\n",
-				      strerror(errno));
+		base = NULL;
+		i = 2;
+		if (strcmp(argv[i], "--base") == 0) {
+			if (argc < 6)
+				ftar_err_exit(EINVAL,
+					      "Error: not enough arguments for "
+					      "specified mode, see \"%s %s %s\"\n",
+					      FTAR_GET_BASENAME(argv[0]),
+					      FTAR_OP_READ_STR,
+					      FTAR_OP_HELP_STR);
+			base = load_archive(argv[i + 1], NULL);
+			i += 2;
+		}
+		archive = argv[i];
+		path = argv[i + 1];
 
-		/* Free the buffer */
-		free(ar_cont);
+		/* Load the archive, taking missing chunks from the base */
+		tar = load_archive(archive, base);
+		if (base)
+			ftar_free(base);
 
 		/* Look for the file requested */
 		ent = ftar_find(tar, NULL, "%s", path);
@@ -203,34 +487,70 @@ int main(int argc, char *argv[])
 
 		/* Check if help was asked for */
 		if (strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
-			printf("Frankentar create mode usage: %s %s <archive"
-			       " to create> <one or more files to add>\n",
+			printf("Frankentar create mode usage: %s %s [options]"
+			       " <archive to create> <one or more files to"
+			       " add>\n"
+			       "Options:\n"
+			       "  --compress [lz|auto] - compress the files with"
+			       " ftar_lz, or with auto, only the ones that"
+			       " look like they'll compress\n"
+			       "  --dedup - store files with identical contents"
+			       " once\n"
+			       "  --cdc - split files into content-defined"
+			       " chunks and store each distinct chunk once\n"
+			       "  --base <archive> - like --cdc, but leave out"
+			       " the chunks already in the given archive, making"
+			       " a delta pack\n"
+			       "  --dict - like --compress, but small files are"
+			       " compressed against a shared dictionary trained"
+			       " from them\n"
+			       "  --align <bytes> - start each file's data on a"
+			       " multiple of this many bytes, like 512 or 4096"
+			       " (add and update keep the archive's)\n"
+			       "  -j <threads> - number of threads to read and"
+			       " compress with (default: one per CPU)\n"
+			       "  --shards <count> - make a set of this many"
+			       " archives instead, with the archive given being"
+			       " the manifest that indexes them (see set.h, not"
+			       " with --cdc or --dict)\n"
+			       "  --by-size - with --shards, spread the files out"
+			       " by size instead of by name\n",
 			       FTAR_GET_BASENAME(argv[0]), FTAR_OP_CREATE_STR);
 			return 0;
 		}
 
+		/* Parse any options */
+		i = parse_pack_opts(argc, argv, &opts, NULL, &shards,
+				    &placement, FTAR_OP_CREATE_STR);
+
 		/* Check for the rest of our arguments */
-		if (argc < 4)
+		if (argc - i < 2)
 			ftar_err_exit(EINVAL,
 				      "Error: not enough arguments for "
 				      "specified mode, see \"%s %s %s\"\n",
 				      FTAR_GET_BASENAME(argv[0]),
 				      FTAR_OP_CREATE_STR, FTAR_OP_HELP_STR);
+		archive = argv[i++];
 
-		/* Initialize our Frankentar structure */
-		tar = calloc(1, sizeof(struct ftar));
-		if (!tar)
-			ftar_err_exit(
-				errno,
-				"Error: failed to allocate structure: %s\n",
-				strerror(errno));
-		strncpy(tar->magic, FTAR_MAGIC, FTAR_MAGIC_LEN);
+		/* A set writes its manifest and shards itself */
+		if (shards) {
+			err = ftar_set_create(archive,
+					      (const char *const *)&argv[i],
+					      argc - i, shards, placement,
+					      &opts);
+			if (err < 0)
+				ftar_err_exit(errno,
+					      "Error: failed to write archive"
+					      " set: %s\n",
+					      strerror(errno));
+			break;
+		}
 
 		/* Open the archive */
-		if (strcmp(argv[2], "/dev/stdout") !=
+		if (strcmp(archive, "/dev/stdout") !=
 			    0 && /* Avoid checking when stdout/stderr is our output */
-		    strcmp(argv[2], "/dev/stderr") != 0) {
-			ar = fopen(argv[2], "rb");
+		    strcmp(archive, "/dev/stderr") != 0) {
+			ar = fopen(archive, "rb");
 			if (ar) {
 				/* See if we're overwriting something */
 				fseek(ar, 0, SEEK_END);
@@ -243,8 +563,8 @@ int main(int argc, char *argv[])
 
 						/* Close, delete, and re-create the file */
 						fclose(ar);
-						remove(argv[2]);
-						ar = fopen(argv[2], "w+b");
+						remove(archive);
+						ar = fopen(archive, "w+b");
 						if (!ar)
 							ftar_err_exit(
 								errno,
@@ -256,9 +576,18 @@ int main(int argc, char *argv[])
 						fclose(ar);
 						return ECANCELED;
 					}
+				} else {
+					/* Reopen the empty file for writing */
+					fclose(ar);
+					ar = fopen(archive, "w+b");
+					if (!ar)
+						ftar_err_exit(
+							errno,
+							"Error: failed to create file: %s\n",
+							strerror(errno));
 				}
 			} else {
-				ar = fopen(argv[2], "w+b");
+				ar = fopen(archive, "w+b");
 				if (!ar)
 					ftar_err_exit(
 						errno,
@@ -266,133 +595,416 @@ int main(int argc, char *argv[])
 						strerror(errno));
 			}
 		} else {
-			if (strcmp(argv[2], "/dev/stdout") == 0)
+			if (strcmp(archive, "/dev/stdout") == 0)
 				ar = stdout;
 
-			if (strcmp(argv[2], "/dev/stderr") == 0)
+			if (strcmp(archive, "/dev/stderr") == 0)
 				ar = stderr;
 		}
 
-		/* Iterate through the remaining arguments */
-		for (i = 3; i < argc; i++)
-			tar->ent_count++;
+		/*
+		 * Pack the rest of the arguments, the files are read and written
+		 *  in chunks rather than all being loaded first
+		 */
+		err = ftar_pack(ar, (const char *const *)&argv[i], argc - i,
+				&opts);
+		if (err < 0)
+			ftar_err_exit(errno,
+				      "Error: failed to write archive: %s\n",
+				      strerror(errno));
+
+		/* Close the file */
+		fclose(ar);
+
+		break;
+	case FTAR_OP_ADD:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s [options]"
+			       " <archive> <one or more files to add>\n"
+			       "The files are appended without rewriting the"
+			       " rest of the archive, and entries with the same"
+			       " names are deleted. The options are the same"
+			       " as for %s mode, except that --cdc reuses the"
+			       " chunks already in the archive.\n",
+			       FTAR_OP_ADD_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_ADD_STR, FTAR_OP_CREATE_STR);
+			return 0;
+		}
+
+		/* Parse any options, then check for the rest */
+		i = parse_pack_opts(argc, argv, &opts, NULL, NULL, NULL,
+				    FTAR_OP_ADD_STR);
+		if (argc - i < 2)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_ADD_STR, FTAR_OP_HELP_STR);
+		archive = argv[i++];
 
-		/* Now that we know how many entries we need, allocate them */
-		tar->entries =
-			calloc(tar->ent_count, sizeof(struct ftar_ent *));
-		if (!tar->entries)
+		/* Append the files */
+		err = ftar_add(archive, (const char *const *)&argv[i],
+			       argc - i, &opts);
+		if (err < 0)
 			ftar_err_exit(errno,
-				      "Error: failed to allocate buffer: %s\n",
+				      "Error: failed to add to archive: %s\n",
 				      strerror(errno));
 
-		/* Now go through the entries again and fill out entries */
-		for (i = 3; i < argc; i++) {
-			/* Stat the file (Windows supports this) */
-			err = stat(argv[i], &st);
-			if (err < 0)
-				ftar_err_exit(
-					errno,
-					"Error: failed to stat file \"%s\": %s\n",
-					strerror(errno));
-
-			/* Allocate the entry */
-			tar->entries[i - 3] =
-				calloc(1, sizeof(struct ftar_ent));
-			if (!tar->entries[i - 3])
-				ftar_err_exit(
-					errno,
-					"Error: failed to allocate structure: %s\n",
-					strerror(errno));
-
-			/* Fill in the entry */
-			strcpy(tar->entries[i - 3]->name, argv[i]);
-			tar->entries[i - 3]->mode =
-				(st.st_mode &
-				 (FTAR_SET_MODE_USER(FTAR_MODE_FULL) |
-				  FTAR_SET_MODE_GROUP(FTAR_MODE_FULL) |
-				  FTAR_SET_MODE_OTHERS(FTAR_MODE_FULL)));
-			tar->entries[i - 3]->size = st.st_size;
-			tar->entries[i - 3]->mtime = st.st_mtime;
-			tar->entries[i - 3]->checksum =
-				ftar_checksum(tar->entries[i - 3]);
-
-			/* Figure out the file type */
-			if (st.st_mode & S_IFREG) {
-				tar->entries[i - 3]->type = FTAR_FTYPE_REG;
-			} else if (st.st_mode & S_IFLNK) {
-				/* Figure out what kind of link this is */
-				err = readlink(tar->entries[i - 3]->name,
-					       tar->entries[i - 3]->link, 100);
-				if (err < 0) { /* Hard link */
-					tar->entries[i - 3]->type =
-						FTAR_FTYPE_LINK;
-					memset(tar->entries[i - 3]->link, 0,
-					       100);
-				} else {
-					tar->entries[i - 3]->type =
-						FTAR_FTYPE_SYMLINK;
-				}
-			} else if (st.st_mode & S_IFSOCK ||
-				   st.st_mode & S_IFCHR ||
-				   st.st_mode & S_IFBLK) {
-				tar->entries[i - 3]->type = FTAR_FTYPE_SPECIAL;
-			} else if (st.st_mode & S_IFDIR) {
-				tar->entries[i - 3]->type = FTAR_FTYPE_DIR;
-			} else if (st.st_mode & S_IFIFO) {
-				tar->entries[i - 3]->type = FTAR_FTYPE_FIFO;
-			}
+		break;
+	case FTAR_OP_UPDATE:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s [options]"
+			       " <archive> <one or more files>\n"
+			       "Only files that are new or changed are added,"
+			       " the rest of the archive is left as it is. The"
+			       " options are the same as for %s mode, plus:\n"
+			       "  --contents - compare the contents of files"
+			       " whose size and mtime haven't changed\n"
+			       "  --prune - delete entries for files that"
+			       " weren't given\n",
+			       FTAR_OP_UPDATE_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_UPDATE_STR, FTAR_OP_ADD_STR);
+			return 0;
+		}
 
-			/* Allocate room for the file's contents */
-			tar->entries[i - 3]->data =
-				calloc(tar->entries[i - 3]->size, sizeof(char));
-			if (!tar->entries[i - 3]->data)
-				ftar_err_exit(
-					errno,
-					"Error: failed to allocate buffer: %s\n",
-					strerror(errno));
-
-			/* Open the file */
-			fp = fopen(argv[i], "rb");
-			if (!fp)
-				ftar_err_exit(
-					errno,
-					"Error: failed to open file: %s\n",
-					strerror(errno));
-
-			/* Read the file */
-			err = fread(tar->entries[i - 3]->data, sizeof(char),
-				    tar->entries[i - 3]->size, fp);
-			if (err < 0)
-				ftar_err_exit(errno,
-					      "Error: failed to read file %s\n",
-					      strerror(errno));
+		/* Parse any options, then check for the rest */
+		i = parse_pack_opts(argc, argv, &opts, &flags, NULL, NULL,
+				    FTAR_OP_UPDATE_STR);
+		if (argc - i < 2)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_UPDATE_STR, FTAR_OP_HELP_STR);
+		archive = argv[i++];
 
-			/* Close the file */
-			fclose(fp);
+		err = ftar_update(archive, (const char *const *)&argv[i],
+				  argc - i, &opts, flags);
+		if (err < 0)
+			ftar_err_exit(errno,
+				      "Error: failed to update archive: %s\n",
+				      strerror(errno));
+
+		break;
+	case FTAR_OP_DEL:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s [--compact]"
+			       " <archive> <one or more files to delete>\n"
+			       "The entries are only marked as deleted, the"
+			       " space they take up is reclaimed by %s mode.\n"
+			       "  --compact - compact the archive afterwards if"
+			       " enough of it is dead\n",
+			       FTAR_OP_DEL_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_DEL_STR, FTAR_OP_COMPACT_STR);
+			return 0;
 		}
 
-		/* Convert the tar into a buffer */
-		ar_cont = ftar_to_raw(tar, &len);
-		if (!ar_cont)
-			ftar_err_exit(
-				errno,
-				"Error: failed to convert to buffer: %s\n",
-				strerror(errno));
+		/* Parse our arguments */
+		i = 2;
+		if (argc > 2 && strcmp(argv[i], "--compact") == 0)
+			i++;
+		if (argc - i < 2)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_DEL_STR, FTAR_OP_HELP_STR);
+		archive = argv[i++];
 
-		/* Free the original structure */
-		ftar_free(tar);
+		/* Mark the entries, then maybe reclaim the space */
+		err = ftar_delete(archive, (const char *const *)&argv[i],
+				  argc - i);
+		if (err < 0)
+			ftar_err_exit(errno,
+				      "Error: failed to delete from archive:"
+				      " %s\n",
+				      strerror(errno));
+		if (i > 3 &&
+		    ftar_compact(archive, FTAR_COMPACT_THRESHOLD) < 0)
+			ftar_err_exit(errno,
+				      "Error: failed to compact archive: %s\n",
+				      strerror(errno));
+
+		break;
+	case FTAR_OP_COMPACT:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s [--threshold"
+			       " <fraction>] <archive>\n"
+			       "Rewrites the archive without its deleted"
+			       " entries.\n"
+			       "  --threshold - only compact if at least this"
+			       " much of the archive is dead (default: %g, 0 to"
+			       " always compact)\n",
+			       FTAR_OP_COMPACT_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_COMPACT_STR, FTAR_COMPACT_THRESHOLD);
+			return 0;
+		}
 
-		/* Write the buffer */
-		err = fwrite(ar_cont, sizeof(char), len, ar);
+		/* Parse our arguments */
+		threshold = FTAR_COMPACT_THRESHOLD;
+		i = 2;
+		if (argc > 3 && strcmp(argv[i], "--threshold") == 0) {
+			threshold = strtod(argv[i + 1], NULL);
+			i += 2;
+		}
+		if (argc - i < 1)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_COMPACT_STR, FTAR_OP_HELP_STR);
+
+		err = ftar_compact(argv[i], threshold);
+		if (err < 0)
+			ftar_err_exit(errno,
+				      "Error: failed to compact archive: %s\n",
+				      strerror(errno));
 		if (!err)
-			ftar_err_exit(
-				errno,
-				"Error: failed to write archive to file: %s\n",
-				strerror(errno));
+			printf("Not enough dead space to compact.\n");
 
-		/* Free the buffer and close the file */
-		free(ar_cont);
-		fclose(ar);
+		break;
+	case FTAR_OP_EXTR:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s [options]"
+			       " <archive> [files to extract]\n"
+			       "Extracts the given files, or all of them, into"
+			       " the current directory.\n"
+			       "Options:\n"
+			       "  --base <archive> - the archive a delta pack"
+			       " was made against, for the chunks it left"
+			       " out\n"
+			       "  --cached - read the archive through the page"
+			       " cache instead of with direct I/O\n"
+			       "  --buffer <bytes> - size of each of the two"
+			       " read buffers (default: %d)\n",
+			       FTAR_OP_EXTR_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_EXTR_STR, FTAR_SCAN_BUF_SIZE);
+			return 0;
+		}
+
+		/* Parse any options, then check for the rest */
+		i = parse_scan_opts(argc, argv, &scan_opts, &base_path,
+				    FTAR_OP_EXTR_STR);
+		if (argc - i < 1)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_EXTR_STR, FTAR_OP_HELP_STR);
+		archive = argv[i++];
+
+		err = ftar_extract_base(archive, base_path,
+					(const char *const *)&argv[i],
+					argc - i, &scan_opts);
+		if (err < 0)
+			ftar_err_exit(errno,
+				      "Error: failed to extract archive: %s\n",
+				      strerror(errno));
+
+		break;
+	case FTAR_OP_VERIFY:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s [options]"
+			       " <archive>\n"
+			       "Reads the whole archive and checks that every"
+			       " file in it is intact, or every shard of an"
+			       " archive set. The options are the same as for"
+			       " %s mode.\n",
+			       FTAR_OP_VERIFY_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_VERIFY_STR, FTAR_OP_EXTR_STR);
+			return 0;
+		}
+
+		i = parse_scan_opts(argc, argv, &scan_opts, NULL,
+				    FTAR_OP_VERIFY_STR);
+		if (argc - i < 1)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_VERIFY_STR, FTAR_OP_HELP_STR);
+
+		if (ftar_set_is_manifest(argv[i]))
+			err = ftar_set_verify(argv[i], &scan_opts, &bad);
+		else
+			err = ftar_verify(argv[i], &scan_opts, &bad);
+		if (err < 0 && bad.name[0])
+			ftar_err_exit(errno,
+				      "Error: \"%s\" is corrupt: %s\n",
+				      bad.name, strerror(errno));
+		if (err < 0)
+			ftar_err_exit(errno,
+				      "Error: failed to verify archive: %s\n",
+				      strerror(errno));
+		printf("Archive is intact.\n");
+
+		break;
+	case FTAR_OP_EMBED:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s [--namespace"
+			       " <name>] <header to create> <archive, or files"
+			       " to embed>\n"
+			       "Writes a C++ header with the files in constexpr"
+			       " arrays, found with frankentar::<name>::find"
+			       " (see frankentar_embed.hpp).\n"
+			       "  --namespace - the namespace in frankentar to"
+			       " put them in (default: %s)\n",
+			       FTAR_OP_EMBED_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_EMBED_STR, FTAR_EMBED_NS);
+			return 0;
+		}
+
+		/* Parse our arguments */
+		path = NULL;
+		i = 2;
+		if (argc > 3 && strcmp(argv[i], "--namespace") == 0) {
+			path = argv[i + 1];
+			i += 2;
+		}
+		if (argc - i < 2)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_EMBED_STR, FTAR_OP_HELP_STR);
+		archive = argv[i++];
+
+		/* Embed an archive as it is, or pack the files first */
+		if (argc - i == 1 && is_archive(argv[i]))
+			tar = load_archive(argv[i], NULL);
+		else
+			tar = pack_files((const char *const *)argv + i,
+					 argc - i);
+
+		ar = fopen(archive, "w");
+		if (!ar)
+			ftar_err_exit(errno,
+				      "Error: failed to create file: %s\n",
+				      strerror(errno));
+		if (ftar_embed(ar, tar, path) < 0 || fclose(ar) != 0)
+			ftar_err_exit(errno,
+				      "Error: failed to write header: %s\n",
+				      strerror(errno));
+		ftar_free(tar);
+
+		break;
+	case FTAR_OP_ATTACH:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s <executable>"
+			       " <archive, or files to attach>\n"
+			       "Appends the archive to the executable, which can"
+			       " load it with ftar_open_self (see"
+			       " frankentar/self.h). One that's already attached"
+			       " is replaced.\n",
+			       FTAR_OP_ATTACH_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_ATTACH_STR);
+			return 0;
+		}
+		if (argc < 4)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_ATTACH_STR, FTAR_OP_HELP_STR);
+
+		/* Attach an archive as it is, or pack the files first */
+		if (argc == 4 && is_archive(argv[3]))
+			buf = read_file(argv[3], &len);
+		else
+			buf = pack_raw((const char *const *)argv + 3, argc - 3,
+				       &len);
+		if (ftar_attach(argv[2], buf, len) < 0)
+			ftar_err_exit(errno,
+				      "Error: failed to attach archive to"
+				      " \"%s\": %s\n",
+				      argv[2], strerror(errno));
+		free(buf);
+
+		break;
+	case FTAR_OP_DIFF:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s <old archive> "
+			       "<new archive> <patch to create>\n",
+			       FTAR_OP_DIFF_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_DIFF_STR);
+			return 0;
+		}
+		if (argc < 5)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_DIFF_STR, FTAR_OP_HELP_STR);
+
+		/* Load both versions and store the new one against the old */
+		base = load_archive(argv[2], NULL);
+		tar = load_archive(argv[3], NULL);
+		buf = ftar_diff(base, tar, &len);
+		if (!buf)
+			ftar_err_exit(errno,
+				      "Error: failed to make patch: %s\n",
+				      strerror(errno));
+		write_file(argv[4], buf, len);
+
+		free(buf);
+		ftar_free(tar);
+		ftar_free(base);
+
+		break;
+	case FTAR_OP_PATCH:
+		/* Check if help was asked for */
+		if (argc > 2 && strcmp(argv[2], FTAR_OP_HELP_STR) == 0) {
+			printf("Frankentar %s mode usage: %s %s <base archive> "
+			       "<patch> <archive to create>\n",
+			       FTAR_OP_PATCH_STR, FTAR_GET_BASENAME(argv[0]),
+			       FTAR_OP_PATCH_STR);
+			return 0;
+		}
+		if (argc < 5)
+			ftar_err_exit(EINVAL,
+				      "Error: not enough arguments for "
+				      "specified mode, see \"%s %s %s\"\n",
+				      FTAR_GET_BASENAME(argv[0]),
+				      FTAR_OP_PATCH_STR, FTAR_OP_HELP_STR);
+
+		/* Load the patch on top of the base */
+		base = load_archive(argv[2], NULL);
+		buf = read_file(argv[3], &len);
+		tar = ftar_load_patched(base, buf, len);
+		if (!tar)
+			ftar_err_exit(errno,
+				      "Error: failed to parse patch: %s\n",
+				      strerror(errno));
+		free(buf);
+
+		/* Reconstruct every entry, then write the result out */
+		for (i = 0; i < tar->ent_count; i++) {
+			if (!ftar_patched_data(tar, tar->entries[i]))
+				ftar_err_exit(errno,
+					      "Error: failed to patch \"%s\":"
+					      " %s\n",
+					      tar->entries[i]->name,
+					      strerror(errno));
+		}
+		buf = ftar_to_raw(tar, &len);
+		if (!buf)
+			ftar_err_exit(errno,
+				      "Error: failed to write archive: %s\n",
+				      strerror(errno));
+		write_file(argv[4], buf, len);
+
+		free(buf);
+		ftar_free(tar);
+		ftar_free(base);
 
 		break;
 	case FTAR_OP_HELP:
@@ -404,11 +1016,23 @@ int main(int argc, char *argv[])
 		       "  list - list the files in the archive\n"
 		       "  find - determine whether a file is in the archive\n"
 		       "  create - create an archive with the given files\n"
-		       "  add - add a file to the archive, overwriting any"
-		       " file with the same name\n"
-		       "  delete - delete a file from the archive\n"
+		       "  add - add files to the archive, replacing any with"
+		       " the same names\n"
+		       "  update - add the files that are new or have"
+		       " changed\n"
+		       "  delete - delete files from the archive\n"
 		       "  extract - extract all or specified files from the"
 		       " archive\n"
+		       "  diff - make a patch from one version of an archive"
+		       " to another\n"
+		       "  patch - apply a patch made by diff\n"
+		       "  compact - reclaim the space taken up by deleted"
+		       " files\n"
+		       "  verify - check that every file in the archive can"
+		       " be read\n"
+		       "  embed - write a C++ header that embeds files in a"
+		       " program\n"
+		       "  attach - append an archive to an executable\n"
 		       "  help - print this help message\n\n"
 		       "Arguments in angle brackets (<>) are mandatory, while"
 		       " those in square brackets ([]) are optional.\n",
@@ -0,0 +1,258 @@
+#include "frankentar/overlay.h"
+#include "frankentar/read.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct overlay_mount {
+	struct ftar *tar;
+	int priority;
+};
+
+struct ftar_overlay {
+	struct overlay_mount *mounts; /* Lowest priority first */
+	size_t mount_count;
+	size_t capacity;
+	struct ftar_ent **names; /* The winning entry for each name */
+	struct ftar **owners; /* The archive each slot's entry is in */
+	size_t mask;
+	size_t total; /* Entries in every archive, which bounds the names */
+	size_t live; /* Names that aren't whited out */
+};
+
+/* Put an archive's entries over whatever's in a table already */
+static void overlay_add(struct ftar_ent **names, struct ftar **owners,
+			size_t mask, struct ftar *tar, size_t *live)
+{
+	const struct ftar_ent *first;
+	struct ftar_ent **slot;
+	struct ftar_ent *ent;
+	size_t i;
+
+	for (i = 0; i < tar->ent_count; i++) {
+		ent = tar->entries[i];
+
+		/* Dictionaries and chunks only mean anything in their archive */
+		if (ent->type == FTAR_FTYPE_DICT ||
+		    ent->type == FTAR_FTYPE_CHUNK)
+			continue;
+
+		/* Only what the archive itself would find counts */
+		if (ftar_find_r(tar, ent->name, &first) != FTAR_OK ||
+		    first != ent)
+			continue;
+
+		slot = ftar_name_slot(names, mask, ent->name);
+		if (*slot && (*slot)->type != FTAR_FTYPE_WHITEOUT)
+			(*live)--;
+		if (ent->type != FTAR_FTYPE_WHITEOUT)
+			(*live)++;
+		*slot = ent;
+		owners[slot - names] = tar;
+	}
+}
+
+/* Make the table again from every archive, bottom to top */
+static int overlay_build(struct ftar_overlay *overlay)
+{
+	struct ftar_ent **names;
+	struct ftar **owners;
+	size_t total;
+	size_t live;
+	size_t mask;
+	size_t i;
+
+	total = 0;
+	for (i = 0; i < overlay->mount_count; i++)
+		total += overlay->mounts[i].tar->ent_count;
+	for (mask = 16; mask < total * 2; mask <<= 1)
+		;
+	names = calloc(mask, sizeof(struct ftar_ent *));
+	owners = calloc(mask, sizeof(struct ftar *));
+	if (!names || !owners) {
+		free(names);
+		free(owners);
+		return -1;
+	}
+	mask--;
+
+	live = 0;
+	for (i = 0; i < overlay->mount_count; i++)
+		overlay_add(names, owners, mask, overlay->mounts[i].tar, &live);
+
+	free(overlay->names);
+	free(overlay->owners);
+	overlay->names = names;
+	overlay->owners = owners;
+	overlay->mask = mask;
+	overlay->total = total;
+	overlay->live = live;
+
+	return 0;
+}
+
+struct ftar_overlay *ftar_overlay_new(void)
+{
+	struct ftar_overlay *overlay;
+
+	errno = 0;
+
+	overlay = calloc(1, sizeof(struct ftar_overlay));
+	if (!overlay)
+		return NULL;
+	if (overlay_build(overlay) < 0) {
+		free(overlay);
+		return NULL;
+	}
+
+	return overlay;
+}
+
+int ftar_overlay_mount(struct ftar_overlay *overlay, struct ftar *tar,
+		       int priority)
+{
+	struct overlay_mount *mounts;
+	size_t capacity;
+	size_t pos;
+	size_t i;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!overlay || !tar) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < overlay->mount_count; i++) {
+		if (overlay->mounts[i].tar == tar) {
+			errno = EEXIST;
+			return -1;
+		}
+	}
+
+	/* Double the space when it runs out */
+	if (overlay->mount_count == overlay->capacity) {
+		capacity = overlay->capacity ? overlay->capacity * 2 : 8;
+		mounts = realloc(overlay->mounts,
+				 capacity * sizeof(struct overlay_mount));
+		if (!mounts)
+			return -1;
+		overlay->mounts = mounts;
+		overlay->capacity = capacity;
+	}
+
+	/* It goes above everything with the same priority or less */
+	for (pos = overlay->mount_count;
+	     pos && overlay->mounts[pos - 1].priority > priority; pos--)
+		;
+	memmove(&overlay->mounts[pos + 1], &overlay->mounts[pos],
+		(overlay->mount_count - pos) * sizeof(struct overlay_mount));
+	overlay->mounts[pos].tar = tar;
+	overlay->mounts[pos].priority = priority;
+	overlay->mount_count++;
+
+	/* On top, it can just go over what's there if it fits */
+	if (pos == overlay->mount_count - 1 &&
+	    (overlay->total + tar->ent_count) * 2 <= overlay->mask + 1) {
+		overlay_add(overlay->names, overlay->owners, overlay->mask, tar,
+			    &overlay->live);
+		overlay->total += tar->ent_count;
+		return 0;
+	}
+
+	if (overlay_build(overlay) < 0) {
+		overlay->mount_count--;
+		memmove(&overlay->mounts[pos], &overlay->mounts[pos + 1],
+			(overlay->mount_count - pos) *
+				sizeof(struct overlay_mount));
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+int ftar_overlay_unmount(struct ftar_overlay *overlay, struct ftar *tar)
+{
+	struct overlay_mount mount;
+	size_t pos;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!overlay || !tar) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (pos = 0; pos < overlay->mount_count; pos++) {
+		if (overlay->mounts[pos].tar == tar)
+			break;
+	}
+	if (pos == overlay->mount_count) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* Whatever it hid has to show through again */
+	mount = overlay->mounts[pos];
+	overlay->mount_count--;
+	memmove(&overlay->mounts[pos], &overlay->mounts[pos + 1],
+		(overlay->mount_count - pos) * sizeof(struct overlay_mount));
+	if (overlay_build(overlay) < 0) {
+		memmove(&overlay->mounts[pos + 1], &overlay->mounts[pos],
+			(overlay->mount_count - pos) *
+				sizeof(struct overlay_mount));
+		overlay->mounts[pos] = mount;
+		overlay->mount_count++;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+enum ftar_result ftar_overlay_find(const struct ftar_overlay *overlay,
+				   const char *name,
+				   const struct ftar_ent **ent_ret,
+				   struct ftar **tar_ret)
+{
+	struct ftar_ent **slot;
+
+	if (!overlay || !name || !ent_ret)
+		return FTAR_E_INVAL;
+
+	slot = ftar_name_slot(overlay->names, overlay->mask, name);
+	if (!*slot || (*slot)->type == FTAR_FTYPE_WHITEOUT) {
+		*ent_ret = NULL;
+		if (tar_ret)
+			*tar_ret = NULL;
+		return FTAR_E_NOENT;
+	}
+
+	*ent_ret = *slot;
+	if (tar_ret)
+		*tar_ret = overlay->owners[slot - overlay->names];
+
+	return FTAR_OK;
+}
+
+size_t ftar_overlay_count(const struct ftar_overlay *overlay)
+{
+	return overlay ? overlay->live : 0;
+}
+
+void ftar_overlay_free(struct ftar_overlay *overlay)
+{
+	if (!overlay)
+		return;
+
+	free(overlay->mounts);
+	free(overlay->names);
+	free(overlay->owners);
+	free(overlay);
+}
+
+#ifdef __cplusplus
+}
+#endif
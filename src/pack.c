@@ -0,0 +1,1342 @@
+#define _XOPEN_SOURCE 501
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frankentar/chunk.h"
+#include "frankentar/compress.h"
+#include "frankentar/hash.h"
+#include "frankentar/index.h"
+#include "frankentar/pack.h"
+#include "frankentar/pool.h"
+#include "frankentar/read.h"
+#include "frankentar/util.h"
+#include "frankentar/write.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _MSC_VER
+#define S_IFMT _S_IFMT
+#define S_IFSOCK _S_IFCHR
+#define S_IFLNK _S_IFLNK
+#define S_IFREG _S_IFREG
+#define S_IFBLK _S_IFCHR
+#define S_IFDIR _S_IFDIR
+#define S_IFCHR _S_IFCHR
+#define S_IFIFO _S_IFIFO
+#endif
+
+/* One chunk of one file, read and compressed by a worker */
+struct pack_job {
+	struct pack_state *state;
+	size_t ent; /* Index of the entry this chunk belongs to */
+	bool first; /* Whether this is the entry's first chunk */
+	bool last; /* Whether this is the entry's last chunk */
+	int codec;
+	int fd;
+	off_t off;
+	size_t len;
+	char *out;
+	size_t out_len;
+	int err;
+	bool done;
+	struct pack_job *next;
+};
+
+struct pack_state {
+	pthread_mutex_t lock;
+	pthread_cond_t cond; /* Signalled whenever a job finishes */
+	const struct ftar_lz_dict *dict; /* Hashed once for every chunk */
+};
+
+int ftar_ent_from_file(struct ftar_ent *ent, const char *path)
+{
+	struct stat st;
+	int err;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!ent || !path) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (strlen(path) >= sizeof(ent->name)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	/* Stat the file (Windows supports this) */
+	err = stat(path, &st);
+	if (err < 0)
+		return -1;
+
+	/* Fill in the entry */
+	memset(ent, 0, FTAR_ENT_HDR_SIZE);
+	strcpy(ent->name, path);
+	ent->mode = (st.st_mode & (FTAR_SET_MODE_USER(FTAR_MODE_FULL) |
+				   FTAR_SET_MODE_GROUP(FTAR_MODE_FULL) |
+				   FTAR_SET_MODE_OTHERS(FTAR_MODE_FULL)));
+	ent->mtime = st.st_mtime;
+
+	/* Figure out the file type, only regular files have contents */
+	switch (st.st_mode & S_IFMT) {
+	case S_IFREG:
+		ent->type = FTAR_FTYPE_REG;
+		ent->size = st.st_size;
+		break;
+	case S_IFLNK:
+		/* Figure out what kind of link this is */
+		err = readlink(path, ent->link, sizeof(ent->link) - 1);
+		if (err < 0) { /* Hard link */
+			ent->type = FTAR_FTYPE_LINK;
+			memset(ent->link, 0, sizeof(ent->link));
+		} else {
+			ent->type = FTAR_FTYPE_SYMLINK;
+		}
+		break;
+	case S_IFDIR:
+		ent->type = FTAR_FTYPE_DIR;
+		break;
+	case S_IFIFO:
+		ent->type = FTAR_FTYPE_FIFO;
+		break;
+	default:
+		ent->type = FTAR_FTYPE_SPECIAL;
+		break;
+	}
+
+	ent->checksum = 0;
+	ftar_checksum(ent);
+
+	errno = 0;
+
+	return 0;
+}
+
+/* Read exactly `len` bytes, returning an error code */
+static int pack_pread(int fd, char *buf, size_t len, off_t off)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = pread(fd, buf + done, len - done, off + done);
+		if (n <= 0)
+			return n ? errno : EIO; /* EIO if the file shrank */
+	}
+
+	return 0;
+}
+
+static void pack_job_run(void *arg)
+{
+	struct pack_job *job;
+	char *raw;
+	int err;
+
+	job = arg;
+
+	/* Read the chunk */
+	raw = malloc(job->len);
+	if (!raw) {
+		err = ENOMEM;
+		goto out;
+	}
+	err = pack_pread(job->fd, raw, job->len, job->off);
+	if (err) {
+		free(raw);
+		goto out;
+	}
+
+	/* Compress it, if that's what we're doing */
+	if (job->codec == FTAR_CODEC_NONE) {
+		job->out = raw;
+		job->out_len = job->len;
+	} else {
+		job->out = malloc(ftar_chunk_bound(job->len));
+		if (job->out) {
+			if (job->codec == FTAR_CODEC_LZ_DICT)
+				job->out_len = ftar_chunk_compress_dict(
+					raw, job->len, job->out,
+					job->state->dict);
+			else
+				job->out_len = ftar_chunk_compress(
+					raw, job->len, job->out, NULL, 0);
+		} else {
+			err = ENOMEM;
+		}
+		free(raw);
+	}
+
+out:
+	pthread_mutex_lock(&job->state->lock);
+	job->err = err;
+	job->done = true;
+	pthread_cond_broadcast(&job->state->cond);
+	pthread_mutex_unlock(&job->state->lock);
+}
+
+/*
+ * Train a dictionary from an even spread of the entries small enough to be
+ *  compressed against it
+ */
+static char *pack_train_dict(struct ftar_ent *ents, const char *const *paths,
+			     size_t count, const struct ftar_pack_opts *opts,
+			     size_t max_entry, size_t *len_ret)
+{
+	char **samples;
+	size_t *lens;
+	char *dict;
+	size_t total;
+	size_t stride;
+	size_t seen;
+	size_t n;
+	size_t i;
+	int fd;
+	int err;
+
+	/* Figure out how often to sample to stay within the budget */
+	total = 0;
+	for (i = 0; i < count; i++) {
+		if (ents[i].size && ents[i].size <= max_entry)
+			total += ents[i].size;
+	}
+	if (!total) {
+		*len_ret = 0;
+		return NULL;
+	}
+	stride = total / (opts->dict_size * FTAR_DICT_SAMPLE_FACTOR) + 1;
+
+	samples = calloc(count, sizeof(char *));
+	lens = calloc(count, sizeof(size_t));
+	if (!samples || !lens) {
+		free(samples);
+		free(lens);
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Read the samples */
+	err = 0;
+	n = 0;
+	seen = 0;
+	for (i = 0; i < count && !err; i++) {
+		if (!ents[i].size || ents[i].size > max_entry)
+			continue;
+		if (seen++ % stride)
+			continue;
+
+		samples[n] = malloc(ents[i].size);
+		if (!samples[n]) {
+			err = ENOMEM;
+			break;
+		}
+		fd = open(paths[i], O_RDONLY);
+		if (fd < 0) {
+			err = errno;
+			free(samples[n]);
+			break;
+		}
+		err = pack_pread(fd, samples[n], ents[i].size, 0);
+		close(fd);
+		lens[n++] = ents[i].size;
+	}
+
+	dict = NULL;
+	if (!err)
+		dict = ftar_dict_train((const void *const *)samples, lens, n,
+				       opts->dict_size, len_ret);
+	else
+		*len_ret = -1;
+	if (!dict && !err)
+		err = errno;
+	while (n--)
+		free(samples[n]);
+	free(samples);
+	free(lens);
+
+	errno = err;
+	return dict;
+}
+
+/* Pick a codec for an entry from the start of its file */
+struct pack_probe {
+	const char *path;
+	struct ftar_ent *ent;
+	int err;
+};
+
+static void pack_probe_run(void *arg)
+{
+	struct pack_probe *probe;
+	char *sample;
+	size_t len;
+	int fd;
+
+	probe = arg;
+	len = probe->ent->size < FTAR_AUTO_SAMPLE_SIZE ? probe->ent->size :
+							  FTAR_AUTO_SAMPLE_SIZE;
+	sample = malloc(len);
+	if (!sample) {
+		probe->err = ENOMEM;
+		return;
+	}
+	fd = open(probe->path, O_RDONLY);
+	if (fd < 0) {
+		probe->err = errno;
+		free(sample);
+		return;
+	}
+	probe->err = pack_pread(fd, sample, len, 0);
+	close(fd);
+	if (!probe->err)
+		probe->ent->codec = ftar_codec_choose(sample, len);
+	free(sample);
+}
+
+/* Hash a whole file, for finding duplicates */
+struct pack_hash {
+	const char *path;
+	size_t size;
+	size_t index;
+	uint8_t hash[FTAR_HASH_SIZE];
+	int err;
+};
+
+static void pack_hash_run(void *arg)
+{
+	struct pack_hash *h;
+	struct ftar_sha256 ctx;
+	char *buf;
+	size_t off;
+	size_t n;
+	int fd;
+
+	h = arg;
+	buf = malloc(FTAR_CHUNK_SIZE);
+	if (!buf) {
+		h->err = ENOMEM;
+		return;
+	}
+	fd = open(h->path, O_RDONLY);
+	if (fd < 0) {
+		h->err = errno;
+		free(buf);
+		return;
+	}
+
+	ftar_sha256_init(&ctx);
+	for (off = 0; off < h->size && !h->err; off += n) {
+		n = h->size - off < FTAR_CHUNK_SIZE ? h->size - off :
+						      FTAR_CHUNK_SIZE;
+		h->err = pack_pread(fd, buf, n, off);
+		ftar_sha256_update(&ctx, buf, n);
+	}
+	ftar_sha256_final(&ctx, h->hash);
+
+	close(fd);
+	free(buf);
+}
+
+static int pack_hash_cmp(const void *a, const void *b)
+{
+	const struct pack_hash *ha;
+	const struct pack_hash *hb;
+	int ret;
+
+	ha = a;
+	hb = b;
+	ret = memcmp(ha->hash, hb->hash, FTAR_HASH_SIZE);
+	if (!ret)
+		ret = (ha->size > hb->size) - (ha->size < hb->size);
+	if (!ret)
+		ret = (ha->index > hb->index) - (ha->index < hb->index);
+
+	return ret;
+}
+
+/*
+ * Turn every file whose contents match an earlier one's into a link to it,
+ *  with no payload of its own (like a hard link in tar)
+ */
+static int pack_dedup(struct ftar_pool *pool, struct ftar_ent *ents,
+		      const char *const *paths, size_t count)
+{
+	struct pack_hash *hashes;
+	size_t canon;
+	size_t n;
+	size_t i;
+	int err;
+
+	hashes = calloc(count ? count : 1, sizeof(struct pack_hash));
+	if (!hashes)
+		return -1;
+
+	/* Hash every regular file on the pool */
+	err = 0;
+	n = 0;
+	for (i = 0; i < count && !err; i++) {
+		if (ents[i].type != FTAR_FTYPE_REG || !ents[i].size)
+			continue;
+		hashes[n].path = paths[i];
+		hashes[n].size = ents[i].size;
+		hashes[n].index = i;
+		if (ftar_pool_submit(pool, pack_hash_run, &hashes[n++]) < 0)
+			err = errno;
+	}
+	ftar_pool_wait(pool);
+	for (i = 0; i < n && !err; i++)
+		err = hashes[i].err;
+	if (err) {
+		free(hashes);
+		errno = err;
+		return -1;
+	}
+
+	/*
+	 * Sorting puts duplicates next to each other, with the first one in
+	 *  the archive at the start of each run
+	 */
+	qsort(hashes, n, sizeof(struct pack_hash), pack_hash_cmp);
+	canon = 0;
+	for (i = 1; i < n; i++) {
+		if (memcmp(hashes[i].hash, hashes[canon].hash,
+			   FTAR_HASH_SIZE) != 0 ||
+		    hashes[i].size != hashes[canon].size) {
+			canon = i;
+			continue;
+		}
+
+		/* The checksum already covers the real size */
+		ents[hashes[i].index].type = FTAR_FTYPE_LINK;
+		strcpy(ents[hashes[i].index].link,
+		       ents[hashes[canon].index].name);
+		ents[hashes[i].index].size = 0;
+	}
+	free(hashes);
+
+	return 0;
+}
+
+/* Pad out from the end of a header to where its payload starts */
+static int pack_write_pad(FILE *out, size_t align)
+{
+	static const char zero_block[FTAR_BLOCK_SIZE];
+	size_t pad;
+	size_t n;
+	long pos;
+
+	if (align <= 1)
+		return 0;
+	pos = ftell(out);
+	if (pos < 0)
+		return -1;
+	for (pad = ftar_payload_pad(pos - FTAR_ENT_HDR_SIZE, 1, align); pad;
+	     pad -= n) {
+		n = pad < sizeof(zero_block) ? pad : sizeof(zero_block);
+		if (fwrite(zero_block, n, 1, out) != 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Write an entry's header, with `size` replaced by the stored size, and the
+ *  padding before its payload if it has one (compressed ones always do)
+ */
+static int pack_write_hdr(FILE *out, struct ftar_ent *ent, size_t size,
+			  size_t align)
+{
+	struct ftar_ent hdr;
+
+	memcpy(&hdr, ent, FTAR_ENT_HDR_SIZE);
+	hdr.size = size;
+	if (fwrite(&hdr, FTAR_ENT_HDR_SIZE, 1, out) != 1)
+		return -1;
+	if (size || ent->codec != FTAR_CODEC_NONE)
+		return pack_write_pad(out, align);
+
+	return 0;
+}
+
+/* Finish off an archive with two empty blocks, returning an error code */
+static int pack_write_end(FILE *out)
+{
+	static const char zero_block[FTAR_BLOCK_SIZE];
+
+	if (fwrite(zero_block, sizeof(zero_block), 1, out) != 1 ||
+	    fwrite(zero_block, sizeof(zero_block), 1, out) != 1 ||
+	    fflush(out) != 0)
+		return errno ? errno : EIO;
+
+	return 0;
+}
+
+/*
+ * Rewrite an entry that compression made bigger as a raw one, starting from
+ *  its header. This leaves the file position at the end of the entry, which
+ *  is no longer the end of the file.
+ */
+static int pack_store_raw(FILE *out, struct ftar_ent *ent, long hdr_pos,
+			  int fd, size_t chunk_size, size_t align)
+{
+	char *buf;
+	size_t off;
+	size_t n;
+	int err;
+
+	if (fseek(out, hdr_pos, SEEK_SET) < 0)
+		return errno;
+	ent->codec = FTAR_CODEC_NONE;
+	if (pack_write_hdr(out, ent, ent->size, align) < 0)
+		return errno ? errno : EIO;
+
+	buf = malloc(chunk_size);
+	if (!buf)
+		return ENOMEM;
+	err = 0;
+	for (off = 0; off < ent->size && !err; off += n) {
+		n = ent->size - off < chunk_size ? ent->size - off : chunk_size;
+		err = pack_pread(fd, buf, n, off);
+		if (!err && fwrite(buf, n, 1, out) != 1)
+			err = errno ? errno : EIO;
+	}
+	free(buf);
+
+	return err;
+}
+
+/* A content-defined chunk of a file */
+struct cdc_chunk {
+	uint8_t hash[FTAR_HASH_SIZE];
+	size_t len;
+};
+
+/* Split a whole file into chunks and hash them */
+struct cdc_file {
+	const char *path;
+	size_t size;
+	struct cdc_chunk *chunks;
+	size_t count;
+	int err;
+};
+
+static void cdc_file_run(void *arg)
+{
+	struct cdc_file *f;
+	char *buf;
+	size_t cap;
+	size_t filled;
+	size_t pos;
+	off_t start; /* Offset in the file of the start of the buffer */
+	size_t n;
+	int fd;
+
+	f = arg;
+	cap = FTAR_CDC_MAX * 4;
+	buf = malloc(cap);
+	f->chunks = malloc((f->size / FTAR_CDC_MIN + 1) *
+			   sizeof(struct cdc_chunk));
+	if (!buf || !f->chunks) {
+		free(buf);
+		f->err = ENOMEM;
+		return;
+	}
+	fd = open(f->path, O_RDONLY);
+	if (fd < 0) {
+		f->err = errno;
+		free(buf);
+		return;
+	}
+
+	start = 0;
+	filled = 0;
+	pos = 0;
+	while (start + pos < f->size) {
+		/* Keep a whole chunk (or the rest of the file) buffered */
+		if (filled - pos < FTAR_CDC_MAX && start + filled < f->size) {
+			memmove(buf, buf + pos, filled - pos);
+			start += pos;
+			filled -= pos;
+			pos = 0;
+			n = f->size - start - filled;
+			if (n > cap - filled)
+				n = cap - filled;
+			f->err = pack_pread(fd, buf + filled, n, start + filled);
+			if (f->err)
+				break;
+			filled += n;
+		}
+
+		n = ftar_cdc_cut(buf + pos, filled - pos);
+		ftar_sha256(buf + pos, n, f->chunks[f->count].hash);
+		f->chunks[f->count++].len = n;
+		pos += n;
+	}
+
+	close(fd);
+	free(buf);
+}
+
+/* Read a chunk that hasn't been stored yet and make an entry for it */
+struct cdc_job {
+	const char *path;
+	off_t off;
+	size_t len;
+	const uint8_t *hash;
+	int codec;
+	char *out;
+	size_t out_len;
+	int err;
+};
+
+static void cdc_job_run(void *arg)
+{
+	struct cdc_job *job;
+	struct ftar_ent ent;
+	int fd;
+
+	job = arg;
+
+	/* Chunks get no mtime, so the same chunk is always stored the same */
+	memset(&ent, 0, sizeof(struct ftar_ent));
+	ftar_chunk_name(job->hash, ent.name);
+	ent.mode = FTAR_SET_MODE_USER(FTAR_MODE_RDWR) |
+		   FTAR_SET_MODE_GROUP(FTAR_MODE_READ) |
+		   FTAR_SET_MODE_OTHERS(FTAR_MODE_READ);
+	ent.codec = job->codec;
+	ent.size = job->len;
+	ent.type = FTAR_FTYPE_CHUNK;
+	ftar_checksum(&ent);
+
+	ent.data = malloc(job->len);
+	if (!ent.data) {
+		job->err = ENOMEM;
+		return;
+	}
+	fd = open(job->path, O_RDONLY);
+	if (fd < 0) {
+		job->err = errno;
+		free(ent.data);
+		return;
+	}
+	job->err = pack_pread(fd, ent.data, job->len, job->off);
+	close(fd);
+
+	if (!job->err) {
+		job->out = ftar_ent_to_raw(&ent, &job->out_len);
+		if (!job->out)
+			job->err = errno ? errno : ENOMEM;
+	}
+	free(ent.data);
+}
+
+/* The hashes of the chunks that are already stored */
+struct cdc_set {
+	uint8_t (*keys)[FTAR_HASH_SIZE];
+	bool *used;
+	size_t mask;
+	size_t count;
+};
+
+/* Find the slot a hash is in, or the empty one it would go in */
+static size_t cdc_set_slot(struct cdc_set *set, const uint8_t *hash)
+{
+	uint64_t h;
+	size_t i;
+
+	/* The hash is already evenly spread, so just use the start of it */
+	memcpy(&h, hash, sizeof(uint64_t));
+	for (i = h & set->mask; set->used[i]; i = (i + 1) & set->mask) {
+		if (memcmp(set->keys[i], hash, FTAR_HASH_SIZE) == 0)
+			break;
+	}
+
+	return i;
+}
+
+/* Add a hash to the set, returning 1 if it's new, 0 if not or -1 (error) */
+static int cdc_set_add(struct cdc_set *set, const uint8_t *hash)
+{
+	struct cdc_set grown;
+	size_t slot;
+	size_t i;
+
+	/* Keep it at most half full */
+	if ((set->count + 1) * 2 > set->mask + 1) {
+		grown.mask = set->mask ? set->mask * 2 + 1 : 1023;
+		grown.count = set->count;
+		grown.keys = malloc((grown.mask + 1) * FTAR_HASH_SIZE);
+		grown.used = calloc(grown.mask + 1, sizeof(bool));
+		if (!grown.keys || !grown.used) {
+			free(grown.keys);
+			free(grown.used);
+			return -1;
+		}
+		for (i = 0; set->mask && i <= set->mask; i++) {
+			if (!set->used[i])
+				continue;
+			slot = cdc_set_slot(&grown, set->keys[i]);
+			memcpy(grown.keys[slot], set->keys[i], FTAR_HASH_SIZE);
+			grown.used[slot] = true;
+		}
+		free(set->keys);
+		free(set->used);
+		*set = grown;
+	}
+
+	slot = cdc_set_slot(set, hash);
+	if (set->used[slot])
+		return 0;
+	memcpy(set->keys[slot], hash, FTAR_HASH_SIZE);
+	set->used[slot] = true;
+	set->count++;
+
+	return 1;
+}
+
+/* Add the chunks in a base archive to the set, only reading its headers */
+static int cdc_set_add_base(struct cdc_set *set, const char *path)
+{
+	struct ftar_index *idx;
+	uint8_t hash[FTAR_HASH_SIZE];
+	size_t i;
+	int fd;
+	int err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return errno;
+	idx = ftar_index_fd(fd);
+	err = idx ? 0 : errno;
+	close(fd);
+
+	for (i = 0; idx && i < idx->ent_count && !err; i++) {
+		if (idx->entries[i].hdr.type == FTAR_FTYPE_CHUNK &&
+		    ftar_chunk_hash(idx->entries[i].hdr.name, hash) == 0 &&
+		    cdc_set_add(set, hash) < 0)
+			err = ENOMEM;
+	}
+	ftar_index_free(idx);
+
+	return err;
+}
+
+/* Read, compress and write out a batch of new chunks, in order */
+static int cdc_flush(FILE *out, struct ftar_pool *pool, struct cdc_job *jobs,
+		     size_t count, size_t align, size_t *records)
+{
+	size_t i;
+	int err;
+
+	err = 0;
+	for (i = 0; i < count && !err; i++) {
+		if (ftar_pool_submit(pool, cdc_job_run, &jobs[i]) < 0)
+			err = errno;
+	}
+	ftar_pool_wait(pool);
+
+	for (i = 0; i < count; i++) {
+		if (!err)
+			err = jobs[i].err;
+		if (!err &&
+		    (fwrite(jobs[i].out, FTAR_ENT_HDR_SIZE, 1, out) != 1 ||
+		     pack_write_pad(out, align) < 0 ||
+		     fwrite(jobs[i].out + FTAR_ENT_HDR_SIZE,
+			    jobs[i].out_len - FTAR_ENT_HDR_SIZE, 1, out) != 1))
+			err = errno ? errno : EIO;
+		if (!err)
+			(*records)++;
+		free(jobs[i].out);
+	}
+
+	return err;
+}
+
+/* Write the entries in [from, to), whose chunks have all been written */
+static int cdc_write_ents(FILE *out, struct ftar_ent *ents,
+			  struct cdc_file *files, size_t from, size_t to,
+			  size_t align, size_t *records)
+{
+	char *manifest;
+	size_t len;
+	size_t i;
+	size_t j;
+	int err;
+
+	err = 0;
+	for (i = from; i < to && !err; i++) {
+		if (!files[i].count) {
+			if (pack_write_hdr(out, &ents[i], ents[i].size,
+					   align) < 0)
+				err = errno ? errno : EIO;
+			(*records)++;
+			continue;
+		}
+
+		len = FTAR_MANIFEST_HDR_SIZE + files[i].count * FTAR_HASH_SIZE;
+		manifest = malloc(len);
+		if (!manifest)
+			return ENOMEM;
+		ftar_manifest_hdr(manifest, files[i].size, files[i].count);
+		for (j = 0; j < files[i].count; j++)
+			memcpy(manifest + FTAR_MANIFEST_HDR_SIZE +
+				       j * FTAR_HASH_SIZE,
+			       files[i].chunks[j].hash, FTAR_HASH_SIZE);
+
+		ents[i].codec = FTAR_CODEC_CHUNKED;
+		if (pack_write_hdr(out, &ents[i], len, align) < 0 ||
+		    fwrite(manifest, len, 1, out) != 1)
+			err = errno ? errno : EIO;
+		free(manifest);
+		(*records)++;
+	}
+
+	return err;
+}
+
+/*
+ * Write a chunked archive (see chunk.h). The number of entries isn't known
+ *  until every chunk has been checked against the ones already stored, so
+ *  it gets patched in at the end, if there's a header to patch.
+ */
+static int pack_cdc(FILE *out, struct ftar_pool *pool, struct ftar_ent *ents,
+		    const char *const *paths, size_t count,
+		    const struct ftar_pack_opts *opts, bool header,
+		    size_t *records_ret)
+{
+	struct cdc_file *files;
+	struct cdc_job *jobs;
+	struct cdc_job *grown;
+	struct cdc_set set;
+	size_t job_count;
+	size_t job_cap;
+	size_t budget;
+	size_t batch;
+	char hdr[FTAR_HDR_SIZE];
+	size_t records;
+	size_t next; /* Next entry to write out */
+	off_t off;
+	long start;
+	size_t i;
+	size_t j;
+	int added;
+	int err;
+
+	start = ftell(out);
+	if (start < 0)
+		return errno;
+
+	files = calloc(count ? count : 1, sizeof(struct cdc_file));
+	if (!files)
+		return ENOMEM;
+	jobs = NULL;
+	memset(&set, 0, sizeof(struct cdc_set));
+
+	/* Chunk and hash every file with contents on the pool */
+	err = 0;
+	for (i = 0; i < count && !err; i++) {
+		if (ents[i].type != FTAR_FTYPE_REG || !ents[i].size)
+			continue;
+		files[i].path = paths[i];
+		files[i].size = ents[i].size;
+		if (ftar_pool_submit(pool, cdc_file_run, &files[i]) < 0)
+			err = errno;
+	}
+	ftar_pool_wait(pool);
+	for (i = 0; i < count && !err; i++)
+		err = files[i].err;
+
+	/* Chunks in the base don't need to be stored again */
+	if (!err && opts->base)
+		err = cdc_set_add_base(&set, opts->base);
+
+	/* Leave the entry count for later */
+	records = 0;
+	ftar_archive_hdr(hdr, records, opts->align);
+	if (!err && header && fwrite(hdr, FTAR_HDR_SIZE, 1, out) != 1)
+		err = errno ? errno : EIO;
+
+	budget = opts->max_inflight;
+	if (!budget)
+		budget = FTAR_CDC_MAX * 4 *
+			 (opts->threads ? opts->threads : ftar_cpu_count());
+	job_count = 0;
+	job_cap = 0;
+	batch = 0;
+	next = 0;
+	for (i = 0; i < count && !err; i++) {
+		off = 0;
+		for (j = 0; j < files[i].count && !err; j++) {
+			/* Only chunks that haven't been seen yet get stored */
+			added = cdc_set_add(&set, files[i].chunks[j].hash);
+			if (added < 0) {
+				err = ENOMEM;
+				break;
+			}
+			if (added) {
+				if (job_count == job_cap) {
+					job_cap = job_cap ? job_cap * 2 : 64;
+					grown = realloc(jobs,
+							job_cap *
+								sizeof(struct cdc_job));
+					if (!grown) {
+						err = ENOMEM;
+						break;
+					}
+					jobs = grown;
+				}
+				memset(&jobs[job_count], 0,
+				       sizeof(struct cdc_job));
+				jobs[job_count].path = paths[i];
+				jobs[job_count].off = off;
+				jobs[job_count].len = files[i].chunks[j].len;
+				jobs[job_count].hash = files[i].chunks[j].hash;
+				jobs[job_count].codec = opts->codec;
+				job_count++;
+				batch += files[i].chunks[j].len;
+			}
+			off += files[i].chunks[j].len;
+
+			/* Entries before this one have all their chunks now */
+			if (batch >= budget) {
+				err = cdc_flush(out, pool, jobs, job_count,
+						opts->align, &records);
+				if (!err)
+					err = cdc_write_ents(out, ents, files,
+							     next, i,
+							     opts->align,
+							     &records);
+				next = i;
+				job_count = 0;
+				batch = 0;
+			}
+		}
+
+		if (!err && !job_count) {
+			err = cdc_write_ents(out, ents, files, next, i + 1,
+					     opts->align, &records);
+			next = i + 1;
+		}
+	}
+	if (!err)
+		err = cdc_flush(out, pool, jobs, job_count, opts->align,
+				&records);
+	if (!err)
+		err = cdc_write_ents(out, ents, files, next, count,
+				     opts->align, &records);
+	if (!err)
+		err = pack_write_end(out);
+
+	/* Now the entry count is known */
+	*records_ret = records;
+	if (!err && header &&
+	    (fseek(out, start + FTAR_MAGIC_LEN, SEEK_SET) < 0 ||
+	     fwrite(&records, sizeof(size_t), 1, out) != 1 ||
+	     fseek(out, 0, SEEK_END) < 0 || fflush(out) != 0))
+		err = errno ? errno : EIO;
+
+	for (i = 0; i < count; i++)
+		free(files[i].chunks);
+	free(files);
+	free(jobs);
+	free(set.keys);
+	free(set.used);
+
+	return err;
+}
+
+/* Write the entries, and the archive header too if `header` is set */
+static int pack_run(FILE *out, const char *const *paths, size_t count,
+		    const struct ftar_pack_opts *opts, bool header,
+		    size_t *written_ret)
+{
+	static const struct ftar_pack_opts default_opts;
+	struct ftar_pool *pool;
+	struct pack_state state;
+	struct pack_job *head;
+	struct pack_job *tail;
+	struct pack_job *job;
+	struct ftar_ent *ents;
+	struct ftar_ent dict_ent;
+	char hdr[FTAR_HDR_SIZE];
+	struct ftar_lz_dict *lz_dict;
+	char *dict;
+	size_t dict_len;
+	char *packed;
+	size_t packed_len;
+	size_t max_entry;
+	size_t written;
+	size_t chunk_size;
+	size_t budget;
+	size_t inflight;
+	size_t chunks;
+	size_t ent_i; /* Next entry to submit a chunk for */
+	size_t chunk_i; /* Next chunk of that entry */
+	struct pack_probe *probes;
+	size_t stored;
+	long hdr_pos;
+	long end_pos;
+	bool shrunk;
+	int fd;
+	int err;
+	size_t i;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!out || (!paths && count)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!opts)
+		opts = &default_opts;
+	chunk_size = opts->chunk_size ? opts->chunk_size : FTAR_CHUNK_SIZE;
+	if (chunk_size >= FTAR_CHUNK_STORED) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* The alignment is kept as a power of two */
+	if (opts->align > FTAR_ALIGN_MAX || (opts->align & (opts->align - 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/*
+	 * Compressed sizes (and ones that are too big) get fixed afterwards,
+	 *  and padding depends on where the payload starts
+	 */
+	if ((opts->codec != FTAR_CODEC_NONE || opts->dict_size || opts->cdc ||
+	     opts->align > 1) &&
+	    ftell(out) < 0)
+		return -1;
+
+	/* Stat everything up front so a bad path fails before any writing */
+	ents = calloc(count ? count : 1, sizeof(struct ftar_ent));
+	if (!ents)
+		return -1;
+	pool = NULL;
+	dict = NULL;
+	dict_len = 0;
+	lz_dict = NULL;
+	for (i = 0; i < count; i++) {
+		if (ftar_ent_from_file(&ents[i], paths[i]) < 0)
+			goto fail;
+	}
+
+	pool = ftar_pool_create(opts->threads);
+	if (!pool)
+		goto fail;
+
+	/* Store files with the same contents once */
+	if (opts->dedup && pack_dedup(pool, ents, paths, count) < 0)
+		goto fail;
+
+	/* Chunked archives are written completely differently */
+	if (opts->cdc) {
+		err = pack_cdc(out, pool, ents, paths, count, opts, header,
+			       written_ret);
+		ftar_pool_free(pool);
+		free(ents);
+		errno = err;
+		return err ? -1 : 0;
+	}
+
+	/* Train a dictionary for the small entries if one was asked for */
+	max_entry = opts->dict_max_entry ? opts->dict_max_entry :
+					   FTAR_DICT_MAX_ENTRY;
+	if (opts->dict_size) {
+		dict = pack_train_dict(ents, paths, count, opts, max_entry,
+				       &dict_len);
+		if (!dict && dict_len)
+			goto fail;
+		if (dict) {
+			lz_dict = ftar_lz_dict_new(dict, dict_len);
+			if (!lz_dict)
+				goto fail;
+		}
+	}
+
+	/* Decide how each entry will be stored */
+	probes = calloc(count ? count : 1, sizeof(struct pack_probe));
+	err = probes ? 0 : errno;
+	for (i = 0; i < count && !err; i++) {
+		if (!ents[i].size) {
+			ents[i].codec = FTAR_CODEC_NONE;
+		} else if (dict && ents[i].size <= max_entry) {
+			ents[i].codec = FTAR_CODEC_LZ_DICT;
+		} else if (opts->codec == FTAR_CODEC_AUTO) {
+			/* Sample it on the pool, these are all independent */
+			ents[i].codec = FTAR_CODEC_NONE;
+			probes[i].path = paths[i];
+			probes[i].ent = &ents[i];
+			if (ftar_pool_submit(pool, pack_probe_run, &probes[i]) <
+			    0)
+				err = errno;
+		} else {
+			ents[i].codec = opts->codec;
+		}
+	}
+	ftar_pool_wait(pool);
+	for (i = 0; i < count && !err; i++)
+		err = probes[i].err;
+	free(probes);
+	if (err) {
+		errno = err;
+		goto fail;
+	}
+
+	budget = opts->max_inflight;
+	if (!budget)
+		budget = chunk_size * 4 * (opts->threads ? opts->threads :
+							     ftar_cpu_count());
+	pthread_mutex_init(&state.lock, NULL);
+	pthread_cond_init(&state.cond, NULL);
+	state.dict = lz_dict;
+
+	/* Write the archive header */
+	err = 0;
+	written = count + (dict ? 1 : 0);
+	*written_ret = written;
+	ftar_archive_hdr(hdr, written, opts->align);
+	if (header && fwrite(hdr, FTAR_HDR_SIZE, 1, out) != 1)
+		err = errno ? errno : EIO;
+
+	/*
+	 * The dictionary goes first, so that it's there before its users. When
+	 *  the samples fit, it's just all of them stuck together, which would
+	 *  cost more than compressing the entries on their own if it wasn't
+	 *  compressed itself.
+	 */
+	if (!err && dict) {
+		memset(&dict_ent, 0, sizeof(struct ftar_ent));
+		strcpy(dict_ent.name, FTAR_DICT_NAME);
+		dict_ent.mode = FTAR_SET_MODE_USER(FTAR_MODE_RDWR) |
+				FTAR_SET_MODE_GROUP(FTAR_MODE_READ) |
+				FTAR_SET_MODE_OTHERS(FTAR_MODE_READ);
+		dict_ent.size = dict_len;
+		dict_ent.mtime = time(NULL);
+		dict_ent.type = FTAR_FTYPE_DICT;
+		ftar_checksum(&dict_ent);
+		packed = ftar_compress(dict, dict_len, 0, NULL, 0, &packed_len);
+		if (packed && packed_len < dict_len) {
+			dict_ent.codec = FTAR_CODEC_LZ;
+		} else {
+			free(packed);
+			packed = NULL;
+			packed_len = dict_len;
+		}
+		if (pack_write_hdr(out, &dict_ent, packed_len, opts->align) <
+			    0 ||
+		    fwrite(packed ? packed : dict, packed_len, 1, out) != 1)
+			err = errno ? errno : EIO;
+		free(packed);
+	}
+
+	head = NULL;
+	tail = NULL;
+	inflight = 0;
+	ent_i = 0;
+	chunk_i = 0;
+	fd = -1;
+	stored = 0;
+	hdr_pos = 0;
+	shrunk = false;
+	while (!err) {
+		/* Keep the workers busy until we're over budget */
+		while (ent_i < count && (inflight < budget || !head)) {
+			job = calloc(1, sizeof(struct pack_job));
+			if (!job) {
+				err = errno;
+				break;
+			}
+			job->state = &state;
+			job->ent = ent_i;
+			job->codec = ents[ent_i].codec;
+			job->fd = -1;
+
+			chunks = (ents[ent_i].size + chunk_size - 1) /
+				 chunk_size;
+			job->first = chunk_i == 0;
+			job->last = chunks == 0 || chunk_i == chunks - 1;
+			if (chunks) {
+				if (job->first) {
+					fd = open(paths[ent_i], O_RDONLY);
+					if (fd < 0) {
+						err = errno;
+						free(job);
+						break;
+					}
+				}
+				job->fd = fd;
+				job->off = chunk_i * chunk_size;
+				job->len = job->last ? ents[ent_i].size -
+							       job->off :
+						       chunk_size;
+			} else {
+				job->done = true;
+			}
+
+			if (tail)
+				tail->next = job;
+			else
+				head = job;
+			tail = job;
+			if (chunks &&
+			    ftar_pool_submit(pool, pack_job_run, job) < 0) {
+				job->err = errno;
+				job->done = true;
+			}
+			inflight += job->len;
+
+			if (job->last) {
+				ent_i++;
+				chunk_i = 0;
+			} else {
+				chunk_i++;
+			}
+		}
+		if (err || !head)
+			break;
+
+		/* Wait for the oldest chunk, since that's the next to write */
+		job = head;
+		pthread_mutex_lock(&state.lock);
+		while (!job->done)
+			pthread_cond_wait(&state.cond, &state.lock);
+		pthread_mutex_unlock(&state.lock);
+		if (job->err) {
+			err = job->err;
+			break;
+		}
+
+		/* Start the entry off with its header */
+		if (job->first) {
+			if (job->codec != FTAR_CODEC_NONE) {
+				char frame[FTAR_FRAME_HDR_SIZE];
+
+				hdr_pos = ftell(out);
+				ftar_frame_hdr(frame, ents[job->ent].size,
+					       chunk_size);
+				stored = FTAR_FRAME_HDR_SIZE;
+				if (pack_write_hdr(out, &ents[job->ent], 0,
+						   opts->align) < 0 ||
+				    fwrite(frame, sizeof(frame), 1, out) != 1)
+					err = errno ? errno : EIO;
+			} else {
+				if (pack_write_hdr(out, &ents[job->ent],
+						   ents[job->ent].size,
+						   opts->align) < 0)
+					err = errno ? errno : EIO;
+			}
+		}
+
+		/* Then the chunk itself */
+		if (!err && job->out_len &&
+		    fwrite(job->out, job->out_len, 1, out) != 1)
+			err = errno ? errno : EIO;
+		stored += job->out_len;
+
+		/*
+		 * Now that the compressed size is known, patch it in, unless
+		 *  compressing the entry didn't help, in which case it gets
+		 *  stored raw instead so that it never grows
+		 */
+		if (!err && job->last && ents[job->ent].codec) {
+			if (stored >= ents[job->ent].size) {
+				err = pack_store_raw(out, &ents[job->ent],
+						     hdr_pos, job->fd,
+						     chunk_size, opts->align);
+				shrunk = true;
+			} else if ((end_pos = ftell(out)) < 0 ||
+				   fseek(out,
+					 hdr_pos +
+						 offsetof(struct ftar_ent, size),
+					 SEEK_SET) < 0 ||
+				   fwrite(&stored, sizeof(size_t), 1, out) != 1 ||
+				   fseek(out, end_pos, SEEK_SET) < 0) {
+				err = errno ? errno : EIO;
+			}
+		}
+		if (job->last && job->fd >= 0)
+			close(job->fd);
+
+		head = job->next;
+		if (!head)
+			tail = NULL;
+		inflight -= job->len;
+		free(job->out);
+		free(job);
+	}
+
+	/* Even on failure, nothing can be freed until the workers finish */
+	ftar_pool_wait(pool);
+	ftar_pool_free(pool);
+	while (head) {
+		job = head;
+		head = job->next;
+		if (job->last && job->fd >= 0)
+			close(job->fd);
+		free(job->out);
+		free(job);
+	}
+	if (chunk_i) /* Part of an entry was submitted, but not its last chunk */
+		close(fd);
+	pthread_cond_destroy(&state.cond);
+	pthread_mutex_destroy(&state.lock);
+	ftar_lz_dict_free(lz_dict);
+	free(dict);
+	free(ents);
+
+	/* Finish off the archive with two empty blocks, like tar */
+	if (!err)
+		err = pack_write_end(out);
+
+	/* Cut off whatever was left over from rewriting entries as raw ones */
+	if (!err && shrunk && ftruncate(fileno(out), ftell(out)) < 0)
+		err = errno;
+
+	errno = err;
+	return err ? -1 : 0;
+fail:
+	err = errno;
+	ftar_pool_free(pool);
+	ftar_lz_dict_free(lz_dict);
+	free(dict);
+	free(ents);
+	errno = err;
+	return -1;
+}
+
+int ftar_pack(FILE *out, const char *const *paths, size_t count,
+	      const struct ftar_pack_opts *opts)
+{
+	size_t written;
+
+	return pack_run(out, paths, count, opts, true, &written);
+}
+
+int ftar_pack_entries(FILE *out, const char *const *paths, size_t count,
+		      const struct ftar_pack_opts *opts, size_t *written_ret)
+{
+	size_t written;
+
+	if (!written_ret)
+		written_ret = &written;
+	return pack_run(out, paths, count, opts, false, written_ret);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,175 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include "frankentar/pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ftar_task {
+	ftar_task_fn fn;
+	void *arg;
+	struct ftar_task *next;
+};
+
+struct ftar_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* Signalled when a task is queued */
+	pthread_cond_t idle; /* Signalled when the last task finishes */
+	struct ftar_task *head;
+	struct ftar_task *tail;
+	size_t pending; /* Queued plus running tasks */
+	bool stop;
+	unsigned thread_count;
+	pthread_t *threads;
+};
+
+static void *pool_worker(void *arg)
+{
+	struct ftar_pool *pool;
+	struct ftar_task *task;
+
+	pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (!pool->head && !pool->stop)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (!pool->head)
+			break;
+
+		/* Take the task off the queue and run it unlocked */
+		task = pool->head;
+		pool->head = task->next;
+		if (!pool->head)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		task->fn(task->arg);
+		free(task);
+
+		pthread_mutex_lock(&pool->lock);
+		if (!--pool->pending)
+			pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+unsigned ftar_cpu_count(void)
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+struct ftar_pool *ftar_pool_create(unsigned threads)
+{
+	struct ftar_pool *pool;
+	unsigned i;
+
+	errno = 0;
+
+	if (!threads)
+		threads = ftar_cpu_count();
+
+	/* Allocate the pool */
+	pool = calloc(1, sizeof(struct ftar_pool));
+	if (!pool)
+		return NULL;
+	pool->threads = calloc(threads, sizeof(pthread_t));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	/* Start the workers */
+	for (i = 0; i < threads; i++) {
+		errno = pthread_create(&pool->threads[i], NULL, pool_worker,
+				       pool);
+		if (errno) {
+			pool->thread_count = i;
+			ftar_pool_free(pool);
+			return NULL;
+		}
+	}
+	pool->thread_count = threads;
+
+	errno = 0;
+
+	return pool;
+}
+
+int ftar_pool_submit(struct ftar_pool *pool, ftar_task_fn fn, void *arg)
+{
+	struct ftar_task *task;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!pool || !fn) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	task = calloc(1, sizeof(struct ftar_task));
+	if (!task)
+		return -1;
+	task->fn = fn;
+	task->arg = arg;
+
+	/* Append it to the queue */
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail)
+		pool->tail->next = task;
+	else
+		pool->head = task;
+	pool->tail = task;
+	pool->pending++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+void ftar_pool_wait(struct ftar_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void ftar_pool_free(struct ftar_pool *pool)
+{
+	unsigned i;
+
+	if (!pool)
+		return;
+
+	/* Let the workers drain the queue and exit */
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+#ifdef __cplusplus
+}
+#endif
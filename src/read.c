@@ -1,19 +1,135 @@
+#define _XOPEN_SOURCE 501
+
+#include "frankentar/chunk.h"
+#include "frankentar/compress.h"
+#include "frankentar/delta.h"
 #include "frankentar/read.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Make a name table for the chunks in `base` */
+static struct ftar_ent **base_table(struct ftar *base, size_t *mask_ret)
+{
+	struct ftar_ent **table;
+	struct ftar_ent **slot;
+	size_t mask;
+	size_t i;
+
+	for (mask = 1; mask < base->ent_count * 2; mask <<= 1)
+		;
+	table = calloc(mask--, sizeof(struct ftar_ent *));
+	if (!table)
+		return NULL;
+	for (i = 0; i < base->ent_count; i++) {
+		if (base->entries[i]->type != FTAR_FTYPE_CHUNK)
+			continue;
+		slot = ftar_name_slot(table, mask, base->entries[i]->name);
+		if (!*slot)
+			*slot = base->entries[i];
+	}
+
+	*mask_ret = mask;
+	return table;
+}
+
+/* Put a chunked payload back together from its manifest */
+static char *load_chunked(const char *manifest, size_t len,
+			  struct ftar_ent **names, size_t mask,
+			  struct ftar_ent **base_names, size_t base_mask,
+			  size_t *len_ret)
+{
+	char name[FTAR_HASH_SIZE * 2 + 1];
+	struct ftar_ent *chunk;
+	uint64_t raw_size;
+	uint32_t count;
+	char *buf;
+	size_t off;
+	size_t i;
+
+	/* Check that the manifest is the right size for its chunk count */
+	if (len < FTAR_MANIFEST_HDR_SIZE) {
+		errno = EINVAL;
+		*len_ret = -1;
+		return NULL;
+	}
+	memcpy(&raw_size, manifest, sizeof(uint64_t));
+	memcpy(&count, manifest + sizeof(uint64_t), sizeof(uint32_t));
+	if ((len - FTAR_MANIFEST_HDR_SIZE) % FTAR_HASH_SIZE ||
+	    (len - FTAR_MANIFEST_HDR_SIZE) / FTAR_HASH_SIZE != count) {
+		errno = EINVAL;
+		*len_ret = -1;
+		return NULL;
+	}
+
+	buf = malloc(raw_size ? raw_size : 1);
+	if (!buf) {
+		*len_ret = -1;
+		return NULL;
+	}
+
+	/* Chunks come from this archive first, then the base */
+	off = 0;
+	for (i = 0; i < count; i++) {
+		ftar_chunk_name((const uint8_t *)manifest +
+					FTAR_MANIFEST_HDR_SIZE +
+					i * FTAR_HASH_SIZE,
+				name);
+		chunk = *ftar_name_slot(names, mask, name);
+		if ((!chunk || chunk->type != FTAR_FTYPE_CHUNK) && base_names)
+			chunk = *ftar_name_slot(base_names, base_mask, name);
+		if (!chunk || chunk->type != FTAR_FTYPE_CHUNK) {
+			free(buf);
+			errno = ENOENT;
+			*len_ret = -1;
+			return NULL;
+		}
+		if (chunk->size > raw_size - off) {
+			free(buf);
+			errno = EINVAL;
+			*len_ret = -1;
+			return NULL;
+		}
+		memcpy(buf + off, chunk->data, chunk->size);
+		off += chunk->size;
+	}
+	if (off != raw_size) {
+		free(buf);
+		errno = EINVAL;
+		*len_ret = -1;
+		return NULL;
+	}
+
+	*len_ret = raw_size;
+	return buf;
+}
+
 struct ftar *ftar_load(void *tar, size_t tar_len)
+{
+	return ftar_load_base(tar, tar_len, NULL);
+}
+
+struct ftar *ftar_load_base(void *tar, size_t tar_len, struct ftar *base)
 {
 	struct ftar *new;
 	struct ftar_ent *ent;
+	struct ftar_ent **names;
+	struct ftar_ent **base_names;
+	struct ftar_ent **slot;
+	size_t mask;
+	size_t base_mask;
+	char *payload;
 	char *addr;
 	char *t;
+	size_t stored;
+	size_t alloc_len;
+	size_t count;
+	size_t pad;
 	size_t i;
 
 	/* Check our arguments */
-	if (!tar || !tar_len) {
+	if (!tar || tar_len < FTAR_HDR_SIZE) {
 		errno = EINVAL;
 		return NULL;
 	}
@@ -29,14 +145,10 @@ struct ftar *ftar_load(void *tar, size_t tar_len)
 	if (!new)
 		return NULL;
 
-	/* Validate the file signature */
+	/* Validate the file signature, which also has the alignment */
 	memcpy(new->magic, t, FTAR_MAGIC_LEN);
-	for (i = 0; i < FTAR_MAGIC_LEN; i++) {
-		if (new->magic[i] != FTAR_MAGIC[i]) {
-			errno = EINVAL;
-			return NULL;
-		}
-	}
+	if (ftar_archive_align(t, &new->align) < 0)
+		return NULL;
 
 	/* Get the number of entries */
 	addr = t + FTAR_MAGIC_LEN;
@@ -51,29 +163,137 @@ struct ftar *ftar_load(void *tar, size_t tar_len)
 	if (!new->entries)
 		return NULL;
 
+	/* Links get resolved by name as they're loaded */
+	for (mask = 1; mask < new->ent_count * 2; mask <<= 1)
+		;
+	names = calloc(mask--, sizeof(struct ftar_ent *));
+	if (!names)
+		return NULL;
+
+	/* Chunks that aren't in a delta pack come from its base */
+	base_names = NULL;
+	base_mask = 0;
+	if (base) {
+		base_names = base_table(base, &base_mask);
+		if (!base_names)
+			return NULL;
+	}
+
 	/* Read each entry into its structure (yay pointer arithmetic!) */
 	addr += sizeof(size_t);
-	for (i = 0; i < new->ent_count; i++) {
+	count = new->ent_count;
+	new->ent_count = 0;
+	for (i = 0; i < count; i++) {
+		/* Make sure the header is actually there */
+		if (addr + FTAR_ENT_HDR_SIZE > t + tar_len) {
+			errno = EINVAL;
+			return NULL;
+		}
+
 		/* Read this header */
-		new->entries[i] = calloc(1, sizeof(struct ftar_ent));
-		if (!new->entries[i])
+		new->entries[new->ent_count] = calloc(1, sizeof(struct ftar_ent));
+		if (!new->entries[new->ent_count])
 			return NULL;
-		ent = new->entries[i];
-		memcpy(ent->name, addr,
-		       (sizeof(*new->entries[i]) - sizeof(char *)));
-
-		/* Read the file for this entry */
-		ent->data =
-			calloc(ent->size, sizeof(char));
-		if (!ent->data)
+		ent = new->entries[new->ent_count];
+		memcpy(ent->name, addr, FTAR_ENT_HDR_SIZE);
+		stored = ent->size;
+		pad = ftar_payload_pad(addr - t, stored, new->align);
+		if (pad > (size_t)(t + tar_len - addr) - FTAR_ENT_HDR_SIZE ||
+		    stored > (size_t)(t + tar_len - addr) - FTAR_ENT_HDR_SIZE -
+				     pad) {
+			errno = EINVAL;
 			return NULL;
-		memcpy(ent->data,
-		       addr + (sizeof(*ent) - sizeof(char *)),
-		       ent->size);
+		}
+		payload = addr + FTAR_ENT_HDR_SIZE + pad;
+
+		/* Deleted entries are just skipped over */
+		if (ent->flags & FTAR_ENT_DELETED) {
+			free(ent);
+			new->entries[new->ent_count] = NULL;
+			addr = payload + stored;
+			continue;
+		}
+		new->ent_count++;
+
+		/*
+		 * A link with no payload shares the data of the entry it
+		 *  names, which is always earlier in the archive
+		 */
+		if (ent->type == FTAR_FTYPE_LINK && ent->link[0] && !stored) {
+			slot = ftar_name_slot(names, mask, ent->link);
+			if (!*slot) {
+				errno = EINVAL;
+				return NULL;
+			}
+			ent->data = (*slot)->data;
+			ent->size = (*slot)->size;
+			goto next;
+		}
+
+		/* Read the file for this entry, decompressing it if need be */
+		switch (ent->codec) {
+		case FTAR_CODEC_NONE:
+			/* Keep the data as aligned as it was in the archive */
+			if (new->align > 1) {
+				alloc_len = (ent->size / new->align + 1) *
+					    new->align;
+				ent->data = aligned_alloc(new->align, alloc_len);
+			} else {
+				ent->data = calloc(ent->size, sizeof(char));
+			}
+			if (!ent->data)
+				return NULL;
+			memcpy(ent->data, payload, ent->size);
+			break;
+		case FTAR_CODEC_LZ:
+			ent->data = ftar_decompress(payload,
+						    stored, NULL, 0, &ent->size);
+			if (!ent->data)
+				return NULL;
+			break;
+		case FTAR_CODEC_LZ_DICT:
+			/* The dictionary always comes before its users */
+			if (!new->dict) {
+				errno = EINVAL;
+				return NULL;
+			}
+			ent->data = ftar_decompress(payload,
+						    stored, new->dict->data,
+						    new->dict->size,
+						    &ent->size);
+			if (!ent->data)
+				return NULL;
+			break;
+		case FTAR_CODEC_CHUNKED:
+			/* Chunks always come before their users too */
+			ent->data = load_chunked(payload,
+						 stored, names, mask,
+						 base_names, base_mask,
+						 &ent->size);
+			if (!ent->data)
+				return NULL;
+			break;
+		default:
+			errno = EINVAL;
+			return NULL;
+		}
+
+		/* Entries after a dictionary are compressed against it */
+		if (ent->type == FTAR_FTYPE_DICT)
+			new->dict = ent;
+
+	next:
+		/* Links go to the first entry with a name */
+		slot = ftar_name_slot(names, mask, ent->name);
+		if (!*slot)
+			*slot = ent;
 
 		/* Jump to the next entry (not the same as tar but it works) */
-		addr += ((sizeof(*ent) - sizeof(char *)) + ent->size);
+		addr = payload + stored;
 	}
+	new->names = names;
+	new->mask = mask;
+	free(base_names);
 
 	/* Free t */
 	free(t);
@@ -82,6 +302,21 @@ struct ftar *ftar_load(void *tar, size_t tar_len)
 	return new;
 }
 
+/* Find an entry without allocating or touching errno */
+static struct ftar_ent *read_find(const struct ftar *tar, const char *name)
+{
+	size_t i;
+
+	if (tar->names)
+		return *ftar_name_slot(tar->names, tar->mask, name);
+	for (i = 0; i < tar->ent_count; i++) {
+		if (strcmp(tar->entries[i]->name, name) == 0)
+			return tar->entries[i];
+	}
+
+	return NULL;
+}
+
 struct ftar_ent *ftar_find(struct ftar *tar, long *index, const char *name, ...)
 {
 	size_t name_len;
@@ -103,14 +338,11 @@ struct ftar_ent *ftar_find(struct ftar *tar, long *index, const char *name, ...)
 	name_fmt = ftar_fmt_text_va(&name_len, name, args);
 	va_end(args);
 
-	/* Loop through entries */
-	for (i = 0; i < tar->ent_count; i++) {
-		/* Check if the name matches */
-		if (strcmp(tar->entries[i]->name, name_fmt) == 0) {
-			ent = tar->entries[i];
-			break;
-		}
-	}
+	ent = read_find(tar, name_fmt);
+
+	/* Free name_fmt, which is name itself if formatting failed */
+	if (name_fmt != name)
+		free(name_fmt);
 
 	/* Check if we failed to find name in the archive */
 	if (!ent) {
@@ -120,17 +352,70 @@ struct ftar_ent *ftar_find(struct ftar *tar, long *index, const char *name, ...)
 		return NULL;
 	}
 
-	/* Free name_fmt */
-	(name_len) ? (void)0 : free(name_fmt);
-
 	errno = 0;
 
 	/* Return ent, and if it's requested, index too */
-	if (index)
+	if (index) {
+		for (i = 0; tar->entries[i] != ent; i++)
+			;
 		*index = i;
+	}
 	return ent;
 }
 
+enum ftar_result ftar_find_r(const struct ftar *tar, const char *name,
+			     const struct ftar_ent **ent_ret)
+{
+	const struct ftar_ent *ent;
+
+	if (!tar || !name || !ent_ret)
+		return FTAR_E_INVAL;
+
+	ent = read_find(tar, name);
+	*ent_ret = ent;
+
+	return ent ? FTAR_OK : FTAR_E_NOENT;
+}
+
+enum ftar_result ftar_read_r(const struct ftar_ent *ent, size_t off,
+			     void *buf, size_t len, size_t *len_ret)
+{
+	if (!ent || (!buf && len) || !len_ret)
+		return FTAR_E_INVAL;
+	*len_ret = 0;
+	if (off > ent->size)
+		return FTAR_E_RANGE;
+	if (!ent->data && ent->size)
+		return FTAR_E_NODATA;
+
+	if (len > ent->size - off)
+		len = ent->size - off;
+	if (len)
+		memcpy(buf, ent->data + off, len);
+	*len_ret = len;
+
+	return FTAR_OK;
+}
+
+enum ftar_result ftar_checksum_r(const struct ftar_ent *ent, long *sum_ret)
+{
+	long sum;
+	size_t i;
+
+	if (!ent || !sum_ret)
+		return FTAR_E_INVAL;
+
+	/* The same sum as ftar_checksum, without filling in the entry */
+	sum = 0;
+	for (i = 0; i < sizeof(ent->name) && ent->name[i]; i++)
+		sum += ((const unsigned char *)ent->name)[i];
+	sum += ent->mode + ent->size + ent->mtime;
+	sum += ' ' * 8;
+	*sum_ret = sum;
+
+	return FTAR_OK;
+}
+
 long ftar_checksum(struct ftar_ent *ent)
 {
 	long ret;
@@ -163,7 +448,8 @@ long ftar_checksum(struct ftar_ent *ent)
 
 void ftar_print_ent(struct ftar_ent *ent)
 {
-	struct tm *now;
+	struct tm now;
+	time_t mtime;
 
 	errno = 0;
 
@@ -174,21 +460,26 @@ void ftar_print_ent(struct ftar_ent *ent)
 	}
 
 	/* Turn the modification time of the entry into a time structure */
-	now = localtime(&ent->mtime);
+	mtime = ent->mtime;
+#ifdef _WIN32
+	localtime_s(&now, &mtime);
+#else
+	localtime_r(&mtime, &now);
+#endif
 
 	/* Print our entry */
 	printf("Name: %s\nMode: user %o, group %o, others %o\nSize: %zu\n"
 	       "Modification time: %d:%d:%d %d/%d/%d (%lu)\nChecksum: %zu\n",
 	       ent->name, FTAR_GET_MODE_USER(ent->mode),
 	       FTAR_GET_MODE_GROUP(ent->mode), FTAR_GET_MODE_OTHERS(ent->mode),
-	       ent->size, now->tm_hour, now->tm_min, now->tm_sec, now->tm_mday,
-	       now->tm_mon + 1, now->tm_year + 1900, ent->mtime, ent->checksum);
+	       ent->size, now.tm_hour, now.tm_min, now.tm_sec, now.tm_mday,
+	       now.tm_mon + 1, now.tm_year + 1900, ent->mtime, ent->checksum);
 	printf("File type: %d\nLink name: %s\nFile contents:\n", ent->type,
 	       ent->link);
 	fwrite(ent->data, ent->size, 1, stdout);
 
 	/* If necessary, write a newline */
-	if (ent->data[ent->size - 1] != '\n')
+	if (ent->size && ent->data[ent->size - 1] != '\n')
 		printf("\n");
 
 	errno = 0;
@@ -206,13 +497,23 @@ void ftar_free(struct ftar *tar)
 		return;
 	}
 
-	/* Free the entries */
+	/* Patched archives keep their entries (and data) differently */
+	if (tar->patch)
+		ftar_patch_free(tar);
+
+	/* Free the entries (links share their target's data) */
 	for (i = 0; i < tar->ent_count; i++) {
-		if (tar->entries[i])
-			free(tar->entries[i]);
+		if (!tar->entries[i])
+			continue;
+		if (tar->entries[i]->type != FTAR_FTYPE_LINK ||
+		    !tar->entries[i]->link[0])
+			free(tar->entries[i]->data);
+		free(tar->entries[i]);
 	}
 
 	/* Free the structure */
+	free(tar->names);
+	free(tar->entries);
 	free(tar);
 
 	errno = 0;
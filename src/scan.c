@@ -0,0 +1,572 @@
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "frankentar/chunk.h"
+#include "frankentar/compress.h"
+#include "frankentar/pool.h"
+#include "frankentar/read.h"
+#include "frankentar/scan.h"
+#include "frankentar/util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One block of the archive */
+struct scan_buf {
+	char *data;
+	size_t len; /* Bytes read, less than the buffer size at the end */
+	uint64_t off; /* Where `data` starts in the archive */
+	int err;
+};
+
+struct scan {
+	int fd;
+	bool direct;
+	size_t size; /* Size of each buffer */
+	struct ftar_pool *pool; /* Reads the next block */
+	struct scan_buf bufs[2];
+	struct scan_buf *cur; /* The block being handed out */
+	struct scan_buf *next; /* The block being read */
+	bool pending; /* Whether `next` has been queued */
+	size_t pos; /* Position in `cur` */
+};
+
+/* Per block state for the worker */
+struct scan_read {
+	struct scan *s;
+	struct scan_buf *buf;
+};
+
+/* Fill a buffer, stopping early only at the end of the file */
+static void scan_fill(struct scan *s, struct scan_buf *buf)
+{
+	ssize_t n;
+
+	buf->len = 0;
+	buf->err = 0;
+	while (buf->len < s->size) {
+		n = pread(s->fd, buf->data + buf->len, s->size - buf->len,
+			  buf->off + buf->len);
+		if (n < 0) {
+			buf->err = errno;
+			return;
+		}
+		buf->len += n;
+
+		/* Direct reads can't carry on from an unaligned offset */
+		if (!n || (s->direct && buf->len % FTAR_SCAN_ALIGN))
+			break;
+	}
+
+	/* Don't leave what was just read in the cache */
+	if (!s->direct)
+		posix_fadvise(s->fd, buf->off, buf->len, POSIX_FADV_DONTNEED);
+}
+
+static void scan_read_run(void *arg)
+{
+	struct scan_read *read;
+
+	read = arg;
+	scan_fill(read->s, read->buf);
+	free(read);
+}
+
+/* Start reading the block after the current one */
+static int scan_queue(struct scan *s)
+{
+	struct scan_read *read;
+
+	if (s->cur->len < s->size) /* That was the last one */
+		return 0;
+
+	read = malloc(sizeof(struct scan_read));
+	if (!read)
+		return -1;
+	read->s = s;
+	read->buf = s->next;
+	read->buf->off = s->cur->off + s->size;
+	if (ftar_pool_submit(s->pool, scan_read_run, read) < 0) {
+		free(read);
+		return -1;
+	}
+	s->pending = true;
+
+	return 0;
+}
+
+/* Move on to the next block once the current one's used up */
+static int scan_advance(struct scan *s)
+{
+	struct scan_buf *tmp;
+
+	if (!s->pending) { /* Ran off the end */
+		errno = EINVAL;
+		return -1;
+	}
+	ftar_pool_wait(s->pool);
+	s->pending = false;
+	tmp = s->cur;
+	s->cur = s->next;
+	s->next = tmp;
+	s->pos = 0;
+	if (s->cur->err) {
+		errno = s->cur->err;
+		return -1;
+	}
+	if (!s->cur->len) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return scan_queue(s);
+}
+
+/* Get the number of bytes available in the current block, up to `want` */
+static size_t scan_avail(struct scan *s, uint64_t want)
+{
+	if (s->pos == s->cur->len && scan_advance(s) < 0)
+		return 0;
+
+	return s->cur->len - s->pos < want ? s->cur->len - s->pos : want;
+}
+
+/* Copy bytes out, across blocks if need be */
+static int scan_copy(struct scan *s, void *dst, size_t len)
+{
+	size_t n;
+
+	while (len) {
+		n = scan_avail(s, len);
+		if (!n)
+			return -1;
+		memcpy(dst, s->cur->data + s->pos, n);
+		dst = (char *)dst + n;
+		s->pos += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int scan_skip(struct scan *s, uint64_t len)
+{
+	size_t n;
+
+	while (len) {
+		n = scan_avail(s, len);
+		if (!n)
+			return -1;
+		s->pos += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int scan_open(struct scan *s, const char *archive,
+		     const struct ftar_scan_opts *opts)
+{
+	size_t i;
+	int flags;
+
+	memset(s, 0, sizeof(struct scan));
+	s->size = opts && opts->buf_size ? opts->buf_size : FTAR_SCAN_BUF_SIZE;
+	s->size = (s->size + FTAR_SCAN_ALIGN - 1) & ~(size_t)(FTAR_SCAN_ALIGN - 1);
+	s->fd = open(archive, O_RDONLY);
+	if (s->fd < 0)
+		return -1;
+
+	/*
+	 * Turn on direct I/O if the file system has it, otherwise tell the
+	 *  kernel to read ahead
+	 */
+	s->direct = false;
+#ifdef O_DIRECT
+	flags = fcntl(s->fd, F_GETFL);
+	if ((!opts || !opts->cached) && flags >= 0 &&
+	    fcntl(s->fd, F_SETFL, flags | O_DIRECT) == 0)
+		s->direct = true;
+#else
+	(void)flags;
+#endif
+	if (!s->direct)
+		posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	for (i = 0; i < 2; i++) {
+		if (posix_memalign((void **)&s->bufs[i].data, FTAR_SCAN_ALIGN,
+				   s->size)) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	s->cur = &s->bufs[0];
+	s->next = &s->bufs[1];
+	s->pool = ftar_pool_create(1);
+	if (!s->pool)
+		return -1;
+
+	/* Some file systems only turn direct I/O down once it's used */
+	scan_fill(s, s->cur);
+#ifdef O_DIRECT
+	if (s->cur->err == EINVAL && s->direct) {
+		fcntl(s->fd, F_SETFL, flags);
+		s->direct = false;
+		posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		scan_fill(s, s->cur);
+	}
+#endif
+	if (s->cur->err) {
+		errno = s->cur->err;
+		return -1;
+	}
+
+	return scan_queue(s);
+}
+
+static void scan_close(struct scan *s)
+{
+	/* The pool has to finish reading before the buffers go */
+	if (s->pool)
+		ftar_pool_free(s->pool);
+	free(s->bufs[0].data);
+	free(s->bufs[1].data);
+	if (s->fd >= 0)
+		close(s->fd);
+}
+
+int ftar_scan(const char *archive, const struct ftar_scan_opts *opts,
+	      ftar_scan_fn fn, void *user)
+{
+	char trailer[FTAR_BLOCK_SIZE * 2];
+	char hdr[FTAR_HDR_SIZE];
+	struct ftar_ent ent;
+	struct scan s;
+	uint64_t hdr_off;
+	uint64_t done;
+	size_t count;
+	size_t align;
+	size_t pad;
+	size_t i;
+	size_t n;
+	int err;
+
+	errno = 0;
+
+	if (!archive || !fn) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (scan_open(&s, archive, opts) < 0 ||
+	    scan_copy(&s, hdr, FTAR_HDR_SIZE) < 0 ||
+	    ftar_archive_align(hdr, &align) < 0)
+		goto fail;
+	memcpy(&count, hdr + FTAR_MAGIC_LEN, sizeof(size_t));
+
+	for (i = 0; i < count; i++) {
+		memset(&ent, 0, sizeof(struct ftar_ent));
+		hdr_off = s.cur->off + s.pos;
+		if (scan_copy(&s, &ent, FTAR_ENT_HDR_SIZE) < 0)
+			goto fail;
+		ent.name[sizeof(ent.name) - 1] = 0;
+		ent.link[sizeof(ent.link) - 1] = 0;
+		pad = ftar_payload_pad(hdr_off, ent.size, align);
+		if (scan_skip(&s, pad) < 0)
+			goto fail;
+
+		/* Deleted entries are just skipped over */
+		if (ent.flags & FTAR_ENT_DELETED) {
+			if (scan_skip(&s, ent.size) < 0)
+				goto fail;
+			continue;
+		}
+
+		if (!ent.size && fn(&ent, NULL, 0, 0, user) < 0)
+			goto fail;
+		for (done = 0; done < ent.size; done += n) {
+			n = scan_avail(&s, ent.size - done);
+			if (!n || fn(&ent, s.cur->data + s.pos, n, done, user) < 0)
+				goto fail;
+			s.pos += n;
+		}
+	}
+
+	/* The entries are followed by two empty blocks */
+	if (scan_copy(&s, trailer, sizeof(trailer)) < 0)
+		goto fail;
+	for (i = 0; i < sizeof(trailer); i++) {
+		if (trailer[i]) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+
+	scan_close(&s);
+
+	errno = 0;
+
+	return 0;
+fail:
+	err = errno ? errno : EIO;
+	scan_close(&s);
+	errno = err;
+	return -1;
+}
+
+struct verify {
+	struct ftar_ent **ents; /* Headers seen so far, with their raw sizes */
+	size_t count;
+	struct ftar_ent **names; /* Lookup table for `ents` */
+	size_t mask;
+	char *buf; /* The payload so far */
+	size_t cap;
+	char *dict;
+	size_t dict_len;
+	struct ftar_ent *bad;
+};
+
+/* Remember a header, growing the table when it's half full */
+static int verify_add(struct verify *v, const struct ftar_ent *hdr,
+		      size_t raw_size)
+{
+	struct ftar_ent **ents;
+	struct ftar_ent **names;
+	struct ftar_ent **slot;
+	struct ftar_ent *ent;
+	size_t mask;
+	size_t i;
+
+	if (v->count * 2 >= v->mask) {
+		mask = v->mask ? v->mask * 2 + 1 : 255;
+		names = calloc(mask + 1, sizeof(struct ftar_ent *));
+		ents = realloc(v->ents, (mask + 1) / 2 * sizeof(struct ftar_ent *));
+		if (!names || !ents) {
+			free(names);
+			if (ents)
+				v->ents = ents;
+			return -1;
+		}
+		v->ents = ents;
+		free(v->names);
+		v->names = names;
+		v->mask = mask;
+
+		/* Adding them in order keeps the first of each name */
+		for (i = 0; i < v->count; i++) {
+			slot = ftar_name_slot(v->names, v->mask,
+					      v->ents[i]->name);
+			if (!*slot)
+				*slot = v->ents[i];
+		}
+	}
+
+	ent = malloc(sizeof(struct ftar_ent));
+	if (!ent)
+		return -1;
+	memcpy(ent, hdr, sizeof(struct ftar_ent));
+	ent->size = raw_size;
+	ent->data = NULL;
+	v->ents[v->count++] = ent;
+	slot = ftar_name_slot(v->names, v->mask, ent->name);
+	if (!*slot)
+		*slot = ent;
+
+	return 0;
+}
+
+static struct ftar_ent *verify_find(struct verify *v, const char *name)
+{
+	if (!v->names)
+		return NULL;
+
+	return *ftar_name_slot(v->names, v->mask, name);
+}
+
+/* Check a manifest, returning the raw size */
+static int verify_manifest(struct verify *v, const char *manifest, size_t len,
+			   uint64_t *raw_ret)
+{
+	char name[FTAR_HASH_SIZE * 2 + 1];
+	struct ftar_ent *chunk;
+	uint64_t found;
+	uint32_t count;
+	uint32_t i;
+	bool all;
+
+	if (len < FTAR_MANIFEST_HDR_SIZE)
+		goto bad;
+	memcpy(raw_ret, manifest, sizeof(uint64_t));
+	memcpy(&count, manifest + sizeof(uint64_t), sizeof(uint32_t));
+	if ((len - FTAR_MANIFEST_HDR_SIZE) % FTAR_HASH_SIZE ||
+	    (len - FTAR_MANIFEST_HDR_SIZE) / FTAR_HASH_SIZE != count)
+		goto bad;
+
+	/* Chunks that aren't here came from a base */
+	all = true;
+	found = 0;
+	for (i = 0; i < count; i++) {
+		ftar_chunk_name((const uint8_t *)manifest +
+					FTAR_MANIFEST_HDR_SIZE +
+					i * FTAR_HASH_SIZE,
+				name);
+		chunk = verify_find(v, name);
+		if (!chunk) {
+			all = false;
+			continue;
+		}
+		if (chunk->type != FTAR_FTYPE_CHUNK)
+			goto bad;
+		found += chunk->size;
+	}
+	if (found > *raw_ret || (all && found != *raw_ret))
+		goto bad;
+
+	return 0;
+bad:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Check an entry once its whole payload is in */
+static int verify_ent(struct verify *v, const struct ftar_ent *hdr)
+{
+	struct ftar_ent *target;
+	struct ftar_ent tmp;
+	uint64_t raw_size;
+	size_t len;
+	char *data;
+
+	data = NULL;
+	if (hdr->type == FTAR_FTYPE_LINK && hdr->link[0] && !hdr->size) {
+		/* Links share an earlier entry's payload */
+		target = verify_find(v, hdr->link);
+		if (!target)
+			goto bad;
+		raw_size = target->size;
+	} else {
+		switch (hdr->codec) {
+		case FTAR_CODEC_NONE:
+			raw_size = hdr->size;
+			break;
+		case FTAR_CODEC_LZ:
+		case FTAR_CODEC_LZ_DICT:
+			if (hdr->codec == FTAR_CODEC_LZ_DICT && !v->dict)
+				goto bad;
+			if (hdr->codec == FTAR_CODEC_LZ_DICT)
+				data = ftar_decompress(v->buf, hdr->size,
+						       v->dict, v->dict_len,
+						       &len);
+			else
+				data = ftar_decompress(v->buf, hdr->size, NULL,
+						       0, &len);
+			if (!data)
+				goto bad;
+			raw_size = len;
+			break;
+		case FTAR_CODEC_CHUNKED:
+			if (verify_manifest(v, v->buf, hdr->size, &raw_size) < 0)
+				goto bad;
+			break;
+		case FTAR_CODEC_DELTA:
+			/* There's nothing to apply it to, just get the size */
+			if (hdr->size < sizeof(uint64_t))
+				goto bad;
+			memcpy(&raw_size, v->buf, sizeof(uint64_t));
+			break;
+		default:
+			goto bad;
+		}
+	}
+
+	/* The checksum covers the raw size */
+	memcpy(&tmp, hdr, sizeof(struct ftar_ent));
+	tmp.size = raw_size;
+	if (tmp.checksum && ftar_checksum(&tmp) != 1)
+		goto bad;
+
+	/* Entries after a dictionary are compressed against it */
+	if (hdr->type == FTAR_FTYPE_DICT) {
+		free(v->dict);
+		v->dict_len = raw_size;
+		if (data) {
+			v->dict = data;
+		} else {
+			v->dict = malloc(raw_size ? raw_size : 1);
+			if (!v->dict)
+				return -1;
+			memcpy(v->dict, v->buf, raw_size);
+		}
+		data = NULL;
+	}
+	free(data);
+
+	return verify_add(v, hdr, raw_size);
+bad:
+	free(data);
+	if (v->bad)
+		memcpy(v->bad, hdr, sizeof(struct ftar_ent));
+	errno = EINVAL;
+	return -1;
+}
+
+static int verify_piece(const struct ftar_ent *hdr, const void *data,
+			size_t len, uint64_t off, void *user)
+{
+	struct verify *v;
+	char *buf;
+
+	v = user;
+
+	/* Raw payloads are only needed whole if they're dictionaries */
+	if (hdr->codec != FTAR_CODEC_NONE || hdr->type == FTAR_FTYPE_DICT) {
+		if (hdr->size > v->cap) {
+			buf = realloc(v->buf, hdr->size);
+			if (!buf)
+				return -1;
+			v->buf = buf;
+			v->cap = hdr->size;
+		}
+		if (len)
+			memcpy(v->buf + off, data, len);
+	}
+
+	if (off + len < hdr->size)
+		return 0;
+	return verify_ent(v, hdr);
+}
+
+int ftar_verify(const char *archive, const struct ftar_scan_opts *opts,
+		struct ftar_ent *bad_ret)
+{
+	struct verify v;
+	size_t i;
+	int err;
+
+	memset(&v, 0, sizeof(struct verify));
+	v.bad = bad_ret;
+	if (bad_ret)
+		memset(bad_ret, 0, sizeof(struct ftar_ent));
+
+	err = ftar_scan(archive, opts, verify_piece, &v);
+	err = err < 0 ? errno : 0;
+
+	for (i = 0; i < v.count; i++)
+		free(v.ents[i]);
+	free(v.ents);
+	free(v.names);
+	free(v.buf);
+	free(v.dict);
+
+	errno = err;
+	return err ? -1 : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
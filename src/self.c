@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "frankentar/self.h"
+#include "frankentar/util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Find the archive attached to a file, ENOENT if there isn't one */
+static int self_find(int fd, uint64_t *off_ret, uint64_t *len_ret)
+{
+	char trailer[FTAR_SELF_TRAILER_SIZE];
+	struct stat st;
+	uint64_t size;
+	ssize_t n;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+	size = st.st_size;
+	if (size < FTAR_SELF_TRAILER_SIZE) {
+		errno = ENOENT;
+		return -1;
+	}
+	n = pread(fd, trailer, FTAR_SELF_TRAILER_SIZE,
+		  size - FTAR_SELF_TRAILER_SIZE);
+	if (n < 0)
+		return -1;
+	if (n != FTAR_SELF_TRAILER_SIZE ||
+	    memcmp(trailer + 16, FTAR_SELF_MAGIC, FTAR_SELF_MAGIC_LEN) != 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	memcpy(off_ret, trailer, sizeof(uint64_t));
+	memcpy(len_ret, trailer + 8, sizeof(uint64_t));
+
+	/* It has to fill the space before the trailer exactly */
+	if (*off_ret % FTAR_SELF_ALIGN || *len_ret < FTAR_HDR_SIZE ||
+	    *off_ret > size - FTAR_SELF_TRAILER_SIZE ||
+	    *len_ret != size - FTAR_SELF_TRAILER_SIZE - *off_ret) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Write exactly `len` bytes */
+static int self_pwrite(int fd, const void *buf, size_t len, uint64_t off)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = pwrite(fd, (const char *)buf + done, len - done, off + done);
+		if (n < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int ftar_attach(const char *path, const void *archive, size_t len)
+{
+	char trailer[FTAR_SELF_TRAILER_SIZE];
+	struct stat st;
+	uint64_t old_len;
+	uint64_t stored;
+	uint64_t start;
+	uint64_t off;
+	size_t align;
+	int err;
+	int fd;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!path || !archive || len < FTAR_HDR_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (ftar_archive_align(archive, &align) < 0)
+		return -1;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -1;
+
+	/* A new archive goes where the old one was */
+	if (self_find(fd, &start, &old_len) < 0) {
+		if (errno != ENOENT || fstat(fd, &st) < 0)
+			goto fail;
+		start = st.st_size;
+	}
+
+	/* Payloads are aligned in the file, so the archive has to be too */
+	if (align < FTAR_SELF_ALIGN)
+		align = FTAR_SELF_ALIGN;
+	off = start + (align - start % align) % align;
+
+	/* Cutting the file here gets rid of the old one and pads with zeros */
+	memcpy(trailer, &off, sizeof(uint64_t));
+	stored = len;
+	memcpy(trailer + 8, &stored, sizeof(uint64_t));
+	memcpy(trailer + 16, FTAR_SELF_MAGIC, FTAR_SELF_MAGIC_LEN);
+	if (ftruncate(fd, start) < 0 ||
+	    self_pwrite(fd, archive, len, off) < 0 ||
+	    self_pwrite(fd, trailer, FTAR_SELF_TRAILER_SIZE, off + len) < 0)
+		goto fail;
+
+	if (close(fd) < 0)
+		return -1;
+
+	errno = 0;
+
+	return 0;
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+struct ftar_self *ftar_open_attached(const char *path)
+{
+	struct ftar_self *self;
+	uint64_t start;
+	uint64_t len;
+	long page;
+	int err;
+
+	errno = 0;
+
+	if (!path) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	self = calloc(1, sizeof(struct ftar_self));
+	if (!self)
+		return NULL;
+	self->fd = open(path, O_RDONLY);
+	if (self->fd < 0)
+		goto fail;
+	if (self_find(self->fd, &self->off, &len) < 0)
+		goto fail;
+	if (len > SIZE_MAX) {
+		errno = EFBIG;
+		goto fail;
+	}
+	self->len = len;
+
+	/* Map just the archive, from the page it starts on */
+	page = sysconf(_SC_PAGESIZE);
+	start = self->off - self->off % (page > 0 ? (uint64_t)page : 1);
+	self->map_len = self->off - start + self->len;
+	self->map = mmap(NULL, self->map_len, PROT_READ, MAP_PRIVATE,
+			 self->fd, start);
+	if (self->map == MAP_FAILED) {
+		self->map = NULL;
+		goto fail;
+	}
+	self->data = (const char *)self->map + (self->off - start);
+
+	self->idx = ftar_index_fd_at(self->fd, self->off, self->len);
+	if (!self->idx)
+		goto fail;
+
+	errno = 0;
+
+	return self;
+fail:
+	err = errno;
+	ftar_self_close(self);
+	errno = err;
+	return NULL;
+}
+
+struct ftar_self *ftar_open_self(void)
+{
+#ifdef __linux__
+	return ftar_open_attached("/proc/self/exe");
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+const char *ftar_self_view(struct ftar_self *self, struct ftar_index_ent *ent,
+			   size_t *len_ret)
+{
+	struct ftar_index_ent *target;
+
+	errno = 0;
+
+	if (!self || !ent || !len_ret) {
+		errno = EINVAL;
+		if (len_ret)
+			*len_ret = -1;
+		return NULL;
+	}
+
+	/* Links with no payload share the one of an earlier entry */
+	if (ent->hdr.type == FTAR_FTYPE_LINK && ent->hdr.link[0] &&
+	    !ent->hdr.size) {
+		target = ftar_index_find(self->idx, ent->hdr.link);
+		if (!target || target >= ent) {
+			errno = EINVAL;
+			*len_ret = -1;
+			return NULL;
+		}
+		ent = target;
+	}
+
+	if (ent->hdr.codec != FTAR_CODEC_NONE) {
+		errno = EINVAL;
+		*len_ret = -1;
+		return NULL;
+	}
+
+	*len_ret = ent->hdr.size;
+	return self->data + (ent->data_off - self->off);
+}
+
+void ftar_self_close(struct ftar_self *self)
+{
+	if (!self)
+		return;
+
+	ftar_index_free(self->idx);
+	if (self->map)
+		munmap(self->map, self->map_len);
+	if (self->fd >= 0)
+		close(self->fd);
+	free(self);
+}
+
+#ifdef __cplusplus
+}
+#endif
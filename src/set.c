@@ -0,0 +1,821 @@
+#define _XOPEN_SOURCE 501
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "frankentar/compress.h"
+#include "frankentar/pool.h"
+#include "frankentar/set.h"
+#include "frankentar/util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A record as it's stored in the manifest */
+struct set_rec {
+	uint64_t hash;
+	uint64_t off;
+	uint32_t shard;
+	uint32_t pad;
+};
+
+struct set_shard {
+	int fd;
+	size_t align;
+	uint64_t size;
+};
+
+struct ftar_set {
+	struct set_shard *shards;
+	unsigned shard_count;
+	struct set_rec *recs; /* Sorted by hash, then shard and offset */
+	size_t count;
+};
+
+/* One shard being packed or verified on the pool */
+struct set_job {
+	char *path;
+	unsigned shard;
+	const char **paths;
+	size_t count;
+	const struct ftar_pack_opts *opts;
+	const struct ftar_scan_opts *scan;
+	struct ftar_set *set;
+	size_t expected; /* Records the manifest has for this shard */
+	struct set_rec *recs;
+	size_t rec_count;
+	uint64_t size;
+	struct ftar_ent bad;
+	int err;
+};
+
+/* A shard and how much has been put in it, for placing by size */
+struct set_load {
+	uint64_t bytes;
+	unsigned shard;
+};
+
+/* A file and its size, for placing by size */
+struct set_file {
+	uint64_t size;
+	size_t index;
+};
+
+/* Read exactly `len` bytes, failing with EINVAL if the file is too short */
+static int set_pread(int fd, void *buf, size_t len, uint64_t off)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = pread(fd, (char *)buf + done, len - done, off + done);
+		if (n < 0)
+			return -1;
+		if (!n) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Get the path of a shard, which has to be freed */
+static char *set_shard_path(const char *manifest, unsigned shard)
+{
+	static const char fmt[] = FTAR_SET_SHARD_FMT;
+	size_t len;
+	char *path;
+
+	/* This hands back the format itself when it fails */
+	path = ftar_fmt_text(&len, fmt, manifest, shard);
+	if (path == fmt) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return path;
+}
+
+static int set_rec_cmp(const void *a, const void *b)
+{
+	const struct set_rec *ra;
+	const struct set_rec *rb;
+	int ret;
+
+	ra = a;
+	rb = b;
+	ret = (ra->hash > rb->hash) - (ra->hash < rb->hash);
+	if (!ret)
+		ret = (ra->shard > rb->shard) - (ra->shard < rb->shard);
+	if (!ret)
+		ret = (ra->off > rb->off) - (ra->off < rb->off);
+
+	return ret;
+}
+
+/* Biggest first, then in the order they were given */
+static int set_file_cmp(const void *a, const void *b)
+{
+	const struct set_file *fa;
+	const struct set_file *fb;
+	int ret;
+
+	fa = a;
+	fb = b;
+	ret = (fa->size < fb->size) - (fa->size > fb->size);
+	if (!ret)
+		ret = (fa->index > fb->index) - (fa->index < fb->index);
+
+	return ret;
+}
+
+/* Check whether one shard has less in it than another */
+static bool set_load_less(const struct set_load *a, const struct set_load *b)
+{
+	return a->bytes < b->bytes ||
+	       (a->bytes == b->bytes && a->shard < b->shard);
+}
+
+/* Move the top of a heap of shards down to where it belongs */
+static void set_heap_down(struct set_load *heap, unsigned count)
+{
+	struct set_load tmp;
+	unsigned least;
+	unsigned i;
+
+	for (i = 0;; i = least) {
+		least = i;
+		if (2 * i + 1 < count &&
+		    set_load_less(&heap[2 * i + 1], &heap[least]))
+			least = 2 * i + 1;
+		if (2 * i + 2 < count &&
+		    set_load_less(&heap[2 * i + 2], &heap[least]))
+			least = 2 * i + 2;
+		if (least == i)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[least];
+		heap[least] = tmp;
+	}
+}
+
+/* Work out which shard each file goes in */
+static int set_place(const char *const *paths, size_t count, unsigned shards,
+		     enum ftar_set_placement placement, unsigned *where)
+{
+	struct set_load *heap;
+	struct set_file *files;
+	struct ftar_ent ent;
+	size_t i;
+
+	if (placement == FTAR_SET_BY_HASH) {
+		for (i = 0; i < count; i++)
+			where[i] = ftar_name_hash(paths[i]) % shards;
+		return 0;
+	}
+
+	/* Each file goes in whichever shard has the least so far */
+	files = calloc(count ? count : 1, sizeof(struct set_file));
+	heap = calloc(shards, sizeof(struct set_load));
+	if (!files || !heap) {
+		free(files);
+		free(heap);
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		if (ftar_ent_from_file(&ent, paths[i]) < 0) {
+			free(files);
+			free(heap);
+			return -1;
+		}
+		files[i].size = ent.size;
+		files[i].index = i;
+	}
+	qsort(files, count, sizeof(struct set_file), set_file_cmp);
+	for (i = 0; i < shards; i++)
+		heap[i].shard = i;
+	for (i = 0; i < count; i++) {
+		where[files[i].index] = heap[0].shard;
+		heap[0].bytes += FTAR_ENT_HDR_SIZE + files[i].size;
+		set_heap_down(heap, shards);
+	}
+	free(files);
+	free(heap);
+
+	return 0;
+}
+
+/* Make the records for every entry of a shard */
+static int set_index(int fd, unsigned shard, struct set_rec **recs_ret,
+		     size_t *count_ret)
+{
+	struct ftar_index_ent *ent;
+	struct ftar_index *idx;
+	struct set_rec *recs;
+	size_t count;
+	size_t i;
+
+	idx = ftar_index_fd(fd);
+	if (!idx)
+		return -1;
+	recs = calloc(idx->ent_count ? idx->ent_count : 1,
+		      sizeof(struct set_rec));
+	if (!recs) {
+		ftar_index_free(idx);
+		return -1;
+	}
+
+	count = 0;
+	for (i = 0; i < idx->ent_count; i++) {
+		ent = &idx->entries[i];
+		if (ent->hdr.flags & FTAR_ENT_DELETED ||
+		    ent->hdr.type == FTAR_FTYPE_DICT ||
+		    ent->hdr.type == FTAR_FTYPE_CHUNK)
+			continue;
+		recs[count].hash = ftar_name_hash(ent->hdr.name);
+		recs[count].off = ent->off;
+		recs[count].shard = shard;
+		count++;
+	}
+	ftar_index_free(idx);
+
+	*recs_ret = recs;
+	*count_ret = count;
+	return 0;
+}
+
+static void set_pack_run(void *arg)
+{
+	struct set_job *job;
+	struct stat st;
+	FILE *out;
+
+	job = arg;
+	out = fopen(job->path, "w+b");
+	if (!out) {
+		job->err = errno;
+		return;
+	}
+	if (ftar_pack(out, job->paths, job->count, job->opts) < 0 ||
+	    fflush(out) != 0 || fstat(fileno(out), &st) < 0 ||
+	    set_index(fileno(out), job->shard, &job->recs, &job->rec_count) <
+		    0) {
+		job->err = errno ? errno : EIO;
+		fclose(out);
+		return;
+	}
+	job->size = st.st_size;
+	if (fclose(out) != 0)
+		job->err = errno ? errno : EIO;
+}
+
+static void set_verify_run(void *arg)
+{
+	struct set_job *job;
+	size_t i;
+
+	job = arg;
+	if (ftar_verify(job->path, job->scan, &job->bad) < 0) {
+		job->err = errno;
+		return;
+	}
+
+	/* Every entry needs the record that points at it, and nothing else */
+	if (set_index(job->set->shards[job->shard].fd, job->shard, &job->recs,
+		      &job->rec_count) < 0) {
+		job->err = errno;
+		return;
+	}
+	if (job->rec_count != job->expected) {
+		job->err = EINVAL;
+		return;
+	}
+	for (i = 0; i < job->rec_count; i++) {
+		if (!bsearch(&job->recs[i], job->set->recs, job->set->count,
+			     sizeof(struct set_rec), set_rec_cmp)) {
+			job->err = EINVAL;
+			return;
+		}
+	}
+}
+
+/* Run a job for each shard, returning the first one that failed */
+static struct set_job *set_run(struct set_job *jobs, unsigned shards,
+			       unsigned threads, ftar_task_fn fn)
+{
+	struct ftar_pool *pool;
+	unsigned i;
+
+	pool = ftar_pool_create(threads < shards ? threads : shards);
+	if (!pool) {
+		jobs[0].err = errno;
+		return &jobs[0];
+	}
+	for (i = 0; i < shards; i++) {
+		if (ftar_pool_submit(pool, fn, &jobs[i]) < 0) {
+			jobs[i].err = errno;
+			break;
+		}
+	}
+	ftar_pool_free(pool);
+
+	for (i = 0; i < shards; i++) {
+		if (jobs[i].err)
+			return &jobs[i];
+	}
+
+	return NULL;
+}
+
+static void set_jobs_free(struct set_job *jobs, unsigned shards)
+{
+	unsigned i;
+
+	for (i = 0; i < shards; i++) {
+		free(jobs[i].path);
+		free(jobs[i].recs);
+	}
+	free(jobs);
+}
+
+/* Write out the manifest for the shards just packed */
+static int set_write(const char *manifest, struct set_job *jobs,
+		     unsigned shards, enum ftar_set_placement placement)
+{
+	char hdr[FTAR_SET_HDR_SIZE];
+	struct set_rec *recs;
+	uint32_t value;
+	uint64_t count;
+	size_t n;
+	FILE *f;
+	unsigned i;
+	int err;
+
+	count = 0;
+	for (i = 0; i < shards; i++)
+		count += jobs[i].rec_count;
+	recs = calloc(count ? count : 1, sizeof(struct set_rec));
+	if (!recs)
+		return -1;
+	n = 0;
+	for (i = 0; i < shards; i++) {
+		memcpy(recs + n, jobs[i].recs,
+		       jobs[i].rec_count * sizeof(struct set_rec));
+		n += jobs[i].rec_count;
+	}
+	qsort(recs, count, sizeof(struct set_rec), set_rec_cmp);
+
+	memcpy(hdr, FTAR_SET_MAGIC, FTAR_SET_MAGIC_LEN);
+	value = shards;
+	memcpy(hdr + FTAR_SET_MAGIC_LEN, &value, sizeof(uint32_t));
+	value = placement;
+	memcpy(hdr + FTAR_SET_MAGIC_LEN + sizeof(uint32_t), &value,
+	       sizeof(uint32_t));
+	memcpy(hdr + FTAR_SET_MAGIC_LEN + 2 * sizeof(uint32_t), &count,
+	       sizeof(uint64_t));
+
+	f = fopen(manifest, "wb");
+	if (!f) {
+		free(recs);
+		return -1;
+	}
+	err = fwrite(hdr, FTAR_SET_HDR_SIZE, 1, f) != 1;
+	for (i = 0; i < shards && !err; i++)
+		err = fwrite(&jobs[i].size, sizeof(uint64_t), 1, f) != 1;
+	if (!err && count)
+		err = fwrite(recs, sizeof(struct set_rec), count, f) != count;
+	free(recs);
+	if (fclose(f) != 0 || err) {
+		errno = errno ? errno : EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+int ftar_set_create(const char *manifest, const char *const *paths,
+		    size_t count, unsigned shards,
+		    enum ftar_set_placement placement,
+		    const struct ftar_pack_opts *opts)
+{
+	struct ftar_pack_opts pack_opts;
+	struct set_job *failed;
+	struct set_job *jobs;
+	const char **lists;
+	unsigned *where;
+	unsigned threads;
+	size_t *next;
+	size_t i;
+	int err;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (!manifest || (!paths && count) || !shards ||
+	    shards > FTAR_SET_MAX_SHARDS ||
+	    (placement != FTAR_SET_BY_HASH && placement != FTAR_SET_BY_SIZE) ||
+	    (opts && (opts->dict_size || opts->cdc))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Split the threads between the shards being packed at once */
+	if (opts)
+		memcpy(&pack_opts, opts, sizeof(struct ftar_pack_opts));
+	else
+		memset(&pack_opts, 0, sizeof(struct ftar_pack_opts));
+	threads = pack_opts.threads ? pack_opts.threads : ftar_cpu_count();
+	pack_opts.threads = threads > shards ? threads / shards : 1;
+
+	where = calloc(count ? count : 1, sizeof(unsigned));
+	lists = calloc(count ? count : 1, sizeof(const char *));
+	next = calloc(shards + 1, sizeof(size_t));
+	jobs = calloc(shards, sizeof(struct set_job));
+	if (!where || !lists || !next || !jobs)
+		goto fail;
+	if (set_place(paths, count, shards, placement, where) < 0)
+		goto fail;
+
+	/* Each shard keeps its files in the order they were given */
+	for (i = 0; i < count; i++)
+		next[where[i] + 1]++;
+	for (i = 0; i < shards; i++) {
+		next[i + 1] += next[i];
+		jobs[i].paths = lists + next[i];
+		jobs[i].count = next[i + 1] - next[i];
+		jobs[i].shard = i;
+		jobs[i].opts = &pack_opts;
+		jobs[i].path = set_shard_path(manifest, i);
+		if (!jobs[i].path)
+			goto fail;
+	}
+	for (i = 0; i < count; i++)
+		lists[next[where[i]]++] = paths[i];
+
+	failed = set_run(jobs, shards, threads, set_pack_run);
+	if (failed) {
+		errno = failed->err;
+		goto fail;
+	}
+	if (set_write(manifest, jobs, shards, placement) < 0)
+		goto fail;
+
+	free(where);
+	free(lists);
+	free(next);
+	set_jobs_free(jobs, shards);
+
+	errno = 0;
+
+	return 0;
+fail:
+	err = errno ? errno : ENOMEM;
+	free(where);
+	free(lists);
+	free(next);
+	if (jobs)
+		set_jobs_free(jobs, shards);
+	errno = err;
+	return -1;
+}
+
+int ftar_set_verify(const char *manifest, const struct ftar_scan_opts *opts,
+		    struct ftar_ent *bad_ret)
+{
+	struct set_job *failed;
+	struct set_job *jobs;
+	struct ftar_set *set;
+	unsigned i;
+	size_t j;
+	int err;
+
+	errno = 0;
+
+	if (bad_ret)
+		memset(bad_ret, 0, sizeof(struct ftar_ent));
+	if (!manifest) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	set = ftar_set_open(manifest);
+	if (!set)
+		return -1;
+	jobs = calloc(set->shard_count, sizeof(struct set_job));
+	if (!jobs) {
+		ftar_set_close(set);
+		return -1;
+	}
+	for (j = 0; j < set->count; j++)
+		jobs[set->recs[j].shard].expected++;
+	for (i = 0; i < set->shard_count; i++) {
+		jobs[i].shard = i;
+		jobs[i].scan = opts;
+		jobs[i].set = set;
+		jobs[i].path = set_shard_path(manifest, i);
+		if (!jobs[i].path) {
+			set_jobs_free(jobs, set->shard_count);
+			ftar_set_close(set);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	err = 0;
+	failed = set_run(jobs, set->shard_count, ftar_cpu_count(),
+			 set_verify_run);
+	if (failed) {
+		err = failed->err;
+		if (bad_ret)
+			memcpy(bad_ret, &failed->bad, sizeof(struct ftar_ent));
+	}
+	set_jobs_free(jobs, set->shard_count);
+	ftar_set_close(set);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct ftar_set *ftar_set_open(const char *manifest)
+{
+	char hdr[FTAR_SET_HDR_SIZE];
+	char archive[FTAR_HDR_SIZE];
+	struct set_shard *shard;
+	struct ftar_set *set;
+	struct stat st;
+	uint64_t count;
+	uint32_t shards;
+	char *path;
+	unsigned i;
+	size_t j;
+	int err;
+	int fd;
+
+	errno = 0;
+
+	if (!manifest) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fd = open(manifest, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	set = calloc(1, sizeof(struct ftar_set));
+	if (!set)
+		goto fail;
+
+	/* The manifest has to be exactly as long as its header says */
+	if (fstat(fd, &st) < 0 || set_pread(fd, hdr, FTAR_SET_HDR_SIZE, 0) < 0)
+		goto fail;
+	memcpy(&shards, hdr + FTAR_SET_MAGIC_LEN, sizeof(uint32_t));
+	memcpy(&count, hdr + FTAR_SET_MAGIC_LEN + 2 * sizeof(uint32_t),
+	       sizeof(uint64_t));
+	if (memcmp(hdr, FTAR_SET_MAGIC, FTAR_SET_MAGIC_LEN) != 0 || !shards ||
+	    shards > FTAR_SET_MAX_SHARDS ||
+	    count > ((uint64_t)st.st_size - FTAR_SET_HDR_SIZE) /
+			    FTAR_SET_REC_SIZE ||
+	    (uint64_t)st.st_size != FTAR_SET_HDR_SIZE +
+					    shards * sizeof(uint64_t) +
+					    count * FTAR_SET_REC_SIZE) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	set->shards = calloc(shards, sizeof(struct set_shard));
+	set->recs = calloc(count ? count : 1, sizeof(struct set_rec));
+	if (!set->shards || !set->recs)
+		goto fail;
+	set->shard_count = shards;
+	for (i = 0; i < shards; i++)
+		set->shards[i].fd = -1;
+	for (i = 0; i < shards; i++) {
+		if (set_pread(fd, &set->shards[i].size, sizeof(uint64_t),
+			      FTAR_SET_HDR_SIZE + i * sizeof(uint64_t)) < 0)
+			goto fail;
+	}
+	if (count && set_pread(fd, set->recs, count * FTAR_SET_REC_SIZE,
+			       FTAR_SET_HDR_SIZE + shards * sizeof(uint64_t)) <
+			     0)
+		goto fail;
+	set->count = count;
+	for (j = 0; j < set->count; j++) {
+		if (set->recs[j].shard >= shards) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+	close(fd);
+	fd = -1;
+
+	/* A shard that was changed on its own doesn't match the records */
+	for (i = 0; i < shards; i++) {
+		shard = &set->shards[i];
+		path = set_shard_path(manifest, i);
+		if (!path)
+			goto fail;
+		shard->fd = open(path, O_RDONLY);
+		free(path);
+		if (shard->fd < 0 || fstat(shard->fd, &st) < 0)
+			goto fail;
+		if ((uint64_t)st.st_size != shard->size) {
+			errno = ESTALE;
+			goto fail;
+		}
+		if (set_pread(shard->fd, archive, FTAR_HDR_SIZE, 0) < 0 ||
+		    ftar_archive_align(archive, &shard->align) < 0)
+			goto fail;
+	}
+
+	errno = 0;
+
+	return set;
+fail:
+	err = errno ? errno : EINVAL;
+	if (fd >= 0)
+		close(fd);
+	ftar_set_close(set);
+	errno = err;
+	return NULL;
+}
+
+bool ftar_set_is_manifest(const char *path)
+{
+	char magic[FTAR_SET_MAGIC_LEN];
+	bool ret;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return false;
+	ret = fread(magic, 1, FTAR_SET_MAGIC_LEN, f) == FTAR_SET_MAGIC_LEN &&
+	      memcmp(magic, FTAR_SET_MAGIC, FTAR_SET_MAGIC_LEN) == 0;
+	fclose(f);
+
+	return ret;
+}
+
+int ftar_set_find(struct ftar_set *set, const char *name,
+		  struct ftar_index_ent *ent_ret, unsigned *shard_ret)
+{
+	struct set_shard *shard;
+	uint64_t hash;
+	size_t lo;
+	size_t hi;
+	size_t i;
+
+	errno = 0;
+
+	if (!set || !name || !ent_ret || !shard_ret) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Find the first record with the name's hash */
+	hash = ftar_name_hash(name);
+	lo = 0;
+	hi = set->count;
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		if (set->recs[i].hash < hash)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+
+	/* Names with the same hash are told apart by their headers */
+	for (i = lo; i < set->count && set->recs[i].hash == hash; i++) {
+		shard = &set->shards[set->recs[i].shard];
+		if (set_pread(shard->fd, &ent_ret->hdr, FTAR_ENT_HDR_SIZE,
+			      set->recs[i].off) < 0)
+			return -1;
+		ent_ret->hdr.name[sizeof(ent_ret->hdr.name) - 1] = 0;
+		ent_ret->hdr.data = NULL;
+		if (ent_ret->hdr.flags & FTAR_ENT_DELETED ||
+		    strcmp(ent_ret->hdr.name, name) != 0)
+			continue;
+
+		ent_ret->off = set->recs[i].off;
+		ent_ret->data_off = ent_ret->off + FTAR_ENT_HDR_SIZE +
+				    ftar_payload_pad(ent_ret->off,
+						     ent_ret->hdr.size,
+						     shard->align);
+		if (ent_ret->data_off > shard->size ||
+		    ent_ret->hdr.size > shard->size - ent_ret->data_off) {
+			errno = EINVAL;
+			return -1;
+		}
+		*shard_ret = set->recs[i].shard;
+		return 0;
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+char *ftar_set_read(struct ftar_set *set, unsigned shard,
+		    const struct ftar_index_ent *ent, size_t *len_ret)
+{
+	struct ftar_index_ent target;
+	unsigned target_shard;
+	char *stored;
+	char *data;
+	int err;
+
+	errno = 0;
+
+	if (!set || shard >= set->shard_count || !ent || !len_ret) {
+		errno = EINVAL;
+		if (len_ret)
+			*len_ret = -1;
+		return NULL;
+	}
+
+	/* Links with no payload share the one of an earlier entry */
+	if (ent->hdr.type == FTAR_FTYPE_LINK && ent->hdr.link[0] &&
+	    !ent->hdr.size) {
+		if (ftar_set_find(set, ent->hdr.link, &target, &target_shard) <
+			    0 ||
+		    target_shard != shard || target.off >= ent->off) {
+			errno = EINVAL;
+			*len_ret = -1;
+			return NULL;
+		}
+		ent = &target;
+	}
+
+	if (ent->hdr.codec != FTAR_CODEC_NONE &&
+	    ent->hdr.codec != FTAR_CODEC_LZ) {
+		errno = EINVAL;
+		*len_ret = -1;
+		return NULL;
+	}
+
+	stored = malloc(ent->hdr.size ? ent->hdr.size : 1);
+	if (!stored) {
+		*len_ret = -1;
+		return NULL;
+	}
+	if (set_pread(set->shards[shard].fd, stored, ent->hdr.size,
+		      ent->data_off) < 0) {
+		err = errno;
+		free(stored);
+		errno = err;
+		*len_ret = -1;
+		return NULL;
+	}
+	if (ent->hdr.codec == FTAR_CODEC_NONE) {
+		*len_ret = ent->hdr.size;
+		return stored;
+	}
+
+	data = ftar_decompress(stored, ent->hdr.size, NULL, 0, len_ret);
+	err = errno;
+	free(stored);
+	if (!data) {
+		errno = err;
+		*len_ret = -1;
+		return NULL;
+	}
+
+	errno = 0;
+
+	return data;
+}
+
+size_t ftar_set_count(struct ftar_set *set)
+{
+	return set ? set->count : 0;
+}
+
+unsigned ftar_set_shards(struct ftar_set *set)
+{
+	return set ? set->shard_count : 0;
+}
+
+void ftar_set_close(struct ftar_set *set)
+{
+	unsigned i;
+
+	if (!set)
+		return;
+
+	for (i = 0; i < set->shard_count; i++) {
+		if (set->shards[i].fd >= 0)
+			close(set->shards[i].fd);
+	}
+	free(set->shards);
+	free(set->recs);
+	free(set);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -142,6 +142,84 @@ bool ftar_get_y_or_n(const char *message, ...)
 	return res;
 }
 
+const char *ftar_result_str(enum ftar_result res)
+{
+	switch (res) {
+	case FTAR_OK:
+		return "Success";
+	case FTAR_E_INVAL:
+		return "Invalid argument";
+	case FTAR_E_NOENT:
+		return "No such entry";
+	case FTAR_E_RANGE:
+		return "Offset past the end of the payload";
+	case FTAR_E_NODATA:
+		return "Payload not loaded";
+	default:
+		return "Unknown result";
+	}
+}
+
+size_t ftar_name_hash(const char *name)
+{
+	size_t h;
+
+	h = 14695981039346656037ull;
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 1099511628211ull;
+	}
+
+	return h;
+}
+
+struct ftar_ent **ftar_name_slot(struct ftar_ent **table, size_t mask,
+				 const char *name)
+{
+	size_t i;
+
+	for (i = ftar_name_hash(name) & mask; table[i]; i = (i + 1) & mask) {
+		if (strcmp(table[i]->name, name) == 0)
+			break;
+	}
+
+	return &table[i];
+}
+
+void ftar_archive_hdr(void *dst, size_t count, size_t align)
+{
+	char shift;
+
+	for (shift = 0; align > 1; align >>= 1)
+		shift++;
+	memcpy(dst, FTAR_MAGIC, FTAR_MAGIC_LEN);
+	((char *)dst)[FTAR_ALIGN_OFF] = shift;
+	memcpy((char *)dst + FTAR_MAGIC_LEN, &count, sizeof(size_t));
+}
+
+int ftar_archive_align(const void *hdr, size_t *align_ret)
+{
+	unsigned char shift;
+
+	shift = ((const unsigned char *)hdr)[FTAR_ALIGN_OFF];
+	if (memcmp(hdr, FTAR_MAGIC, FTAR_ALIGN_OFF) != 0 || shift >= 32 ||
+	    ((size_t)1 << shift) > FTAR_ALIGN_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*align_ret = (size_t)1 << shift;
+	return 0;
+}
+
+size_t ftar_payload_pad(uint64_t hdr_off, size_t stored, size_t align)
+{
+	if (!stored || align <= 1)
+		return 0;
+
+	return (align - (hdr_off + FTAR_ENT_HDR_SIZE) % align) % align;
+}
+
 #ifdef __cplusplus
 }
 #endif
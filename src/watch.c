@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "frankentar/util.h"
+#include "frankentar/watch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ftar_watch {
+	char *path;
+	const char *name; /* The base name, which events are about */
+	int notify; /* The inotify descriptor */
+	int fd; /* The archive */
+	dev_t dev;
+	ino_t ino;
+	struct ftar_index *idx;
+	ftar_watch_fn fn;
+	void *user;
+};
+
+/*
+ * Check whether two entries' headers differ, besides their flags. In the same
+ *  file, an entry that moved was replaced, even if its header didn't change
+ *  (the checksum doesn't cover the payload).
+ */
+static bool watch_differs(const struct ftar_index_ent *a,
+			  const struct ftar_index_ent *b, bool same)
+{
+	struct ftar_ent x;
+	struct ftar_ent y;
+
+	if (same && a->off != b->off)
+		return true;
+
+	memcpy(&x, &a->hdr, FTAR_ENT_HDR_SIZE);
+	memcpy(&y, &b->hdr, FTAR_ENT_HDR_SIZE);
+	x.flags = y.flags = 0;
+
+	return memcmp(&x, &y, FTAR_ENT_HDR_SIZE) != 0;
+}
+
+/* Tell the callback about everything that's different between two indexes */
+static int watch_diff(struct ftar_watch *watch, struct ftar_index *old,
+		      struct ftar_index *idx, bool same)
+{
+	struct ftar_index_ent *ent;
+	struct ftar_index_ent *was;
+	size_t i;
+	int n;
+
+	/* Only the first live entry with a name can be found, so compare those */
+	n = 0;
+	for (i = 0; i < idx->ent_count; i++) {
+		ent = &idx->entries[i];
+		if (ent->hdr.flags & FTAR_ENT_DELETED ||
+		    ftar_index_find(idx, ent->hdr.name) != ent)
+			continue;
+		was = ftar_index_find(old, ent->hdr.name);
+		if (!was) {
+			watch->fn(watch, FTAR_WATCH_ADDED, NULL, ent,
+				  watch->user);
+			n++;
+		} else if (watch_differs(was, ent, same)) {
+			watch->fn(watch, FTAR_WATCH_CHANGED, was, ent,
+				  watch->user);
+			n++;
+		}
+	}
+	for (i = 0; i < old->ent_count; i++) {
+		was = &old->entries[i];
+		if (was->hdr.flags & FTAR_ENT_DELETED ||
+		    ftar_index_find(old, was->hdr.name) != was ||
+		    ftar_index_find(idx, was->hdr.name))
+			continue;
+		watch->fn(watch, FTAR_WATCH_REMOVED, was, NULL, watch->user);
+		n++;
+	}
+
+	errno = 0;
+
+	return n;
+}
+
+struct ftar_watch *ftar_watch_open(const char *archive, ftar_watch_fn fn,
+				   void *user)
+{
+#ifdef __linux__
+	struct ftar_watch *watch;
+	struct stat st;
+	char *slash;
+	int err;
+
+	errno = 0;
+
+	if (!archive || !fn) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	watch = calloc(1, sizeof(struct ftar_watch));
+	if (!watch)
+		return NULL;
+	watch->fn = fn;
+	watch->user = user;
+	watch->notify = -1;
+	watch->path = strdup(archive);
+	watch->fd = open(archive, O_RDONLY | O_CLOEXEC);
+	if (!watch->path || watch->fd < 0 || fstat(watch->fd, &st) < 0)
+		goto fail;
+	watch->dev = st.st_dev;
+	watch->ino = st.st_ino;
+	watch->idx = ftar_index_fd(watch->fd);
+	if (!watch->idx)
+		goto fail;
+
+	/*
+	 * Archives are often replaced rather than written over, so it's the
+	 *  directory that's watched
+	 */
+	watch->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->notify < 0)
+		goto fail;
+	slash = strrchr(watch->path, '/');
+	if (slash) {
+		watch->name = slash + 1;
+		*slash = 0;
+		err = inotify_add_watch(watch->notify,
+					slash == watch->path ? "/" :
+							       watch->path,
+					IN_CLOSE_WRITE | IN_MOVED_TO);
+		*slash = '/';
+	} else {
+		watch->name = watch->path;
+		err = inotify_add_watch(watch->notify, ".",
+					IN_CLOSE_WRITE | IN_MOVED_TO);
+	}
+	if (err < 0)
+		goto fail;
+
+	errno = 0;
+
+	return watch;
+fail:
+	err = errno;
+	ftar_watch_free(watch);
+	errno = err;
+	return NULL;
+#else
+	(void)archive;
+	(void)fn;
+	(void)user;
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+int ftar_watch_fd(struct ftar_watch *watch)
+{
+	if (!watch) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return watch->notify;
+}
+
+int ftar_watch_poll(struct ftar_watch *watch, int timeout)
+{
+#ifdef __linux__
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct pollfd pfd;
+	ssize_t len;
+	ssize_t i;
+	bool hit;
+	int ret;
+
+	errno = 0;
+
+	if (!watch) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pfd.fd = watch->notify;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	ret = poll(&pfd, 1, timeout);
+	if (ret <= 0)
+		return ret;
+
+	/* Drain everything, one reload covers any number of writes */
+	hit = false;
+	while ((len = read(watch->notify, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < len;
+		     i += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *)(buf + i);
+			if (ev->mask & IN_Q_OVERFLOW ||
+			    (ev->len && strcmp(ev->name, watch->name) == 0))
+				hit = true;
+		}
+	}
+	if (len < 0 && errno != EAGAIN)
+		return -1;
+
+	errno = 0;
+
+	return hit ? ftar_watch_reload(watch) : 0;
+#else
+	(void)watch;
+	(void)timeout;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int ftar_watch_reload(struct ftar_watch *watch)
+{
+	struct ftar_index *old;
+	struct ftar_index *idx;
+	struct stat st;
+	int old_fd;
+	bool same;
+	int err;
+	int fd;
+	int n;
+
+	errno = 0;
+
+	if (!watch) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* It might not be there while it's being replaced */
+	if (stat(watch->path, &st) < 0)
+		return -1;
+
+	idx = NULL;
+	if (st.st_dev == watch->dev && st.st_ino == watch->ino) {
+		/* Appends only need the new headers (and what they replace) */
+		fd = watch->fd;
+		idx = ftar_index_refresh(fd, watch->idx);
+		if (idx && idx->ent_count == watch->idx->ent_count) {
+			/* Nothing was appended, so something was deleted */
+			ftar_index_free(idx);
+			idx = NULL;
+		}
+	} else {
+		fd = open(watch->path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return -1;
+		if (fstat(fd, &st) < 0) {
+			err = errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+	}
+	if (!idx)
+		idx = ftar_index_fd(fd);
+	if (!idx) {
+		err = errno;
+		if (fd != watch->fd)
+			close(fd);
+		errno = err;
+		return -1;
+	}
+
+	/* Switch over first, so the callback can read the new entries */
+	same = fd == watch->fd;
+	old = watch->idx;
+	old_fd = watch->fd;
+	watch->idx = idx;
+	watch->fd = fd;
+	watch->dev = st.st_dev;
+	watch->ino = st.st_ino;
+	n = watch_diff(watch, old, idx, same);
+
+	ftar_index_free(old);
+	if (old_fd != fd)
+		close(old_fd);
+
+	errno = 0;
+
+	return n;
+}
+
+struct ftar_index *ftar_watch_index(struct ftar_watch *watch)
+{
+	return watch ? watch->idx : NULL;
+}
+
+int ftar_watch_archive(struct ftar_watch *watch)
+{
+	return watch ? watch->fd : -1;
+}
+
+void ftar_watch_free(struct ftar_watch *watch)
+{
+	if (!watch)
+		return;
+
+	ftar_index_free(watch->idx);
+	if (watch->fd >= 0)
+		close(watch->fd);
+	if (watch->notify >= 0)
+		close(watch->notify);
+	free(watch->path);
+	free(watch);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,9 +1,87 @@
+#include "frankentar/chunk.h"
+#include "frankentar/compress.h"
+#include "frankentar/util.h"
 #include "frankentar/write.h"
 
-void *ftar_ent_to_raw(struct ftar_ent *ent, size_t *len_ret)
+/*
+ * Get the payload of an entry as it should be stored, `owned` says whether
+ *  the caller has to free it and `codec` returns the codec that was actually
+ *  used. A compressed payload that isn't smaller than the original is thrown
+ *  away, so storing an entry never makes it bigger.
+ */
+static void *ent_payload(struct ftar_ent *ent, struct ftar_ent *dict,
+			 size_t *len_ret, bool *owned, char *codec)
+{
+	void *payload;
+
+	/* Links with a name have no payload, they share their target's */
+	*owned = false;
+	if (ent->type == FTAR_FTYPE_LINK && ent->link[0]) {
+		*codec = FTAR_CODEC_NONE;
+		*len_ret = 0;
+		return NULL;
+	}
+
+	*codec = ent->codec;
+	if (*codec == FTAR_CODEC_AUTO)
+		*codec = ftar_codec_choose(ent->data, ent->size);
+	if (!ent->size)
+		*codec = FTAR_CODEC_NONE;
+
+	switch (*codec) {
+	case FTAR_CODEC_NONE:
+		*len_ret = ent->size;
+		return ent->data;
+	case FTAR_CODEC_LZ:
+		payload = ftar_compress(ent->data, ent->size, 0, NULL, 0,
+					len_ret);
+		break;
+	case FTAR_CODEC_LZ_DICT:
+		if (!dict) {
+			errno = EINVAL;
+			return NULL;
+		}
+		payload = ftar_compress(ent->data, ent->size, 0, dict->data,
+					dict->size, len_ret);
+		break;
+	case FTAR_CODEC_CHUNKED:
+		/*
+		 * Chunking is deterministic, so this is the manifest the entry
+		 *  was loaded from. It can be bigger than the payload, but the
+		 *  chunks are shared, so it has to stay chunked.
+		 */
+		payload = ftar_cdc_manifest(ent->data, ent->size, len_ret);
+		*owned = true;
+		return payload;
+	default:
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!payload) {
+		*owned = true;
+		return NULL;
+	}
+
+	if (*len_ret >= ent->size) {
+		free(payload);
+		*codec = FTAR_CODEC_NONE;
+		*len_ret = ent->size;
+		return ent->data;
+	}
+
+	*owned = true;
+	return payload;
+}
+
+static void *ent_to_raw(struct ftar_ent *ent, struct ftar_ent *dict,
+			size_t *len_ret)
 {
 	char *buf;
+	char *payload;
+	size_t payload_len;
 	size_t len;
+	bool owned;
+	char codec;
 
 	errno = 0;
 
@@ -13,18 +91,31 @@ void *ftar_ent_to_raw(struct ftar_ent *ent, size_t *len_ret)
 		return NULL;
 	}
 
+	/* Get the payload into the form it'll be stored in */
+	payload = ent_payload(ent, dict, &payload_len, &owned, &codec);
+	if (!payload && (payload_len || owned || errno)) {
+		*len_ret = -1;
+		return NULL;
+	}
+
 	/* Figure out how big the buffer should be and allocate it */
-	len = (sizeof(struct ftar_ent) - sizeof(char *)) + ent->size;
+	len = FTAR_ENT_HDR_SIZE + payload_len;
 	buf = calloc(len, 1);
 	if (!buf) {
+		if (owned)
+			free(payload);
 		*len_ret = -1;
 		return NULL;
 	}
 
-	/* Write in the entry */
-	memcpy(buf, ent, sizeof(struct ftar_ent) - sizeof(char *));
-	memcpy(buf + (sizeof(struct ftar_ent) - sizeof(char *)), ent->data,
-	       ent->size);
+	/* Write in the entry, with the codec and size of what's stored */
+	memcpy(buf, ent, FTAR_ENT_HDR_SIZE);
+	memcpy(buf + offsetof(struct ftar_ent, codec), &codec, sizeof(char));
+	memcpy(buf + offsetof(struct ftar_ent, size), &payload_len,
+	       sizeof(size_t));
+	memcpy(buf + FTAR_ENT_HDR_SIZE, payload, payload_len);
+	if (owned)
+		free(payload);
 
 	errno = 0;
 
@@ -33,10 +124,61 @@ void *ftar_ent_to_raw(struct ftar_ent *ent, size_t *len_ret)
 	return buf;
 }
 
+void *ftar_ent_to_raw(struct ftar_ent *ent, size_t *len_ret)
+{
+	return ent_to_raw(ent, NULL, len_ret);
+}
+
+/*
+ * Check that the chunks in a stored manifest are all earlier in the archive
+ *  (in `chunks`), since loading needs them first
+ */
+static int raw_chunks_ok(const char *raw, size_t len, struct ftar_ent **chunks,
+			 size_t mask)
+{
+	char name[FTAR_HASH_SIZE * 2 + 1];
+	struct ftar_ent *chunk;
+	uint32_t count;
+	size_t i;
+
+	if (raw[offsetof(struct ftar_ent, codec)] != FTAR_CODEC_CHUNKED)
+		return 0;
+	if (len < FTAR_ENT_HDR_SIZE + FTAR_MANIFEST_HDR_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	raw += FTAR_ENT_HDR_SIZE;
+	len -= FTAR_ENT_HDR_SIZE;
+	memcpy(&count, raw + sizeof(uint64_t), sizeof(uint32_t));
+	if ((len - FTAR_MANIFEST_HDR_SIZE) / FTAR_HASH_SIZE != count) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		ftar_chunk_name((const uint8_t *)raw + FTAR_MANIFEST_HDR_SIZE +
+					i * FTAR_HASH_SIZE,
+				name);
+		chunk = *ftar_name_slot(chunks, mask, name);
+		if (!chunk) {
+			errno = ENOENT;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 void *ftar_to_raw(struct ftar *tar, size_t *len_ret)
 {
+	struct ftar_ent **chunks;
+	struct ftar_ent **slot;
 	char *buf;
 	char *addr;
+	char **raw;
+	size_t *raw_len;
+	struct ftar_ent *dict;
+	size_t mask;
 	size_t len;
 	size_t i;
 
@@ -48,42 +190,87 @@ void *ftar_to_raw(struct ftar *tar, size_t *len_ret)
 		return NULL;
 	}
 
-	/* Figure out how large the buffer should be */
-	len = ((sizeof(struct ftar_ent) - sizeof(char *)) * tar->ent_count) +
-	      (sizeof(struct ftar) - sizeof(struct ftar_ent **)) +
-	      (FTAR_BLOCK_SIZE * 2);
-	for (i = 0; i < tar->ent_count; i++)
-		len += tar->entries[i]->size;
-
-	/* Allocate the buffer */
-	buf = calloc(len, 1);
-	if (!buf) {
+	/*
+	 * Convert each entry first, since the size of a compressed one isn't
+	 *  known until it's been compressed
+	 */
+	raw = calloc(tar->ent_count ? tar->ent_count : 1, sizeof(char *));
+	raw_len = calloc(tar->ent_count ? tar->ent_count : 1, sizeof(size_t));
+	for (mask = 1; mask < tar->ent_count * 2; mask <<= 1)
+		;
+	chunks = calloc(mask--, sizeof(struct ftar_ent *));
+	if (!raw || !raw_len || !chunks) {
+		free(raw);
+		free(raw_len);
+		free(chunks);
 		*len_ret = -1;
 		return NULL;
 	}
-
-	/* Copy in the signature and the entries */
-	strncpy(buf, FTAR_MAGIC, FTAR_MAGIC_LEN);
-	addr = buf + FTAR_MAGIC_LEN;
-	memcpy(addr, &tar->ent_count, sizeof(size_t));
-	addr += sizeof(size_t);
+	len = FTAR_HDR_SIZE + (FTAR_BLOCK_SIZE * 2);
+	dict = NULL;
 	for (i = 0; i < tar->ent_count; i++) {
 		/* Check the entry's validity */
 		if (!tar->entries[i]) {
 			errno = EINVAL;
-			return NULL;
+			break;
+		}
+
+		raw[i] = ent_to_raw(tar->entries[i], dict, &raw_len[i]);
+		if (!raw[i])
+			break;
+		len += raw_len[i] +
+		       ftar_payload_pad(len - FTAR_BLOCK_SIZE * 2,
+					raw_len[i] - FTAR_ENT_HDR_SIZE,
+					tar->align);
+
+		/*
+		 * A delta pack's chunks from its base (see `ftar_load_base`)
+		 *  aren't in it, and its manifests would point at nothing
+		 */
+		if (raw_chunks_ok(raw[i], raw_len[i], chunks, mask) < 0) {
+			free(raw[i]);
+			break;
+		}
+		if (tar->entries[i]->type == FTAR_FTYPE_CHUNK) {
+			slot = ftar_name_slot(chunks, mask,
+					      tar->entries[i]->name);
+			if (!*slot)
+				*slot = tar->entries[i];
 		}
 
-		/* Copy the entry in */
-		memcpy(addr, tar->entries[i],
-		       sizeof(struct ftar_ent) - sizeof(char *));
-		memcpy(addr + (sizeof(struct ftar_ent) - sizeof(char *)),
-		       tar->entries[i]->data, tar->entries[i]->size);
+		/* Entries after a dictionary are compressed against it */
+		if (tar->entries[i]->type == FTAR_FTYPE_DICT)
+			dict = tar->entries[i];
+	}
+	free(chunks);
+
+	/* Allocate the buffer */
+	buf = i == tar->ent_count ? calloc(len, 1) : NULL;
+	if (!buf) {
+		while (i--)
+			free(raw[i]);
+		free(raw);
+		free(raw_len);
+		*len_ret = -1;
+		return NULL;
+	}
 
-		/* Advance the pointer */
-		addr += ((sizeof(struct ftar_ent) - sizeof(char *)) +
-			 tar->entries[i]->size);
+	/* Copy in the signature and the entries, with any padding */
+	ftar_archive_hdr(buf, tar->ent_count, tar->align);
+	addr = buf + FTAR_HDR_SIZE;
+	for (i = 0; i < tar->ent_count; i++) {
+		memcpy(addr, raw[i], FTAR_ENT_HDR_SIZE);
+		addr += FTAR_ENT_HDR_SIZE +
+			ftar_payload_pad(addr - buf,
+					 raw_len[i] - FTAR_ENT_HDR_SIZE,
+					 tar->align);
+		memcpy(addr, raw[i] + FTAR_ENT_HDR_SIZE,
+		       raw_len[i] - FTAR_ENT_HDR_SIZE);
+		addr += raw_len[i] - FTAR_ENT_HDR_SIZE;
+		free(raw[i]);
 	}
+	free(raw);
+	free(raw_len);
 
 	/* Even though calloc already does this, clear the last two blocks */
 	memset(addr, 0, FTAR_BLOCK_SIZE * 2);
@@ -94,3 +281,294 @@ void *ftar_to_raw(struct ftar *tar, size_t *len_ret)
 	*len_ret = len;
 	return buf;
 }
+
+/* Make the name table big enough for `count` entries, rebuilding it */
+static int names_rebuild(struct ftar *tar, size_t count)
+{
+	struct ftar_ent **names;
+	struct ftar_ent **slot;
+	size_t mask;
+	size_t i;
+
+	for (mask = 16; mask < count * 2; mask <<= 1)
+		;
+	names = calloc(mask--, sizeof(struct ftar_ent *));
+	if (!names)
+		return -1;
+	for (i = 0; i < tar->ent_count; i++) {
+		slot = ftar_name_slot(names, mask, tar->entries[i]->name);
+		if (!*slot)
+			*slot = tar->entries[i];
+	}
+	free(tar->names);
+	tar->names = names;
+	tar->mask = mask;
+
+	return 0;
+}
+
+/* Take an entry out of the name table, moving back the ones after it */
+static void names_remove(struct ftar *tar, struct ftar_ent *ent)
+{
+	struct ftar_ent **slot;
+	size_t hole;
+	size_t home;
+	size_t i;
+
+	slot = ftar_name_slot(tar->names, tar->mask, ent->name);
+	if (*slot != ent)
+		return;
+	*slot = NULL;
+	hole = slot - tar->names;
+	for (i = (hole + 1) & tar->mask; tar->names[i];
+	     i = (i + 1) & tar->mask) {
+		/* It can fill the hole if the hole is between it and its home */
+		home = ftar_name_hash(tar->names[i]->name) & tar->mask;
+		if (((i - home) & tar->mask) >= ((i - hole) & tar->mask)) {
+			tar->names[hole] = tar->names[i];
+			tar->names[i] = NULL;
+			hole = i;
+		}
+	}
+}
+
+/* Check that an archive can be changed, and that its table is there */
+static int mutable_check(struct ftar *tar)
+{
+	if (!tar || tar->patch) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!tar->names && names_rebuild(tar, tar->ent_count) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Check a new entry going in before `limit`, and give named links their
+ *  target's data, which has to come before it
+ */
+static int mutable_ent(struct ftar *tar, struct ftar_ent *ent, size_t limit)
+{
+	struct ftar_ent *target;
+	size_t i;
+
+	if (!ent || !memchr(ent->name, 0, sizeof(ent->name)) ||
+	    !memchr(ent->link, 0, sizeof(ent->link))) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (ent->type == FTAR_FTYPE_LINK && ent->link[0]) {
+		target = *ftar_name_slot(tar->names, tar->mask, ent->link);
+		for (i = 0; target && limit < tar->ent_count && i < limit; i++) {
+			if (tar->entries[i] == target)
+				break;
+		}
+		if (!target || i == limit) {
+			errno = ENOENT;
+			return -1;
+		}
+		ent->data = target->data;
+		ent->size = target->size;
+	}
+
+	return 0;
+}
+
+struct ftar *ftar_new(size_t align)
+{
+	struct ftar *tar;
+
+	errno = 0;
+
+	/* Check arguments */
+	if (align > FTAR_ALIGN_MAX || (align & (align - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	tar = calloc(1, sizeof(struct ftar));
+	if (!tar)
+		return NULL;
+	memcpy(tar->magic, FTAR_MAGIC, FTAR_MAGIC_LEN);
+	tar->align = align ? align : 1;
+	if (names_rebuild(tar, 0) < 0) {
+		free(tar);
+		return NULL;
+	}
+
+	return tar;
+}
+
+int ftar_add_entry(struct ftar *tar, struct ftar_ent *ent)
+{
+	struct ftar_ent **entries;
+	struct ftar_ent **slot;
+	size_t capacity;
+
+	errno = 0;
+
+	if (mutable_check(tar) < 0 || mutable_ent(tar, ent, tar->ent_count) < 0)
+		return -1;
+
+	/* Double the space when it runs out */
+	capacity = tar->capacity > tar->ent_count ? tar->capacity :
+						    tar->ent_count;
+	if (tar->ent_count == capacity) {
+		capacity = capacity ? capacity * 2 : 16;
+		entries = realloc(tar->entries,
+				  capacity * sizeof(struct ftar_ent *));
+		if (!entries)
+			return -1;
+		tar->entries = entries;
+		tar->capacity = capacity;
+	}
+	if ((tar->ent_count + 1) * 2 > tar->mask + 1 &&
+	    names_rebuild(tar, tar->ent_count + 1) < 0)
+		return -1;
+
+	tar->entries[tar->ent_count++] = ent;
+	slot = ftar_name_slot(tar->names, tar->mask, ent->name);
+	if (!*slot)
+		*slot = ent;
+	if (ent->type == FTAR_FTYPE_DICT)
+		tar->dict = ent;
+
+	errno = 0;
+
+	return 0;
+}
+
+int ftar_replace_entry(struct ftar *tar, struct ftar_ent *ent)
+{
+	struct ftar_ent **slot;
+	struct ftar_ent *old;
+	struct ftar_ent *e;
+	size_t pos;
+	size_t i;
+
+	errno = 0;
+
+	if (mutable_check(tar) < 0)
+		return -1;
+	if (!ent || !memchr(ent->name, 0, sizeof(ent->name))) {
+		errno = EINVAL;
+		return -1;
+	}
+	slot = ftar_name_slot(tar->names, tar->mask, ent->name);
+	old = *slot;
+	if (!old) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (old == ent) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (pos = 0; tar->entries[pos] != old; pos++)
+		;
+	if (mutable_ent(tar, ent, pos) < 0)
+		return -1;
+
+	/* Links to the old one get the new one's data */
+	for (i = pos + 1; i < tar->ent_count; i++) {
+		e = tar->entries[i];
+		if (e->type == FTAR_FTYPE_LINK && e->link[0] &&
+		    strcmp(e->link, old->name) == 0) {
+			e->data = ent->data;
+			e->size = ent->size;
+		}
+	}
+
+	tar->entries[pos] = ent;
+	*slot = ent;
+	if (tar->dict == old)
+		tar->dict = ent->type == FTAR_FTYPE_DICT ? ent : NULL;
+	if (old->type != FTAR_FTYPE_LINK || !old->link[0])
+		free(old->data);
+	free(old);
+
+	return 0;
+}
+
+int ftar_remove_entry(struct ftar *tar, const char *name)
+{
+	struct ftar_ent **slot;
+	struct ftar_ent *owner;
+	struct ftar_ent *old;
+	struct ftar_ent *e;
+	bool owned;
+	size_t pos;
+	size_t i;
+
+	errno = 0;
+
+	if (mutable_check(tar) < 0)
+		return -1;
+	if (!name) {
+		errno = EINVAL;
+		return -1;
+	}
+	old = *ftar_name_slot(tar->names, tar->mask, name);
+	if (!old) {
+		errno = ENOENT;
+		return -1;
+	}
+	for (pos = 0; tar->entries[pos] != old; pos++)
+		;
+	owned = old->type != FTAR_FTYPE_LINK || !old->link[0];
+
+	/*
+	 * Links to a link point at its target instead. If it has data, the
+	 *  first link to it takes that over and the rest point at that one.
+	 */
+	owner = NULL;
+	for (i = pos + 1; i < tar->ent_count; i++) {
+		e = tar->entries[i];
+		if (e->type != FTAR_FTYPE_LINK || strcmp(e->link, old->name) != 0)
+			continue;
+		if (!owned) {
+			strcpy(e->link, old->link);
+		} else if (owner) {
+			strcpy(e->link, owner->name);
+		} else {
+			owner = e;
+			e->type = old->type;
+			e->link[0] = 0;
+		}
+	}
+	if (owner)
+		owned = false;
+
+	/* The entries keep their order, so that links still point back */
+	names_remove(tar, old);
+	memmove(tar->entries + pos, tar->entries + pos + 1,
+		(tar->ent_count - pos - 1) * sizeof(struct ftar_ent *));
+	tar->ent_count--;
+	for (i = pos; i < tar->ent_count; i++) {
+		if (strcmp(tar->entries[i]->name, old->name) == 0) {
+			slot = ftar_name_slot(tar->names, tar->mask,
+					      old->name);
+			*slot = tar->entries[i];
+			break;
+		}
+	}
+
+	/* Later entries were compressed against the last dictionary */
+	if (tar->dict == old) {
+		tar->dict = NULL;
+		for (i = pos; i-- > 0;) {
+			if (tar->entries[i]->type == FTAR_FTYPE_DICT) {
+				tar->dict = tar->entries[i];
+				break;
+			}
+		}
+	}
+
+	if (owned)
+		free(old->data);
+	free(old);
+
+	return 0;
+}
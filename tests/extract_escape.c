@@ -0,0 +1,88 @@
+/*
+ * An archive with a symlink pointing outside the current directory and then
+ *  a file "inside" it mustn't be able to write through the link
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "frankentar.h"
+#include "frankentar/extract.h"
+#include "frankentar/read.h"
+#include "frankentar/write.h"
+
+static struct ftar_ent *make_ent(const char *name, int type, const char *link,
+				 const char *data)
+{
+	struct ftar_ent *ent;
+
+	ent = calloc(1, sizeof(struct ftar_ent));
+	if (!ent)
+		return NULL;
+	strcpy(ent->name, name);
+	strcpy(ent->link, link);
+	ent->type = type;
+	ent->mode = 0644;
+	ent->size = strlen(data);
+	ent->data = strdup(data);
+	ftar_checksum(ent);
+
+	return ent;
+}
+
+int main(void)
+{
+	char root[] = "/tmp/ftar_escape_XXXXXX";
+	char path[256];
+	struct ftar *tar;
+	struct stat st;
+	size_t len;
+	void *raw;
+	FILE *f;
+	int err;
+
+	if (!mkdtemp(root))
+		return 1;
+
+	/* root/in is where it's extracted, root/out is what the link escapes to */
+	snprintf(path, sizeof(path), "%s/in", root);
+	if (mkdir(path, 0755) < 0)
+		return 1;
+	snprintf(path, sizeof(path), "%s/out", root);
+	if (mkdir(path, 0755) < 0)
+		return 1;
+
+	tar = ftar_new(0);
+	if (!tar ||
+	    ftar_add_entry(tar, make_ent("d", FTAR_FTYPE_SYMLINK, path, "")) <
+		    0 ||
+	    ftar_add_entry(tar, make_ent("d/pwn", FTAR_FTYPE_REG, "", "pwned")) <
+		    0)
+		return 1;
+	raw = ftar_to_raw(tar, &len);
+	if (!raw)
+		return 1;
+	snprintf(path, sizeof(path), "%s/evil.ftar", root);
+	f = fopen(path, "wb");
+	if (!f || fwrite(raw, len, 1, f) != 1 || fclose(f) != 0)
+		return 1;
+
+	snprintf(path, sizeof(path), "%s/in", root);
+	if (chdir(path) < 0)
+		return 1;
+	snprintf(path, sizeof(path), "%s/evil.ftar", root);
+	err = ftar_extract(path, NULL, 0, NULL);
+	snprintf(path, sizeof(path), "%s/out/pwn", root);
+	if (err == 0 || errno != EINVAL || lstat(path, &st) == 0) {
+		fprintf(stderr, "extracting wrote through a symlink\n");
+		return 1;
+	}
+
+	return 0;
+}
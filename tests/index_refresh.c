@@ -0,0 +1,115 @@
+/*
+ * Refreshing an index after an entry that dedup links point at was replaced
+ *  has to give the same index as making it from scratch
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "frankentar.h"
+#include "frankentar/edit.h"
+#include "frankentar/index.h"
+#include "frankentar/pack.h"
+
+static int write_file(const char *path, const char *data)
+{
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (!f || fwrite(data, strlen(data), 1, f) != 1)
+		return -1;
+
+	return fclose(f);
+}
+
+static int check_read(int fd, struct ftar_index *idx, const char *name,
+		      const char *want)
+{
+	struct ftar_index_ent *ent;
+	size_t len;
+	char *data;
+	int ok;
+
+	ent = ftar_index_find(idx, name);
+	if (!ent)
+		return -1;
+	data = ftar_index_read(fd, idx, ent, &len);
+	if (!data)
+		return -1;
+	ok = len == strlen(want) && memcmp(data, want, len) == 0;
+	free(data);
+
+	return ok ? 0 : -1;
+}
+
+int main(void)
+{
+	static const char *const paths[] = { "x.txt", "l.txt" };
+	struct ftar_pack_opts opts = { 0 };
+	char root[] = "/tmp/ftar_refresh_XXXXXX";
+	struct ftar_index *fresh;
+	struct ftar_index *idx;
+	struct ftar_index *old;
+	FILE *f;
+	size_t i;
+	int fd;
+
+	if (!mkdtemp(root) || chdir(root) < 0)
+		return 1;
+
+	/* l.txt is stored as a link to x.txt */
+	opts.dedup = true;
+	if (write_file("x.txt", "old contents") < 0 ||
+	    write_file("l.txt", "old contents") < 0)
+		return 1;
+	f = fopen("a.ftar", "wb");
+	if (!f || ftar_pack(f, paths, 2, &opts) < 0 || fclose(f) != 0)
+		return 1;
+
+	fd = open("a.ftar", O_RDONLY);
+	if (fd < 0)
+		return 1;
+	old = ftar_index_fd(fd);
+	if (!old)
+		return 1;
+
+	/* Replacing x.txt hands its payload over to l.txt */
+	if (write_file("x.txt", "new contents") < 0 ||
+	    ftar_add("a.ftar", paths, 1, NULL) < 0)
+		return 1;
+	idx = ftar_index_refresh(fd, old);
+	fresh = ftar_index_fd(fd);
+	if (!idx || !fresh)
+		return 1;
+
+	if (idx->ent_count != fresh->ent_count || idx->dead != fresh->dead) {
+		fprintf(stderr, "refreshed index doesn't match a fresh one\n");
+		return 1;
+	}
+	for (i = 0; i < idx->ent_count; i++) {
+		if (memcmp(&idx->entries[i].hdr, &fresh->entries[i].hdr,
+			   FTAR_ENT_HDR_SIZE) != 0) {
+			fprintf(stderr, "entry %zu differs after refreshing\n",
+				i);
+			return 1;
+		}
+	}
+	if (check_read(fd, idx, "x.txt", "new contents") < 0 ||
+	    check_read(fd, idx, "l.txt", "old contents") < 0) {
+		fprintf(stderr, "refreshed index reads the wrong payloads\n");
+		return 1;
+	}
+
+	ftar_index_free(old);
+	ftar_index_free(idx);
+	ftar_index_free(fresh);
+	close(fd);
+
+	return 0;
+}
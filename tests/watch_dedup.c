@@ -0,0 +1,95 @@
+/*
+ * Appending over an entry that dedup links point at has to be reported as a
+ *  change, and the watch's index has to read the new payload afterwards
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "frankentar.h"
+#include "frankentar/edit.h"
+#include "frankentar/index.h"
+#include "frankentar/pack.h"
+#include "frankentar/watch.h"
+
+static int write_file(const char *path, const char *data)
+{
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (!f || fwrite(data, strlen(data), 1, f) != 1)
+		return -1;
+
+	return fclose(f);
+}
+
+static void on_change(struct ftar_watch *watch, enum ftar_watch_change change,
+		      const struct ftar_index_ent *old,
+		      const struct ftar_index_ent *ent, void *user)
+{
+	(void)watch;
+	(void)old;
+
+	if (change == FTAR_WATCH_CHANGED && strcmp(ent->hdr.name, "x.txt") == 0)
+		(*(int *)user)++;
+}
+
+int main(void)
+{
+	static const char *const paths[] = { "x.txt", "l.txt" };
+	struct ftar_pack_opts opts = { 0 };
+	char root[] = "/tmp/ftar_watch_XXXXXX";
+	struct ftar_index_ent *ent;
+	struct ftar_watch *watch;
+	int changed;
+	size_t len;
+	char *data;
+	FILE *f;
+
+	if (!mkdtemp(root) || chdir(root) < 0)
+		return 1;
+
+	/* l.txt is stored as a link to x.txt */
+	opts.dedup = true;
+	if (write_file("x.txt", "old contents") < 0 ||
+	    write_file("l.txt", "old contents") < 0)
+		return 1;
+	f = fopen("a.ftar", "wb");
+	if (!f || ftar_pack(f, paths, 2, &opts) < 0 || fclose(f) != 0)
+		return 1;
+
+	changed = 0;
+	watch = ftar_watch_open("a.ftar", on_change, &changed);
+	if (!watch)
+		return errno == ENOSYS ? 0 : 1;
+
+	if (write_file("x.txt", "new contents") < 0 ||
+	    ftar_add("a.ftar", paths, 1, NULL) < 0 ||
+	    ftar_watch_reload(watch) < 0)
+		return 1;
+	if (changed != 1) {
+		fprintf(stderr, "replacing x.txt wasn't reported\n");
+		return 1;
+	}
+
+	ent = ftar_index_find(ftar_watch_index(watch), "x.txt");
+	if (!ent)
+		return 1;
+	data = ftar_index_read(ftar_watch_archive(watch),
+			       ftar_watch_index(watch), ent, &len);
+	if (!data || len != strlen("new contents") ||
+	    memcmp(data, "new contents", len) != 0) {
+		fprintf(stderr, "the watch's index reads the old x.txt\n");
+		return 1;
+	}
+
+	free(data);
+	ftar_watch_free(watch);
+
+	return 0;
+}